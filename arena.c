@@ -0,0 +1,173 @@
+/****************************************************************************
+
+  @file         arena.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Bump allocator whose memory is reused rather than freed.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+/**
+ * @brief Allocates size bytes from the arena.
+ *
+ * Blocks kept by an earlier arena_reset() are reused before a new one is
+ * malloc'd; a new block is at least ARENA_BLOCK_SIZE bytes and large
+ * enough for the request. Allocation failure is fatal, as elsewhere in
+ * the shell.
+ *
+ * @param a    The arena.
+ * @param size Number of bytes wanted.
+ * @return Memory aligned for any type, valid until the next reset.
+ */
+void *arena_alloc(struct arena *a, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    struct arena_block *b = a->current;
+    while (b != NULL && b->size - b->used < size)
+    {
+        b = b->next;
+        if (b != NULL)
+        {
+            b->used = 0;  // a block kept by arena_reset()
+        }
+    }
+
+    if (b == NULL)
+    {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = check_alloc(malloc(sizeof(struct arena_block) + block_size));
+        b->size = block_size;
+        b->used = 0;
+        b->next = NULL;
+
+        // Append after the current block so the chain keeps its order
+        if (a->current == NULL)
+        {
+            a->first = b;
+        }
+        else
+        {
+            struct arena_block *tail = a->current;
+            while (tail->next != NULL)
+            {
+                tail = tail->next;
+            }
+            tail->next = b;
+        }
+    }
+
+    a->current = b;
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+/**
+ * @brief Copies a string into the arena.
+ *
+ * @param a The arena.
+ * @param s The string to copy.
+ * @return The copy.
+ */
+char *arena_strdup(struct arena *a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    return memcpy(arena_alloc(a, len), s, len);
+}
+
+/**
+ * @brief Makes all of the arena's memory available again.
+ *
+ * Every pointer handed out since the last reset becomes invalid. The
+ * blocks themselves are kept.
+ *
+ * @param a The arena.
+ * @return none
+ */
+void arena_reset(struct arena *a)
+{
+    a->current = a->first;
+    if (a->first != NULL)
+    {
+        a->first->used = 0;
+    }
+}
+
+/**
+ * @brief Remembers how much of the arena is in use.
+ *
+ * @param a The arena.
+ * @return The mark, for arena_rewind().
+ */
+struct arena_mark arena_save(const struct arena *a)
+{
+    return (struct arena_mark){a->current, a->current != NULL ? a->current->used : 0};
+}
+
+/**
+ * @brief Gives back everything allocated since a mark, like a partial
+ *        arena_reset(), so a loop that allocates on every pass stays in
+ *        the same memory.
+ *
+ * Pointers handed out before the mark stay valid.
+ *
+ * @param a The arena.
+ * @param m A mark from arena_save(), taken since the last reset.
+ * @return none
+ */
+void arena_rewind(struct arena *a, struct arena_mark m)
+{
+    if (m.block == NULL)
+    {
+        arena_reset(a);
+        return;
+    }
+    a->current = m.block;
+    m.block->used = m.used;
+}
+
+/**
+ * @brief Frees every block of the arena.
+ *
+ * @param a The arena.
+ * @return none
+ */
+void arena_release(struct arena *a)
+{
+    struct arena_block *b = a->first;
+    while (b != NULL)
+    {
+        struct arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->first = NULL;
+    a->current = NULL;
+}
+
+/**
+ * @brief Reports an allocation failure and exits, for the malloc() calls
+ *        outside any arena.
+ *
+ * @param p The allocation's result.
+ * @return p, when it is not NULL.
+ */
+void *check_alloc(void *p)
+{
+    if (p == NULL)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
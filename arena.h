@@ -0,0 +1,55 @@
+/****************************************************************************
+
+  @file         arena.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Bump allocator whose memory is reused rather than freed.
+
+*******************************************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/**
+ * A chain of blocks. Allocations are carved from the current block;
+ * arena_reset() rewinds to the first block and keeps them all, so once
+ * the arena has grown to fit the largest line, resetting and refilling
+ * it allocates nothing.
+ */
+struct arena
+{
+    struct arena_block *first;
+    struct arena_block *current;
+};
+
+/**
+ * A position in an arena, for giving back everything allocated after it.
+ */
+struct arena_mark
+{
+    struct arena_block *block;
+    size_t used;
+};
+
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *s);
+void arena_reset(struct arena *a);
+struct arena_mark arena_save(const struct arena *a);
+void arena_rewind(struct arena *a, struct arena_mark m);
+void arena_release(struct arena *a);
+void *check_alloc(void *p);
+
+#endif
@@ -0,0 +1,421 @@
+/****************************************************************************
+
+  @file         arith.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Integer arithmetic for "$((expression))".
+
+                The lexer keeps the expression as written and it is
+                evaluated each time the word is expanded, by recursive
+                descent over the text: no tree is built, since a loop
+                counter such as "i=$((i+1))" is a handful of characters.
+                Numbers are C longs; names and "$name" references are
+                the variables' values (unset or empty is 0), and "$1" or
+                "$#" the positional parameters. The operators are those
+                of sh without assignment or bitwise ones: unary + - ! ~,
+                then * / %, + -, < <= > >=, == !=, && and ||, each group
+                binding less tightly than the one before, with
+                parentheses for grouping. The side of && or || that is
+                not needed is still parsed but not checked for division
+                by zero.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "arith.h"
+#include "func.h"
+#include "vars.h"
+
+/**
+ * Where the evaluator is in an expression.
+ */
+struct arith
+{
+    const char *p, *end;
+    const char *expr;       // the whole expression, for error messages
+    size_t len;
+    int noeval;             // inside the unused side of && or ||
+    int failed;             // an error has been reported
+};
+
+static long arith_or(struct arith *s);
+
+/**
+ * @brief Reports an error in the expression, once.
+ *
+ * @param s       The evaluator.
+ * @param message What is wrong.
+ * @return 0, as the value of the failed part.
+ */
+static long arith_error(struct arith *s, const char *message)
+{
+    if (!s->failed)
+    {
+        fprintf(stderr, "dragonshell: %.*s: %s\n", (int)s->len, s->expr, message);
+        s->failed = 1;
+    }
+    s->p = s->end;
+    return 0;
+}
+
+/**
+ * @brief Skips blanks and tells whether the text continues with an
+ *        operator.
+ *
+ * @param s  The evaluator.
+ * @param op The operator's spelling.
+ * @return 1 (and skips it) if the next thing is op, 0 otherwise.
+ */
+static int arith_accept(struct arith *s, const char *op)
+{
+    size_t n = strlen(op);
+
+    while (s->p < s->end && isspace((unsigned char)*s->p))
+    {
+        s->p++;
+    }
+    if ((size_t)(s->end - s->p) < n || memcmp(s->p, op, n) != 0)
+    {
+        return 0;
+    }
+    // "<" is not the start of "<=", nor "!" of "!=", nor "&" of "&&"
+    if (n == 1 && s->p + 1 < s->end && s->p[1] == '=' && strchr("<>!=", *op) != NULL)
+    {
+        return 0;
+    }
+    s->p += n;
+    return 1;
+}
+
+/**
+ * @brief The numeric value of a variable or positional parameter.
+ *
+ * @param s     The evaluator.
+ * @param value The parameter's value, or NULL if it is unset.
+ * @return The number; unset or empty is 0.
+ */
+static long arith_value(struct arith *s, const char *value)
+{
+    char *end;
+
+    if (value == NULL || value[strspn(value, " \t\n")] == '\0')
+    {
+        return 0;
+    }
+    long n = strtol(value, &end, 0);
+    if (end == value || end[strspn(end, " \t\n")] != '\0')
+    {
+        return arith_error(s, "invalid number in a variable");
+    }
+    return n;
+}
+
+/**
+ * @brief Evaluates a "$name", "${name}", "$1" or "$#" reference.
+ *
+ * @param s The evaluator, just past the '$'.
+ * @return The value.
+ */
+static long arith_parameter(struct arith *s)
+{
+    int braced = s->p < s->end && *s->p == '{';
+    const char *name = s->p + braced;
+    size_t len = 0;
+
+    if (name < s->end && (isdigit((unsigned char)*name) || *name == '#'))
+    {
+        len = braced ? strspn(name, "0123456789") : 1;
+        len = len > 0 ? len : 1;
+    }
+    else
+    {
+        while (name + len < s->end && (isalnum((unsigned char)name[len]) || name[len] == '_'))
+        {
+            len++;
+        }
+    }
+    s->p = name + len;
+    if (braced && !(s->p < s->end && *s->p++ == '}'))
+    {
+        return arith_error(s, "bad substitution");
+    }
+
+    if (len == 1 && *name == '#')
+    {
+        return positional_count();
+    }
+    if (len > 0 && isdigit((unsigned char)*name))
+    {
+        return arith_value(s, positional_get(strtol(name, NULL, 10)));
+    }
+    if (!var_valid_name(name, len))
+    {
+        return arith_error(s, "arithmetic syntax error");
+    }
+    return arith_value(s, var_lookup(name, len));
+}
+
+/**
+ * @brief Evaluates a number, a name, a reference, a parenthesized
+ *        expression or a unary operator applied to one of them.
+ *
+ * @param s The evaluator.
+ * @return The value.
+ */
+static long arith_unary(struct arith *s)
+{
+    if (arith_accept(s, "-"))
+    {
+        return -arith_unary(s);
+    }
+    if (arith_accept(s, "+"))
+    {
+        return arith_unary(s);
+    }
+    if (arith_accept(s, "!"))
+    {
+        return !arith_unary(s);
+    }
+    if (arith_accept(s, "~"))
+    {
+        return ~arith_unary(s);
+    }
+    if (arith_accept(s, "("))
+    {
+        long value = arith_or(s);
+        if (!arith_accept(s, ")"))
+        {
+            return arith_error(s, "missing `)'");
+        }
+        return value;
+    }
+    if (arith_accept(s, "$"))
+    {
+        return arith_parameter(s);
+    }
+
+    if (s->p < s->end && isdigit((unsigned char)*s->p))
+    {
+        char *end;
+        long value = strtol(s->p, &end, 0);
+        if (end > s->end || (end < s->end && (isalnum((unsigned char)*end) || *end == '_')))
+        {
+            return arith_error(s, "invalid number");
+        }
+        s->p = end;
+        return value;
+    }
+    if (s->p < s->end && (isalpha((unsigned char)*s->p) || *s->p == '_'))
+    {
+        const char *name = s->p;
+        while (s->p < s->end && (isalnum((unsigned char)*s->p) || *s->p == '_'))
+        {
+            s->p++;
+        }
+        return arith_value(s, var_lookup(name, s->p - name));
+    }
+    return arith_error(s, "arithmetic syntax error");
+}
+
+/**
+ * @brief Evaluates "*", "/" and "%", left to right.
+ *
+ * @param s The evaluator.
+ * @return The value.
+ */
+static long arith_mul(struct arith *s)
+{
+    long value = arith_unary(s);
+
+    for (;;)
+    {
+        int op = arith_accept(s, "*") ? '*' : arith_accept(s, "/") ? '/' : arith_accept(s, "%") ? '%' : 0;
+        if (op == 0)
+        {
+            return value;
+        }
+        long right = arith_unary(s);
+        if (op == '*')
+        {
+            value *= right;
+        }
+        else if (right == 0)
+        {
+            value = s->noeval ? 0 : arith_error(s, "division by zero");
+        }
+        else if (right == -1)
+        {
+            // Negated, not divided: LONG_MIN / -1 traps, and wraps to LONG_MIN as in bash
+            value = op == '/' ? (long)(0UL - (unsigned long)value) : 0;
+        }
+        else
+        {
+            value = op == '/' ? value / right : value % right;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates "+" and "-", left to right.
+ *
+ * @param s The evaluator.
+ * @return The value.
+ */
+static long arith_add(struct arith *s)
+{
+    long value = arith_mul(s);
+
+    for (;;)
+    {
+        if (arith_accept(s, "+"))
+        {
+            value += arith_mul(s);
+        }
+        else if (arith_accept(s, "-"))
+        {
+            value -= arith_mul(s);
+        }
+        else
+        {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates "<", "<=", ">" and ">=", which give 1 or 0.
+ *
+ * @param s The evaluator.
+ * @return The value.
+ */
+static long arith_compare(struct arith *s)
+{
+    long value = arith_add(s);
+
+    for (;;)
+    {
+        if (arith_accept(s, "<="))
+        {
+            value = value <= arith_add(s);
+        }
+        else if (arith_accept(s, ">="))
+        {
+            value = value >= arith_add(s);
+        }
+        else if (arith_accept(s, "<"))
+        {
+            value = value < arith_add(s);
+        }
+        else if (arith_accept(s, ">"))
+        {
+            value = value > arith_add(s);
+        }
+        else
+        {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates "==" and "!=".
+ *
+ * @param s The evaluator.
+ * @return The value.
+ */
+static long arith_equal(struct arith *s)
+{
+    long value = arith_compare(s);
+
+    for (;;)
+    {
+        if (arith_accept(s, "=="))
+        {
+            value = value == arith_compare(s);
+        }
+        else if (arith_accept(s, "!="))
+        {
+            value = value != arith_compare(s);
+        }
+        else
+        {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief Evaluates "&&".
+ *
+ * @param s The evaluator.
+ * @return 1 if both sides are nonzero, 0 otherwise.
+ */
+static long arith_and(struct arith *s)
+{
+    long value = arith_equal(s);
+
+    while (arith_accept(s, "&&"))
+    {
+        s->noeval += !value;
+        long right = arith_equal(s);
+        s->noeval -= !value;
+        value = value && right;
+    }
+    return value;
+}
+
+/**
+ * @brief Evaluates "||", the loosest-binding operator.
+ *
+ * @param s The evaluator.
+ * @return 1 if either side is nonzero, 0 otherwise.
+ */
+static long arith_or(struct arith *s)
+{
+    long value = arith_and(s);
+
+    while (arith_accept(s, "||"))
+    {
+        s->noeval += value != 0;
+        long right = arith_and(s);
+        s->noeval -= value != 0;
+        value = value || right;
+    }
+    return value;
+}
+
+/**
+ * @brief Evaluates an arithmetic expression.
+ *
+ * @param expr  The text between "$((" and "))".
+ * @param len   Its length.
+ * @param value Receives the result.
+ * @return 0, or -1 after reporting a syntax error or a division by zero
+ *         (*value is then 0).
+ */
+int arith_eval(const char *expr, size_t len, long *value)
+{
+    struct arith s = {expr, expr + len, expr, len, 0, 0};
+
+    while (len > 0 && isspace((unsigned char)expr[len - 1]))
+    {
+        len--;
+    }
+    s.end = expr + len;
+    *value = len > 0 ? arith_or(&s) : 0;    // "$(( ))" is 0
+    if (!s.failed && s.p < s.end)
+    {
+        arith_error(&s, "arithmetic syntax error");
+    }
+    if (s.failed)
+    {
+        *value = 0;
+        return -1;
+    }
+    return 0;
+}
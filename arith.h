@@ -0,0 +1,18 @@
+/****************************************************************************
+
+  @file         arith.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Integer arithmetic for "$((expression))".
+
+*******************************************************************************/
+
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stddef.h>
+
+int arith_eval(const char *expr, size_t len, long *value);
+
+#endif
@@ -0,0 +1,432 @@
+/****************************************************************************
+
+  @file         bench.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Benchmarks a dragonshell build and prints the results as
+                JSON, for "make bench".
+
+                Six things are measured, each the way a user would see
+                it: how many trivial commands per second a script runs
+                (an external and a builtin); how many external commands
+                per second it runs once the shell's heap has grown to a
+                few hundred megabytes, as it does in a long session with
+                history, caches and variables; how fast data moves through
+                "cat file | cat | ... > /dev/null" with 2 to 8 stages; how
+                long the lexer takes per line (in this process, against
+                the same lexer.o the shell links); how long an interactive
+                shell takes from exec to printing its first prompt on a
+                pseudo-terminal; and how long "dragonshell -c true" takes
+                from fork to exit. Comparing two builds' JSON is meant to
+                catch regressions before one is deployed.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include "arena.h"
+#include "lexer.h"
+
+#define BENCH_EXTERNALS 2000         // lines of "/bin/true" in the spawn script
+#define BENCH_BUILTINS 200000        // lines of "true" in the builtin script
+#define BENCH_RSS_SPAWNS 1000        // lines of "/bin/true" after the heap has grown
+#define BENCH_PIPE_MB 64             // size of the file pushed through pipelines
+#define BENCH_MAX_STAGES 8
+#define BENCH_LEX_ROUNDS 20000       // passes over lex_lines[]
+#define BENCH_STARTUPS 21            // shells started on a pty; the median is reported
+#define BENCH_RUNS 201               // runs of "dragonshell -c true"
+
+static const char *shell;
+static char dir[] = "/tmp/dragonbench.XXXXXX";
+
+// A mix of what interactive lines and scripts look like
+static const char *lex_lines[] = {
+    "ls -l",
+    "grep -n \"main(\" *.c | sort | uniq -c > counts.txt",
+    "cd /tmp && make -j4 CFLAGS='-O2 -g' 2>&1 | tee build.log",
+    "for_each=$HOME/src; echo \"${for_each}/a b\" 'c d' e\\ f &",
+    "(cd src; tar cf - .) | (cd /backup && tar xf -) ; echo done # copy",
+};
+
+/**
+ * @brief The time on a monotonic clock.
+ *
+ * @return Seconds.
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Reports a failed setup step and exits.
+ *
+ * @param what What failed.
+ * @return Does not return.
+ */
+static void fail(const char *what)
+{
+    fprintf(stderr, "dragonbench: %s: %s\n", what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Runs the shell to completion with its output discarded.
+ *
+ * @param argv   The shell's arguments after its name (NULL-terminated).
+ * @param rss_mb If not NULL, receives the shell's peak resident size.
+ * @return The wall-clock time it took, in seconds.
+ */
+static double run_shell(char *const *argv, double *rss_mb)
+{
+    char *args[4] = {(char *)shell, argv[0], argv[1], NULL};
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        fail("fork");
+    }
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execv(shell, args);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    if (rss_mb != NULL)
+    {
+        *rss_mb = ru.ru_maxrss / 1024.0;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+    {
+        fprintf(stderr, "dragonbench: %s did not run cleanly\n", shell);
+        exit(EXIT_FAILURE);
+    }
+    return now() - start;
+}
+
+/**
+ * @brief Writes a script: some lines that grow the shell's heap, then
+ *        one line repeated.
+ *
+ * @param data  The data file, which each of the first lines reads into
+ *              a variable of its own.
+ * @param grow  How many of those lines there are.
+ * @param line  The command repeated.
+ * @param count How many times it appears.
+ * @return The script's path.
+ */
+static const char *write_script(const char *data, int grow, const char *line, int count)
+{
+    static char path[sizeof(dir) + 16];
+    snprintf(path, sizeof(path), "%s/script", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        fail(path);
+    }
+    for (int i = 0; i < grow; i++)
+    {
+        fprintf(f, "heap%d=$(cat %s)\n", i, data);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(f, "%s\n", line);
+    }
+    fclose(f);
+    return path;
+}
+
+/**
+ * @brief Writes a script repeating one line and times running it.
+ *
+ * @param line  The command.
+ * @param count How many times it appears.
+ * @return Commands per second.
+ */
+static double commands_per_sec(const char *line, int count)
+{
+    char *argv[] = {(char *)write_script(NULL, 0, line, count), NULL};
+    return count / run_shell(argv, NULL);
+}
+
+/**
+ * @brief Times external commands in a shell whose heap has first been
+ *        grown by reading the data file into variables.
+ *
+ * The time to grow the heap is measured on its own and taken off, so
+ * what is left is the cost of starting commands from a large process.
+ *
+ * @param data   The data file.
+ * @param grow   How many copies of it the shell keeps (0 for none).
+ * @param rss_mb Receives the shell's peak resident size.
+ * @return Commands per second.
+ */
+static double spawns_per_sec_at(const char *data, int grow, double *rss_mb)
+{
+    char *argv[] = {(char *)write_script(data, grow, "true", 1), NULL};
+    double setup = run_shell(argv, NULL);
+
+    write_script(data, grow, "/bin/true", BENCH_RSS_SPAWNS);
+    double total = run_shell(argv, rss_mb);
+    return BENCH_RSS_SPAWNS / (total > setup ? total - setup : total);
+}
+
+/**
+ * @brief Times a pipeline of cats moving a file to /dev/null.
+ *
+ * @param data   The file.
+ * @param stages How many cats (2 or more).
+ * @return Megabytes per second.
+ */
+static double pipeline_mb_per_sec(const char *data, int stages)
+{
+    char cmd[256];
+    int len = snprintf(cmd, sizeof(cmd), "cat %s", data);
+    for (int i = 1; i < stages; i++)
+    {
+        len += snprintf(cmd + len, sizeof(cmd) - len, " | cat");
+    }
+    snprintf(cmd + len, sizeof(cmd) - len, " > /dev/null");
+
+    char *argv[] = {"-c", cmd, NULL};
+    return BENCH_PIPE_MB / run_shell(argv, NULL);
+}
+
+/**
+ * @brief Times the lexer over a mix of lines.
+ *
+ * @return Nanoseconds per line.
+ */
+static double lex_ns_per_line(void)
+{
+    struct arena a = {NULL, NULL};
+    int n = sizeof(lex_lines) / sizeof(lex_lines[0]);
+
+    double start = now();
+    for (int r = 0; r < BENCH_LEX_ROUNDS; r++)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            arena_reset(&a);
+            if (lex_line(&a, lex_lines[i]) == NULL)
+            {
+                fprintf(stderr, "dragonbench: lexing failed: %s\n", lex_lines[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    double elapsed = now() - start;
+    arena_release(&a);
+    return elapsed * 1e9 / ((double)BENCH_LEX_ROUNDS * n);
+}
+
+/**
+ * @brief Times one interactive start, from fork to the first prompt.
+ *
+ * @return Milliseconds.
+ */
+static double startup_ms(void)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+    {
+        fail("posix_openpt");
+    }
+    const char *slave = ptsname(master);
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        fail("fork");
+    }
+    if (pid == 0)
+    {
+        setsid();
+        int fd = open(slave, O_RDWR);
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        execl(shell, shell, (char *)NULL);
+        _exit(127);
+    }
+
+    // The prompt may arrive split across reads, so search what has come
+    char seen[4096];
+    size_t used = 0;
+    double elapsed = -1;
+    struct pollfd pfd = {master, POLLIN, 0};
+    while (used < sizeof(seen) - 1 && poll(&pfd, 1, 5000) == 1)
+    {
+        ssize_t n = read(master, seen + used, sizeof(seen) - 1 - used);
+        if (n <= 0)
+        {
+            break;
+        }
+        used += n;
+        seen[used] = '\0';
+        if (strstr(seen, "dragonshell > ") != NULL)
+        {
+            elapsed = (now() - start) * 1e3;
+            break;
+        }
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(master);
+    if (elapsed < 0)
+    {
+        fprintf(stderr, "dragonbench: %s never showed a prompt\n", shell);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+/**
+ * @brief qsort() comparison of two doubles.
+ *
+ * @param a The first.
+ * @param b The second.
+ * @return Negative, zero or positive.
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Removes the scratch directory.
+ *
+ * @return none
+ */
+static void cleanup(void)
+{
+    char path[sizeof(dir) + 16];
+    snprintf(path, sizeof(path), "%s/script", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/data", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+/**
+ * @brief Runs every benchmark against the shell named on the command
+ *        line (default ./dragonshell) and prints one JSON object.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return 0 on success.
+ */
+int main(int argc, char **argv)
+{
+    shell = argc > 1 ? argv[1] : "./dragonshell";
+    if (access(shell, X_OK) == -1)
+    {
+        fail(shell);
+    }
+    if (mkdtemp(dir) == NULL)
+    {
+        fail("mkdtemp");
+    }
+    atexit(cleanup);
+
+    // Incompressible data, so nothing along the way can cheat
+    char data[sizeof(dir) + 16];
+    snprintf(data, sizeof(data), "%s/data", dir);
+    int fd = open(data, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+    {
+        fail(data);
+    }
+    static unsigned int block[1 << 16];      // 256 KiB
+    unsigned int x = 2463534242u;
+    for (int i = 0; i < BENCH_PIPE_MB * 4; i++)
+    {
+        for (size_t j = 0; j < sizeof(block) / sizeof(block[0]); j++)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            block[j] = x;
+        }
+        if (write(fd, block, sizeof(block)) != sizeof(block))
+        {
+            fail(data);
+        }
+    }
+    close(fd);
+
+    double external = commands_per_sec("/bin/true", BENCH_EXTERNALS);
+    double builtin = commands_per_sec("true", BENCH_BUILTINS);
+    double lex = lex_ns_per_line();
+
+    static const int grows[] = {0, 1, 3, 7};     // about 64 MB more resident per copy
+    int ngrows = sizeof(grows) / sizeof(grows[0]);
+    double spawn_rate[ngrows], spawn_rss[ngrows];
+    for (int i = 0; i < ngrows; i++)
+    {
+        spawn_rate[i] = spawns_per_sec_at(data, grows[i], &spawn_rss[i]);
+    }
+
+    double startups[BENCH_STARTUPS];
+    for (int i = 0; i < BENCH_STARTUPS; i++)
+    {
+        startups[i] = startup_ms();
+    }
+    qsort(startups, BENCH_STARTUPS, sizeof(double), compare_doubles);
+
+    // Non-interactive: the whole life of "dragonshell -c true"
+    double runs[BENCH_RUNS];
+    char *true_argv[] = {"-c", "true", NULL};
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        runs[i] = run_shell(true_argv, NULL) * 1e3;
+    }
+    qsort(runs, BENCH_RUNS, sizeof(double), compare_doubles);
+
+    printf("{\n");
+    printf("  \"shell\": \"%s\",\n", shell);
+    printf("  \"commands_per_sec\": {\"external\": %.1f, \"builtin\": %.1f},\n", external, builtin);
+    printf("  \"spawns_per_sec_by_rss\": [");
+    for (int i = 0; i < ngrows; i++)
+    {
+        printf("%s{\"rss_mb\": %.1f, \"per_sec\": %.1f}", i > 0 ? ", " : "", spawn_rss[i], spawn_rate[i]);
+    }
+    printf("],\n");
+    printf("  \"pipeline_mb_per_sec\": {");
+    for (int stages = 2; stages <= BENCH_MAX_STAGES; stages++)
+    {
+        printf("%s\"%d\": %.1f", stages > 2 ? ", " : "", stages, pipeline_mb_per_sec(data, stages));
+    }
+    printf("},\n");
+    printf("  \"lexer_ns_per_line\": %.1f,\n", lex);
+    printf("  \"startup_ms\": {\"min\": %.3f, \"median\": %.3f},\n",
+           startups[0], startups[BENCH_STARTUPS / 2]);
+    printf("  \"run_c_true_ms\": {\"min\": %.3f, \"median\": %.3f}\n",
+           runs[0], runs[BENCH_RUNS / 2]);
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,992 @@
+/****************************************************************************
+
+  @file         builtins.c
+
+  @author       Ahnaful Hoque
+
+  @brief        The builtin table and the utilities the shell runs itself.
+
+                Builtins are found by binary search in a table sorted by
+                name, instead of a chain of strcmp() calls. echo, printf,
+                test/[, true, false, export, unset and type are common in
+                scripts' inner loops, and running them here costs a
+                function call rather than a fork() and an exec(). A
+                builtin honors its redirections: they are applied to the
+                shell's own descriptors for the call and undone after it.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include "builtins.h"
+#include "shell.h"
+#include "redirect.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "usage.h"
+#include "trace.h"
+#include "parallel.h"
+#include "cache.h"
+#include "confine.h"
+#include "procsub.h"
+#include "vars.h"
+#include "history.h"
+#include "func.h"
+
+/**
+ * @brief Decodes one backslash escape.
+ *
+ * @param p         The text just after the backslash.
+ * @param c         Receives the character, -1 for "\c" (stop output), or
+ *                  '\\' when p does not start an escape (the backslash is
+ *                  then literal and p is not advanced).
+ * @param echo_octal Octal escapes are "\0nnn", as for echo and %b,
+ *                  rather than printf's "\nnn".
+ * @return The text after the escape.
+ */
+static const char *unescape(const char *p, int *c, int echo_octal)
+{
+    static const char plain[] = "abefnrtv\\";
+    static const char codes[] = "\a\b\033\f\n\r\t\v\\";
+    const char *hit = *p != '\0' ? strchr(plain, *p) : NULL;
+
+    if (hit != NULL)
+    {
+        *c = codes[hit - plain];
+        return p + 1;
+    }
+    if (*p == 'c')
+    {
+        *c = -1;
+        return p + 1;
+    }
+    if (*p == 'x' && isxdigit((unsigned char)p[1]))
+    {
+        int v = 0, n = 0;
+        for (p++; n < 2 && isxdigit((unsigned char)*p); n++, p++)
+        {
+            v = v * 16 + (isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10);
+        }
+        *c = v;
+        return p;
+    }
+    if (*p >= '0' && *p <= '7' && (!echo_octal || *p == '0'))
+    {
+        int v = 0, n = 0;
+        if (echo_octal)
+        {
+            p++;    // the leading 0 of \0nnn
+        }
+        for (; n < 3 && *p >= '0' && *p <= '7'; n++, p++)
+        {
+            v = v * 8 + (*p - '0');
+        }
+        *c = v & 0xff;
+        return p;
+    }
+    *c = '\\';
+    return p;
+}
+
+/**
+ * @brief Prints a string, decoding backslash escapes.
+ *
+ * @param s          The string.
+ * @param echo_octal As for unescape().
+ * @return 1 if a "\c" asked for all further output to stop, 0 otherwise.
+ */
+static int print_escaped(const char *s, int echo_octal)
+{
+    while (*s != '\0')
+    {
+        if (*s != '\\')
+        {
+            putchar(*s++);
+            continue;
+        }
+        int c;
+        s = unescape(s + 1, &c, echo_octal);
+        if (c == -1)
+        {
+            return 1;
+        }
+        putchar(c);
+    }
+    return 0;
+}
+
+/**
+ * @brief The "echo" builtin: echo [-neE] [args...]
+ *
+ * @param args The argument vector, args[0] being "echo".
+ * @return 0
+ */
+static int echo_builtin(char **args)
+{
+    int newline = 1, escapes = 0;
+    int i = 1;
+
+    // Only words made entirely of n, e and E are options, as in bash
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0' &&
+           strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++)
+    {
+        for (const char *f = args[i] + 1; *f; f++)
+        {
+            if (*f == 'n')
+            {
+                newline = 0;
+            }
+            else
+            {
+                escapes = *f == 'e';
+            }
+        }
+    }
+
+    for (int first = i; args[i] != NULL; i++)
+    {
+        if (i > first)
+        {
+            putchar(' ');
+        }
+        if (!escapes)
+        {
+            fputs(args[i], stdout);
+        }
+        else if (print_escaped(args[i], 1))
+        {
+            return 0;
+        }
+    }
+    if (newline)
+    {
+        putchar('\n');
+    }
+    return 0;
+}
+
+/**
+ * @brief Converts a printf argument to a number.
+ *
+ * A leading quote gives the value of the following character, as in
+ * printf(1).
+ *
+ * @param arg    The argument, or NULL for a missing one (0).
+ * @param status Set to 1 if the argument is not a valid number.
+ * @return The value.
+ */
+static long long printf_number(const char *arg, int *status)
+{
+    if (arg == NULL || *arg == '\0')
+    {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"')
+    {
+        return (unsigned char)arg[1];
+    }
+
+    char *end;
+    errno = 0;
+    long long v = strtoll(arg, &end, 0);
+    if (*end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "dragonshell: printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return v;
+}
+
+/**
+ * @brief The "printf" builtin: printf format [args...]
+ *
+ * Supports the escapes of printf(1) and the %s %b %c %d %i %u %o %x %X
+ * %e %f %g (and upper-case) conversions with flags, width and precision,
+ * either of which may be '*'. The format is reused while arguments
+ * remain.
+ *
+ * @param args The argument vector, args[0] being "printf".
+ * @return 0, 1 if an argument was not a valid number, 2 for a bad format.
+ */
+static int printf_builtin(char **args)
+{
+    if (args[1] == NULL)
+    {
+        fprintf(stderr, "dragonshell: printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = args[1];
+    char **arg = &args[2];
+    int status = 0;
+
+    for (;;)
+    {
+        int consumed = 0;
+        for (const char *p = format; *p != '\0';)
+        {
+            if (*p == '\\')
+            {
+                int c;
+                p = unescape(p + 1, &c, 0);
+                if (c == -1)
+                {
+                    return status;
+                }
+                putchar(c);
+                continue;
+            }
+            if (*p != '%')
+            {
+                putchar(*p++);
+                continue;
+            }
+            if (p[1] == '%')
+            {
+                putchar('%');
+                p += 2;
+                continue;
+            }
+
+            // Copy "%[flags][width][.precision]" with any '*' filled in
+            char spec[64];
+            int len = 0;
+            spec[len++] = *p++;
+            while (*p != '\0' && strchr("-+ #0", *p) != NULL && len < 8)
+            {
+                spec[len++] = *p++;
+            }
+            for (int part = 0; part < 2; part++)
+            {
+                if (part == 1)
+                {
+                    if (*p != '.')
+                    {
+                        break;
+                    }
+                    spec[len++] = *p++;
+                }
+                if (*p == '*')
+                {
+                    len += snprintf(spec + len, 16, "%d", (int)printf_number(*arg, &status));
+                    arg += *arg != NULL;
+                    consumed = 1;
+                    p++;
+                }
+                while (isdigit((unsigned char)*p) && len < 40)
+                {
+                    spec[len++] = *p++;
+                }
+            }
+
+            char conv = *p++;
+            const char *value = *arg;
+            if (conv != '\0' && strchr("sbcdiuoxXeEfFgGaA", conv) != NULL)
+            {
+                arg += *arg != NULL;
+                consumed = 1;
+            }
+            switch (conv)
+            {
+            case 's':
+                spec[len++] = 's';
+                spec[len] = '\0';
+                printf(spec, value != NULL ? value : "");
+                break;
+            case 'b':
+                if (value != NULL && print_escaped(value, 1))
+                {
+                    return status;
+                }
+                break;
+            case 'c':
+                if (value != NULL && value[0] != '\0')
+                {
+                    spec[len++] = 'c';
+                    spec[len] = '\0';
+                    printf(spec, value[0]);
+                }
+                break;
+            case 'd':
+            case 'i':
+                strcpy(spec + len, "lld");
+                printf(spec, printf_number(value, &status));
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                snprintf(spec + len, 4, "ll%c", conv);
+                printf(spec, (unsigned long long)printf_number(value, &status));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                char *end = "";
+                double d = value != NULL ? strtod(value, &end) : 0.0;
+                if (*end != '\0')
+                {
+                    fprintf(stderr, "dragonshell: printf: %s: invalid number\n", value);
+                    status = 1;
+                }
+                spec[len++] = conv;
+                spec[len] = '\0';
+                printf(spec, d);
+                break;
+            }
+            default:
+                fprintf(stderr, "dragonshell: printf: `%c': invalid format character\n", conv);
+                return 2;
+            }
+        }
+        if (*arg == NULL || !consumed)
+        {
+            break;
+        }
+    }
+    return status;
+}
+
+/**
+ * State of the recursive-descent evaluation of a test expression.
+ */
+struct test_state
+{
+    char **argv;
+    int pos;
+    int argc;
+    int error;
+};
+
+/**
+ * @brief Tells whether a word is a unary test operator.
+ *
+ * @param op The word.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int test_unary_op(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghLnprsStuwxzOG", op[1]) != NULL;
+}
+
+/**
+ * @brief Tells whether a word is a binary test operator.
+ *
+ * @param op The word.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int test_binary_op(const char *op)
+{
+    static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                "-gt", "-ge", "-nt", "-ot", "-ef"};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        if (strcmp(op, ops[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses an integer operand of -eq and friends.
+ *
+ * @param ts  The evaluation state; error is set for a bad integer.
+ * @param arg The operand.
+ * @return The value.
+ */
+static long long test_integer(struct test_state *ts, const char *arg)
+{
+    char *end;
+    const char *p = arg + strspn(arg, " \t");
+    long long v = strtoll(p, &end, 10);
+    if (end == p || end[strspn(end, " \t")] != '\0')
+    {
+        fprintf(stderr, "dragonshell: test: %s: integer expression expected\n", arg);
+        ts->error = 1;
+    }
+    return v;
+}
+
+/**
+ * @brief Evaluates a unary operator.
+ *
+ * @param ts  The evaluation state.
+ * @param op  The operator, e.g. "-f".
+ * @param arg Its operand.
+ * @return 1 if true, 0 if false.
+ */
+static int test_unary(struct test_state *ts, const char *op, const char *arg)
+{
+    struct stat sb;
+    char c = op[1];
+
+    switch (c)
+    {
+    case 'n':
+        return arg[0] != '\0';
+    case 'z':
+        return arg[0] == '\0';
+    case 't':
+        return isatty((int)test_integer(ts, arg));
+    case 'r':
+        return access(arg, R_OK) == 0;
+    case 'w':
+        return access(arg, W_OK) == 0;
+    case 'x':
+        return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L':
+        return lstat(arg, &sb) == 0 && S_ISLNK(sb.st_mode);
+    }
+
+    if (stat(arg, &sb) != 0)
+    {
+        return 0;
+    }
+    switch (c)
+    {
+    case 'e':
+        return 1;
+    case 'f':
+        return S_ISREG(sb.st_mode);
+    case 'd':
+        return S_ISDIR(sb.st_mode);
+    case 'b':
+        return S_ISBLK(sb.st_mode);
+    case 'c':
+        return S_ISCHR(sb.st_mode);
+    case 'p':
+        return S_ISFIFO(sb.st_mode);
+    case 'S':
+        return S_ISSOCK(sb.st_mode);
+    case 's':
+        return sb.st_size > 0;
+    case 'g':
+        return (sb.st_mode & S_ISGID) != 0;
+    case 'u':
+        return (sb.st_mode & S_ISUID) != 0;
+    case 'O':
+        return sb.st_uid == geteuid();
+    case 'G':
+        return sb.st_gid == getegid();
+    }
+    return 0;
+}
+
+/**
+ * @brief Evaluates a binary operator.
+ *
+ * @param ts The evaluation state.
+ * @param a  The left operand.
+ * @param op The operator.
+ * @param b  The right operand.
+ * @return 1 if true, 0 if false.
+ */
+static int test_binary(struct test_state *ts, const char *a, const char *op, const char *b)
+{
+    if (op[0] != '-')
+    {
+        int cmp = strcmp(a, b);
+        switch (op[0])
+        {
+        case '=':
+            return cmp == 0;
+        case '!':
+            return cmp != 0;
+        case '<':
+            return cmp < 0;
+        default:
+            return cmp > 0;
+        }
+    }
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+    {
+        struct stat sa, sb;
+        int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        if (op[1] == 'e')
+        {
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        }
+        if (!ha || !hb)
+        {
+            return op[1] == 'n' ? ha : hb;  // an existing file is newer than a missing one
+        }
+        long long d = (long long)(sa.st_mtim.tv_sec - sb.st_mtim.tv_sec) * 1000000000LL +
+                      (sa.st_mtim.tv_nsec - sb.st_mtim.tv_nsec);
+        return op[1] == 'n' ? d > 0 : d < 0;
+    }
+
+    long long x = test_integer(ts, a), y = test_integer(ts, b);
+    if (strcmp(op, "-eq") == 0)
+    {
+        return x == y;
+    }
+    if (strcmp(op, "-ne") == 0)
+    {
+        return x != y;
+    }
+    if (strcmp(op, "-lt") == 0)
+    {
+        return x < y;
+    }
+    if (strcmp(op, "-le") == 0)
+    {
+        return x <= y;
+    }
+    if (strcmp(op, "-gt") == 0)
+    {
+        return x > y;
+    }
+    return x >= y;
+}
+
+static int test_or(struct test_state *ts);
+
+/**
+ * @brief primary := '(' expr ')' | word binop word | unop word | word
+ *
+ * A binary operator in second position wins over a unary one in first,
+ * so [ "$x" = y ] works whatever $x holds.
+ *
+ * @param ts The evaluation state.
+ * @return 1 if true, 0 if false.
+ */
+static int test_primary(struct test_state *ts)
+{
+    char **v = ts->argv;
+    int left = ts->argc - ts->pos;
+
+    if (left <= 0)
+    {
+        fprintf(stderr, "dragonshell: test: argument expected\n");
+        ts->error = 1;
+        return 0;
+    }
+    if (left >= 3 && test_binary_op(v[ts->pos + 1]))
+    {
+        ts->pos += 3;
+        return test_binary(ts, v[ts->pos - 3], v[ts->pos - 2], v[ts->pos - 1]);
+    }
+    if (strcmp(v[ts->pos], "(") == 0 && left >= 2)
+    {
+        ts->pos++;
+        int result = test_or(ts);
+        if (ts->pos >= ts->argc || strcmp(v[ts->pos], ")") != 0)
+        {
+            fprintf(stderr, "dragonshell: test: `)' expected\n");
+            ts->error = 1;
+            return 0;
+        }
+        ts->pos++;
+        return result;
+    }
+    if (left >= 2 && test_unary_op(v[ts->pos]))
+    {
+        ts->pos += 2;
+        return test_unary(ts, v[ts->pos - 2], v[ts->pos - 1]);
+    }
+    return v[ts->pos++][0] != '\0';
+}
+
+/**
+ * @brief not := '!' not | primary
+ *
+ * @param ts The evaluation state.
+ * @return 1 if true, 0 if false.
+ */
+static int test_not(struct test_state *ts)
+{
+    if (ts->pos < ts->argc - 1 && strcmp(ts->argv[ts->pos], "!") == 0)
+    {
+        ts->pos++;
+        return !test_not(ts);
+    }
+    return test_primary(ts);
+}
+
+/**
+ * @brief and := not ( '-a' not )*
+ *
+ * @param ts The evaluation state.
+ * @return 1 if true, 0 if false.
+ */
+static int test_and(struct test_state *ts)
+{
+    int result = test_not(ts);
+    while (ts->pos < ts->argc && strcmp(ts->argv[ts->pos], "-a") == 0)
+    {
+        ts->pos++;
+        result = test_not(ts) && result;
+    }
+    return result;
+}
+
+/**
+ * @brief or := and ( '-o' and )*
+ *
+ * @param ts The evaluation state.
+ * @return 1 if true, 0 if false.
+ */
+static int test_or(struct test_state *ts)
+{
+    int result = test_and(ts);
+    while (ts->pos < ts->argc && strcmp(ts->argv[ts->pos], "-o") == 0)
+    {
+        ts->pos++;
+        result = test_and(ts) || result;
+    }
+    return result;
+}
+
+/**
+ * @brief The "test" and "[" builtins.
+ *
+ * @param args The argument vector; for "[" the last word must be "]".
+ * @return 0 if the expression is true, 1 if false, 2 on error.
+ */
+static int test_builtin(char **args)
+{
+    int argc = 0;
+    while (args[argc] != NULL)
+    {
+        argc++;
+    }
+    if (strcmp(args[0], "[") == 0)
+    {
+        if (strcmp(args[argc - 1], "]") != 0)
+        {
+            fprintf(stderr, "dragonshell: [: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+    if (argc == 1)
+    {
+        return 1;   // no expression is false
+    }
+
+    struct test_state ts = {args, 1, argc, 0};
+    int result = test_or(&ts);
+    if (!ts.error && ts.pos < ts.argc)
+    {
+        fprintf(stderr, "dragonshell: test: %s: unexpected argument\n", args[ts.pos]);
+        ts.error = 1;
+    }
+    return ts.error ? 2 : !result;
+}
+
+/**
+ * @brief The "true" builtin.
+ *
+ * @param args Ignored.
+ * @return 0
+ */
+static int true_builtin(char **args)
+{
+    (void)args;
+    return 0;
+}
+
+/**
+ * @brief The "false" builtin.
+ *
+ * @param args Ignored.
+ * @return 1
+ */
+static int false_builtin(char **args)
+{
+    (void)args;
+    return 1;
+}
+
+/**
+ * @brief The "export" builtin: export [-p] [name[=value]...]
+ *
+ * With no names (or -p) the exported variables are listed. name=value
+ * sets a variable and exports it; a bare name exports a variable,
+ * whether or not it is set yet.
+ *
+ * @param args The argument vector, args[0] being "export".
+ * @return 0, or 1 if a name was invalid.
+ */
+static int export_builtin(char **args)
+{
+    int i = 1, status = 0;
+
+    if (args[i] != NULL && strcmp(args[i], "-p") == 0)
+    {
+        i++;
+    }
+    if (args[i] == NULL)
+    {
+        vars_print_exported();
+        return 0;
+    }
+
+    for (; args[i] != NULL; i++)
+    {
+        char *eq = strchr(args[i], '=');
+        size_t len = eq != NULL ? (size_t)(eq - args[i]) : strlen(args[i]);
+        if (!var_valid_name(args[i], len))
+        {
+            fprintf(stderr, "dragonshell: export: `%s': not a valid identifier\n", args[i]);
+            status = 1;
+        }
+        else if (eq != NULL)
+        {
+            var_assign(args[i], VAR_EXPORT);
+        }
+        else
+        {
+            var_export(args[i]);
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief The "unset" builtin: unset [-v] name...
+ *
+ * @param args The argument vector, args[0] being "unset".
+ * @return 0, or 1 if a name was invalid.
+ */
+static int unset_builtin(char **args)
+{
+    int i = 1, status = 0;
+
+    if (args[i] != NULL && strcmp(args[i], "-v") == 0)
+    {
+        i++;
+    }
+    for (; args[i] != NULL; i++)
+    {
+        if (!var_valid_name(args[i], strlen(args[i])))
+        {
+            fprintf(stderr, "dragonshell: unset: `%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+        var_unset(args[i]);
+    }
+    return status;
+}
+
+/**
+ * @brief The "type" builtin: says how each name would be run.
+ *
+ * @param args The argument vector, args[0] being "type".
+ * @return 0, or 1 if a name was not found.
+ */
+static int type_builtin(char **args)
+{
+    static const char *keywords[] = {"time", "if", "then", "elif", "else", "fi", "while", "until",
+                                     "for", "in", "do", "done", "{", "}", "!", "function"};
+    int status = 0;
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        const char *name = args[i];
+        const char *path;
+        int keyword = 0;
+
+        for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++)
+        {
+            keyword |= strcmp(name, keywords[k]) == 0;
+        }
+        if (keyword)
+        {
+            printf("%s is a shell keyword\n", name);
+        }
+        else if (function_lookup(name) != NULL)
+        {
+            printf("%s is a function\n", name);
+        }
+        else if (builtin_lookup(name) != NULL)
+        {
+            printf("%s is a shell builtin\n", name);
+        }
+        else if ((path = path_lookup(name)) != NULL)
+        {
+            printf("%s is %s\n", name, path);
+        }
+        else
+        {
+            fprintf(stderr, "dragonshell: type: %s: not found\n", name);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/**
+ * Every builtin, sorted by name (in strcmp() order) for bsearch().
+ */
+static const struct builtin builtins[] = {
+    {":", true_builtin},
+    {"[", test_builtin},
+    {"bg", bg_builtin},
+    {"break", break_builtin},
+    {"cache", cache_builtin},
+    {"cd", cd_builtin},
+    {"confine", confine_builtin},
+    {"continue", continue_builtin},
+    {"coproc", coproc_builtin},
+    {"echo", echo_builtin},
+    {"exit", exit_builtin},
+    {"export", export_builtin},
+    {"false", false_builtin},
+    {"fg", fg_builtin},
+    {"hash", hash_builtin},
+    {"history", history_builtin},
+    {"jobs", jobs_builtin},
+    {"local", local_builtin},
+    {"parallel", parallel_builtin},
+    {"printf", printf_builtin},
+    {"pwd", pwd_builtin},
+    {"return", return_builtin},
+    {"set", set_builtin},
+    {"shift", shift_builtin},
+    {"test", test_builtin},
+    {"times", times_builtin},
+    {"trace", trace_builtin},
+    {"true", true_builtin},
+    {"type", type_builtin},
+    {"ulimit", ulimit_builtin},
+    {"unset", unset_builtin},
+    {"wait", wait_builtin},
+};
+
+/**
+ * @brief bsearch() comparison of a name with a table entry.
+ *
+ * @param key   The name.
+ * @param entry The table entry.
+ * @return As strcmp().
+ */
+static int compare_builtin(const void *key, const void *entry)
+{
+    return strcmp(key, ((const struct builtin *)entry)->name);
+}
+
+/**
+ * @brief Finds a builtin by name.
+ *
+ * @param name The command name.
+ * @return The builtin, or NULL if the name is not one.
+ */
+const struct builtin *builtin_lookup(const char *name)
+{
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                   sizeof(builtins[0]), compare_builtin);
+}
+
+/**
+ * @brief Walks the builtin table, for completion.
+ *
+ * @param i An index, from 0.
+ * @return The i-th builtin's name in sorted order, or NULL past the end.
+ */
+const char *builtin_name(size_t i)
+{
+    return i < sizeof(builtins) / sizeof(builtins[0]) ? builtins[i].name : NULL;
+}
+
+/**
+ * @brief Runs a builtin with its "NAME=value" prefixes in effect.
+ *
+ * The variables are set for the call and put back afterwards, so a
+ * prefix such as "LC_ALL=C printf ..." does not outlive the command.
+ *
+ * @param b       The builtin.
+ * @param argv    Its arguments.
+ * @param assigns The prefixes, NULL-terminated, or NULL.
+ * @return The builtin's exit status.
+ */
+static int call_builtin(const struct builtin *b, char **argv, char **assigns)
+{
+    if (assigns == NULL)
+    {
+        return b->fn(argv);
+    }
+
+    int n = 0;
+    while (assigns[n] != NULL)
+    {
+        n++;
+    }
+    char *old[n];
+    for (int i = 0; i < n; i++)
+    {
+        size_t len = strcspn(assigns[i], "=");
+        const char *value = var_lookup(assigns[i], len);
+        old[i] = value != NULL ? strdup(value) : NULL;
+        var_assign(assigns[i], 0);
+    }
+
+    int status = b->fn(argv);
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        size_t len = strcspn(assigns[i], "=");
+        char name[len + 1];
+        memcpy(name, assigns[i], len);
+        name[len] = '\0';
+        if (old[i] != NULL)
+        {
+            var_set(name, old[i], 0);
+            free(old[i]);
+        }
+        else
+        {
+            var_unset(name);
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief Runs a builtin in the shell with the stage's redirections.
+ *
+ * @param b  The builtin.
+ * @param st The stage naming it.
+ * @return The builtin's exit status, or 1 if a redirection failed.
+ */
+int builtin_run(const struct builtin *b, struct stage *st)
+{
+    if (st->nredirs == 0)
+    {
+        return call_builtin(b, st->argv, st->assigns);
+    }
+
+    int saved[st->nredirs];
+    if (redirect_prepare(st->redirs, st->nredirs) == -1)
+    {
+        return 1;
+    }
+    if (redirect_save(st->redirs, st->nredirs, saved) == -1)
+    {
+        redirect_release(st->redirs, st->nredirs);
+        return 1;
+    }
+    int status = call_builtin(b, st->argv, st->assigns);
+    redirect_restore(st->redirs, st->nredirs, saved);
+    redirect_release(st->redirs, st->nredirs);
+    return status;
+}
@@ -0,0 +1,28 @@
+/****************************************************************************
+
+  @file         builtins.h
+
+  @author       Ahnaful Hoque
+
+  @brief        The table of builtin commands and the small utilities
+                (echo, printf, test, true, false, export, unset, type)
+                the shell runs without forking.
+
+*******************************************************************************/
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "pipeline.h"
+
+struct builtin
+{
+    const char *name;
+    int (*fn)(char **args);
+};
+
+const struct builtin *builtin_lookup(const char *name);
+int builtin_run(const struct builtin *b, struct stage *st);
+const char *builtin_name(size_t i);
+
+#endif
@@ -0,0 +1,555 @@
+/****************************************************************************
+
+  @file         cache.c
+
+  @author       Ahnaful Hoque
+
+  @brief        The cache builtin.
+
+                  cache [-t seconds] [-f file]... command [args...]
+
+                runs an external command with its standard output going
+                both to the shell's standard output and to memory, and
+                keeps the output and exit status. Running the same command
+                again replays them without starting a process, which turns
+                the hundreds of "uname -r" or "git rev-parse HEAD" calls a
+                build script makes into a write() each. An entry is keyed
+                by the arguments, the working directory and the exported
+                environment, and stays valid for -t seconds (default 300,
+                0 for as long as the shell runs). Each -f file is stat()ed
+                on every lookup, and a change to its modification time,
+                size or inode makes the next run a miss. Only standard
+                output is kept; standard error is not replayed, and a run
+                killed by a signal or printing more than CACHE_MAX_OUTPUT
+                bytes is not stored. "cache -c" forgets everything and
+                "cache" alone lists the entries.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <time.h>
+
+#include "builtins.h"
+#include "cache.h"
+#include "jobs.h"
+#include "pathcache.h"
+#include "vars.h"
+
+#define CACHE_ENTRIES 128                   // least recently used goes first
+#define CACHE_MAX_OUTPUT (4 << 20)          // larger outputs are passed through only
+#define CACHE_DEFAULT_TTL 300               // seconds
+
+struct cache_entry
+{
+    uint64_t key;           // hash of arguments, directory, environment and -f names
+    uint64_t stamps;        // hash of the -f files' stat() results
+    char *command;          // arguments, directory and -f names, NUL-separated
+    size_t command_len;
+    char *output;
+    size_t output_len;
+    int status;
+    uint64_t expires;       // CLOCK_MONOTONIC ns, 0 for never
+    uint64_t last_used;
+    unsigned long hits;
+};
+
+static struct cache_entry entries[CACHE_ENTRIES];
+static int nentries;
+
+/**
+ * @brief Reads CLOCK_MONOTONIC.
+ *
+ * @param none
+ * @return Nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Continues an FNV-1a hash over some bytes.
+ *
+ * @param h   The hash so far.
+ * @param p   The bytes.
+ * @param len How many.
+ * @return The new hash.
+ */
+static uint64_t hash_bytes(uint64_t h, const void *p, size_t len)
+{
+    const unsigned char *s = p;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ s[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Hashes the exported environment.
+ *
+ * The strings are hashed one by one and summed, so the order
+ * vars_environ() happens to list them in does not matter.
+ *
+ * @param none
+ * @return The hash.
+ */
+static uint64_t hash_environ(void)
+{
+    uint64_t sum = 0;
+    for (char **e = vars_environ(); *e != NULL; e++)
+    {
+        uint64_t h = hash_bytes(0xcbf29ce484222325ULL, *e, strlen(*e));
+        sum += h ^ (h >> 29);
+    }
+    return sum;
+}
+
+/**
+ * @brief Hashes what stat() says about each -f file.
+ *
+ * @param files The file names.
+ * @param n     How many.
+ * @return The hash; a missing file hashes as its errno.
+ */
+static uint64_t hash_stamps(char **files, int n)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < n; i++)
+    {
+        struct stat sb;
+        if (stat(files[i], &sb) == -1)
+        {
+            h = hash_bytes(h, &errno, sizeof(errno));
+            continue;
+        }
+        h = hash_bytes(h, &sb.st_dev, sizeof(sb.st_dev));
+        h = hash_bytes(h, &sb.st_ino, sizeof(sb.st_ino));
+        h = hash_bytes(h, &sb.st_size, sizeof(sb.st_size));
+        h = hash_bytes(h, &sb.st_mtim, sizeof(sb.st_mtim));
+        h = hash_bytes(h, &sb.st_ctim, sizeof(sb.st_ctim));
+    }
+    return h;
+}
+
+/**
+ * @brief Lays out the arguments, working directory and -f names as the
+ *        text an entry is compared by.
+ *
+ * @param argv  The command.
+ * @param files The -f names.
+ * @param n     How many.
+ * @param len   Receives the length.
+ * @return The text (malloc()ed), or NULL if the directory is unknown.
+ */
+static char *command_text(char **argv, char **files, int n, size_t *len)
+{
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        return NULL;
+    }
+
+    size_t total = strlen(cwd) + 2;
+    for (int i = 0; argv[i] != NULL; i++)
+    {
+        total += strlen(argv[i]) + 1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        total += strlen(files[i]) + 1;
+    }
+
+    char *text = malloc(total);
+    if (!text)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    char *p = text;
+    for (int i = 0; argv[i] != NULL; i++)
+    {
+        p = stpcpy(p, argv[i]) + 1;
+    }
+    *p++ = '\0';        // an empty string ends the arguments
+    p = stpcpy(p, cwd) + 1;
+    for (int i = 0; i < n; i++)
+    {
+        p = stpcpy(p, files[i]) + 1;
+    }
+    *len = p - text;
+    return text;
+}
+
+/**
+ * @brief Forgets an entry.
+ *
+ * @param e The entry; the last one is moved into its place.
+ * @return none
+ */
+static void drop_entry(struct cache_entry *e)
+{
+    free(e->command);
+    free(e->output);
+    *e = entries[--nentries];
+}
+
+/**
+ * @brief Finds the entry for a command.
+ *
+ * An expired entry is dropped on the way.
+ *
+ * @param key  The command's hash.
+ * @param text The command's text, from command_text().
+ * @param len  Its length.
+ * @param now  The time.
+ * @return The entry, or NULL.
+ */
+static struct cache_entry *find_entry(uint64_t key, const char *text, size_t len, uint64_t now)
+{
+    for (int i = 0; i < nentries; i++)
+    {
+        struct cache_entry *e = &entries[i];
+        if (e->key != key || e->command_len != len || memcmp(e->command, text, len) != 0)
+        {
+            continue;
+        }
+        if (e->expires != 0 && now >= e->expires)
+        {
+            drop_entry(e);
+            return NULL;
+        }
+        return e;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Makes room for a new entry.
+ *
+ * @param now The time.
+ * @return An unused entry: a fresh slot, or the least recently used one
+ *         emptied.
+ */
+static struct cache_entry *new_entry(uint64_t now)
+{
+    if (nentries == CACHE_ENTRIES)
+    {
+        struct cache_entry *oldest = &entries[0];
+        for (int i = 0; i < nentries; i++)
+        {
+            if (entries[i].expires != 0 && now >= entries[i].expires)
+            {
+                oldest = &entries[i];
+                break;
+            }
+            if (entries[i].last_used < oldest->last_used)
+            {
+                oldest = &entries[i];
+            }
+        }
+        drop_entry(oldest);
+    }
+    struct cache_entry *e = &entries[nentries++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+/**
+ * @brief Writes all of a buffer to a descriptor.
+ *
+ * @param fd  The descriptor.
+ * @param p   The bytes.
+ * @param len How many.
+ * @return 0, or -1 if a write failed.
+ */
+static int write_all(int fd, const char *p, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs the command with its standard output through a pipe,
+ *        copying it to the shell's standard output as it arrives.
+ *
+ * @param path    The resolved command.
+ * @param argv    Its arguments.
+ * @param out     Receives the output (malloc()ed), or NULL if it was
+ *                too long to keep.
+ * @param out_len Receives its length.
+ * @return The exit status, or -1 if the command could not be started.
+ */
+static int run_captured(const char *path, char **argv, char **out, size_t *out_len)
+{
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1)
+    {
+        perror("dragonshell: cache: pipe failed");
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, p[1], STDOUT_FILENO);
+
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &old_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    struct job *job = job_create(argv[0], 0);
+    pid_t pid;
+    int err = path_spawn(&pid, path, &actions, &attr, argv, vars_environ());
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(p[1]);
+
+    if (err != 0)
+    {
+        job_finish(job);
+        jobs_unblock(&old_mask);
+        close(p[0]);
+        fprintf(stderr, "dragonshell: cache: %s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+    job_add_process(job, pid);
+    jobs_unblock(&old_mask);
+
+    size_t len = 0, cap = 4096;
+    char *buf = malloc(cap);
+    int passing = 1;        // stop copying once our own output is gone
+    for (;;)
+    {
+        if (buf != NULL && len == cap)
+        {
+            char *bigger = cap < CACHE_MAX_OUTPUT ? realloc(buf, cap * 2) : NULL;
+            if (bigger == NULL)
+            {
+                free(buf);      // too long: keep passing it through
+                buf = NULL;
+            }
+            else
+            {
+                buf = bigger;
+                cap *= 2;
+            }
+        }
+
+        char chunk[4096];
+        char *dst = buf != NULL ? buf + len : chunk;
+        size_t room = buf != NULL ? cap - len : sizeof(chunk);
+        ssize_t n = read(p[0], dst, room);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        if (passing && write_all(STDOUT_FILENO, dst, n) == -1)
+        {
+            passing = 0;
+        }
+        if (buf != NULL)
+        {
+            len += n;
+        }
+    }
+    close(p[0]);
+
+    *out = buf;
+    *out_len = len;
+    return job_wait(job, NULL, NULL);
+}
+
+/**
+ * @brief Prints the entries: hits, seconds left and the command.
+ *
+ * @param none
+ * @return none
+ */
+static void list_entries(void)
+{
+    uint64_t now = now_ns();
+    for (int i = 0; i < nentries; i++)
+    {
+        struct cache_entry *e = &entries[i];
+        if (e->expires != 0 && now >= e->expires)
+        {
+            continue;
+        }
+        if (e->expires != 0)
+        {
+            printf("%6lu %6llus ", e->hits, (unsigned long long)((e->expires - now) / 1000000000));
+        }
+        else
+        {
+            printf("%6lu %7s ", e->hits, "-");
+        }
+        for (const char *w = e->command; *w != '\0'; w += strlen(w) + 1)
+        {
+            printf(w == e->command ? "%s" : " %s", w);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief The "cache" builtin.
+ *
+ * @param args The argument vector, args[0] being "cache".
+ * @return The command's exit status, replayed on a hit; 127 if it is
+ *         not found, 2 for a usage error.
+ */
+int cache_builtin(char **args)
+{
+    long ttl = CACHE_DEFAULT_TTL;
+    int i = 1, nfiles = 0, argc = 0;
+    while (args[argc] != NULL)
+    {
+        argc++;
+    }
+    char *files[argc];
+
+    for (; args[i] != NULL && args[i][0] == '-'; i++)
+    {
+        if (strcmp(args[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-c") == 0 && args[i + 1] == NULL)
+        {
+            while (nentries > 0)
+            {
+                drop_entry(&entries[0]);
+            }
+            return 0;
+        }
+        if ((strcmp(args[i], "-t") != 0 && strcmp(args[i], "-f") != 0) || args[i + 1] == NULL)
+        {
+            fprintf(stderr, "dragonshell: cache: usage: cache [-t seconds] [-f file]... command [args...]\n"
+                            "       cache -c\n");
+            return 2;
+        }
+        if (args[i][1] == 'f')
+        {
+            files[nfiles++] = args[++i];
+            continue;
+        }
+        char *end;
+        ttl = strtol(args[++i], &end, 10);
+        if (*end != '\0' || end == args[i] || ttl < 0)
+        {
+            fprintf(stderr, "dragonshell: cache: -t: expected a number of seconds\n");
+            return 2;
+        }
+    }
+
+    char **argv = &args[i];
+    if (argv[0] == NULL)
+    {
+        list_entries();
+        return 0;
+    }
+
+    // A builtin never forks, so there is nothing to save
+    const struct builtin *b = builtin_lookup(argv[0]);
+    if (b != NULL)
+    {
+        return b->fn(argv);
+    }
+
+    const char *path = path_lookup(argv[0]);
+    if (path == NULL)
+    {
+        fprintf(stderr, "dragonshell: %s: command not found\n", argv[0]);
+        return 127;
+    }
+
+    // With the directory unknown the command runs uncached
+    size_t len = 0;
+    char *text = command_text(argv, files, nfiles, &len);
+    uint64_t key = text != NULL ? hash_environ() ^ hash_bytes(0xcbf29ce484222325ULL, text, len) : 0;
+    uint64_t stamps = hash_stamps(files, nfiles);
+    uint64_t now = now_ns();
+
+    struct cache_entry *e = text != NULL ? find_entry(key, text, len, now) : NULL;
+    if (e != NULL && e->stamps == stamps)
+    {
+        free(text);
+        e->hits++;
+        e->last_used = now;
+        fflush(stdout);
+        write_all(STDOUT_FILENO, e->output, e->output_len);
+        return e->status;
+    }
+
+    fflush(stdout);
+    char *out;
+    size_t out_len;
+    int status = run_captured(path, argv, &out, &out_len);
+    if (status == -1)
+    {
+        free(text);
+        return 126;
+    }
+
+    // Keep the run unless it was cut short or the directory is unknown
+    if (out == NULL || text == NULL || status > 128)
+    {
+        free(out);
+        free(text);
+        return status;
+    }
+    if (e == NULL)
+    {
+        e = new_entry(now);
+        e->key = key;
+        e->command = text;
+        e->command_len = len;
+    }
+    else
+    {
+        free(text);
+        free(e->output);
+        e->hits = 0;
+    }
+    e->stamps = stamps;
+    e->output = out;
+    e->output_len = out_len;
+    e->status = status;
+    e->expires = ttl != 0 ? now + ttl * 1000000000ULL : 0;
+    e->last_used = now;
+    return status;
+}
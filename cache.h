@@ -0,0 +1,17 @@
+/****************************************************************************
+
+  @file         cache.h
+
+  @author       Ahnaful Hoque
+
+  @brief        The cache builtin: remember a deterministic command's
+                output and exit status and replay them without a fork.
+
+*******************************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+int cache_builtin(char **args);
+
+#endif
@@ -0,0 +1,415 @@
+/****************************************************************************
+
+  @file         cmdsub.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Command substitution.
+
+                "$(command)" (or "`command`") runs the command and is
+                replaced by what it wrote to stdout, less trailing
+                newlines. The lexer keeps the command's text in the word;
+                it is parsed the first time it runs and the tree kept in a
+                small table of its own, so a substitution in a loop is
+                parsed once. The parse cache of whole lines cannot be
+                used, as parsing into it could evict the line that is
+                running.
+
+                Usually the command runs in a forked copy of the shell
+                with its stdout on a pipe, which the shell drains into a
+                buffer that doubles as it fills: a capture of n bytes
+                takes O(log n) reallocations, and once the buffer is large
+                enough for malloc() to map it, those move pages rather
+                than copy bytes, so tens of megabytes stay linear. A
+                command made only of builtins that print something and
+                change nothing, such as "$(pwd)" or "$(printf %s "$x")",
+                runs in the shell itself with stdout switched to a memory
+                stream, and costs no fork() at all.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "cmdsub.h"
+#include "builtins.h"
+#include "func.h"
+#include "input.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "parser.h"
+#include "shell.h"
+
+#define CMDSUB_CACHE_SIZE 32
+#define CMDSUB_INITIAL_BUF 4096
+
+/**
+ * A parsed substitution, in an arena of its own.
+ */
+struct cmdsub_entry
+{
+    unsigned hash;
+    char *text;             // NULL while the slot is empty
+    size_t len;
+    struct node *root;
+    int busy;               // runs of it in progress, which keep it in its slot
+    struct arena arena;
+};
+
+int cmdsub_status = 0;
+
+static struct cmdsub_entry cache[CMDSUB_CACHE_SIZE];
+static FILE *shell_stdout;  // the real stdout, while a memory stream stands in for it
+
+// Builtins that only print: running them in the shell changes nothing a
+// subshell would have kept to itself
+static const char *const printing_builtins[] = {
+    ":", "[", "echo", "false", "printf", "pwd", "test", "true", "type",
+};
+
+/**
+ * @brief FNV-1a hash of a substitution's text.
+ *
+ * @param text The text.
+ * @param len  Its length.
+ * @return The hash.
+ */
+static unsigned hash_text(const char *text, size_t len)
+{
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Finds a substitution's tree, parsing it into its slot if the
+ *        slot holds something else.
+ *
+ * @param text The text.
+ * @param len  Its length.
+ * @return The entry, or NULL if its slot is taken by a substitution that
+ *         is running (a substitution inside another one).
+ */
+static struct cmdsub_entry *cmdsub_parse(const char *text, size_t len)
+{
+    unsigned h = hash_text(text, len);
+    struct cmdsub_entry *e = &cache[h % CMDSUB_CACHE_SIZE];
+
+    if (e->text != NULL && e->hash == h && e->len == len && memcmp(e->text, text, len) == 0)
+    {
+        return e;
+    }
+    if (e->busy > 0)
+    {
+        return NULL;
+    }
+    arena_reset(&e->arena);
+    e->text = arena_alloc(&e->arena, len + 1);
+    memcpy(e->text, text, len);
+    e->text[len] = '\0';
+    e->hash = h;
+    e->len = len;
+    e->root = parse_text(&e->arena, e->text);
+    if (e->root == NULL)
+    {
+        e->text = NULL;     // an error is reported again on the next run
+    }
+    return e;
+}
+
+/**
+ * @brief Tells whether a tree can be run in the shell itself: a list of
+ *        plain calls to builtins that only print.
+ *
+ * @param n The tree.
+ * @return 1 if it can, 0 if it needs a forked copy of the shell.
+ */
+static int runs_in_process(const struct node *n)
+{
+    if (n == NULL)
+    {
+        return 1;
+    }
+    if (n->type == NODE_SEQUENCE || n->type == NODE_AND || n->type == NODE_OR)
+    {
+        return runs_in_process(n->left) && runs_in_process(n->right);
+    }
+    if (n->type != NODE_PIPELINE)
+    {
+        return 0;
+    }
+
+    const struct pipeline *pl = n->pipeline;
+    const struct stage *st = &pl->stages[0];
+    if (pl->nstages != 1 || pl->background || pl->timed || st->group != NULL ||
+        st->nredirs > 0 || st->nassigns > 0 || st->argv[0] == NULL)
+    {
+        return 0;
+    }
+    const char *name = st->argv[0];
+    if (strpbrk(name, (char[]){LEX_PARAM, LEX_QPARAM, LEX_GLOB, LEX_PROCSUB, '\0'}) != NULL ||
+        function_lookup(name) != NULL)
+    {
+        return 0;   // the command is only known once it is expanded
+    }
+    for (size_t i = 0; i < sizeof(printing_builtins) / sizeof(printing_builtins[0]); i++)
+    {
+        if (strcmp(name, printing_builtins[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs a tree of printing builtins with stdout switched to a
+ *        memory stream.
+ *
+ * $? is left as it was, as if a subshell had run them.
+ *
+ * @param root The tree.
+ * @param out  Receives the output, malloc'd.
+ * @param len  Receives its length.
+ * @return The status of the last command.
+ */
+static int capture_in_process(struct node *root, char **out, size_t *len)
+{
+    FILE *saved = stdout;
+    int saved_status = last_status;
+    int outermost = shell_stdout == NULL;
+
+    fflush(stdout);
+    FILE *mem = open_memstream(out, len);
+    if (!mem)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (outermost)
+    {
+        shell_stdout = saved;
+    }
+    stdout = mem;
+    int status = run_node(root);
+    fclose(mem);
+    stdout = saved;
+    if (outermost)
+    {
+        shell_stdout = NULL;
+    }
+    last_status = saved_status;
+    return status;
+}
+
+/**
+ * @brief The output of a substitution that could not run.
+ *
+ * @param out Receives "", malloc'd.
+ * @param len Receives 0.
+ * @return none
+ */
+static void no_output(char **out, size_t *len)
+{
+    *out = calloc(1, 1);
+    if (!*out)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    *len = 0;
+}
+
+/**
+ * @brief Reads a pipe to end-of-file into a buffer that doubles as it
+ *        fills.
+ *
+ * @param fd  The read end.
+ * @param out Receives the data, malloc'd and NUL-terminated.
+ * @param len Receives its length.
+ * @return none
+ */
+static void drain(int fd, char **out, size_t *len)
+{
+    size_t used = 0, cap = CMDSUB_INITIAL_BUF;
+    char *buf = malloc(cap);
+
+    for (;;)
+    {
+        if (!buf)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        ssize_t n = read(fd, buf + used, cap - used - 1);
+        if (n > 0)
+        {
+            used += n;
+            if (cap - used - 1 == 0)
+            {
+                cap *= 2;
+                buf = realloc(buf, cap);
+            }
+        }
+        else if (n == 0 || errno != EINTR)
+        {
+            break;
+        }
+    }
+    buf[used] = '\0';
+    *out = buf;
+    *len = used;
+}
+
+/**
+ * @brief Runs a tree in a forked copy of the shell with its stdout on a
+ *        pipe, and collects the output.
+ *
+ * The child stays in the shell's process group and ignores Ctrl-Z: a
+ * substitution is part of the command being expanded, not a job of its
+ * own. Ctrl-C stops it and, through interrupted, that command.
+ *
+ * @param root The tree.
+ * @param out  Receives the output, malloc'd.
+ * @param len  Receives its length.
+ * @return The child's exit status, or 1 if it could not be started.
+ */
+static int capture_forked(struct node *root, char **out, size_t *len)
+{
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1)
+    {
+        perror("dragonshell: pipe failed");
+        no_output(out, len);
+        return 1;
+    }
+
+    // SIGCHLD stays blocked until the child is in the job table
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    struct job *job = job_create("$(...)", 0);
+
+    fflush(stdout);     // don't let the child inherit buffered output
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (shell_stdout != NULL)
+        {
+            stdout = shell_stdout;  // inside "$(echo $(ls))" run in the shell
+        }
+        dup2(p[1], STDOUT_FILENO);
+        close(p[0]);
+        close(p[1]);
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        in_subshell = 1;
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_IGN);
+        jobs_forget();
+        exit(run_node(root));
+    }
+
+    close(p[1]);
+    if (pid == -1)
+    {
+        perror("dragonshell: fork failed");
+        job_launched(job);      // frees the job, which has no processes
+        jobs_unblock(&old_mask);
+        close(p[0]);
+        no_output(out, len);
+        return 1;
+    }
+    job_add_process(job, pid);
+    jobs_unblock(&old_mask);
+
+    drain(p[0], out, len);
+    close(p[0]);
+    int status = job_wait(job, NULL, NULL);
+    if (interrupted && input_is_interactive())
+    {
+        fputc('\n', stderr);   // the command it was part of is abandoned after "^C"
+    }
+    return status;
+}
+
+/**
+ * @brief Runs a command substitution.
+ *
+ * The output loses its trailing newlines, and any NUL bytes, which
+ * cannot be part of an argument. cmdsub_status is set to the command's
+ * exit status.
+ *
+ * @param text The command's text, as the lexer kept it.
+ * @param len  Its length.
+ * @return The output, malloc'd; the caller frees it.
+ */
+char *cmdsub_run(const char *text, size_t len)
+{
+    struct arena scratch = {NULL, NULL};
+    struct cmdsub_entry *e = cmdsub_parse(text, len);
+    struct node *root;
+
+    if (e != NULL)
+    {
+        root = e->root;
+        e->busy++;
+    }
+    else
+    {
+        char *copy = arena_alloc(&scratch, len + 1);
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+        root = parse_text(&scratch, copy);
+    }
+
+    char *out;
+    size_t n;
+    int status;
+    if (root == NULL)
+    {
+        no_output(&out, &n);
+        status = len > strspn(text, " \t\n") ? 2 : 0;   // a syntax error, or "$()"
+    }
+    else if (runs_in_process(root))
+    {
+        status = capture_in_process(root, &out, &n);
+    }
+    else
+    {
+        status = capture_forked(root, &out, &n);
+    }
+    if (e != NULL)
+    {
+        e->busy--;
+    }
+    arena_release(&scratch);
+
+    while (n > 0 && out[n - 1] == '\n')
+    {
+        n--;
+    }
+    out[n] = '\0';
+    if (memchr(out, '\0', n) != NULL)
+    {
+        char *to = out;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (out[i] != '\0')
+            {
+                *to++ = out[i];
+            }
+        }
+        *to = '\0';
+    }
+    cmdsub_status = status;
+    return out;
+}
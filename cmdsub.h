@@ -0,0 +1,21 @@
+/****************************************************************************
+
+  @file         cmdsub.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Command substitution: "$(command)" and "`command`" replaced
+                by the command's output.
+
+*******************************************************************************/
+
+#ifndef CMDSUB_H
+#define CMDSUB_H
+
+#include <stddef.h>
+
+extern int cmdsub_status;   // status of the last substitution, for "x=$(cmd)"
+
+char *cmdsub_run(const char *text, size_t len);
+
+#endif
@@ -0,0 +1,600 @@
+/****************************************************************************
+
+  @file         confine.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Resource limits and placement for the commands the shell
+                starts.
+
+                "ulimit" changes the shell's own soft and hard limits
+                (RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE and the rest), which
+                every later child inherits. For one command,
+
+                  confine [-g cgroup] [-C cpu.max] [-m memory.max]
+                          [-a cpus] [-n nice] command [args...]
+
+                starts it in a cgroup v2 group, created under the cgroup2
+                mount if needed and given the cpu.max and memory.max
+                written here, and/or pinned to a CPU list such as "0-3,6"
+                with a nice increment. The child is created straight into
+                the group with clone3(CLONE_INTO_CGROUP), so not even its
+                first page is charged elsewhere; on kernels without it the
+                child moves itself through cgroup.procs before exec. The
+                affinity and nice value are set in the child between the
+                fork and the exec, so the shell keeps its own.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <linux/sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "confine.h"
+#include "pipeline.h"
+#include "shell.h"
+
+struct confine
+{
+    int cgroup_fd;      // directory of the cgroup to start in, or -1
+    int have_cpus;
+    cpu_set_t cpus;     // CPU affinity mask, when have_cpus
+    int have_nice;
+    int nice;           // added to the shell's nice value, when have_nice
+};
+
+/**
+ * The limits ulimit knows, by option letter.
+ */
+static const struct
+{
+    char option;
+    int resource;
+    rlim_t unit;            // bytes per unit the user gives, or 1
+    const char *name;
+} rlimits[] = {
+    {'c', RLIMIT_CORE, 512, "core file size (blocks)"},
+    {'d', RLIMIT_DATA, 1024, "data seg size (kbytes)"},
+    {'f', RLIMIT_FSIZE, 512, "file size (blocks)"},
+    {'l', RLIMIT_MEMLOCK, 1024, "max locked memory (kbytes)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (kbytes)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "max user processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (kbytes)"},
+};
+
+#define NRLIMITS (int)(sizeof(rlimits) / sizeof(rlimits[0]))
+
+static int join_error;      // in a child: errno from moving into the cgroup
+
+/**
+ * @brief Prints one limit.
+ *
+ * @param i    Index in rlimits.
+ * @param hard Print the hard limit rather than the soft one.
+ * @param all  Prefix the limit's name and option, as for "ulimit -a".
+ * @return none
+ */
+static void print_rlimit(int i, int hard, int all)
+{
+    struct rlimit rl;
+    getrlimit(rlimits[i].resource, &rl);
+    rlim_t v = hard ? rl.rlim_max : rl.rlim_cur;
+
+    if (all)
+    {
+        printf("%-28s(-%c) ", rlimits[i].name, rlimits[i].option);
+    }
+    if (v == RLIM_INFINITY)
+    {
+        printf("unlimited\n");
+    }
+    else
+    {
+        printf("%llu\n", (unsigned long long)(v / rlimits[i].unit));
+    }
+}
+
+/**
+ * @brief The "ulimit" builtin.
+ *
+ *   ulimit [-SH] [-a | -c|-d|-f|-l|-n|-s|-t|-u|-v] [limit]
+ *
+ * prints or sets one limit (-f by default). -S and -H pick the soft or
+ * hard limit; setting with neither sets both, and printing shows the
+ * soft one. The limit is a number or "unlimited".
+ *
+ * @param args The argument vector, args[0] being "ulimit".
+ * @return 0 on success, 1 if setrlimit() fails, 2 for a usage error.
+ */
+int ulimit_builtin(char **args)
+{
+    int soft = 0, hard = 0, all = 0, which = -1, i = 1;
+
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+    {
+        for (const char *p = args[i] + 1; *p != '\0'; p++)
+        {
+            if (*p == 'S' || *p == 'H' || *p == 'a')
+            {
+                soft |= *p == 'S';
+                hard |= *p == 'H';
+                all |= *p == 'a';
+                continue;
+            }
+            int k = 0;
+            while (k < NRLIMITS && rlimits[k].option != *p)
+            {
+                k++;
+            }
+            if (k == NRLIMITS || (which != -1 && which != k))
+            {
+                fprintf(stderr, "dragonshell: ulimit: usage: ulimit [-SH] [-a | -cdflnstuv] [limit]\n");
+                return 2;
+            }
+            which = k;
+        }
+    }
+
+    if (all)
+    {
+        for (int k = 0; k < NRLIMITS; k++)
+        {
+            print_rlimit(k, hard && !soft, 1);
+        }
+        return 0;
+    }
+    if (which == -1)
+    {
+        which = 2;      // -f, as in sh
+    }
+    if (args[i] == NULL)
+    {
+        print_rlimit(which, hard && !soft, 0);
+        return 0;
+    }
+
+    rlim_t value = RLIM_INFINITY;
+    if (strcmp(args[i], "unlimited") != 0)
+    {
+        char *end;
+        errno = 0;
+        unsigned long long n = strtoull(args[i], &end, 10);
+        if (*end != '\0' || end == args[i] || args[i][0] == '-' || errno != 0 ||
+            n > RLIM_INFINITY / rlimits[which].unit)
+        {
+            fprintf(stderr, "dragonshell: ulimit: %s: invalid number\n", args[i]);
+            return 1;
+        }
+        value = n * rlimits[which].unit;
+    }
+
+    struct rlimit rl;
+    getrlimit(rlimits[which].resource, &rl);
+    if (soft || !hard)
+    {
+        rl.rlim_cur = value;
+    }
+    if (hard || !soft)
+    {
+        rl.rlim_max = value;
+    }
+    if (setrlimit(rlimits[which].resource, &rl) == -1)
+    {
+        fprintf(stderr, "dragonshell: ulimit: %s: %s\n", rlimits[which].name, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds where the cgroup v2 hierarchy is mounted.
+ *
+ * @param none
+ * @return The mount point ("/sys/fs/cgroup" on a pure v2 system,
+ *         "/sys/fs/cgroup/unified" on a hybrid one), or NULL.
+ */
+static const char *cgroup2_root(void)
+{
+    static char root[4096];
+
+    if (root[0] != '\0')
+    {
+        return root;
+    }
+    FILE *f = fopen("/proc/self/mountinfo", "re");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+
+    // id parent major:minor root mountpoint options... - fstype source options
+    char line[8192];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char mount[4096], fstype[64];
+        const char *dash = strstr(line, " - ");
+        if (dash != NULL && sscanf(dash, " - %63s", fstype) == 1 && strcmp(fstype, "cgroup2") == 0 &&
+            sscanf(line, "%*s %*s %*s %*s %4095s", mount) == 1)
+        {
+            strcpy(root, mount);
+            break;
+        }
+    }
+    fclose(f);
+    return root[0] != '\0' ? root : NULL;
+}
+
+/**
+ * @brief Writes a value into one of a cgroup's control files.
+ *
+ * @param dir   The cgroup directory.
+ * @param file  The file, e.g. "cpu.max".
+ * @param value What to write.
+ * @return 0, or -1 with errno set.
+ */
+static int write_control(int dir, const char *file, const char *value)
+{
+    int fd = openat(dir, file, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    int err = errno;
+    close(fd);
+    errno = err;
+    return n == (ssize_t)strlen(value) ? 0 : -1;
+}
+
+/**
+ * @brief Sets one limit of a cgroup, enabling its controller in the
+ *        parent group first if the file is not there yet.
+ *
+ * @param path       The cgroup's path.
+ * @param dir        The cgroup directory.
+ * @param controller "cpu" or "memory".
+ * @param file       "cpu.max" or "memory.max".
+ * @param value      The limit.
+ * @return 0, or -1 after reporting the error.
+ */
+static int set_cgroup_limit(const char *path, int dir, const char *controller, const char *file,
+                            const char *value)
+{
+    if (write_control(dir, file, value) == 0)
+    {
+        return 0;
+    }
+    if (errno == ENOENT)
+    {
+        char enable[16];
+        snprintf(enable, sizeof(enable), "+%s", controller);
+        int parent = openat(dir, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int enabled = parent != -1 && write_control(parent, "cgroup.subtree_control", enable) == 0;
+        if (parent != -1)
+        {
+            close(parent);
+        }
+        if (enabled && write_control(dir, file, value) == 0)
+        {
+            return 0;
+        }
+        if (!enabled)
+        {
+            fprintf(stderr, "dragonshell: confine: %s: cannot enable the %s controller: %s\n",
+                    path, controller, strerror(errno));
+            return -1;
+        }
+    }
+    fprintf(stderr, "dragonshell: confine: %s/%s: %s\n", path, file, strerror(errno));
+    return -1;
+}
+
+/**
+ * @brief Opens a cgroup, creating it and any missing parents.
+ *
+ * @param name The group's path below the cgroup2 mount.
+ * @param path Receives the full path.
+ * @param size The size of path.
+ * @return The directory, or -1 after reporting the error.
+ */
+static int open_cgroup(const char *name, char *path, size_t size)
+{
+    const char *root = cgroup2_root();
+    if (root == NULL)
+    {
+        fprintf(stderr, "dragonshell: confine: no cgroup2 file system is mounted\n");
+        return -1;
+    }
+    while (*name == '/')
+    {
+        name++;
+    }
+    if ((size_t)snprintf(path, size, "%s/%s", root, name) >= size)
+    {
+        fprintf(stderr, "dragonshell: confine: %s: name too long\n", name);
+        return -1;
+    }
+
+    for (char *p = path + strlen(root) + 1; ; p++)
+    {
+        if (*p == '/' || *p == '\0')
+        {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(path, 0755) == -1 && errno != EEXIST)
+            {
+                fprintf(stderr, "dragonshell: confine: %s: %s\n", path, strerror(errno));
+                return -1;
+            }
+            *p = c;
+            if (c == '\0')
+            {
+                break;
+            }
+        }
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        fprintf(stderr, "dragonshell: confine: %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * @brief Parses a CPU list such as "0-3,6".
+ *
+ * @param list The list.
+ * @param set  Receives the CPUs.
+ * @return 0, or -1 if the list is malformed or empty.
+ */
+static int parse_cpus(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    const char *p = list;
+    for (;;)
+    {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p || lo < 0)
+        {
+            return -1;
+        }
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+            {
+                return -1;
+            }
+        }
+        if (hi >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        for (long cpu = lo; cpu <= hi; cpu++)
+        {
+            CPU_SET(cpu, set);
+        }
+        if (*end == '\0')
+        {
+            return 0;
+        }
+        if (*end != ',')
+        {
+            return -1;
+        }
+        p = end + 1;
+    }
+}
+
+/**
+ * @brief Turns "50%" into a cpu.max value; anything else is passed on as
+ *        it is ("max", "50000", "50000 100000").
+ *
+ * @param arg   The -C argument.
+ * @param buf   Room for the converted value.
+ * @param size  Its size.
+ * @return The value to write.
+ */
+static const char *cpu_max_value(const char *arg, char *buf, size_t size)
+{
+    char *end;
+    double percent = strtod(arg, &end);
+    if (end == arg || strcmp(end, "%") != 0 || percent <= 0)
+    {
+        return arg;
+    }
+    snprintf(buf, size, "%ld 100000", (long)(percent * 1000));
+    return buf;
+}
+
+/**
+ * @brief Creates the child for a confined command.
+ *
+ * With a cgroup the child is made by clone3(CLONE_INTO_CGROUP), and
+ * where the kernel lacks that it is forked and moves itself, leaving
+ * any error for confine_apply() to report.
+ *
+ * @param c What to apply.
+ * @return As fork().
+ */
+pid_t confine_fork(const struct confine *c)
+{
+    if (c->cgroup_fd == -1)
+    {
+        return fork();
+    }
+
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = c->cgroup_fd;
+    pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL))
+    {
+        return pid;
+    }
+
+    pid = fork();
+    if (pid == 0 && write_control(c->cgroup_fd, "cgroup.procs", "0") == -1)
+    {
+        join_error = errno;
+    }
+    return pid;
+}
+
+/**
+ * @brief Applies the CPU affinity and nice value, in the child just
+ *        before it execs.
+ *
+ * @param c What to apply.
+ * @return 0, or -1 after reporting the error.
+ */
+int confine_apply(const struct confine *c)
+{
+    if (join_error != 0)
+    {
+        fprintf(stderr, "dragonshell: confine: cgroup.procs: %s\n", strerror(join_error));
+        return -1;
+    }
+    if (c->have_cpus && sched_setaffinity(0, sizeof(c->cpus), &c->cpus) == -1)
+    {
+        fprintf(stderr, "dragonshell: confine: sched_setaffinity: %s\n", strerror(errno));
+        return -1;
+    }
+    if (c->have_nice)
+    {
+        // Like nice(1), a refused change is reported but not fatal
+        errno = 0;
+        int now = getpriority(PRIO_PROCESS, 0);
+        if (errno == 0 && setpriority(PRIO_PROCESS, 0, now + c->nice) == -1)
+        {
+            fprintf(stderr, "dragonshell: confine: setpriority: %s\n", strerror(errno));
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief The "confine" builtin: runs one external command in a cgroup,
+ *        on a set of CPUs or at a nice value.
+ *
+ * -C and -m configure the -g group before the command starts, so they
+ * need one.
+ *
+ * @param args The argument vector, args[0] being "confine".
+ * @return The command's exit status, 127 if it is not found, 1 if the
+ *         cgroup cannot be set up, 2 for a usage error.
+ */
+int confine_builtin(char **args)
+{
+    struct confine c;
+    memset(&c, 0, sizeof(c));
+    c.cgroup_fd = -1;
+    const char *group = NULL, *cpu_max = NULL, *memory_max = NULL;
+    int i = 1, bad = 0;
+
+    for (; args[i] != NULL && args[i][0] == '-'; i++)
+    {
+        const char *opt = args[i];
+        if (strcmp(opt, "--") == 0)
+        {
+            i++;
+            break;
+        }
+        if (strlen(opt) != 2 || strchr("gCman", opt[1]) == NULL || args[i + 1] == NULL)
+        {
+            bad = 1;
+            break;
+        }
+        const char *value = args[++i];
+        char *end;
+        switch (opt[1])
+        {
+        case 'g':
+            group = value;
+            break;
+        case 'C':
+            cpu_max = value;
+            break;
+        case 'm':
+            memory_max = value;
+            break;
+        case 'a':
+            if (parse_cpus(value, &c.cpus) == -1)
+            {
+                fprintf(stderr, "dragonshell: confine: %s: invalid CPU list\n", value);
+                return 2;
+            }
+            c.have_cpus = 1;
+            break;
+        case 'n':
+            c.nice = strtol(value, &end, 10);
+            if (*end != '\0' || end == value)
+            {
+                fprintf(stderr, "dragonshell: confine: %s: invalid nice value\n", value);
+                return 2;
+            }
+            c.have_nice = 1;
+            break;
+        }
+    }
+    if (bad || args[i] == NULL || ((cpu_max != NULL || memory_max != NULL) && group == NULL))
+    {
+        fprintf(stderr, "dragonshell: confine: usage: confine [-g cgroup] [-C cpu.max] [-m memory.max] "
+                        "[-a cpus] [-n nice] command [args...]\n");
+        return 2;
+    }
+
+    if (group != NULL)
+    {
+        char path[4096], buf[32];
+        c.cgroup_fd = open_cgroup(group, path, sizeof(path));
+        if (c.cgroup_fd == -1 ||
+            (cpu_max != NULL &&
+             set_cgroup_limit(path, c.cgroup_fd, "cpu", "cpu.max", cpu_max_value(cpu_max, buf, sizeof(buf))) == -1) ||
+            (memory_max != NULL && set_cgroup_limit(path, c.cgroup_fd, "memory", "memory.max", memory_max) == -1))
+        {
+            if (c.cgroup_fd != -1)
+            {
+                close(c.cgroup_fd);
+            }
+            return 1;
+        }
+    }
+
+    // The builtin's redirections are already on the shell's descriptors
+    struct stage st;
+    memset(&st, 0, sizeof(st));
+    st.argv = &args[i];
+    struct pipeline pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.stages = &st;
+    pl.nstages = 1;
+    pl.text = args[i];
+    pl.confine = &c;
+
+    int status = execute_command(&pl);
+    if (c.cgroup_fd != -1)
+    {
+        close(c.cgroup_fd);
+    }
+    return status;
+}
@@ -0,0 +1,24 @@
+/****************************************************************************
+
+  @file         confine.h
+
+  @author       Ahnaful Hoque
+
+  @brief        The ulimit builtin, and the confine prefix that starts one
+                command in a cgroup, on a set of CPUs or at a nice value.
+
+*******************************************************************************/
+
+#ifndef CONFINE_H
+#define CONFINE_H
+
+#include <sys/types.h>
+
+struct confine;
+
+pid_t confine_fork(const struct confine *c);
+int confine_apply(const struct confine *c);
+int ulimit_builtin(char **args);
+int confine_builtin(char **args);
+
+#endif
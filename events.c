@@ -0,0 +1,208 @@
+/****************************************************************************
+
+  @file         events.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Waits for the next command line while reacting to
+                everything else that happens at the prompt.
+
+                While the prompt is up, SIGINT, SIGTSTP and SIGCHLD are
+                blocked and read from a signalfd, and every background
+                process has a pidfd, so a single epoll_wait() sleeps until
+                the user types a line, presses Ctrl-C or Ctrl-Z, or a job
+                finishes or stops. All of it is then handled in ordinary
+                code rather than in signal handlers: a finished job is
+                reported at once, however many are running, and the line
+                editor (lineedit.c) is handed each batch of keys and
+                redraws the line around the report. Outside the prompt the
+                signals are unblocked again, so a foreground wait behaves
+                as before.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "events.h"
+#include "input.h"
+#include "jobs.h"
+#include "lineedit.h"
+#include "pathtrie.h"
+
+#define EVENTS_BATCH 64
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static sigset_t prompt_signals;     // blocked and read from signal_fd at the prompt
+static int editing = 0;             // the line editor has the terminal
+
+/**
+ * @brief Sets up the epoll set with the terminal and the signalfd.
+ *
+ * @param none
+ * @return none
+ */
+void events_init(void)
+{
+    sigemptyset(&prompt_signals);
+    sigaddset(&prompt_signals, SIGINT);
+    sigaddset(&prompt_signals, SIGTSTP);
+    sigaddset(&prompt_signals, SIGCHLD);
+    sigaddset(&prompt_signals, SIGWINCH);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &prompt_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epoll_fd == -1 || signal_fd == -1)
+    {
+        perror("dragonshell: event loop");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EVENT_DATA(EVENT_SIGNAL, 0)};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+    ev.data.u64 = EVENT_DATA(EVENT_INPUT, 0);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+    jobs_watch(epoll_fd);
+    pathtrie_init(epoll_fd);
+}
+
+/**
+ * @brief Reads every pending signal from the signalfd.
+ *
+ * @param prompt The prompt, redrawn after Ctrl-C or Ctrl-Z.
+ * @return none
+ */
+static void handle_signals(const char *prompt)
+{
+    struct signalfd_siginfo si;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si))
+    {
+        if (si.ssi_signo == SIGCHLD)
+        {
+            jobs_reap_pending();
+        }
+        else if (si.ssi_signo == SIGWINCH)
+        {
+            lineedit_resize();
+        }
+        else if (editing)
+        {
+            lineedit_interrupt();
+        }
+        else
+        {
+            // Ctrl-C or Ctrl-Z with nothing running: the tty already
+            // discarded the partial line, so start a fresh one
+            printf("\n%s", prompt);
+        }
+    }
+}
+
+/**
+ * @brief Shows the prompt and waits for a command line, handling signals
+ *        and background job changes in the meantime.
+ *
+ * @param prompt The prompt.
+ * @return The line, as from read_line(), or NULL at end of input.
+ */
+char *events_read_line(const char *prompt)
+{
+    sigset_t old;
+
+    sigprocmask(SIG_BLOCK, &prompt_signals, &old);
+    jobs_notify(1);
+    fflush(stdout);
+    editing = lineedit_begin(prompt) == 0;
+    if (!editing)
+    {
+        fputs(prompt, stdout);
+        fflush(stdout);
+    }
+
+    while (!input_has_line())
+    {
+        struct epoll_event events[EVENTS_BATCH];
+        // Idle time at the prompt goes to indexing $PATH for completion
+        int n = epoll_wait(epoll_fd, events, EVENTS_BATCH, pathtrie_pending() ? 0 : -1);
+        if (n == 0)
+        {
+            pathtrie_step();
+            continue;
+        }
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("dragonshell: epoll_wait");
+            break;
+        }
+
+        int ready = 0;
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t data = events[i].data.u64;
+            switch ((enum event_source)(data >> 32))
+            {
+            case EVENT_INPUT:
+                if (editing)
+                {
+                    lineedit_read();
+                }
+                else
+                {
+                    ready = 1;
+                }
+                break;
+            case EVENT_SIGNAL:
+                handle_signals(prompt);
+                break;
+            case EVENT_CHILD:
+                jobs_reap_pid((pid_t)(uint32_t)data);
+                break;
+            case EVENT_PATH:
+                pathtrie_notify();
+                break;
+            }
+        }
+        if (jobs_have_news() && editing)
+        {
+            lineedit_hide();
+            jobs_notify(1);
+            fflush(stdout);
+            lineedit_show();
+        }
+        else if (jobs_have_news())
+        {
+            putchar('\n');
+            jobs_notify(1);
+            fputs(prompt, stdout);
+        }
+        fflush(stdout);
+        if (ready)
+        {
+            break;
+        }
+    }
+
+    if (editing)
+    {
+        lineedit_end();
+        editing = 0;
+    }
+
+    // A signal still pending goes to the handlers, which only forward it
+    char *line = read_line();
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return line;
+}
@@ -0,0 +1,31 @@
+/****************************************************************************
+
+  @file         events.h
+
+  @author       Ahnaful Hoque
+
+  @brief        The interactive prompt's event loop: terminal input,
+                signals and background job exits in one epoll set.
+
+*******************************************************************************/
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+enum event_source
+{
+    EVENT_INPUT,        // the terminal has input
+    EVENT_SIGNAL,       // the signalfd has SIGINT, SIGTSTP, SIGCHLD or SIGWINCH
+    EVENT_CHILD,        // a background process's pidfd: it exited
+    EVENT_PATH          // inotify: a $PATH directory changed
+};
+
+// The epoll_event data of a source; id is a pid for EVENT_CHILD
+#define EVENT_DATA(source, id) (((uint64_t)(source) << 32) | (uint32_t)(id))
+
+void events_init(void);
+char *events_read_line(const char *prompt);
+
+#endif
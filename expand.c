@@ -0,0 +1,545 @@
+/****************************************************************************
+
+  @file         expand.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Fills in the parameter references and patterns the lexer
+                marked.
+
+                A parsed pipeline is shared by every run of a cached line,
+                so it is never modified: each run that needs expansion
+                gets a copy of the stages, allocated from the caller's
+                per-line arena, with "$name", "${name}", "$?", "$$", the
+                positional parameters and "$((expression))" replaced by
+                their values, and "$(command)" by the command's output
+                (cmdsub.c). An unquoted reference is split
+                into fields at blanks, a quoted one is not (except that
+                "$@" gives one field per parameter), and one that
+                expands to nothing unquoted leaves no argument behind.
+                Each field with unquoted pattern characters is then
+                replaced by the sorted paths it matches (glob.c), or kept
+                as written when nothing matches. Leading "NAME=value"
+                words are taken out of argv; they become the command's
+                environment (or, with no command, shell variables). Each
+                process substitution is started here and replaced by its
+                "/dev/fd/N" path. A pipeline with nothing to expand is run
+                as parsed, at no cost.
+
+*******************************************************************************/
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "expand.h"
+#include "arith.h"
+#include "cmdsub.h"
+#include "func.h"
+#include "glob.h"
+#include "procsub.h"
+#include "lexer.h"
+#include "redirect.h"
+#include "vars.h"
+#include "shell.h"
+
+#define EXPAND_IFS " \t\n"
+#define PARAM_BUF 24        // room for any long, for "$((...))"
+
+/**
+ * A NULL-terminated argument vector that grows in an arena.
+ */
+struct fields
+{
+    char **v;
+    int n;
+    int cap;
+};
+
+/**
+ * @brief Appends an argument to a vector.
+ *
+ * @param a The arena.
+ * @param f The vector.
+ * @param s The argument.
+ * @return none
+ */
+static void add_field(struct arena *a, struct fields *f, char *s)
+{
+    if (f->n + 1 >= f->cap)
+    {
+        int cap = f->cap * 2;
+        char **v = arena_alloc(a, cap * sizeof(char *));
+        memcpy(v, f->v, f->n * sizeof(char *));
+        f->v = v;
+        f->cap = cap;
+    }
+    f->v[f->n++] = s;
+    f->v[f->n] = NULL;
+}
+
+/**
+ * @brief Appends a field, or the paths it matches if it is a pattern.
+ *
+ * @param a The arena.
+ * @param f The vector.
+ * @param s The field, possibly with LEX_GLOB markers.
+ * @return none
+ */
+static void add_word(struct arena *a, struct fields *f, char *s)
+{
+    if (strchr(s, LEX_GLOB) == NULL)
+    {
+        add_field(a, f, s);
+        return;
+    }
+
+    int n;
+    char **paths = glob_expand(a, s, &n);
+    if (n == 0)
+    {
+        add_field(a, f, glob_literal(a, s));   // no match leaves the word as written
+    }
+    for (int i = 0; i < n; i++)
+    {
+        add_field(a, f, paths[i]);
+    }
+}
+
+/**
+ * @brief The value of PIPESTATUS: one stage's status of the last
+ *        pipeline, or all of them separated by spaces.
+ *
+ * @param subscript What follows the '[': a number, "@]" or "*]".
+ * @param buf       Room for one number.
+ * @return The value; a stage past the last is "".
+ */
+static const char *pipe_status_value(const char *subscript, char buf[PARAM_BUF])
+{
+    static char *list = NULL;
+    static size_t list_cap = 0;
+
+    if (*subscript != '@' && *subscript != '*')
+    {
+        long i = strtol(subscript, NULL, 10);
+        if (i >= pipe_nstatus)
+        {
+            return "";
+        }
+        snprintf(buf, PARAM_BUF, "%d", pipe_status[i]);
+        return buf;
+    }
+
+    if ((size_t)pipe_nstatus * 12 + 1 > list_cap)
+    {
+        list_cap = pipe_nstatus * 12 + 1;
+        list = realloc(list, list_cap);
+        if (!list)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    char *p = list;
+    *p = '\0';
+    for (int i = 0; i < pipe_nstatus; i++)
+    {
+        p += sprintf(p, i > 0 ? " %d" : "%d", pipe_status[i]);
+    }
+    return list;
+}
+
+/**
+ * @brief The value of a parameter.
+ *
+ * There are no arrays besides PIPESTATUS: "${name[0]}", "${name[@]}"
+ * and "${name[*]}" are the variable itself and a higher subscript is "".
+ *
+ * @param name The name, possibly with a subscript; "?", "$", "#", "@",
+ *             "*" or a number; or LEX_ARITH and an expression.
+ * @param len  Its length.
+ * @param buf  Room for a number, for "$?", "$$", "$#", "$PIPESTATUS" and
+ *             arithmetic.
+ * @return The value; an unset variable is "".
+ */
+static const char *param_value(const char *name, size_t len, char buf[PARAM_BUF])
+{
+    if (name[0] == LEX_ARITH)
+    {
+        long value;
+        arith_eval(name + 1, len - 1, &value);      // an error has been reported; it is 0
+        snprintf(buf, PARAM_BUF, "%ld", value);
+        return buf;
+    }
+    if (len == 1 && (name[0] == '?' || name[0] == '$' || name[0] == '#'))
+    {
+        snprintf(buf, PARAM_BUF, "%d", name[0] == '?' ? last_status :
+                                       name[0] == '$' ? (int)shell_pid : positional_count());
+        return buf;
+    }
+    if (len == 1 && (name[0] == '@' || name[0] == '*'))
+    {
+        return positional_join();
+    }
+    if (isdigit((unsigned char)name[0]))
+    {
+        const char *value = positional_get(strtol(name, NULL, 10));
+        return value != NULL ? value : "";
+    }
+
+    const char *subscript = memchr(name, '[', len);
+    if (subscript != NULL)
+    {
+        len = subscript++ - name;
+    }
+    if (len == 10 && memcmp(name, "PIPESTATUS", 10) == 0)
+    {
+        return pipe_status_value(subscript != NULL ? subscript : "0", buf);
+    }
+    if (subscript != NULL && strtol(subscript, NULL, 10) > 0)
+    {
+        return "";
+    }
+    const char *value = var_lookup(name, len);
+    return value != NULL ? value : "";
+}
+
+/**
+ * @brief Counts the command substitutions in a word.
+ *
+ * @param word The word as the lexer left it.
+ * @return How many there are.
+ */
+static int count_cmdsubs(const char *word)
+{
+    int n = 0;
+    for (const char *p = word; (p = strchr(p, LEX_CMDSUB)) != NULL; p++)
+    {
+        n += p > word && (p[-1] == LEX_PARAM || p[-1] == LEX_QPARAM);
+    }
+    return n;
+}
+
+/**
+ * @brief Expands every reference in one word.
+ *
+ * Command substitutions are run first, in order, so that both passes
+ * over the word see the same output.
+ *
+ * @param a     The arena the result is allocated from.
+ * @param word  The word as the lexer left it.
+ * @param f     Receives the fields, when splitting; may be NULL.
+ * @return The expansion as a single string when f is NULL.
+ */
+static char *expand_word(struct arena *a, const char *word, struct fields *f)
+{
+    char buf[PARAM_BUF];
+    size_t total = 0;
+    int nsubs = count_cmdsubs(word), sub = 0;
+    char *outputs[nsubs + 1];
+
+    for (const char *p = word; nsubs > 0 && *p != '\0'; p++)
+    {
+        if ((*p == LEX_PARAM || *p == LEX_QPARAM) && p[1] == LEX_CMDSUB)
+        {
+            const char *end = strchr(p + 2, LEX_PARAM_END);
+            outputs[sub++] = cmdsub_run(p + 2, end - (p + 2));
+            p = end;
+        }
+    }
+
+    sub = 0;
+    for (const char *p = word; *p != '\0';)
+    {
+        if ((*p == LEX_PARAM || *p == LEX_QPARAM) && p[1] == LEX_ARITH)
+        {
+            // Any number fits; evaluating it twice would report errors twice
+            total += PARAM_BUF;
+            p = strchr(p + 1, LEX_PARAM_END) + 1;
+        }
+        else if (*p == LEX_PARAM || *p == LEX_QPARAM)
+        {
+            size_t len = strchr(p + 1, LEX_PARAM_END) - (p + 1);
+            const char *value = p[1] == LEX_CMDSUB ? outputs[sub++] : param_value(p + 1, len, buf);
+            total += strlen(value);
+            if (*p == LEX_PARAM && f != NULL)
+            {
+                // Pattern characters in an unquoted value get markers
+                for (; *value != '\0'; value++)
+                {
+                    total += strchr("*?[", *value) != NULL;
+                }
+            }
+            p += len + 2;
+        }
+        else
+        {
+            total++;
+            p++;
+        }
+    }
+
+    // Splitting only ever replaces a blank with a terminator, so the
+    // fields fit where the unsplit result would
+    char *out = arena_alloc(a, total + 1);
+    char *field = out;
+    int have = 0;   // the current field has something in it, maybe ""
+
+    sub = 0;
+    for (const char *p = word; *p != '\0';)
+    {
+        if (*p != LEX_PARAM && *p != LEX_QPARAM)
+        {
+            if (*p != LEX_GLOB || f != NULL)
+            {
+                *out++ = *p;
+            }
+            p++;
+            have = 1;
+            continue;
+        }
+
+        size_t len = strchr(p + 1, LEX_PARAM_END) - (p + 1);
+        if (*p == LEX_QPARAM && f != NULL && len == 1 && p[1] == '@')
+        {
+            // "$@": each parameter is a field of its own, and none is none
+            char **args = positional_args();
+            for (int i = 0; args[i] != NULL; i++)
+            {
+                if (i > 0)
+                {
+                    *out++ = '\0';
+                    add_word(a, f, field);
+                    field = out;
+                }
+                size_t n = strlen(args[i]);
+                memcpy(out, args[i], n);
+                out += n;
+                have = 1;
+            }
+            p += len + 2;
+            continue;
+        }
+
+        const char *value = p[1] == LEX_CMDSUB ? outputs[sub++] : param_value(p + 1, len, buf);
+        if (*p == LEX_QPARAM || f == NULL)
+        {
+            size_t n = strlen(value);
+            memcpy(out, value, n);
+            out += n;
+            have = 1;
+        }
+        else
+        {
+            for (; *value != '\0'; value++)
+            {
+                if (strchr(EXPAND_IFS, *value) == NULL)
+                {
+                    if (strchr("*?[", *value) != NULL)
+                    {
+                        *out++ = LEX_GLOB;
+                    }
+                    *out++ = *value;
+                    have = 1;
+                }
+                else if (have)
+                {
+                    *out++ = '\0';
+                    add_word(a, f, field);
+                    field = out;
+                    have = 0;
+                }
+            }
+        }
+        p += len + 2;
+    }
+    *out = '\0';
+    if (f != NULL && have)
+    {
+        add_word(a, f, field);
+    }
+    for (int i = 0; i < nsubs; i++)
+    {
+        free(outputs[i]);
+    }
+    return field;
+}
+
+/**
+ * @brief Tells whether a word has references to expand.
+ *
+ * @param word The word.
+ * @return 1 if it does, 0 otherwise.
+ */
+static int has_params(const char *word)
+{
+    return strchr(word, LEX_PARAM) != NULL || strchr(word, LEX_QPARAM) != NULL;
+}
+
+/**
+ * @brief Tells whether a word has references or pattern markers.
+ *
+ * @param word The word.
+ * @return 1 if it does, 0 otherwise.
+ */
+static int has_markers(const char *word)
+{
+    return has_params(word) || strchr(word, LEX_GLOB) != NULL;
+}
+
+/**
+ * @brief The path a process substitution word stands for.
+ *
+ * @param a    The arena.
+ * @param fds  The shell's ends of the stage's substitutions, -1 for one
+ *             that could not be started.
+ * @param word The LEX_PROCSUB word.
+ * @return "/dev/fd/N".
+ */
+static char *procsub_path(struct arena *a, const int *fds, const char *word)
+{
+    char *path = arena_alloc(a, 24);
+    snprintf(path, 24, "/dev/fd/%d", fds[atoi(word + 1)]);
+    return path;
+}
+
+/**
+ * @brief Finishes a "<&$fd" or ">&$fd" whose word has been expanded.
+ *
+ * @param r The redirection: a descriptor number makes it a copy of that
+ *          descriptor and "-" closes; anything else leaves the source at
+ *          -1 for redirect_prepare() to reject.
+ * @return none
+ */
+static void dup_source(struct redir *r)
+{
+    if (strcmp(r->word, "-") == 0)
+    {
+        r->type = REDIR_CLOSE;
+    }
+    else if (r->word[0] != '\0' && strspn(r->word, "0123456789") == strlen(r->word))
+    {
+        r->source = atoi(r->word);
+    }
+}
+
+/**
+ * @brief Expands one stage into a copy.
+ *
+ * @param a   The arena for the copy.
+ * @param st  The parsed stage.
+ * @param out Receives the expanded stage.
+ * @return none
+ */
+static void expand_stage(struct arena *a, const struct stage *st, struct stage *out)
+{
+    *out = *st;
+    if (!st->expand && st->nassigns == 0)
+    {
+        return;     // a group's references are in its own stages
+    }
+
+    if (st->nassigns > 0)
+    {
+        out->assigns = arena_alloc(a, (st->nassigns + 1) * sizeof(char *));
+        for (int i = 0; i < st->nassigns; i++)
+        {
+            char *word = st->argv[i];
+            out->assigns[i] = has_markers(word) ? expand_word(a, word, NULL) : word;
+        }
+        out->assigns[st->nassigns] = NULL;
+        out->envp = vars_environ_with(a, out->assigns);
+    }
+
+    out->argv = st->argv + st->nassigns;
+    if (st->expand)
+    {
+        // The substitutions' ends are passed on as "N>&N", ahead of the
+        // stage's own redirections
+        int *fds = st->nprocsubs > 0 ? arena_alloc(a, st->nprocsubs * sizeof(int)) : NULL;
+        out->redirs = arena_alloc(a, (st->nprocsubs + st->nredirs) * sizeof(struct redir));
+        out->nredirs = 0;
+        for (int i = 0; i < st->nprocsubs; i++)
+        {
+            fds[i] = procsub_start(st->procsubs[i].list, st->procsubs[i].output);
+            if (fds[i] != -1)
+            {
+                out->redirs[out->nredirs++] = (struct redir){REDIR_DUP, fds[i], fds[i], NULL, NULL, 0};
+            }
+        }
+
+        struct fields f = {arena_alloc(a, 8 * sizeof(char *)), 0, 8};
+        f.v[0] = NULL;
+        for (int i = st->nassigns; st->argv[i] != NULL; i++)
+        {
+            if (st->argv[i][0] == LEX_PROCSUB)
+            {
+                add_field(a, &f, procsub_path(a, fds, st->argv[i]));
+            }
+            else if (has_params(st->argv[i]))
+            {
+                expand_word(a, st->argv[i], &f);
+            }
+            else
+            {
+                add_word(a, &f, st->argv[i]);
+            }
+        }
+        out->argv = f.v;
+
+        for (int i = 0; i < st->nredirs; i++)
+        {
+            struct redir *r = &out->redirs[out->nredirs++];
+            *r = st->redirs[i];
+            if (r->type == REDIR_HEREDOC && r->expand_body && has_params(r->body))
+            {
+                r->body = expand_word(a, r->body, NULL);
+            }
+            if (r->word == NULL || r->type == REDIR_CLOSE || r->type == REDIR_HEREDOC)
+            {
+                continue;
+            }
+            if (r->word[0] == LEX_PROCSUB)
+            {
+                r->word = procsub_path(a, fds, r->word);
+            }
+            else if (has_markers(r->word))
+            {
+                r->word = expand_word(a, r->word, NULL);
+                if (r->type == REDIR_DUP)
+                {
+                    dup_source(r);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Expands a pipeline for one run.
+ *
+ * @param a  The per-line arena the expanded copy is allocated from.
+ * @param pl The parsed pipeline, which is not modified.
+ * @return pl itself when there is nothing to expand, otherwise a copy
+ *         whose stages have their final argv, redirections and
+ *         environment. A stage's argv may be empty if it only had
+ *         assignments, or references that expanded to nothing.
+ */
+struct pipeline *expand_pipeline(struct arena *a, struct pipeline *pl)
+{
+    if (!pl->expand)
+    {
+        return pl;
+    }
+
+    struct pipeline *copy = arena_alloc(a, sizeof(struct pipeline));
+    *copy = *pl;
+    copy->stages = arena_alloc(a, pl->nstages * sizeof(struct stage));
+    for (int i = 0; i < pl->nstages; i++)
+    {
+        expand_stage(a, &pl->stages[i], &copy->stages[i]);
+    }
+    return copy;
+}
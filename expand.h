@@ -0,0 +1,20 @@
+/****************************************************************************
+
+  @file         expand.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Parameter expansion of a parsed pipeline, just before it
+                runs.
+
+*******************************************************************************/
+
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "arena.h"
+#include "pipeline.h"
+
+struct pipeline *expand_pipeline(struct arena *a, struct pipeline *pl);
+
+#endif
@@ -0,0 +1,520 @@
+/****************************************************************************
+
+  @file         fastio.c
+
+  @author       Ahnaful Hoque
+
+  @brief        cat and tee run inside the shell.
+
+                A "cat file | grep x" stage or a "cat < in > out" command
+                does nothing but move bytes, so instead of forking a cat
+                that copies every byte through its own buffer, the shell
+                hands the work to the kernel: copy_file_range() between
+                regular files, splice() whenever one side is a pipe, and
+                sendfile() from a regular file to anything else. Only
+                when none of those apply (a terminal on both ends, an
+                O_APPEND target) does it fall back to read()/write().
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "fastio.h"
+#include "jobs.h"
+
+#define COPY_CHUNK (1 << 30)        // per copy_file_range()/sendfile() call
+#define SPLICE_CHUNK PIPELINE_PIPE_SIZE
+#define FALLBACK_BUF 131072
+#define TEE_MAX_FILES 16
+
+/**
+ * @brief Raises a pipe's capacity to PIPELINE_PIPE_SIZE.
+ *
+ * Fewer, larger transfers mean fewer context switches between the
+ * stages. Failure (above /proc/sys/fs/pipe-max-size) is harmless.
+ *
+ * @param fd Either end of the pipe.
+ * @return none
+ */
+void pipe_grow(int fd)
+{
+    fcntl(fd, F_SETPIPE_SZ, PIPELINE_PIPE_SIZE);
+}
+
+/**
+ * @brief Tells whether a stage can run inside the shell.
+ *
+ * Only plain cat (files, or "-" for stdin) and tee (files, optionally
+ * -a) qualify, and only when they redirect nothing but their stdin and
+ * stdout; anything else is left to the real program.
+ *
+ * @param st The stage.
+ * @return 1 if fastio_run() can execute it, 0 otherwise.
+ */
+int fastio_stage(const struct stage *st)
+{
+    char **argv = st->argv;
+    if (argv[0] == NULL)
+    {
+        return 0;
+    }
+
+    int is_tee = strcmp(argv[0], "tee") == 0;
+    int nfiles = 0;
+
+    if (!is_tee && strcmp(argv[0], "cat") != 0)
+    {
+        return 0;
+    }
+    for (int i = 0; i < st->nredirs; i++)
+    {
+        const struct redir *r = &st->redirs[i];
+        int in = r->type == REDIR_IN || r->type == REDIR_HERESTRING || r->type == REDIR_HEREDOC;
+        int out = r->type == REDIR_OUT || r->type == REDIR_APPEND;
+        if (!(in && r->fd == STDIN_FILENO) && !(out && r->fd == STDOUT_FILENO))
+        {
+            return 0;
+        }
+    }
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        if (is_tee && i == 1 && strcmp(argv[i], "-a") == 0)
+        {
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            return 0;
+        }
+        nfiles++;
+    }
+    return !is_tee || nfiles <= TEE_MAX_FILES;
+}
+
+/**
+ * @brief SIGINT handler while a stage runs in the shell.
+ *
+ * Installed without SA_RESTART, so the blocking copy call fails with
+ * EINTR and the stage ends the way a real cat would on Ctrl-C. It sets
+ * the shell's own interrupted, so a loop or list around the stage stops
+ * as it would for an external cat.
+ *
+ * @param sig The signal number.
+ * @return none
+ */
+static void note_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+/**
+ * @brief Writes a whole buffer, retrying short writes.
+ *
+ * @param fd  The descriptor.
+ * @param buf The data.
+ * @param len Its length.
+ * @return 0 on success, -1 on error (errno is set).
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Tells whether a zero-copy call failed only because it does not
+ *        support these descriptors, so a slower method should be tried.
+ *
+ * @param err The errno value.
+ * @return 1 to fall back, 0 for a real error.
+ */
+static int unsupported(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF ||
+           err == EOPNOTSUPP;
+}
+
+/**
+ * @brief Ends a copy cut short by Ctrl-C between two calls, which would
+ *        otherwise never see EINTR from a source that does not block,
+ *        such as /dev/zero.
+ *
+ * @param none
+ * @return -1, with errno set to EINTR.
+ */
+static int stopped(void)
+{
+    errno = EINTR;
+    return -1;
+}
+
+/**
+ * @brief Copies everything readable from in to out.
+ *
+ * File offsets are used and advanced, so a shared stdin is left where
+ * the data ended.
+ *
+ * @param in  The source.
+ * @param out The destination.
+ * @return 0 on success, -1 on error (errno is set).
+ */
+static int copy_fd(int in, int out)
+{
+    struct stat si, so;
+    ssize_t n;
+
+    if (fstat(in, &si) == -1 || fstat(out, &so) == -1)
+    {
+        return -1;
+    }
+
+    if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode))
+    {
+        while ((n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0)) > 0)
+        {
+            if (interrupted)
+            {
+                return stopped();
+            }
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (!unsupported(errno))
+        {
+            return -1;
+        }
+    }
+
+    if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode))
+    {
+        while ((n = splice(in, NULL, out, NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+        {
+            if (interrupted)
+            {
+                return stopped();
+            }
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (!unsupported(errno))
+        {
+            return -1;
+        }
+    }
+
+    if (S_ISREG(si.st_mode))
+    {
+        while ((n = sendfile(out, in, NULL, COPY_CHUNK)) > 0)
+        {
+            if (interrupted)
+            {
+                return stopped();
+            }
+        }
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (!unsupported(errno))
+        {
+            return -1;
+        }
+    }
+
+    char buf[FALLBACK_BUF];
+    for (;;)
+    {
+        if (interrupted)
+        {
+            return stopped();
+        }
+        n = read(in, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            return (int)n;
+        }
+        if (write_all(out, buf, n) == -1)
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Tells whether copying in to out would read back what it writes.
+ *
+ * That is one regular file with data past the read offset, as cat checks
+ * it: an output just truncated by ">" is empty, so "cat f > f" passes.
+ *
+ * @param in  The source.
+ * @param out The destination.
+ * @return 1 if the copy would never end, else 0.
+ */
+static int same_file(int in, int out)
+{
+    struct stat si, so;
+
+    if (fstat(in, &si) == -1 || fstat(out, &so) == -1 || !S_ISREG(so.st_mode) ||
+        si.st_dev != so.st_dev || si.st_ino != so.st_ino)
+    {
+        return 0;
+    }
+    off_t pos = lseek(in, 0, SEEK_CUR);
+    return pos != -1 && pos < so.st_size;
+}
+
+/**
+ * @brief Reports a failed copy the way the real utility would.
+ *
+ * @param name The utility, "cat" or "tee".
+ * @param what The file involved.
+ * @return The exit status: 128 + SIGPIPE if the reader went away,
+ *         128 + SIGINT after Ctrl-C, else 1.
+ */
+static int copy_error(const char *name, const char *what)
+{
+    if (errno == EPIPE)
+    {
+        return 128 + SIGPIPE;
+    }
+    if (errno == EINTR)
+    {
+        return 128 + SIGINT;
+    }
+    fprintf(stderr, "%s: %s: %s\n", name, what, strerror(errno));
+    return 1;
+}
+
+/**
+ * @brief cat: copies each file (or stdin for none or "-") to out.
+ *
+ * @param argv The stage's arguments.
+ * @param in   The stage's stdin.
+ * @param out  The stage's stdout.
+ * @return The exit status.
+ */
+static int run_cat(char **argv, int in, int out)
+{
+    int status = 0;
+
+    if (argv[1] == NULL)
+    {
+        if (same_file(in, out))
+        {
+            fprintf(stderr, "cat: -: input file is output file\n");
+            return 1;
+        }
+        return copy_fd(in, out) == -1 ? copy_error("cat", "-") : 0;
+    }
+    for (int i = 1; argv[i] != NULL; i++)
+    {
+        int fd = strcmp(argv[i], "-") == 0 ? in : open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            status = copy_error("cat", argv[i]);
+            continue;
+        }
+        if (same_file(fd, out))
+        {
+            fprintf(stderr, "cat: %s: input file is output file\n", argv[i]);
+            if (fd != in)
+            {
+                close(fd);
+            }
+            status = 1;
+            continue;
+        }
+        int rc = copy_fd(fd, out);
+        int err = errno;
+        if (fd != in)
+        {
+            close(fd);
+        }
+        if (rc == -1)
+        {
+            errno = err;
+            status = copy_error("cat", argv[i]);
+            if (status != 1)
+            {
+                return status;  // nobody is reading any more
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief tee: copies in to out and to every file.
+ *
+ * With one file and pipes on both sides, tee() duplicates the input into
+ * the output pipe without consuming it, and splice() then moves the same
+ * bytes into the file, so the data never enters user space.
+ *
+ * @param argv The stage's arguments.
+ * @param in   The stage's stdin.
+ * @param out  The stage's stdout.
+ * @return The exit status.
+ */
+static int run_tee(char **argv, int in, int out)
+{
+    int append = argv[1] != NULL && strcmp(argv[1], "-a") == 0;
+    int files[TEE_MAX_FILES];
+    const char *names[TEE_MAX_FILES];
+    int nfiles = 0, status = 0;
+
+    for (int i = append ? 2 : 1; argv[i] != NULL; i++)
+    {
+        int fd = open(argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+        if (fd == -1)
+        {
+            status = copy_error("tee", argv[i]);
+            continue;
+        }
+        names[nfiles] = argv[i];
+        files[nfiles++] = fd;
+    }
+
+    // "tee -a f < f" would copy f onto its own end for ever
+    const char *loop = same_file(in, out) ? "standard output" : NULL;
+    for (int i = 0; loop == NULL && i < nfiles; i++)
+    {
+        if (same_file(in, files[i]))
+        {
+            loop = names[i];
+        }
+    }
+    if (loop != NULL)
+    {
+        fprintf(stderr, "tee: %s: input file is output file\n", loop);
+        for (int i = 0; i < nfiles; i++)
+        {
+            close(files[i]);
+        }
+        return 1;
+    }
+
+    struct stat si, so;
+    int zero_copy = nfiles == 1 && !append && fstat(in, &si) == 0 && fstat(out, &so) == 0 &&
+                    S_ISFIFO(si.st_mode) && S_ISFIFO(so.st_mode);
+    char buf[FALLBACK_BUF];
+    ssize_t n = -1;
+
+    while (zero_copy && (n = tee(in, out, SPLICE_CHUNK, 0)) > 0)
+    {
+        while (n > 0)
+        {
+            ssize_t moved = splice(in, NULL, files[0], NULL, n, SPLICE_F_MOVE);
+            if (moved <= 0)
+            {
+                // Keep the bytes tee() already duplicated; finish with copies
+                zero_copy = 0;
+                while (n > 0 && (moved = read(in, buf, n < FALLBACK_BUF ? n : FALLBACK_BUF)) > 0)
+                {
+                    write_all(files[0], buf, moved);
+                    n -= moved;
+                }
+                break;
+            }
+            n -= moved;
+        }
+    }
+
+    int out_ok = 1;
+    if (interrupted)
+    {
+        status = 128 + SIGINT;
+    }
+    while (!interrupted && !(zero_copy && n == 0) && (n = read(in, buf, sizeof(buf))) != 0)
+    {
+        if (n == -1)
+        {
+            status = copy_error("tee", "-");
+            break;
+        }
+        if (out_ok && write_all(out, buf, n) == -1)
+        {
+            out_ok = 0;  // like tee, keep filling the files
+            status = copy_error("tee", "standard output");
+        }
+        for (int i = 0; i < nfiles; i++)
+        {
+            write_all(files[i], buf, n);
+        }
+    }
+    for (int i = 0; i < nfiles; i++)
+    {
+        close(files[i]);
+    }
+    return status;
+}
+
+/**
+ * @brief Runs a cat or tee stage in the shell itself.
+ *
+ * The stage's own redirections, already opened by redirect_prepare(),
+ * take precedence over in_fd and out_fd. SIGPIPE is ignored while
+ * copying so that a reader that exits early ends the copy with EPIPE
+ * instead of killing the shell, and SIGINT interrupts the copy instead
+ * of reprinting the prompt.
+ *
+ * @param st     The stage; fastio_stage() must have accepted it.
+ * @param in_fd  Where it reads from (a pipe or the shell's stdin).
+ * @param out_fd Where it writes to (a pipe or the shell's stdout).
+ * @return The stage's exit status.
+ */
+int fastio_run(const struct stage *st, int in_fd, int out_fd)
+{
+    for (int i = 0; i < st->nredirs; i++)
+    {
+        if (st->redirs[i].fd == STDIN_FILENO)
+        {
+            in_fd = st->redirs[i].source;
+        }
+        else
+        {
+            out_fd = st->redirs[i].source;
+        }
+    }
+
+    struct sigaction on_int = {0}, old_int;
+    on_int.sa_handler = note_interrupt;
+    sigemptyset(&on_int.sa_mask);
+    sigaction(SIGINT, &on_int, &old_int);
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+    fflush(stdout);
+
+    int status = strcmp(st->argv[0], "tee") == 0 ? run_tee(st->argv, in_fd, out_fd)
+                                                  : run_cat(st->argv, in_fd, out_fd);
+
+    signal(SIGPIPE, old_pipe);
+    sigaction(SIGINT, &old_int, NULL);
+    if (interrupted)
+    {
+        printf("\n");
+    }
+    return status;
+}
@@ -0,0 +1,24 @@
+/****************************************************************************
+
+  @file         fastio.h
+
+  @author       Ahnaful Hoque
+
+  @brief        cat and tee run inside the shell, moving data between file
+                descriptors with splice(), tee(), sendfile() and
+                copy_file_range() instead of a forked copy loop.
+
+*******************************************************************************/
+
+#ifndef FASTIO_H
+#define FASTIO_H
+
+#include "pipeline.h"
+
+#define PIPELINE_PIPE_SIZE (1 << 20)
+
+int fastio_stage(const struct stage *st);
+int fastio_run(const struct stage *st, int in_fd, int out_fd);
+void pipe_grow(int fd);
+
+#endif
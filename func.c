@@ -0,0 +1,549 @@
+/****************************************************************************
+
+  @file         func.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Shell functions, positional parameters, and the break,
+                continue, return, shift and local builtins.
+
+                "name() { list; }" copies the body's tree out of the
+                line's arena, which is soon reused, into an arena of the
+                function's own, and keeps it in a small hash table that
+                is looked up before the builtins. A call runs the body
+                with run_node() in the shell process, like any other
+                list: only the external commands in it are spawned. The
+                arguments become $1, $2, ... for the call by pointing at
+                the expanded argv, which outlives it, and the caller's
+                are put back afterwards, as are the variables the body
+                declared local. A function redefined while it runs is
+                freed once its last call returns.
+
+                break, continue and return do not longjmp out of the
+                interpreter: they set jump_pending, and run_node() stops
+                running lists while it is set, until the loop or call it
+                was meant for clears it.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "func.h"
+#include "parser.h"
+#include "redirect.h"
+#include "vars.h"
+#include "shell.h"
+
+#define FUNC_BUCKETS 64
+#define FUNC_MAX_DEPTH 1000     // calls within calls, before the C stack runs out
+
+struct function
+{
+    char *name;
+    struct node *body;
+    struct arena arena;         // the body's nodes, pipelines and words
+    int calls;                  // calls in progress
+    int retired;                // redefined or replaced while a call ran
+    struct function *next;      // next function in the same bucket
+};
+
+/**
+ * A variable a function declared local, and the value it had outside.
+ */
+struct local
+{
+    char *name;
+    char *old;                  // NULL if it was unset
+};
+
+enum jump jump_pending = JUMP_NONE;
+int jump_levels = 0;
+int loop_depth = 0;
+
+static struct function *functions[FUNC_BUCKETS];
+static int nfunctions = 0;
+static int call_depth = 0;
+
+static char *no_args[] = {NULL};
+static char *arg_zero = "dragonshell";
+static char **positional = no_args;     // $1 onwards, NULL-terminated
+static int npositional = 0;
+
+static struct local *locals;
+static size_t nlocals, locals_cap;
+static size_t frame_start = 0;          // the running call's first local
+
+/**
+ * @brief FNV-1a hash of a function name.
+ *
+ * @param name The name.
+ * @return The bucket it belongs in.
+ */
+static unsigned bucket_of(const char *name)
+{
+    unsigned h = 2166136261u;
+    for (const char *p = name; *p; p++)
+    {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h % FUNC_BUCKETS;
+}
+
+/**
+ * @brief Frees a function that is no longer in the table or running.
+ *
+ * @param fn The function.
+ * @return none
+ */
+static void function_free(struct function *fn)
+{
+    arena_release(&fn->arena);
+    free(fn->name);
+    free(fn);
+}
+
+/**
+ * @brief Defines or redefines a function.
+ *
+ * @param name The function's name.
+ * @param body Its body, which is copied.
+ * @return none
+ */
+void function_define(const char *name, const struct node *body)
+{
+    struct function *fn = calloc(1, sizeof(struct function));
+    if (!fn || !(fn->name = strdup(name)))
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    fn->body = node_copy(&fn->arena, body);
+
+    struct function **p = &functions[bucket_of(name)];
+    while (*p != NULL && strcmp((*p)->name, name) != 0)
+    {
+        p = &(*p)->next;
+    }
+    struct function *old = *p;
+    fn->next = old != NULL ? old->next : NULL;
+    *p = fn;
+    if (old == NULL)
+    {
+        nfunctions++;
+    }
+    else if (old->calls > 0)
+    {
+        old->retired = 1;
+    }
+    else
+    {
+        function_free(old);
+    }
+}
+
+/**
+ * @brief Finds a function by name.
+ *
+ * @param name The command name.
+ * @return The function, or NULL if there is none by that name.
+ */
+struct function *function_lookup(const char *name)
+{
+    if (nfunctions == 0)
+    {
+        return NULL;
+    }
+    for (struct function *fn = functions[bucket_of(name)]; fn != NULL; fn = fn->next)
+    {
+        if (strcmp(fn->name, name) == 0)
+        {
+            return fn;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Puts back the variables declared local since a point in the
+ *        stack of locals, last first.
+ *
+ * @param start The stack's height before the call.
+ * @return none
+ */
+static void locals_restore(size_t start)
+{
+    while (nlocals > start)
+    {
+        struct local *l = &locals[--nlocals];
+        if (l->old != NULL)
+        {
+            var_set(l->name, l->old, 0);
+        }
+        else
+        {
+            var_unset(l->name);
+        }
+        free(l->name);
+        free(l->old);
+    }
+}
+
+/**
+ * @brief Calls a function in the shell, with the stage's redirections
+ *        and its arguments as the positional parameters.
+ *
+ * "NAME=value" prefixes are assigned as shell variables and stay set, as
+ * for sh's special builtins.
+ *
+ * @param fn The function.
+ * @param st The expanded stage calling it.
+ * @return The status of the last command the body ran, or of return.
+ */
+int function_call(struct function *fn, struct stage *st)
+{
+    if (call_depth >= FUNC_MAX_DEPTH)
+    {
+        fprintf(stderr, "dragonshell: %s: maximum function nesting level exceeded (%d)\n",
+                fn->name, FUNC_MAX_DEPTH);
+        return 1;
+    }
+
+    int saved[st->nredirs > 0 ? st->nredirs : 1];
+    if (redirect_prepare(st->redirs, st->nredirs) == -1)
+    {
+        return 1;
+    }
+    if (redirect_save(st->redirs, st->nredirs, saved) == -1)
+    {
+        redirect_release(st->redirs, st->nredirs);
+        return 1;
+    }
+    for (int i = 0; st->assigns != NULL && st->assigns[i] != NULL; i++)
+    {
+        var_assign(st->assigns[i], 0);
+    }
+
+    char **caller_args = positional;
+    int caller_count = npositional, caller_loops = loop_depth;
+    size_t caller_frame = frame_start;
+
+    positional = st->argv + 1;
+    for (npositional = 0; positional[npositional] != NULL; npositional++)
+    {
+    }
+    loop_depth = 0;     // a break in the body cannot leave the caller's loop
+    frame_start = nlocals;
+    call_depth++;
+    fn->calls++;
+
+    int status = run_node(fn->body);
+    jump_pending = JUMP_NONE;
+
+    fn->calls--;
+    call_depth--;
+    locals_restore(frame_start);
+    frame_start = caller_frame;
+    loop_depth = caller_loops;
+    positional = caller_args;
+    npositional = caller_count;
+    redirect_restore(st->redirs, st->nredirs, saved);
+    redirect_release(st->redirs, st->nredirs);
+    if (fn->retired && fn->calls == 0)
+    {
+        function_free(fn);
+    }
+    return status;
+}
+
+/**
+ * @brief Sets $0 and the positional parameters the shell starts with.
+ *
+ * @param arg0 The shell's or script's name, for $0.
+ * @param args The arguments after it, NULL-terminated; they must outlive
+ *             the shell (main()'s argv does).
+ * @return none
+ */
+void positional_init(char *arg0, char **args)
+{
+    arg_zero = arg0;
+    positional = args;
+    for (npositional = 0; args[npositional] != NULL; npositional++)
+    {
+    }
+}
+
+/**
+ * @brief The value of a positional parameter.
+ *
+ * @param i The parameter: 0 for $0, 1 for $1 and so on.
+ * @return The value, or NULL if there are fewer parameters.
+ */
+const char *positional_get(long i)
+{
+    if (i == 0)
+    {
+        return arg_zero;
+    }
+    return i > 0 && i <= npositional ? positional[i - 1] : NULL;
+}
+
+/**
+ * @brief The number of positional parameters, for $#.
+ *
+ * @param none
+ * @return The count.
+ */
+int positional_count(void)
+{
+    return npositional;
+}
+
+/**
+ * @brief The positional parameters, for "$@".
+ *
+ * @param none
+ * @return $1 onwards, NULL-terminated; valid until the parameters change.
+ */
+char **positional_args(void)
+{
+    return positional;
+}
+
+/**
+ * @brief The positional parameters joined by spaces, for $* and an
+ *        unsplit "$@".
+ *
+ * @param none
+ * @return The joined string, valid until the next call.
+ */
+const char *positional_join(void)
+{
+    static char *joined = NULL;
+    static size_t joined_cap = 0;
+    size_t len = 1;
+
+    for (int i = 0; i < npositional; i++)
+    {
+        len += strlen(positional[i]) + 1;
+    }
+    if (len > joined_cap)
+    {
+        joined = realloc(joined, len);
+        if (!joined)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        joined_cap = len;
+    }
+
+    char *p = joined;
+    *p = '\0';
+    for (int i = 0; i < npositional; i++)
+    {
+        p += sprintf(p, i > 0 ? " %s" : "%s", positional[i]);
+    }
+    return joined;
+}
+
+/**
+ * @brief Reads the optional count of break, continue and shift.
+ *
+ * @param name The builtin, for the error message.
+ * @param arg  The argument, or NULL for 1.
+ * @param min  The smallest count allowed.
+ * @return The count, or -1 after reporting a bad one.
+ */
+static long builtin_count(const char *name, const char *arg, long min)
+{
+    char *end;
+
+    if (arg == NULL)
+    {
+        return 1;
+    }
+    long n = strtol(arg, &end, 10);
+    if (*end != '\0' || end == arg || n < min)
+    {
+        fprintf(stderr, "dragonshell: %s: %s: numeric argument required\n", name, arg);
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Starts a break or continue out of the enclosing loops.
+ *
+ * @param args The builtin's arguments: an optional number of loops.
+ * @param jump JUMP_BREAK or JUMP_CONTINUE.
+ * @return 0, or 1 for a bad count.
+ */
+static int loop_jump(char **args, enum jump jump)
+{
+    long n = builtin_count(args[0], args[1], 1);
+    if (n == -1)
+    {
+        return 1;
+    }
+    if (loop_depth == 0)
+    {
+        fprintf(stderr, "dragonshell: %s: only meaningful in a `for', `while', or `until' loop\n",
+                args[0]);
+        return 0;
+    }
+    jump_pending = jump;
+    jump_levels = n < loop_depth ? (int)n : loop_depth;
+    return 0;
+}
+
+/**
+ * @brief The "break" builtin: break [n]
+ *
+ * Leaves the innermost n loops (default 1).
+ *
+ * @param args The argument vector, args[0] being "break".
+ * @return 0, or 1 for a bad count.
+ */
+int break_builtin(char **args)
+{
+    return loop_jump(args, JUMP_BREAK);
+}
+
+/**
+ * @brief The "continue" builtin: continue [n]
+ *
+ * Starts the next pass of the nth enclosing loop (default 1).
+ *
+ * @param args The argument vector, args[0] being "continue".
+ * @return 0, or 1 for a bad count.
+ */
+int continue_builtin(char **args)
+{
+    return loop_jump(args, JUMP_CONTINUE);
+}
+
+/**
+ * @brief The "return" builtin: return [n]
+ *
+ * @param args The argument vector, args[0] being "return".
+ * @return n, or the status of the last command without it; 1 outside a
+ *         function, 2 for a bad n.
+ */
+int return_builtin(char **args)
+{
+    if (call_depth == 0)
+    {
+        fprintf(stderr, "dragonshell: return: can only `return' from a function\n");
+        return 1;
+    }
+
+    int status = last_status;
+    if (args[1] != NULL)
+    {
+        char *end;
+        long n = strtol(args[1], &end, 10);
+        if (*end != '\0' || end == args[1])
+        {
+            fprintf(stderr, "dragonshell: return: %s: numeric argument required\n", args[1]);
+            return 2;
+        }
+        status = (int)n & 0xff;
+    }
+    jump_pending = JUMP_RETURN;
+    return status;
+}
+
+/**
+ * @brief The "shift" builtin: shift [n]
+ *
+ * Drops the first n positional parameters (default 1).
+ *
+ * @param args The argument vector, args[0] being "shift".
+ * @return 0, or 1 if n is bad or more than there are.
+ */
+int shift_builtin(char **args)
+{
+    long n = builtin_count("shift", args[1], 0);
+    if (n == -1)
+    {
+        return 1;
+    }
+    if (n > npositional)
+    {
+        fprintf(stderr, "dragonshell: shift: %ld: shift count out of range\n", n);
+        return 1;
+    }
+    positional += n;
+    npositional -= n;
+    return 0;
+}
+
+/**
+ * @brief The "local" builtin: local name[=value]...
+ *
+ * Each variable gets its value back (or is unset again) when the
+ * function returns. Without a value it is unset for the call.
+ *
+ * @param args The argument vector, args[0] being "local".
+ * @return 0, or 1 outside a function or for a bad name.
+ */
+int local_builtin(char **args)
+{
+    if (call_depth == 0)
+    {
+        fprintf(stderr, "dragonshell: local: can only be used in a function\n");
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        size_t len = strcspn(args[i], "=");
+        if (!var_valid_name(args[i], len))
+        {
+            fprintf(stderr, "dragonshell: local: `%s': not a valid identifier\n", args[i]);
+            status = 1;
+            continue;
+        }
+
+        int known = 0;
+        for (size_t k = frame_start; k < nlocals && !known; k++)
+        {
+            known = strncmp(locals[k].name, args[i], len) == 0 && locals[k].name[len] == '\0';
+        }
+        if (!known)
+        {
+            if (nlocals == locals_cap)
+            {
+                locals_cap = locals_cap ? locals_cap * 2 : 8;
+                locals = realloc(locals, locals_cap * sizeof(*locals));
+                if (!locals)
+                {
+                    fprintf(stderr, "dragonshell: allocation error\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            const char *old = var_lookup(args[i], len);
+            struct local *l = &locals[nlocals++];
+            l->name = strndup(args[i], len);
+            l->old = old != NULL ? strdup(old) : NULL;
+            if (!l->name || (old != NULL && !l->old))
+            {
+                fprintf(stderr, "dragonshell: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (args[i][len] == '=')
+        {
+            var_assign(args[i], 0);
+        }
+        else if (!known)
+        {
+            var_unset(locals[nlocals - 1].name);
+        }
+    }
+    return status;
+}
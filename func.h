@@ -0,0 +1,49 @@
+/****************************************************************************
+
+  @file         func.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Shell functions, positional parameters, and the break,
+                continue, return, shift and local builtins.
+
+*******************************************************************************/
+
+#ifndef FUNC_H
+#define FUNC_H
+
+struct node;
+struct stage;
+struct function;
+
+/**
+ * A break, continue or return that is unwinding the tree being run.
+ */
+enum jump
+{
+    JUMP_NONE,
+    JUMP_BREAK,
+    JUMP_CONTINUE,
+    JUMP_RETURN
+};
+
+extern enum jump jump_pending;
+extern int jump_levels;         // loops a break or continue has yet to leave
+extern int loop_depth;          // loops around the command running now
+
+void function_define(const char *name, const struct node *body);
+struct function *function_lookup(const char *name);
+int function_call(struct function *fn, struct stage *st);
+void positional_init(char *arg0, char **args);
+const char *positional_get(long i);
+int positional_count(void);
+const char *positional_join(void);
+char **positional_args(void);
+
+int break_builtin(char **args);
+int continue_builtin(char **args);
+int return_builtin(char **args);
+int shift_builtin(char **args);
+int local_builtin(char **args);
+
+#endif
@@ -0,0 +1,616 @@
+/****************************************************************************
+
+  @file         glob.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Expands pathname patterns.
+
+                A pattern is matched one path component at a time against
+                directory listings, and the matches are returned sorted.
+                Each listing is read with getdents64() into one buffer,
+                sorted once, and kept in a table keyed on the directory's
+                device and inode. A later glob of the same directory only
+                has to stat() it: while its mtime is unchanged the listing
+                is reused, so a loop that globs a directory of 100k files
+                reads it once instead of once per iteration. A listing read
+                within a second of the directory's last change could have
+                missed a second change in the same clock tick, so it is
+                not trusted and is read again next time.
+
+                Only characters the lexer marked with LEX_GLOB are special:
+                '*' matches any run of characters, '?' any one, and "[...]"
+                (negated by a leading '!' or '^', with ranges) one of a
+                set. A component that is exactly "**" matches any number
+                of directories, hidden ones excepted. A name starting with
+                '.' only matches a component that starts with a literal
+                '.', and "." and ".." are never matched.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#include "arena.h"
+#include "glob.h"
+#include "lexer.h"
+
+#define GLOB_CACHE_SLOTS 256
+#define GLOB_DENTS_SIZE 65536
+
+/**
+ * One name in a listing.
+ */
+struct entry
+{
+    unsigned name;          // offset into the listing's names
+    unsigned char type;     // d_type: DT_DIR, DT_REG, ... or DT_UNKNOWN
+};
+
+/**
+ * A directory's names, sorted.
+ */
+struct listing
+{
+    dev_t dev;
+    ino_t ino;              // 0 while the slot is empty
+    struct timespec mtime;
+    int racy;               // read too soon after a change to be reused
+    char *names;            // every name, NUL-terminated, back to back
+    size_t names_cap;
+    struct entry *entries;
+    int count;
+    int cap;
+};
+
+static struct listing cache[GLOB_CACHE_SLOTS];
+static const char *sort_names;  // the names compare_entries() looks at
+
+/**
+ * The matches of one glob_expand() call.
+ */
+struct matches
+{
+    struct arena *arena;
+    char **v;
+    int n;
+    int cap;
+};
+
+/**
+ * @brief qsort() comparison of two entries by name.
+ *
+ * @param a The first entry.
+ * @param b The second.
+ * @return As strcmp().
+ */
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(sort_names + ((const struct entry *)a)->name,
+                  sort_names + ((const struct entry *)b)->name);
+}
+
+/**
+ * @brief Reads a directory into a listing with getdents64().
+ *
+ * The listing's buffers are reused, so rereading a directory that has
+ * not grown allocates nothing.
+ *
+ * @param l   The listing, which is overwritten.
+ * @param dir The directory's path.
+ * @return 0 on success, -1 if it cannot be read.
+ */
+static int read_listing(struct listing *l, const char *dir)
+{
+    static char dents[GLOB_DENTS_SIZE];
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    size_t used = 0;
+    ssize_t n;
+    l->count = 0;
+    while ((n = getdents64(fd, dents, sizeof(dents))) > 0)
+    {
+        for (ssize_t off = 0; off < n;)
+        {
+            struct dirent64 *d = (struct dirent64 *)(dents + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            size_t len = strlen(d->d_name) + 1;
+            if (used + len > l->names_cap)
+            {
+                do
+                {
+                    l->names_cap = l->names_cap ? l->names_cap * 2 : 4096;
+                } while (used + len > l->names_cap);
+                l->names = check_alloc(realloc(l->names, l->names_cap));
+            }
+            if (l->count == l->cap)
+            {
+                l->cap = l->cap ? l->cap * 2 : 64;
+                l->entries = check_alloc(realloc(l->entries, l->cap * sizeof(struct entry)));
+            }
+            memcpy(l->names + used, d->d_name, len);
+            l->entries[l->count].name = used;
+            l->entries[l->count++].type = d->d_type;
+            used += len;
+        }
+    }
+    close(fd);
+    if (n == -1)
+    {
+        return -1;
+    }
+
+    sort_names = l->names;
+    qsort(l->entries, l->count, sizeof(struct entry), compare_entries);
+    return 0;
+}
+
+/**
+ * @brief Finds a directory's listing, reading it only if it changed.
+ *
+ * @param dir The directory's path ("" for the current directory).
+ * @return The listing, or NULL if the directory cannot be read. It stays
+ *         valid only until the next call.
+ */
+static struct listing *get_listing(const char *dir)
+{
+    struct stat sb;
+    if (*dir == '\0')
+    {
+        dir = ".";
+    }
+    if (stat(dir, &sb) == -1 || !S_ISDIR(sb.st_mode))
+    {
+        return NULL;
+    }
+
+    size_t h = ((size_t)sb.st_dev * 31 + (size_t)sb.st_ino) * 0x9E3779B97F4A7C15ULL;
+    struct listing *l = &cache[(h >> 56) % GLOB_CACHE_SLOTS];
+    if (l->ino == sb.st_ino && l->dev == sb.st_dev && !l->racy &&
+        l->mtime.tv_sec == sb.st_mtim.tv_sec && l->mtime.tv_nsec == sb.st_mtim.tv_nsec)
+    {
+        return l;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (read_listing(l, dir) == -1)
+    {
+        l->ino = 0;
+        return NULL;
+    }
+    l->dev = sb.st_dev;
+    l->ino = sb.st_ino;
+    l->mtime = sb.st_mtim;
+    l->racy = sb.st_mtim.tv_sec >= now.tv_sec - 1;
+    return l;
+}
+
+/**
+ * @brief Adds a path to the matches.
+ *
+ * @param m    The matches.
+ * @param path The path, which is copied.
+ * @return none
+ */
+static void add_match(struct matches *m, const char *path)
+{
+    if (m->n == m->cap)
+    {
+        int cap = m->cap ? m->cap * 2 : 16;
+        char **v = arena_alloc(m->arena, cap * sizeof(char *));
+        if (m->n > 0)
+        {
+            memcpy(v, m->v, m->n * sizeof(char *));
+        }
+        m->v = v;
+        m->cap = cap;
+    }
+    m->v[m->n++] = arena_strdup(m->arena, path);
+}
+
+/**
+ * @brief Tells whether a pattern component has anything special in it.
+ *
+ * @param p   The component.
+ * @param end Its end.
+ * @return 1 if it has a LEX_GLOB marker, 0 otherwise.
+ */
+static int is_pattern(const char *p, const char *end)
+{
+    return memchr(p, LEX_GLOB, end - p) != NULL;
+}
+
+/**
+ * @brief Matches one character against a "[...]" set.
+ *
+ * @param p   The pattern, just after the '['.
+ * @param end The end of the component.
+ * @param c   The character.
+ * @param in  Receives 1 if c is in the set, 0 if not.
+ * @return Where the pattern goes on after the set, or NULL if the set is
+ *         never closed (the '[' is then literal).
+ */
+static const char *match_set(const char *p, const char *end, unsigned char c, int *in)
+{
+    int negate = p < end && (*p == '!' || *p == '^');
+    int found = 0;
+
+    p += negate;
+    for (int first = 1; p < end; first = 0)
+    {
+        if (*p == LEX_GLOB)
+        {
+            p++;
+            continue;
+        }
+        if (*p == ']' && !first)
+        {
+            *in = found != negate;
+            return p + 1;
+        }
+
+        unsigned char lo = *p++, hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']')
+        {
+            hi = p[1];
+            p += 2;
+        }
+        found |= lo <= c && c <= hi;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Matches a name against one pattern component.
+ *
+ * A '*' is tried at its shortest first and only ever backtracks to the
+ * last one seen, so the match is linear in practice.
+ *
+ * @param p   The component.
+ * @param end Its end.
+ * @param s   The name.
+ * @return 1 if it matches, 0 otherwise.
+ */
+static int match_component(const char *p, const char *end, const char *s)
+{
+    const char *star_p = NULL, *star_s = NULL;
+
+    for (;;)
+    {
+        if (p < end)
+        {
+            if (*p == LEX_GLOB && p[1] == '*')
+            {
+                p += 2;
+                star_p = p;
+                star_s = s;
+                continue;
+            }
+            if (*s != '\0')
+            {
+                const char *next = NULL;
+                if (*p == LEX_GLOB && p[1] == '?')
+                {
+                    next = p + 2;
+                }
+                else if (*p == LEX_GLOB && p[1] == '[')
+                {
+                    int in;
+                    const char *after = match_set(p + 2, end, *s, &in);
+                    if (after == NULL)
+                    {
+                        next = *s == '[' ? p + 2 : NULL;
+                    }
+                    else
+                    {
+                        next = in ? after : NULL;
+                    }
+                }
+                else if (*p == *s)
+                {
+                    next = p + 1;
+                }
+
+                if (next != NULL)
+                {
+                    p = next;
+                    s++;
+                    continue;
+                }
+            }
+        }
+        else if (*s == '\0')
+        {
+            return 1;
+        }
+
+        if (star_p == NULL || *star_s == '\0')
+        {
+            return 0;
+        }
+        p = star_p;
+        s = ++star_s;
+    }
+}
+
+/**
+ * @brief Tells whether a listed name is a directory, following symlinks.
+ *
+ * @param path The name's full path.
+ * @param type Its d_type.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int is_dir(const char *path, unsigned char type)
+{
+    struct stat sb;
+    if (type == DT_DIR)
+    {
+        return 1;
+    }
+    return (type == DT_LNK || type == DT_UNKNOWN) && stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+static void glob_at(struct matches *m, char *path, size_t len, const char *pat);
+
+/**
+ * @brief Matches "**" at a directory: the rest of the pattern here and
+ *        in every directory below it.
+ *
+ * @param m    The matches.
+ * @param path The directory, ending in '/' unless it is "".
+ * @param len  Its length.
+ * @param rest The pattern after the "**" ("" when it was last).
+ * @return none
+ */
+static void glob_recursive(struct matches *m, char *path, size_t len, const char *rest)
+{
+    if (*rest == '\0')
+    {
+        // A final "**" matches everything below, directories included
+        static const char every[] = {LEX_GLOB, '*', '\0'};
+        glob_at(m, path, len, every);
+    }
+    else
+    {
+        glob_at(m, path, len, rest);
+    }
+
+    struct listing *l = get_listing(path);
+    if (l == NULL)
+    {
+        return;
+    }
+
+    // Take the subdirectories' names before the cache slot is reused
+    int n = 0;
+    char **dirs = arena_alloc(m->arena, (l->count + 1) * sizeof(char *));
+    for (int i = 0; i < l->count; i++)
+    {
+        const char *name = l->names + l->entries[i].name;
+        unsigned char type = l->entries[i].type;
+        if (name[0] == '.')
+        {
+            continue;
+        }
+        if (type == DT_UNKNOWN)
+        {
+            struct stat sb;
+            snprintf(path + len, PATH_MAX - len, "%s", name);
+            type = lstat(path, &sb) == 0 && S_ISDIR(sb.st_mode) ? DT_DIR : DT_REG;
+            path[len] = '\0';
+        }
+        if (type == DT_DIR)
+        {
+            dirs[n++] = arena_strdup(m->arena, name);
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t sub = len + strlen(dirs[i]) + 1;
+        if (sub + 1 < PATH_MAX)
+        {
+            sprintf(path + len, "%s/", dirs[i]);
+            glob_recursive(m, path, sub, rest);
+            path[len] = '\0';
+        }
+    }
+}
+
+/**
+ * @brief Matches the rest of a pattern below a directory.
+ *
+ * @param m    The matches.
+ * @param path The directory so far, ending in '/' unless it is "";
+ *             extended in place and put back before returning.
+ * @param len  Its length.
+ * @param pat  The remaining components.
+ * @return none
+ */
+static void glob_at(struct matches *m, char *path, size_t len, const char *pat)
+{
+    const char *end = strchrnul(pat, '/');
+    const char *next = end;
+    while (*next == '/')
+    {
+        next++;
+    }
+    int last = *next == '\0';
+    int want_dir = last && *end == '/';    // a trailing '/' only matches directories
+
+    if (end - pat == 4 && pat[0] == LEX_GLOB && pat[1] == '*' && pat[2] == LEX_GLOB && pat[3] == '*')
+    {
+        glob_recursive(m, path, len, next);
+        return;
+    }
+
+    if (!is_pattern(pat, end))
+    {
+        size_t n = end - pat;
+        if (len + n + 2 >= PATH_MAX)
+        {
+            return;
+        }
+        memcpy(path + len, pat, n);
+        path[len + n] = '\0';
+
+        struct stat sb;
+        if (!last)
+        {
+            path[len + n] = '/';
+            path[len + n + 1] = '\0';
+            glob_at(m, path, len + n + 1, next);
+        }
+        else if (want_dir ? stat(path, &sb) == 0 && S_ISDIR(sb.st_mode) : lstat(path, &sb) == 0)
+        {
+            if (want_dir)
+            {
+                strcpy(path + len + n, "/");
+            }
+            add_match(m, path);
+        }
+        path[len] = '\0';
+        return;
+    }
+
+    struct listing *l = get_listing(path);
+    if (l == NULL)
+    {
+        return;
+    }
+
+    int hidden = pat[0] == '.';
+    int n = 0;
+    char **hits = NULL;
+    if (!last)
+    {
+        hits = arena_alloc(m->arena, (l->count + 1) * sizeof(char *));
+    }
+    for (int i = 0; i < l->count; i++)
+    {
+        const char *name = l->names + l->entries[i].name;
+        if ((name[0] == '.' && !hidden) || !match_component(pat, end, name))
+        {
+            continue;
+        }
+        if (len + strlen(name) + 2 >= PATH_MAX)
+        {
+            continue;
+        }
+
+        strcpy(path + len, name);
+        if (!last)
+        {
+            // Names are copied out, as matching below reuses the cache
+            unsigned char type = l->entries[i].type;
+            if (type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN)
+            {
+                hits[n++] = arena_strdup(m->arena, name);
+            }
+        }
+        else if (!want_dir)
+        {
+            add_match(m, path);
+        }
+        else if (is_dir(path, l->entries[i].type))
+        {
+            strcat(path + len, "/");
+            add_match(m, path);
+        }
+    }
+    path[len] = '\0';
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t sub = len + strlen(hits[i]) + 1;
+        sprintf(path + len, "%s/", hits[i]);
+        glob_at(m, path, sub, next);
+        path[len] = '\0';
+    }
+}
+
+/**
+ * @brief qsort() comparison of two matched paths.
+ *
+ * @param a The first path.
+ * @param b The second.
+ * @return As strcmp().
+ */
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Expands a pathname pattern.
+ *
+ * @param a       The arena the matches are allocated from.
+ * @param pattern The word, with LEX_GLOB before each special character.
+ * @param count   Receives the number of matches.
+ * @return The matching paths, sorted, or NULL when there are none.
+ */
+char **glob_expand(struct arena *a, const char *pattern, int *count)
+{
+    char path[PATH_MAX];
+    struct matches m = {a, NULL, 0, 0};
+    size_t len = 0;
+
+    if (*pattern == '/')
+    {
+        path[len++] = '/';
+        pattern += strspn(pattern, "/");
+    }
+    path[len] = '\0';
+    if (*pattern != '\0')
+    {
+        glob_at(&m, path, len, pattern);
+    }
+
+    if (m.n > 1)
+    {
+        qsort(m.v, m.n, sizeof(char *), compare_paths);
+    }
+    *count = m.n;
+    return m.v;
+}
+
+/**
+ * @brief A pattern as plain text, for a word that matched nothing.
+ *
+ * @param a       The arena the copy is allocated from.
+ * @param pattern The word, with LEX_GLOB markers.
+ * @return The word without them.
+ */
+char *glob_literal(struct arena *a, const char *pattern)
+{
+    char *out = arena_alloc(a, strlen(pattern) + 1);
+    char *o = out;
+    for (; *pattern != '\0'; pattern++)
+    {
+        if (*pattern != LEX_GLOB)
+        {
+            *o++ = *pattern;
+        }
+    }
+    *o = '\0';
+    return out;
+}
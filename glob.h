@@ -0,0 +1,20 @@
+/****************************************************************************
+
+  @file         glob.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Pathname expansion ("*", "?", "[...]", "**") over cached
+                directory listings.
+
+*******************************************************************************/
+
+#ifndef GLOB_H
+#define GLOB_H
+
+#include "arena.h"
+
+char **glob_expand(struct arena *a, const char *pattern, int *count);
+char *glob_literal(struct arena *a, const char *pattern);
+
+#endif
@@ -0,0 +1,318 @@
+/****************************************************************************
+
+  @file         history.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Keeps the lines typed at the prompt in a history file.
+
+                The file ($HISTFILE, or ~/.dragonshell_history) is only
+                ever appended to: each line goes out in one write() on an
+                O_APPEND descriptor, so several shells can add to it at
+                once without locking and nothing is ever rewritten. To
+                read it, the file is mapped with mmap() and indexed by
+                the offset of each line, so entry i is found in constant
+                time and no line is copied. The index is built the first
+                time history is needed, and extended (after remapping)
+                whenever the file has grown, which also brings in lines
+                other shells have added since.
+
+                A search scans the mapped bytes directly with memmem(),
+                which glibc vectorizes, a block at a time from the newest
+                end backwards, and only maps the hit back to an entry by
+                binary search on the index. Searching a million entries
+                costs about as much as one pass of memchr() over the file.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "arena.h"
+#include "history.h"
+#include "vars.h"
+
+#define HISTORY_FILE ".dragonshell_history"
+#define HISTORY_SCAN_BLOCK 65536    // bytes memmem() searches per step, newest first
+
+static char *path = NULL;       // NULL until history is first used
+static int append_fd = -1;
+static int read_fd = -1;
+static char *map = NULL;
+static size_t map_size = 0;
+static size_t *starts = NULL;   // the offset of each complete line
+static long count = 0;
+static long cap = 0;
+static size_t indexed = 0;      // bytes of the file covered by starts[]
+
+/**
+ * @brief Works out where the history file is, the first time.
+ *
+ * @return The path, or NULL when there is no $HISTFILE or $HOME.
+ */
+static const char *history_path(void)
+{
+    if (path == NULL)
+    {
+        const char *file = var_get("HISTFILE");
+        const char *home = var_get("HOME");
+        if (file != NULL && *file != '\0')
+        {
+            path = check_alloc(strdup(file));
+        }
+        else if (home != NULL && *home != '\0')
+        {
+            path = check_alloc(malloc(strlen(home) + sizeof(HISTORY_FILE) + 1));
+            sprintf(path, "%s/%s", home, HISTORY_FILE);
+        }
+    }
+    return path;
+}
+
+/**
+ * @brief Appends a line to the history file.
+ *
+ * Blank lines are not kept.
+ *
+ * @param line The line as typed, without its newline.
+ * @return none
+ */
+void history_add(const char *line)
+{
+    if (line[strspn(line, " \t")] == '\0' || append_fd == -2)
+    {
+        return;
+    }
+    if (append_fd == -1)
+    {
+        if (history_path() == NULL)
+        {
+            return;
+        }
+        append_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+        if (append_fd == -1)
+        {
+            return;
+        }
+    }
+
+    // One write() per line, so concurrent shells' lines never interleave
+    size_t len = strlen(line);
+    char buf[4096];
+    char *out = len < sizeof(buf) ? buf : check_alloc(malloc(len + 1));
+    memcpy(out, line, len);
+    out[len] = '\n';
+    if (write(append_fd, out, len + 1) == -1)
+    {
+        fprintf(stderr, "dragonshell: %s: %s\n", path, strerror(errno));
+        close(append_fd);
+        append_fd = -2;     // do not try again
+    }
+    if (out != buf)
+    {
+        free(out);
+    }
+}
+
+/**
+ * @brief Brings the mapping and index up to date with the file.
+ *
+ * Only the bytes added since the last call are scanned. A line that is
+ * not yet terminated (another shell may be writing it) is left for the
+ * next call.
+ *
+ * @return none
+ */
+static void history_refresh(void)
+{
+    struct stat sb;
+    if (read_fd == -1)
+    {
+        if (history_path() == NULL || (read_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        {
+            return;
+        }
+    }
+    if (fstat(read_fd, &sb) == -1 || (size_t)sb.st_size == map_size)
+    {
+        return;
+    }
+
+    if ((size_t)sb.st_size < map_size)
+    {
+        // Truncated by hand or rotated in place: start over
+        count = 0;
+        indexed = 0;
+    }
+    if (map != NULL)
+    {
+        munmap(map, map_size);
+        map = NULL;
+        map_size = 0;
+    }
+    if (sb.st_size == 0)
+    {
+        return;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, read_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        map = NULL;
+        return;
+    }
+    map_size = sb.st_size;
+
+    const char *end = map + map_size;
+    for (const char *p = map + indexed, *nl; (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1)
+    {
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            starts = check_alloc(realloc(starts, cap * sizeof(size_t)));
+        }
+        starts[count++] = p - map;
+        indexed = nl + 1 - map;
+    }
+}
+
+/**
+ * @brief The number of entries, including other shells' recent ones.
+ *
+ * @return The count.
+ */
+long history_count(void)
+{
+    history_refresh();
+    return count;
+}
+
+/**
+ * @brief Looks up one entry, without copying it.
+ *
+ * @param i   The entry, 0 being the oldest (below history_count()).
+ * @param len Receives its length; the text is not NUL-terminated.
+ * @return The entry's text, valid until history is next refreshed.
+ */
+const char *history_entry(long i, size_t *len)
+{
+    size_t end = i + 1 < count ? starts[i + 1] : indexed;
+    *len = end - starts[i] - 1;
+    return map + starts[i];
+}
+
+/**
+ * @brief Finds the entry a byte of the file belongs to.
+ *
+ * @param off The offset, within the indexed part of the file.
+ * @return The entry.
+ */
+static long entry_at(size_t off)
+{
+    long lo = 0, hi = count - 1;
+    while (lo < hi)
+    {
+        long mid = lo + (hi - lo + 1) / 2;
+        if (starts[mid] <= off)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Finds the newest entry before a given one containing some text.
+ *
+ * Each block is searched forward with memmem() and its last hit kept;
+ * blocks overlap by the needle's length so no match is split. A needle
+ * never holds a newline, so a hit never spans two entries.
+ *
+ * @param needle The text ("" matches every entry).
+ * @param before Only entries older than this are searched (pass
+ *               history_count() to search them all).
+ * @return The entry, or -1 if none matches.
+ */
+long history_search(const char *needle, long before)
+{
+    size_t n = strlen(needle);
+    size_t block = n * 2 > HISTORY_SCAN_BLOCK ? n * 2 : HISTORY_SCAN_BLOCK;
+    if (before > count)
+    {
+        before = count;
+    }
+    if (before <= 0)
+    {
+        return -1;
+    }
+    if (n == 0)
+    {
+        return before - 1;
+    }
+
+    size_t limit = before < count ? starts[before] : indexed;
+    while (limit > 0)
+    {
+        size_t from = limit > block ? limit - block : 0;
+        const char *last = NULL;
+        for (const char *p = map + from, *hit;
+             (hit = memmem(p, map + limit - p, needle, n)) != NULL; p = hit + 1)
+        {
+            last = hit;
+        }
+        if (last != NULL)
+        {
+            return entry_at(last - map);
+        }
+        if (from == 0)
+        {
+            break;
+        }
+        limit = from + n - 1;   // the next block overlaps this one
+    }
+    return -1;
+}
+
+/**
+ * @brief The "history" builtin: history [n]
+ *
+ * Lists the last n entries (or all of them), numbered from 1 as in bash.
+ *
+ * @param args The argument vector, args[0] being "history".
+ * @return 0, or 2 for a bad count.
+ */
+int history_builtin(char **args)
+{
+    long total = history_count();
+    long first = 0;
+
+    if (args[1] != NULL)
+    {
+        char *end;
+        long n = strtol(args[1], &end, 10);
+        if (*end != '\0' || n < 0 || end == args[1])
+        {
+            fprintf(stderr, "dragonshell: history: %s: numeric argument required\n", args[1]);
+            return 2;
+        }
+        first = n < total ? total - n : 0;
+    }
+    for (long i = first; i < total; i++)
+    {
+        size_t len;
+        const char *text = history_entry(i, &len);
+        printf("%5ld  %.*s\n", i + 1, (int)len, text);
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+/****************************************************************************
+
+  @file         history.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Command history: an append-only file shared by every
+                shell, read through mmap() with an index of line starts.
+
+*******************************************************************************/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+void history_add(const char *line);
+long history_count(void);
+const char *history_entry(long i, size_t *len);
+long history_search(const char *needle, long before);
+int history_builtin(char **args);
+
+#endif
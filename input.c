@@ -0,0 +1,370 @@
+/****************************************************************************
+
+  @file         input.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Reads command lines for the shell.
+
+                A terminal is read with read(), which returns one line at a
+                time in canonical mode, into the same buffer a pipe uses,
+                so the event loop can tell whether a line is already
+                buffered before waiting for more; when the line editor is
+                in use it fills that buffer instead. Script
+                files (and a regular file on stdin) are mmap()ed and cut into
+                lines in place, a pipe on stdin is read in large blocks, and
+                the -c string is used directly. Only the terminal shows a
+                prompt, so running a long script costs neither a syscall per
+                line nor prompt flushing.
+
+*******************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "input.h"
+
+#define INPUT_BLOCK_SIZE 65536
+
+enum input_mode
+{
+    INPUT_TTY,      // interactive terminal, read() per line
+    INPUT_MAPPED,   // whole file mapped with mmap()
+    INPUT_STREAM,   // pipe or socket, read() in blocks
+    INPUT_STRING    // the -c argument
+};
+
+static enum input_mode mode = INPUT_TTY;
+static char *buf = NULL;        // mapping or block buffer
+static size_t buf_size = 0;     // bytes valid in buf
+static size_t pos = 0;          // start of the next unread line
+static int input_fd = -1;       // descriptor for INPUT_STREAM
+static int seek_stdin = 0;      // keep fd 0's offset in step for children
+static int at_eof = 0;
+static char *tail_line = NULL;  // copy of a last line with no newline
+static size_t capacity = INPUT_BLOCK_SIZE;  // size of buf for INPUT_TTY and INPUT_STREAM
+
+/**
+ * @brief Maps a regular file for reading lines in place.
+ *
+ * The mapping is private and writable so that newlines can be replaced
+ * with NUL bytes without touching the file itself.
+ *
+ * @param fd   The open file.
+ * @param size The file's size.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+static int map_file(int fd, off_t size)
+{
+    mode = INPUT_MAPPED;
+    pos = 0;
+    buf_size = (size_t)size;
+    if (size == 0)
+    {
+        buf = NULL;
+        at_eof = 1;
+        return 0;
+    }
+    buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED)
+    {
+        buf = NULL;
+        return -1;
+    }
+    madvise(buf, buf_size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+/**
+ * @brief Selects standard input as the line source.
+ *
+ * A regular file is mapped; a terminal or a pipe is read into an
+ * INPUT_BLOCK_SIZE buffer.
+ *
+ * @param none
+ * @return none
+ */
+void input_open_stdin(void)
+{
+    struct stat st;
+
+    if (!isatty(STDIN_FILENO) && fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        off_t start = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        if (start == 0 && map_file(STDIN_FILENO, st.st_size) == 0)
+        {
+            seek_stdin = 1;
+            return;
+        }
+    }
+    mode = isatty(STDIN_FILENO) ? INPUT_TTY : INPUT_STREAM;
+    input_fd = STDIN_FILENO;
+    buf = malloc(INPUT_BLOCK_SIZE);
+    buf_size = 0;
+    if (!buf)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Selects a script file as the line source.
+ *
+ * @param path The script's path.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int input_open_file(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 || map_file(fd, st.st_size) == -1)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    close(fd);  // the mapping stays valid
+    return 0;
+}
+
+/**
+ * @brief Selects a string (the argument of -c) as the line source.
+ *
+ * @param text The commands, separated by newlines.
+ * @return none
+ */
+void input_open_string(const char *text)
+{
+    if (mode == INPUT_STRING)
+    {
+        free(buf);  // a --server worker replaces the empty placeholder
+    }
+    mode = INPUT_STRING;
+    buf = strdup(text);
+    if (!buf)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    buf_size = strlen(buf);
+    pos = 0;
+}
+
+/**
+ * @brief Tells whether the shell is reading from a terminal.
+ *
+ * @param none
+ * @return 1 if a prompt should be shown, 0 otherwise.
+ */
+int input_is_interactive(void)
+{
+    return mode == INPUT_TTY;
+}
+
+/**
+ * @brief Tells whether read_line() can return without reading the
+ *        terminal, because a whole line (or the end of input) is already
+ *        buffered.
+ *
+ * @param none
+ * @return 1 if so, 0 if read_line() would have to wait for input.
+ */
+int input_has_line(void)
+{
+    if (mode != INPUT_TTY && mode != INPUT_STREAM)
+    {
+        return 1;
+    }
+    return at_eof || memchr(buf + pos, '\n', buf_size - pos) != NULL;
+}
+
+/**
+ * @brief Cuts the next line out of a mapped or string buffer.
+ *
+ * The newline is overwritten with a NUL. A final line with no newline
+ * cannot always be terminated in place (it may end exactly at the end
+ * of the mapping), so it is copied instead. When the map is stdin, fd
+ * 0's offset is kept just past the returned line so that commands
+ * reading stdin continue from there, and whatever they consume is
+ * skipped.
+ *
+ * @param none
+ * @return The line, or NULL at the end of the buffer.
+ */
+static char *next_buffered_line(void)
+{
+    if (seek_stdin)
+    {
+        // A command may have read part of the script from the shared stdin
+        off_t cur = lseek(STDIN_FILENO, 0, SEEK_CUR);
+        if (cur >= 0 && (size_t)cur > pos)
+        {
+            pos = cur;
+        }
+    }
+    if (pos >= buf_size)
+    {
+        return NULL;
+    }
+
+    char *line = buf + pos;
+    char *nl = memchr(line, '\n', buf_size - pos);
+    if (nl != NULL)
+    {
+        *nl = '\0';
+        pos = nl - buf + 1;
+    }
+    else
+    {
+        free(tail_line);
+        tail_line = strndup(line, buf_size - pos);
+        pos = buf_size;
+        line = tail_line;
+    }
+
+    if (seek_stdin)
+    {
+        lseek(STDIN_FILENO, pos, SEEK_SET);
+    }
+    return line;
+}
+
+/**
+ * @brief Moves unconsumed bytes to the front of the stream buffer and
+ *        grows it until more bytes fit after them.
+ *
+ * @param more How many bytes are about to be added.
+ * @return none
+ */
+static void make_room(size_t more)
+{
+    memmove(buf, buf + pos, buf_size - pos);
+    buf_size -= pos;
+    pos = 0;
+    while (buf_size + more + 1 > capacity)
+    {
+        char *bigger = realloc(buf, capacity * 2);
+        if (!bigger)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        buf = bigger;
+        capacity *= 2;
+    }
+}
+
+/**
+ * @brief Queues a line the line editor finished, for read_line().
+ *
+ * @param text The line, without a newline.
+ * @param len  Its length.
+ * @return none
+ */
+void input_push_line(const char *text, size_t len)
+{
+    make_room(len + 1);
+    memcpy(buf + buf_size, text, len);
+    buf[buf_size + len] = '\n';
+    buf_size += len + 1;
+}
+
+/**
+ * @brief Marks the end of terminal input, as the line editor saw it.
+ *
+ * @param none
+ * @return none
+ */
+void input_push_eof(void)
+{
+    at_eof = 1;
+}
+
+/**
+ * @brief Returns the next line from a pipe or the terminal, reading a
+ *        block when needed.
+ *
+ * Unconsumed bytes are moved to the front of the buffer before reading
+ * more, and the buffer doubles when a single line does not fit.
+ *
+ * @param none
+ * @return The line, or NULL at end of input.
+ */
+static char *next_stream_line(void)
+{
+    for (;;)
+    {
+        char *nl = memchr(buf + pos, '\n', buf_size - pos);
+        if (nl != NULL)
+        {
+            char *line = buf + pos;
+            *nl = '\0';
+            pos = nl - buf + 1;
+            return line;
+        }
+        if (at_eof)
+        {
+            if (pos >= buf_size)
+            {
+                return NULL;
+            }
+            buf[buf_size] = '\0';  // capacity always leaves room for this
+            char *line = buf + pos;
+            pos = buf_size;
+            return line;
+        }
+
+        // Compact, grow if a single line fills the buffer, then refill
+        make_room(1);
+
+        ssize_t n = read(input_fd, buf + buf_size, capacity - buf_size - 1);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("dragonshell: read");
+            exit(EXIT_FAILURE);
+        }
+        if (n == 0)
+        {
+            at_eof = 1;
+        }
+        buf_size += n;
+    }
+}
+
+/**
+ * @brief Reads the next command line from the current source.
+ *
+ * The returned line, without its newline, belongs to the input module
+ * and stays valid until the next call; the caller must not free it. On
+ * read error, it prints
+ * an error message with perror and exits with failure status
+ * (EXIT_FAILURE).
+ *
+ * @param void
+ * @return A pointer to the line, or NULL at end of input.
+ */
+char *read_line(void)
+{
+    if (mode == INPUT_MAPPED || mode == INPUT_STRING)
+    {
+        return next_buffered_line();
+    }
+    return next_stream_line();
+}
@@ -0,0 +1,26 @@
+/****************************************************************************
+
+  @file         input.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Line sources for the shell: the interactive terminal, a
+                script file, a pipe, or the string given to -c.
+
+*******************************************************************************/
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+void input_open_stdin(void);
+int input_open_file(const char *path);
+void input_open_string(const char *text);
+int input_is_interactive(void);
+int input_has_line(void);
+char *read_line(void);
+void input_push_line(const char *text, size_t len);
+void input_push_eof(void);
+
+#endif
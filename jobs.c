@@ -0,0 +1,1274 @@
+/****************************************************************************
+
+  @file         jobs.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Job table, SIGCHLD reaper and the jobs/fg/bg/wait builtins.
+
+                Every command the shell starts is a job. A SIGCHLD handler
+                reaps children with wait4(WNOHANG) in a loop and records
+                their status and resource usage in the table; foreground
+                waits sleep in
+                sigsuspend() until their job changes state. The table is
+                only modified with SIGCHLD blocked, so the handler never
+                sees it half-updated. At the prompt the event loop reaps
+                instead: each background process has a pidfd in its epoll
+                set, and SIGCHLD arrives through a signalfd.
+
+                An interactive shell does job control: it leads a process
+                group of its own, every pipeline gets another, and the
+                terminal is handed to a foreground job's group for as long
+                as it runs. Ctrl-C and Ctrl-Z then reach only that job, a
+                stopped job keeps its terminal modes for fg, and the shell
+                gets the terminal (and its own modes) back afterwards.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "jobs.h"
+#include "usage.h"
+#include "events.h"
+
+#define JOBS_INITIAL_SLOTS 16
+
+volatile sig_atomic_t foreground_pgid = 0;  // own-group job run by fg, for the signal handlers
+int pipefail = 0;                           // "set -o pipefail": any failing stage fails the job
+int job_control = 0;                        // pipelines get process groups and the terminal
+volatile sig_atomic_t interrupted = 0;      // Ctrl-C: the rest of the command line is skipped
+
+static struct job **table = NULL;
+static int table_cap = 0;
+static struct job *current_job = NULL;      // the job "%%" and a bare fg/bg refer to
+static struct rusage children_usage;        // every child reaped so far
+static int watch_fd = -1;                   // epoll set for background pidfds
+static pid_t shell_pgid = 0;                // with job control: the shell's own group
+static pid_t original_pgid = 0;             // the terminal's group when the shell started
+static struct termios shell_tmodes;         // the terminal's modes at the prompt
+
+/**
+ * @brief Reads CLOCK_MONOTONIC, which is async-signal-safe, so the
+ *        SIGCHLD handler can stamp a process's end.
+ *
+ * @param none
+ * @return Nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Recomputes a job's state from its processes.
+ *
+ * @param j The job.
+ * @return none
+ */
+static void update_state(struct job *j)
+{
+    enum job_state old = j->state;
+
+    if (j->ndone == j->nprocs)
+    {
+        j->state = JOB_DONE;
+    }
+    else if (j->nstopped > 0 && j->nstopped + j->ndone == j->nprocs)
+    {
+        j->state = JOB_STOPPED;
+    }
+    else
+    {
+        j->state = JOB_RUNNING;
+    }
+
+    if (j->state != old && j->background)
+    {
+        j->notify = 1;
+    }
+}
+
+/**
+ * @brief Records a wait status reported for pid.
+ *
+ * When the child has terminated, its resource usage is added to its
+ * job and to the shell's total for all children.
+ *
+ * @param pid    The child that changed state.
+ * @param status Its wait status.
+ * @param ru     The child's usage, as returned by wait4().
+ * @return none
+ */
+static void record_status(pid_t pid, int status, const struct rusage *ru)
+{
+    for (int i = 0; i < table_cap; i++)
+    {
+        struct job *j = table[i];
+        if (j == NULL || !j->in_use)
+        {
+            continue;
+        }
+        for (int k = 0; k < j->nprocs; k++)
+        {
+            struct process *p = &j->procs[k];
+            if (p->pid != pid || p->done)
+            {
+                continue;
+            }
+
+            if (WIFSTOPPED(status))
+            {
+                if (!p->stopped)
+                {
+                    p->stopped = 1;
+                    j->nstopped++;
+                }
+            }
+            else if (WIFCONTINUED(status))
+            {
+                if (p->stopped)
+                {
+                    p->stopped = 0;
+                    j->nstopped--;
+                }
+            }
+            else
+            {
+                if (p->stopped)
+                {
+                    p->stopped = 0;
+                    j->nstopped--;
+                }
+                p->status = status;
+                p->done = 1;
+                p->end_ns = monotonic_ns();
+                if (p->pidfd != -1)
+                {
+                    close(p->pidfd);    // also leaves the epoll set
+                    p->pidfd = -1;
+                }
+                j->ndone++;
+                usage_add(&j->usage, ru);
+            }
+            update_state(j);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Collects one child that has changed state.
+ *
+ * wait4() is async-signal-safe and, unlike getrusage(RUSAGE_CHILDREN),
+ * reports each child's own usage, which is added to the shell's total
+ * when the child has terminated.
+ *
+ * @param which The child to wait for, or -1 for any.
+ * @param flags Options for wait4().
+ * @return The child's pid, 0 if none was ready (WNOHANG), -1 on error.
+ */
+static pid_t reap_child(pid_t which, int flags)
+{
+    int status;
+    struct rusage ru;
+    pid_t pid = wait4(which, &status, flags, &ru);
+
+    if (pid > 0)
+    {
+        if (!WIFSTOPPED(status) && !WIFCONTINUED(status))
+        {
+            usage_add(&children_usage, &ru);
+        }
+        record_status(pid, status, &ru);
+    }
+    return pid;
+}
+
+/**
+ * @brief Collects every child that has changed state.
+ *
+ * Runs from the SIGCHLD handler.
+ *
+ * @param sig The signal number received (SIGCHLD).
+ * @return none
+ */
+static void sigchld_handler(int sig)
+{
+    int saved_errno = errno;
+
+    while (reap_child(-1, WNOHANG | WUNTRACED | WCONTINUED) > 0)
+    {
+        // keep going until no child has anything left to report
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief Installs the SIGCHLD reaper.
+ *
+ * SA_RESTART keeps a reap from interrupting the shell's own reads.
+ *
+ * @param none
+ * @return none
+ */
+void jobs_init(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+/**
+ * @brief Makes a process group the terminal's foreground group.
+ *
+ * SIGTTOU is blocked meanwhile, so the call also succeeds from a group
+ * that is not in the foreground (the shell taking the terminal back, or
+ * a child handing it to its own new group).
+ *
+ * @param pgid The group.
+ * @return none
+ */
+static void terminal_to(pid_t pgid)
+{
+    sigset_t set, old;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    tcsetpgrp(STDIN_FILENO, pgid);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/**
+ * @brief Turns on job control for an interactive shell: waits until the
+ *        shell is in the foreground of its terminal, then puts it in a
+ *        process group of its own and takes the terminal.
+ *
+ * @param none
+ * @return none
+ */
+void jobs_control_init(void)
+{
+    pid_t fg, pgid;
+
+    // Started in the background: stop until brought to the foreground
+    while ((fg = tcgetpgrp(STDIN_FILENO)) != -1 && fg != (pgid = getpgrp()))
+    {
+        kill(-pgid, SIGTTIN);
+    }
+    if (fg == -1)
+    {
+        return;     // not our controlling terminal
+    }
+
+    original_pgid = pgid;
+    shell_pgid = getpid();
+    if (pgid != shell_pgid && setpgid(0, shell_pgid) == -1)
+    {
+        perror("dragonshell: setpgid");
+        return;
+    }
+    terminal_to(shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+    job_control = 1;
+}
+
+/**
+ * @brief Gives the terminal back to the group that had it when the shell
+ *        started. Used when the shell exits.
+ *
+ * @param none
+ * @return none
+ */
+void jobs_control_end(void)
+{
+    if (job_control && original_pgid != shell_pgid)
+    {
+        terminal_to(original_pgid);
+    }
+}
+
+/**
+ * @brief Gives the table an epoll set to add a pidfd to for every
+ *        background process, tagged EVENT_CHILD with its pid.
+ *
+ * @param epoll_fd The event loop's epoll set.
+ * @return none
+ */
+void jobs_watch(int epoll_fd)
+{
+    watch_fd = epoll_fd;
+}
+
+/**
+ * @brief Collects every child that has changed state, outside a signal
+ *        handler: the event loop's response to SIGCHLD from its signalfd.
+ *
+ * @param none
+ * @return none
+ */
+void jobs_reap_pending(void)
+{
+    sigchld_handler(SIGCHLD);
+}
+
+/**
+ * @brief Collects one background process whose pidfd became readable.
+ *
+ * @param pid The process.
+ * @return none
+ */
+void jobs_reap_pid(pid_t pid)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    reap_child(pid, WNOHANG);
+    jobs_unblock(&old);
+}
+
+/**
+ * @brief Tells whether a background job changed state and has not been
+ *        reported yet.
+ *
+ * @param none
+ * @return 1 if jobs_notify() has something to print, 0 otherwise.
+ */
+int jobs_have_news(void)
+{
+    for (int i = 0; i < table_cap; i++)
+    {
+        if (table[i] != NULL && table[i]->in_use && table[i]->notify)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Blocks SIGCHLD, saving the previous signal mask.
+ *
+ * Callers hold the block from job_create() until every process of the
+ * job has been added, so a child that exits at once is not reaped before
+ * the table knows about it. Children must restore *old before exec.
+ *
+ * @param old Receives the previous mask.
+ * @return none
+ */
+void jobs_block(sigset_t *old)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, old);
+}
+
+/**
+ * @brief Restores the signal mask saved by jobs_block().
+ *
+ * @param old The mask to restore.
+ * @return none
+ */
+void jobs_unblock(const sigset_t *old)
+{
+    sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+/**
+ * @brief Marks a job's slot as free for reuse.
+ *
+ * @param j The job.
+ * @return none
+ */
+static void job_release(struct job *j)
+{
+    j->in_use = 0;
+    if (current_job == j)
+    {
+        current_job = NULL;
+    }
+}
+
+/**
+ * @brief Empties the table in a forked subshell, whose parent's jobs are
+ *        not its children.
+ *
+ * @param none
+ * @return none
+ */
+void jobs_forget(void)
+{
+    for (int i = 0; i < table_cap; i++)
+    {
+        if (table[i] == NULL)
+        {
+            continue;
+        }
+        for (int k = 0; k < table[i]->nprocs; k++)
+        {
+            if (table[i]->in_use && table[i]->procs[k].pidfd != -1)
+            {
+                close(table[i]->procs[k].pidfd);
+            }
+        }
+        table[i]->in_use = 0;
+    }
+    current_job = NULL;
+    watch_fd = -1;
+    job_control = 0;    // a subshell's children stay in its group
+    memset(&children_usage, 0, sizeof(children_usage));
+}
+
+/**
+ * @brief Takes a free slot in the table for a new job.
+ *
+ * The lowest free job number is used and the table doubles when it is
+ * full. Must be called with SIGCHLD blocked.
+ *
+ * @param command    The command line, copied for job listings without
+ *                   its trailing '&'.
+ * @param background Whether the job runs in the background.
+ * @return The job, with no processes yet.
+ */
+struct job *job_create(const char *command, int background)
+{
+    int slot = 0;
+    while (slot < table_cap && table[slot] != NULL && table[slot]->in_use)
+    {
+        slot++;
+    }
+
+    if (slot == table_cap)
+    {
+        int new_cap = table_cap ? table_cap * 2 : JOBS_INITIAL_SLOTS;
+        struct job **bigger = realloc(table, new_cap * sizeof(*bigger));
+        if (!bigger)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(bigger + table_cap, 0, (new_cap - table_cap) * sizeof(*bigger));
+        table = bigger;
+        table_cap = new_cap;
+    }
+    if (table[slot] == NULL)
+    {
+        table[slot] = calloc(1, sizeof(struct job));
+        if (!table[slot])
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct job *j = table[slot];
+    size_t len = strlen(command);
+    while (len > 0 && strchr(" \t\r\n&", command[len - 1]) != NULL)
+    {
+        len--;  // listings add " &" back while the job runs in the background
+    }
+    if (len + 1 > j->command_cap)
+    {
+        char *bigger = realloc(j->command, len + 1);
+        if (!bigger)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        j->command = bigger;
+        j->command_cap = len + 1;
+    }
+    memcpy(j->command, command, len);
+    j->command[len] = '\0';
+
+    j->id = slot + 1;
+    j->in_use = 1;
+    j->grouped = background;
+    j->pgid = 0;
+    j->nprocs = 0;
+    j->ndone = 0;
+    j->nstopped = 0;
+    j->state = JOB_DONE;
+    j->background = background;
+    j->notify = 0;
+    j->have_tmodes = 0;
+    memset(&j->usage, 0, sizeof(j->usage));
+    return j;
+}
+
+/**
+ * @brief Moves a just-started process of a grouped job into the job's
+ *        process group (the first one founds it) and, for a foreground
+ *        job under job control, gives that group the terminal.
+ *
+ * The parent and the child both call this, whichever runs first, so
+ * the group exists and holds the terminal before either relies on it.
+ * Nothing happens for a job that shares the shell's group.
+ *
+ * @param j   The job, before job_add_process() for this process.
+ * @param pid The child in the parent, or 0 in the child itself.
+ * @return none
+ */
+void job_set_group(const struct job *j, pid_t pid)
+{
+    if (!j->grouped)
+    {
+        return;
+    }
+
+    pid_t pgid = j->pgid != 0 ? j->pgid : pid != 0 ? pid : getpid();
+    setpgid(pid, pgid);
+    if (job_control && !j->background)
+    {
+        terminal_to(pgid);
+    }
+}
+
+/**
+ * @brief Adds a started process to a job.
+ *
+ * The first process of a grouped job leads its process group. Must be
+ * called with SIGCHLD blocked.
+ *
+ * @param j   The job.
+ * @param pid The process id.
+ * @return none
+ */
+void job_add_process(struct job *j, pid_t pid)
+{
+    if (j->nprocs == j->procs_cap)
+    {
+        int new_cap = j->procs_cap ? j->procs_cap * 2 : 4;
+        struct process *bigger = realloc(j->procs, new_cap * sizeof(*bigger));
+        if (!bigger)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        j->procs = bigger;
+        j->procs_cap = new_cap;
+    }
+
+    j->procs[j->nprocs++] = (struct process){pid, 0, 0, 0, -1, monotonic_ns(), 0};
+    if (j->grouped && j->pgid == 0)
+    {
+        j->pgid = pid;
+    }
+    j->state = JOB_RUNNING;  // nothing is reaped while SIGCHLD is blocked
+}
+
+/**
+ * @brief Converts a process's wait status to a shell exit status.
+ *
+ * @param p The process.
+ * @return The exit code, 128 + the signal that killed or stopped it, or 0
+ *         while it is still running.
+ */
+int process_status(const struct process *p)
+{
+    if (p->stopped)
+    {
+        return 128 + SIGTSTP;
+    }
+    if (!p->done)
+    {
+        return 0;
+    }
+    if (WIFEXITED(p->status))
+    {
+        return WEXITSTATUS(p->status);
+    }
+    if (WIFSIGNALED(p->status))
+    {
+        return 128 + WTERMSIG(p->status);
+    }
+    return 0;
+}
+
+/**
+ * @brief Converts a job's wait statuses to a shell exit status: the last
+ *        process's, or with pipefail the last one that failed.
+ *
+ * @param j The job.
+ * @return The exit code, or 128 + the signal that killed or stopped it.
+ */
+static int job_status(const struct job *j)
+{
+    if (j->nprocs == 0)
+    {
+        return 127;
+    }
+
+    const struct process *p = &j->procs[j->nprocs - 1];
+    if (j->state == JOB_STOPPED && p->stopped)
+    {
+        return 128 + SIGTSTP;
+    }
+    for (int k = j->nprocs - 1; pipefail && k > 0 && process_status(p) == 0; k--)
+    {
+        p = &j->procs[k - 1];
+    }
+    return process_status(p);
+}
+
+/**
+ * @brief Describes a job's state the way the jobs builtin prints it.
+ *
+ * @param j The job.
+ * @return A static or constant string.
+ */
+static const char *state_name(const struct job *j)
+{
+    static char buf[32];
+
+    if (j->state == JOB_RUNNING)
+    {
+        return "Running";
+    }
+    if (j->state == JOB_STOPPED)
+    {
+        return "Stopped";
+    }
+
+    int status = j->procs[j->nprocs - 1].status;
+    if (WIFSIGNALED(status))
+    {
+        return strsignal(WTERMSIG(status));
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    {
+        snprintf(buf, sizeof(buf), "Exit %d", WEXITSTATUS(status));
+        return buf;
+    }
+    return "Done";
+}
+
+/**
+ * @brief Prints one line for a job, e.g. "[1]+  Running   sleep 10 &".
+ *
+ * @param j       The job.
+ * @param verbose Also print the process ids.
+ * @return none
+ */
+static void print_job(const struct job *j, int verbose)
+{
+    printf("[%d]%c  ", j->id, j == current_job ? '+' : ' ');
+    if (verbose)
+    {
+        for (int k = 0; k < j->nprocs; k++)
+        {
+            printf("%d ", j->procs[k].pid);
+        }
+    }
+    printf("%-24s%s%s\n", state_name(j), j->command,
+           j->background && j->state == JOB_RUNNING ? " &" : "");
+}
+
+/**
+ * @brief Sends a signal to every process of a job.
+ *
+ * @param j   The job.
+ * @param sig The signal.
+ * @return none
+ */
+static void signal_job(struct job *j, int sig)
+{
+    if (j->pgid != 0)
+    {
+        kill(-j->pgid, sig);
+        return;
+    }
+    for (int k = 0; k < j->nprocs; k++)
+    {
+        if (!j->procs[k].done)
+        {
+            kill(j->procs[k].pid, sig);
+        }
+    }
+}
+
+/**
+ * @brief Takes the terminal back from a foreground job that finished or
+ *        stopped.
+ *
+ * A stopped job's terminal modes are kept for fg and the shell's are put
+ * back, as they are after a job killed by a signal; a job that exited
+ * normally may have changed them on purpose (stty), so the shell keeps
+ * what it left.
+ *
+ * @param j The job.
+ * @return none
+ */
+static void take_terminal(struct job *j)
+{
+    terminal_to(shell_pgid);
+    if (j->state == JOB_STOPPED)
+    {
+        j->have_tmodes = tcgetattr(STDIN_FILENO, &j->tmodes) == 0;
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+    else if (WIFSIGNALED(j->procs[j->nprocs - 1].status))
+    {
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+    else
+    {
+        tcgetattr(STDIN_FILENO, &shell_tmodes);
+    }
+}
+
+/**
+ * @brief Tells the user that a foreground job was killed by a signal,
+ *        e.g. "Killed" or "Segmentation fault (core dumped)".
+ *
+ * Ctrl-C only ends the line the terminal echoed "^C" on, so the prompt
+ * starts on a fresh one; a broken pipe is not worth a word.
+ *
+ * @param j The finished job.
+ * @return none
+ */
+static void report_signal(const struct job *j)
+{
+    int status = j->procs[j->nprocs - 1].status;
+
+    if (!WIFSIGNALED(status) || WTERMSIG(status) == SIGPIPE)
+    {
+        return;
+    }
+    fflush(stdout);
+    if (WTERMSIG(status) == SIGINT)
+    {
+        fputc('\n', stderr);
+    }
+    else
+    {
+        fprintf(stderr, "%s%s\n", strsignal(WTERMSIG(status)),
+                WCOREDUMP(status) ? " (core dumped)" : "");
+    }
+}
+
+/**
+ * @brief Waits for a foreground job to finish or stop.
+ *
+ * A finished job's slot is released; a stopped one is reported and
+ * becomes the current job, ready for fg or bg. Under job control the
+ * job's group has the terminal until then.
+ *
+ * @param j     The job.
+ * @param usage If not NULL, receives the usage of the job's processes
+ *              that have exited.
+ * @param procs If not NULL, receives a copy of the job's processes, in
+ *              the order they were added, with their statuses and times.
+ * @return The job's exit status.
+ */
+int job_wait(struct job *j, struct rusage *usage, struct process *procs)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    if (j->pgid != 0)
+    {
+        foreground_pgid = j->pgid;
+        if (job_control)
+        {
+            terminal_to(j->pgid);
+        }
+    }
+    while (j->state == JOB_RUNNING)
+    {
+        sigsuspend(&old);
+    }
+    foreground_pgid = 0;
+    if (job_control && j->pgid != 0)
+    {
+        take_terminal(j);
+        if (j->state == JOB_DONE)
+        {
+            report_signal(j);
+        }
+    }
+
+    int status = job_status(j);
+    if (j->nprocs > 0 && j->state == JOB_DONE && WIFSIGNALED(j->procs[j->nprocs - 1].status) &&
+        WTERMSIG(j->procs[j->nprocs - 1].status) == SIGINT)
+    {
+        interrupted = 1;    // a loop around the job stops too, as in sh
+    }
+    if (usage != NULL)
+    {
+        *usage = j->usage;
+    }
+    if (procs != NULL)
+    {
+        memcpy(procs, j->procs, j->nprocs * sizeof(*procs));
+    }
+    if (j->state == JOB_STOPPED)
+    {
+        j->background = 1;
+        j->notify = 0;
+        current_job = j;
+        printf("\n");
+        print_job(j, 0);
+    }
+    else
+    {
+        job_release(j);
+    }
+    jobs_unblock(&old);
+    return status;
+}
+
+/**
+ * @brief Announces a job that was started in the background, and has the
+ *        event loop watch its processes.
+ *
+ * @param j The job.
+ * @return none
+ */
+void job_launched(struct job *j)
+{
+    if (j->nprocs == 0)
+    {
+        job_release(j);
+        return;
+    }
+
+    sigset_t old;
+    jobs_block(&old);   // a process must not be reaped until its pidfd is open
+    for (int k = 0; k < j->nprocs && watch_fd != -1; k++)
+    {
+        struct process *p = &j->procs[k];
+        if (p->done)
+        {
+            continue;
+        }
+        p->pidfd = syscall(SYS_pidfd_open, p->pid, 0);
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EVENT_DATA(EVENT_CHILD, p->pid)};
+        if (p->pidfd != -1 && epoll_ctl(watch_fd, EPOLL_CTL_ADD, p->pidfd, &ev) == -1)
+        {
+            close(p->pidfd);
+            p->pidfd = -1;
+        }
+    }
+    jobs_unblock(&old);
+    current_job = j;
+    printf("[%d] PID %d is sent to background\n", j->id, j->procs[j->nprocs - 1].pid);
+}
+
+/**
+ * @brief Reports background jobs that finished or stopped since the
+ *        last prompt, and frees the slots of finished ones.
+ *
+ * @param interactive Print the reports (scripts only clean up).
+ * @return none
+ */
+void jobs_notify(int interactive)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    for (int i = 0; i < table_cap; i++)
+    {
+        struct job *j = table[i];
+        if (j == NULL || !j->in_use || !j->notify)
+        {
+            continue;
+        }
+        if (interactive)
+        {
+            print_job(j, 0);
+        }
+        j->notify = 0;
+        if (j->state == JOB_DONE)
+        {
+            job_release(j);
+        }
+    }
+    jobs_unblock(&old);
+}
+
+/**
+ * @brief Sends SIGTERM to every job, and SIGCONT to stopped ones so they
+ *        can act on it. Used when the shell exits.
+ *
+ * @param none
+ * @return none
+ */
+void jobs_terminate_all(void)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    for (int i = 0; i < table_cap; i++)
+    {
+        struct job *j = table[i];
+        if (j == NULL || !j->in_use || j->state == JOB_DONE)
+        {
+            continue;
+        }
+        signal_job(j, SIGTERM);
+        if (j->state == JOB_STOPPED)
+        {
+            signal_job(j, SIGCONT);
+        }
+    }
+    jobs_unblock(&old);
+}
+
+/**
+ * @brief Sleeps until any child changes state and records it.
+ *
+ * Lets a builtin that keeps many children in flight use one wait4(-1)
+ * loop instead of waiting on each job. The caller must hold SIGCHLD
+ * blocked so that the handler does not take the child first.
+ *
+ * @param none
+ * @return The child's pid, or -1 when there are no children left.
+ */
+pid_t jobs_reap_any(void)
+{
+    pid_t pid;
+
+    do
+    {
+        pid = reap_child(-1, WUNTRACED);
+    } while (pid == -1 && errno == EINTR);
+    return pid;
+}
+
+/**
+ * @brief Releases a finished job that nobody will wait for with job_wait().
+ *
+ * @param j The job, in state JOB_DONE.
+ * @return The job's exit status.
+ */
+int job_finish(struct job *j)
+{
+    int status = job_status(j);
+    job_release(j);
+    return status;
+}
+
+/**
+ * @brief Copies the accumulated usage of every child reaped so far.
+ *
+ * @param usage Receives the totals.
+ * @return none
+ */
+void jobs_children_usage(struct rusage *usage)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    *usage = children_usage;
+    jobs_unblock(&old);
+}
+
+/**
+ * @brief Picks the job that a bare fg/bg or "%%" means.
+ *
+ * @param none
+ * @return The current job, else the newest unfinished one, else NULL.
+ */
+static struct job *default_job(void)
+{
+    if (current_job != NULL && current_job->in_use && current_job->state != JOB_DONE)
+    {
+        return current_job;
+    }
+    for (int i = table_cap - 1; i >= 0; i--)
+    {
+        if (table[i] != NULL && table[i]->in_use && table[i]->state != JOB_DONE)
+        {
+            return table[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Resolves a job specification: %n, n, %%, %+ or nothing.
+ *
+ * Prints an error naming the builtin when there is no such job.
+ *
+ * @param spec    The argument, or NULL for the current job.
+ * @param builtin The builtin's name, for the error message.
+ * @return The job, or NULL.
+ */
+static struct job *find_job(const char *spec, const char *builtin)
+{
+    struct job *j = NULL;
+
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 ||
+        strcmp(spec, "%") == 0)
+    {
+        j = default_job();
+        if (j == NULL)
+        {
+            fprintf(stderr, "dragonshell: %s: current: no such job\n", builtin);
+        }
+        return j;
+    }
+
+    char *end;
+    long id = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+    if (*end == '\0' && id >= 1 && id <= table_cap && table[id - 1] != NULL &&
+        table[id - 1]->in_use)
+    {
+        j = table[id - 1];
+    }
+    if (j == NULL)
+    {
+        fprintf(stderr, "dragonshell: %s: %s: no such job\n", builtin, spec);
+    }
+    return j;
+}
+
+/**
+ * @brief Resumes a stopped job's processes.
+ *
+ * The state is set to running before SIGCONT is sent, so a wait that
+ * follows does not return on the stale stopped state.
+ *
+ * @param j The job.
+ * @return none
+ */
+static void continue_job(struct job *j)
+{
+    for (int k = 0; k < j->nprocs; k++)
+    {
+        j->procs[k].stopped = 0;
+    }
+    j->nstopped = 0;
+    j->state = j->ndone == j->nprocs ? JOB_DONE : JOB_RUNNING;
+    j->notify = 0;
+    signal_job(j, SIGCONT);
+}
+
+/**
+ * @brief The "jobs" builtin: lists jobs; -l adds pids, -p prints only
+ *        the process group (or first pid) of each job.
+ *
+ * Finished jobs are listed once more and then forgotten.
+ *
+ * @param args The argument vector, args[0] being "jobs".
+ * @return 0
+ */
+int jobs_builtin(char **args)
+{
+    int verbose = args[1] != NULL && strcmp(args[1], "-l") == 0;
+    int pids_only = args[1] != NULL && strcmp(args[1], "-p") == 0;
+    sigset_t old;
+
+    jobs_block(&old);
+    for (int i = 0; i < table_cap; i++)
+    {
+        struct job *j = table[i];
+        if (j == NULL || !j->in_use || !j->background)
+        {
+            continue;
+        }
+        if (pids_only)
+        {
+            printf("%d\n", j->pgid ? j->pgid : j->procs[0].pid);
+        }
+        else
+        {
+            print_job(j, verbose);
+        }
+        j->notify = 0;
+        if (j->state == JOB_DONE)
+        {
+            job_release(j);
+        }
+    }
+    jobs_unblock(&old);
+    return 0;
+}
+
+/**
+ * @brief The "fg" builtin: moves a job to the foreground, continuing it
+ *        if it was stopped, and waits for it.
+ *
+ * @param args The argument vector; args[1] is an optional job spec.
+ * @return The job's exit status, or 1 if there is no such job.
+ */
+int fg_builtin(char **args)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    struct job *j = find_job(args[1], "fg");
+    if (j == NULL)
+    {
+        jobs_unblock(&old);
+        return 1;
+    }
+    printf("%s\n", j->command);
+    fflush(stdout);
+    j->background = 0;
+    if (job_control && j->pgid != 0)
+    {
+        // Its modes go back while the shell still has the terminal
+        if (j->have_tmodes)
+        {
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &j->tmodes);
+        }
+        terminal_to(j->pgid);
+    }
+    if (j->state == JOB_STOPPED)
+    {
+        continue_job(j);
+    }
+    jobs_unblock(&old);
+    return job_wait(j, NULL, NULL);
+}
+
+/**
+ * @brief The "bg" builtin: continues a stopped job in the background.
+ *
+ * @param args The argument vector; args[1] is an optional job spec.
+ * @return 0, or 1 if there is no such job.
+ */
+int bg_builtin(char **args)
+{
+    sigset_t old;
+
+    jobs_block(&old);
+    struct job *j = find_job(args[1], "bg");
+    if (j == NULL)
+    {
+        jobs_unblock(&old);
+        return 1;
+    }
+    if (j->state == JOB_STOPPED)
+    {
+        j->background = 1;
+        current_job = j;
+        continue_job(j);
+        printf("[%d]+ %s &\n", j->id, j->command);
+    }
+    else
+    {
+        fprintf(stderr, "dragonshell: bg: job %d already in background\n", j->id);
+    }
+    jobs_unblock(&old);
+    return 0;
+}
+
+/**
+ * @brief Finds the job a pid belongs to.
+ *
+ * @param pid The process id.
+ * @return The job, or NULL.
+ */
+static struct job *find_job_by_pid(pid_t pid)
+{
+    for (int i = 0; i < table_cap; i++)
+    {
+        struct job *j = table[i];
+        if (j == NULL || !j->in_use)
+        {
+            continue;
+        }
+        for (int k = 0; k < j->nprocs; k++)
+        {
+            if (j->procs[k].pid == pid)
+            {
+                return j;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief The "wait" builtin: waits for the given jobs or pids, or for
+ *        every background job when there are no arguments.
+ *
+ * Jobs that are waited for are removed from the table without a "Done"
+ * report.
+ *
+ * @param args The argument vector, args[0] being "wait".
+ * @return The status of the last job waited for (0 with no arguments),
+ *         or 127 if an argument is not a job of this shell.
+ */
+int wait_builtin(char **args)
+{
+    sigset_t old;
+    int status = 0;
+
+    jobs_block(&old);
+    if (args[1] == NULL)
+    {
+        for (int i = 0; i < table_cap; i++)
+        {
+            struct job *j = table[i];
+            while (j != NULL && j->in_use && j->background && j->state == JOB_RUNNING)
+            {
+                sigsuspend(&old);
+            }
+            if (j != NULL && j->in_use && j->state == JOB_DONE)
+            {
+                job_release(j);
+            }
+        }
+        jobs_unblock(&old);
+        return 0;
+    }
+
+    for (int i = 1; args[i] != NULL; i++)
+    {
+        struct job *j;
+        if (args[i][0] == '%')
+        {
+            j = find_job(args[i], "wait");
+        }
+        else
+        {
+            j = find_job_by_pid(atoi(args[i]));
+            if (j == NULL)
+            {
+                fprintf(stderr, "dragonshell: wait: pid %s is not a child of this shell\n",
+                        args[i]);
+            }
+        }
+        if (j == NULL)
+        {
+            status = 127;
+            continue;
+        }
+
+        while (j->state == JOB_RUNNING)
+        {
+            sigsuspend(&old);
+        }
+        status = job_status(j);
+        if (j->state == JOB_DONE)
+        {
+            job_release(j);
+        }
+    }
+    jobs_unblock(&old);
+    return status;
+}
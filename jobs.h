@@ -0,0 +1,99 @@
+/****************************************************************************
+
+  @file         jobs.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Job table: every pipeline or command the shell starts, with
+                its processes, process group and state.
+
+*******************************************************************************/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <stdint.h>
+#include <termios.h>
+
+enum job_state
+{
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+};
+
+/**
+ * One process of a job and the wait status it last reported.
+ */
+struct process
+{
+    pid_t pid;
+    int status;
+    int done;
+    int stopped;
+    int pidfd;          // -1 unless the event loop watches this process
+    uint64_t start_ns;  // CLOCK_MONOTONIC when it joined the job
+    uint64_t end_ns;    // and when it was reaped, once done
+};
+
+/**
+ * A job. Slots of the table are never freed, only marked unused, so the
+ * process array and command buffer of a finished job are reused by the
+ * next one.
+ */
+struct job
+{
+    int id;                   // job number, as in %1
+    int in_use;
+    int grouped;              // the processes get a group of their own
+    pid_t pgid;               // 0 while the job shares the shell's group
+    struct process *procs;
+    int nprocs;
+    int procs_cap;
+    int ndone;                // processes that have terminated
+    int nstopped;             // processes currently stopped
+    struct rusage usage;      // summed over the processes that have exited
+    enum job_state state;
+    int background;
+    int notify;               // state changed and the user has not been told
+    char *command;            // command line, for listings
+    size_t command_cap;
+    struct termios tmodes;    // the terminal's modes when the job stopped
+    int have_tmodes;
+};
+
+extern volatile sig_atomic_t foreground_pgid;
+extern int pipefail;
+extern int job_control;
+extern volatile sig_atomic_t interrupted;
+
+void jobs_init(void);
+void jobs_control_init(void);
+void jobs_control_end(void);
+void jobs_watch(int epoll_fd);
+void jobs_reap_pending(void);
+void jobs_reap_pid(pid_t pid);
+int jobs_have_news(void);
+void jobs_block(sigset_t *old);
+void jobs_unblock(const sigset_t *old);
+void jobs_forget(void);
+struct job *job_create(const char *command, int background);
+void job_set_group(const struct job *j, pid_t pid);
+void job_add_process(struct job *j, pid_t pid);
+int job_wait(struct job *j, struct rusage *usage, struct process *procs);
+int process_status(const struct process *p);
+int job_finish(struct job *j);
+pid_t jobs_reap_any(void);
+void job_launched(struct job *j);
+void jobs_notify(int interactive);
+void jobs_terminate_all(void);
+void jobs_children_usage(struct rusage *usage);
+int jobs_builtin(char **args);
+int fg_builtin(char **args);
+int bg_builtin(char **args);
+int wait_builtin(char **args);
+
+#endif
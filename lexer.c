@@ -0,0 +1,589 @@
+/****************************************************************************
+
+  @file         lexer.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Splits a command line into words and operators.
+
+                Unlike strtok() on LSH_TOK_DELIM, the lexer understands
+                quoting: '...' is taken literally, "..." keeps its blanks
+                and allows \" \\ \$ and \` escapes, and an unquoted
+                backslash escapes the next character. An unquoted '#' at
+                the start of a word begins a comment. Operators are matched
+                longest first, so ">>", ">&" and "<<<" come out as single
+                tokens; "<(" and ">(" open a process substitution, which the
+                parser reads up to its ')'. Parameter references ("$HOME",
+                "${x}", "$?") are not expanded here, since a lexed line may
+                be cached and run again; they are marked in the word, with
+                whether they were quoted, for expand.c to fill in when it
+                runs; so is "$((expression))", whose text is kept as
+                written for arith.c, and "$(command)" or "`command`",
+                whose text cmdsub.c parses and runs. So are unquoted '*', '?' and '[',
+                which make the word a pathname pattern. A command that
+                runs over several lines (an unfinished "if" or loop) is
+                lexed as one text, in which a newline is a token of its
+                own and a comment ends at the end of its line.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "shell.h"
+#include "lexer.h"
+#include "vars.h"
+
+int lex_unfinished;
+
+// Operators grouped by their first byte, longest spelling first in each
+// group, so "&>>" is not read as "&" ">>"
+static const struct
+{
+    const char *spelling;
+    int len;
+    enum token_type type;
+} operators[] = {
+    {"&>>", 3, TOK_ANDDGREAT}, {"&&", 2, TOK_AND_IF}, {"&>", 2, TOK_ANDGREAT}, {"&", 1, TOK_AMP},
+    {"<<<", 3, TOK_TLESS}, {"<<-", 3, TOK_DLESSDASH}, {"<<", 2, TOK_DLESS},
+    {"<&", 2, TOK_LESSAND}, {"<(", 2, TOK_PROCSUB_IN}, {"<", 1, TOK_LESS},
+    {">>", 2, TOK_DGREAT}, {">&", 2, TOK_GREATAND}, {">(", 2, TOK_PROCSUB_OUT}, {">", 1, TOK_GREAT},
+    {"||", 2, TOK_OR_IF}, {"|", 1, TOK_PIPE},
+    {";", 1, TOK_SEMI}, {"(", 1, TOK_LPAREN}, {")", 1, TOK_RPAREN},
+};
+
+// Bytes that end an unquoted word: the end of the text, LSH_TOK_DELIM
+// and the first byte of every operator
+static const unsigned char ends_word[256] = {
+    ['\0'] = 1, [' '] = 1, ['\t'] = 1, ['\r'] = 1, ['\n'] = 1, ['\a'] = 1,
+    ['&'] = 1, ['<'] = 1, ['>'] = 1, ['|'] = 1, [';'] = 1, ['('] = 1, [')'] = 1,
+};
+
+/**
+ * @brief Recognizes an unquoted operator.
+ *
+ * Called once per token rather than once per byte: inside a word,
+ * ends_word[] tells where it stops.
+ *
+ * @param p     The text at the current position.
+ * @param token Receives the operator token when p starts with one.
+ * @return The operator's length, or 0 if p does not start with one.
+ */
+static int lex_operator(const char *p, struct token *token)
+{
+    size_t i;
+    switch (*p)
+    {
+    case '&':
+        i = 0;
+        break;
+    case '<':
+        i = 4;
+        break;
+    case '>':
+        i = 10;
+        break;
+    case '|':
+        i = 14;
+        break;
+    case ';':
+        i = 16;
+        break;
+    case '(':
+        i = 17;
+        break;
+    case ')':
+        i = 18;
+        break;
+    default:
+        return 0;
+    }
+
+    // Every group ends with the one-byte spelling, which always matches
+    for (; strncmp(p, operators[i].spelling, operators[i].len) != 0; i++)
+    {
+    }
+    *token = (struct token){operators[i].type, (char *)operators[i].spelling, 0, 0, 0, 0, 0};
+    return operators[i].len;
+}
+
+/**
+ * @brief Finds where a "[n]", "[@]" or "[*]" subscript starts in the
+ *        name of a "${name[n]}" reference.
+ *
+ * @param name The text between the braces.
+ * @param len  Its length.
+ * @return The length of the name before the subscript, or len if there
+ *         is none (or it is not a number, '@' or '*', so the name is
+ *         rejected).
+ */
+static size_t subscript_start(const char *name, size_t len)
+{
+    const char *open = memchr(name, '[', len);
+    if (open == NULL || len < 3 || name[len - 1] != ']')
+    {
+        return len;
+    }
+
+    size_t at = open - name;
+    size_t digits = strspn(open + 1, "0123456789");
+    int all = len - at == 3 && (open[1] == '@' || open[1] == '*');
+    return all || (digits > 0 && at + digits + 2 == len) ? at : len;
+}
+
+/**
+ * @brief Finds the end of a "$((expression))".
+ *
+ * @param p The text just after "$((".
+ * @return The length of the expression, up to the "))" that closes it,
+ *         or -1 if there is none.
+ */
+static int arith_length(const char *p)
+{
+    int depth = 0;
+    for (int i = 0; p[i] != '\0'; i++)
+    {
+        if (p[i] == '(')
+        {
+            depth++;
+        }
+        else if (p[i] == ')' && depth > 0)
+        {
+            depth--;
+        }
+        else if (p[i] == ')')
+        {
+            return p[i + 1] == ')' ? i : -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Finds the end of a "$(command)".
+ *
+ * Parentheses nest, and quotes, escapes, backquotes and comments inside
+ * the command are skipped, so "$(echo ')')" ends at the last ')'.
+ *
+ * @param p The text just after "$(".
+ * @return The length of the command, up to the ')' that closes it, or
+ *         -1 if there is none.
+ */
+static int cmdsub_length(const char *p)
+{
+    int depth = 0;
+    for (int i = 0; p[i] != '\0'; i++)
+    {
+        const char *close;
+        switch (p[i])
+        {
+        case '\\':
+            i += p[i + 1] != '\0';
+            break;
+        case '\'':
+        case '`':
+            close = strchr(p + i + 1, p[i]);
+            while (close != NULL && p[i] == '`' && close[-1] == '\\')
+            {
+                close = strchr(close + 1, '`');
+            }
+            if (close == NULL)
+            {
+                return -1;
+            }
+            i = close - p;
+            break;
+        case '"':
+            for (i++; p[i] != '"'; i++)
+            {
+                if (p[i] == '\0')
+                {
+                    return -1;
+                }
+                i += p[i] == '\\' && p[i + 1] != '\0';
+            }
+            break;
+        case '#':
+            if (i == 0 || strchr(" \t\n(;&|", p[i - 1]) != NULL)
+            {
+                i += strcspn(p + i, "\n") - 1;    // a comment: its ')' does not count
+            }
+            break;
+        case '(':
+            depth++;
+            break;
+        case ')':
+            if (depth == 0)
+            {
+                return i;
+            }
+            depth--;
+            break;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Copies a "`command`" into a word, marked like "$(command)".
+ *
+ * Inside backquotes a backslash only escapes '$', '`' and '\\' (and '"'
+ * inside double quotes); the command's text is stored without those
+ * backslashes.
+ *
+ * @param p      The text at the opening '`'.
+ * @param out    The word being written; advanced past the reference.
+ * @param marker LEX_PARAM outside quotes, LEX_QPARAM inside "double" ones.
+ * @return How much of p was used, or -1 if the closing '`' is missing.
+ */
+static int lex_backquote(const char *p, char **out, char marker)
+{
+    const char *escapes = marker == LEX_QPARAM ? "$`\\\"" : "$`\\";
+    int i = 1;
+
+    *(*out)++ = marker;
+    *(*out)++ = LEX_CMDSUB;
+    for (; p[i] != '`'; i++)
+    {
+        if (p[i] == '\0')
+        {
+            return -1;
+        }
+        if (p[i] == '\\' && p[i + 1] != '\0' && strchr(escapes, p[i + 1]) != NULL)
+        {
+            i++;
+        }
+        *(*out)++ = p[i];
+    }
+    *(*out)++ = LEX_PARAM_END;
+    return i + 1;
+}
+
+/**
+ * @brief Tells whether the text between "${" and "}" names a positional
+ *        or special parameter, as in "${10}" or "${#}".
+ *
+ * @param name The name.
+ * @param len  Its length.
+ * @return 1 if it does, 0 otherwise.
+ */
+static int special_name(const char *name, size_t len)
+{
+    if (len == 1 && strchr("?$#@*", name[0]) != NULL)
+    {
+        return 1;
+    }
+    return len > 0 && strspn(name, "0123456789") >= len;
+}
+
+/**
+ * @brief Copies a parameter reference into a word, marked for expansion.
+ *
+ * "$name", "${name}", "${name[n]}", the positional parameters "$1" and
+ * "${10}", and "$?", "$$", "$#", "$@" and "$*" are stored as a
+ * LEX_PARAM or LEX_QPARAM byte, the name and a LEX_PARAM_END byte, which
+ * expand.c replaces with the value when the command runs. "$((expr))"
+ * is stored the same way with LEX_ARITH and the expression as its name,
+ * and "$(command)" with LEX_CMDSUB and the command's text. A '$' that
+ * does not start a reference is an ordinary character.
+ *
+ * @param p      The text at the '$'.
+ * @param out    The word being written; advanced past the reference.
+ * @param marker LEX_PARAM outside quotes, LEX_QPARAM inside "double" ones.
+ * @return How much of p was used, 0 if it is not a reference, or -1 for
+ *         a "$(" with no ')'.
+ */
+static int lex_parameter(const char *p, char **out, char marker)
+{
+    const char *name = p + 1;
+    size_t len;
+    int used;
+
+    if (name[0] == '(' && name[1] == '(')
+    {
+        int n = arith_length(name + 2);
+        if (n >= 0)
+        {
+            *(*out)++ = marker;
+            *(*out)++ = LEX_ARITH;
+            memcpy(*out, name + 2, n);
+            *out += n;
+            *(*out)++ = LEX_PARAM_END;
+            return n + 5;
+        }
+        // "$((cd /; ls) | wc)" is a command starting with a subshell
+    }
+    if (name[0] == '(')
+    {
+        int n = cmdsub_length(name + 1);
+        if (n < 0)
+        {
+            return -1;
+        }
+        *(*out)++ = marker;
+        *(*out)++ = LEX_CMDSUB;
+        memcpy(*out, name + 1, n);
+        *out += n;
+        *(*out)++ = LEX_PARAM_END;
+        return n + 3;
+    }
+    if ((*name != '\0' && strchr("?$#@*", *name) != NULL) || isdigit((unsigned char)*name))
+    {
+        len = 1;    // "$10" is "${1}0", as in sh
+        used = 2;
+    }
+    else if (*name == '{')
+    {
+        name++;
+        len = strcspn(name, "}");
+        if (name[len] != '}' ||
+            (!var_valid_name(name, subscript_start(name, len)) && !special_name(name, len)))
+        {
+            return 0;
+        }
+        used = len + 3;
+    }
+    else
+    {
+        len = 0;
+        while (isalnum((unsigned char)name[len]) || name[len] == '_')
+        {
+            len++;
+        }
+        if (!var_valid_name(name, len))
+        {
+            return 0;
+        }
+        used = len + 1;
+    }
+
+    *(*out)++ = marker;
+    memcpy(*out, name, len);
+    *out += len;
+    *(*out)++ = LEX_PARAM_END;
+    return used;
+}
+
+/**
+ * @brief Tells whether an unquoted character is a pathname pattern
+ *        character: '*', '?', or a '[' closed by a ']' in the same word.
+ *
+ * @param p The text at the character.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int lex_is_glob(const char *p)
+{
+    if (*p == '*' || *p == '?')
+    {
+        return 1;
+    }
+    return *p == '[' && p[1 + strcspn(p + 1, " \t\r\n\a|&;<>()'\"\\]")] == ']';
+}
+
+/**
+ * @brief Marks the references in a here-document whose delimiter was
+ *        not quoted, for expand.c to fill in when the stage runs.
+ *
+ * The body is read as if it were in double quotes, except that '"' is
+ * an ordinary character: references, "$((expression))", "$(command)"
+ * and "`command`" are marked as quoted ones, so their values are
+ * neither split nor matched as patterns, and a backslash only escapes
+ * '$', '`' and '\\', or removes a newline. A "$(" or '`' that is never
+ * closed is left as written.
+ *
+ * @param a    The arena the result is allocated from.
+ * @param body The document, as read_heredoc() stored it.
+ * @return The marked document.
+ */
+char *lex_heredoc(struct arena *a, const char *body)
+{
+    char *marked = arena_alloc(a, 2 * strlen(body) + 1);
+    char *out = marked;
+
+    for (const char *p = body; *p != '\0';)
+    {
+        if (*p == '\\' && p[1] == '\n')
+        {
+            p += 2;
+        }
+        else if (*p == '\\' && p[1] != '\0' && strchr("\\$`", p[1]) != NULL)
+        {
+            *out++ = p[1];
+            p += 2;
+        }
+        else if (*p == '$' || *p == '`')
+        {
+            char *start = out;
+            int used = *p == '$' ? lex_parameter(p, &out, LEX_QPARAM) : lex_backquote(p, &out, LEX_QPARAM);
+            if (used > 0)
+            {
+                p += used;
+                continue;
+            }
+            out = start;    // an unclosed '`' has been copied part of the way
+            *out++ = *p++;
+        }
+        else
+        {
+            *out++ = *p++;
+        }
+    }
+    *out = '\0';
+    return marked;
+}
+
+/**
+ * @brief Splits a line into tokens stored in the arena.
+ *
+ * A line of n bytes yields at most n tokens and at most 2n bytes of word
+ * text (every byte plus a terminator, where a "$x" reference takes three
+ * bytes for two, a "``" three for two and a pattern character two for
+ * one), so both are
+ * allocated once up front and nothing is resized while lexing.
+ *
+ * @param a    The arena the tokens and their text are allocated from.
+ * @param line The command line; it is not modified.
+ * @return An array of tokens ending with TOK_END, or NULL after printing
+ *         an error for an unterminated quote; or NULL with lex_unfinished
+ *         set when a command substitution runs past the end, so the
+ *         parser can read more lines.
+ */
+struct token *lex_line(struct arena *a, const char *line)
+{
+    size_t len = strlen(line);
+    struct token *tokens = arena_alloc(a, (len + 1) * sizeof(struct token));
+    char *out = arena_alloc(a, 2 * len + 1);
+    const char *p = line;
+    int n = 0;
+
+    lex_unfinished = 0;
+    for (;;)
+    {
+        p += strspn(p, " \t\r\a");
+        if (*p == '#')
+        {
+            p += strcspn(p, "\n");     // a comment runs to the end of its line
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        if (*p == '\n')
+        {
+            tokens[n++] = (struct token){TOK_NEWLINE, "\n", 0, p - line, p - line + 1, 0, 0};
+            p++;
+            continue;
+        }
+        int oplen = lex_operator(p, &tokens[n]);
+        if (oplen > 0)
+        {
+            tokens[n].start = p - line;
+            tokens[n++].end = p + oplen - line;
+            p += oplen;
+            continue;
+        }
+
+        int start = p - line;
+        char *word = out;
+        int quoted = 0, expand = 0, used;
+
+        // "NAME=value" at the start of a command is an assignment
+        size_t name_len = 0;
+        while (isalnum((unsigned char)p[name_len]) || p[name_len] == '_')
+        {
+            name_len++;
+        }
+        int assign = p[name_len] == '=' && var_valid_name(p, name_len);
+
+        while (!ends_word[(unsigned char)*p])
+        {
+            if (*p == '\\' || *p == '\'' || *p == '"')
+            {
+                quoted = 1;
+            }
+            if (*p == '\\')
+            {
+                p++;
+                if (*p != '\0')
+                {
+                    *out++ = *p++;
+                }
+            }
+            else if (*p == '\'')
+            {
+                const char *close = strchr(p + 1, '\'');
+                if (close == NULL)
+                {
+                    fprintf(stderr, "dragonshell: syntax error: unterminated quote\n");
+                    return NULL;
+                }
+                memcpy(out, p + 1, close - p - 1);
+                out += close - p - 1;
+                p = close + 1;
+            }
+            else if (*p == '"')
+            {
+                p++;
+                while (*p != '"')
+                {
+                    if (*p == '\0')
+                    {
+                        fprintf(stderr, "dragonshell: syntax error: unterminated quote\n");
+                        return NULL;
+                    }
+                    if (*p == '\\' && p[1] != '\0' && strchr("\\\"$`", p[1]) != NULL)
+                    {
+                        p++;
+                    }
+                    else if ((*p == '$' && (used = lex_parameter(p, &out, LEX_QPARAM)) != 0) ||
+                             (*p == '`' && (used = lex_backquote(p, &out, LEX_QPARAM)) != 0))
+                    {
+                        if (used < 0)
+                        {
+                            lex_unfinished = 1;
+                            return NULL;
+                        }
+                        p += used;
+                        expand = 1;
+                        continue;
+                    }
+                    *out++ = *p++;
+                }
+                p++;
+            }
+            else if ((*p == '$' && (used = lex_parameter(p, &out, LEX_PARAM)) != 0) ||
+                     (*p == '`' && (used = lex_backquote(p, &out, LEX_PARAM)) != 0))
+            {
+                if (used < 0)
+                {
+                    lex_unfinished = 1;
+                    return NULL;
+                }
+                p += used;
+                expand = 1;
+            }
+            else
+            {
+                if (lex_is_glob(p))
+                {
+                    *out++ = LEX_GLOB;
+                    expand = 1;
+                }
+                *out++ = *p++;
+            }
+        }
+        *out++ = '\0';
+
+        // "2>file": unquoted digits right before '<' or '>' name a descriptor
+        enum token_type type = TOK_WORD;
+        if (!quoted && (*p == '<' || *p == '>') && strspn(word, "0123456789") == strlen(word))
+        {
+            type = TOK_IO_NUMBER;
+        }
+        tokens[n++] = (struct token){type, word, quoted, start, p - line, expand, assign};
+    }
+
+    tokens[n] = (struct token){TOK_END, NULL, 0, p - line, p - line, 0, 0};
+    return tokens;
+}
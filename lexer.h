@@ -0,0 +1,67 @@
+/****************************************************************************
+
+  @file         lexer.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Splits a command line into words and operators.
+
+*******************************************************************************/
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "arena.h"
+
+// How a word marks a parameter reference: marker, name, LEX_PARAM_END
+#define LEX_PARAM '\001'        // "$name" outside quotes: the value is split into fields
+#define LEX_QPARAM '\002'       // "$name" inside double quotes: the value is one field
+#define LEX_PARAM_END '\003'
+#define LEX_GLOB '\004'         // before an unquoted '*', '?' or '[': a pattern character
+#define LEX_PROCSUB '\005'      // a whole word: this, then the stage's procsubs[] index
+#define LEX_ARITH '\006'        // first byte of a reference's name: the rest is a $((expression))
+#define LEX_CMDSUB '\007'       // first byte of a reference's name: the rest is a $(command)
+
+enum token_type
+{
+    TOK_WORD,       // a word, with quotes and escapes already removed
+    TOK_PIPE,       // |
+    TOK_LESS,       // <
+    TOK_GREAT,      // >
+    TOK_DGREAT,     // >>
+    TOK_DLESS,      // <<
+    TOK_DLESSDASH,  // <<-
+    TOK_TLESS,      // <<<
+    TOK_LESSAND,    // <&
+    TOK_GREATAND,   // >&
+    TOK_ANDGREAT,   // &>
+    TOK_ANDDGREAT,  // &>>
+    TOK_IO_NUMBER,  // the digits of "2>", directly before a redirection
+    TOK_AMP,        // &
+    TOK_SEMI,       // ;
+    TOK_AND_IF,     // &&
+    TOK_OR_IF,      // ||
+    TOK_LPAREN,     // (
+    TOK_RPAREN,     // )
+    TOK_PROCSUB_IN, // <(, a process substitution read from
+    TOK_PROCSUB_OUT, // >(, a process substitution written to
+    TOK_NEWLINE,    // a newline inside a command that continues over several lines
+    TOK_END         // end of the line
+};
+
+struct token
+{
+    enum token_type type;
+    char *text;             // the word, or the operator's spelling
+    int quoted;             // a word that had quotes or escapes in it
+    int start, end;         // where it lies in the line, as byte offsets
+    int expand;             // the word holds parameter references or pattern characters
+    int assign;             // the word starts with an unquoted "NAME="
+};
+
+extern int lex_unfinished;      // lex_line() stopped inside a "$(" or "`"
+
+struct token *lex_line(struct arena *a, const char *line);
+char *lex_heredoc(struct arena *a, const char *body);
+
+#endif
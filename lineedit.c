@@ -0,0 +1,1122 @@
+/****************************************************************************
+
+  @file         lineedit.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Edits the command line in raw mode.
+
+                While the prompt is up the terminal is switched out of
+                canonical mode and every key is handled here: cursor and
+                word movement, deletion and kill commands, Up/Down through
+                history, Ctrl-R reverse incremental search over the
+                history file, and Tab completion of command and file
+                names. A finished line is handed to input.c, so
+                read_line() returns it as if the terminal had produced it.
+
+                Output is kept cheap for slow links: all keys from one
+                read() are applied first, then the new screen line is
+                compared with what is already shown and only the part
+                after the first difference is sent, with relative cursor
+                moves, in a single write(). Typing a character at the end
+                of the line sends that one character. A line wider than
+                the terminal scrolls sideways instead of wrapping, so the
+                editor never has to know where a wrap happened. Input left
+                over after Enter (a pasted block, or typing ahead) is kept
+                for the next line.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lineedit.h"
+#include "input.h"
+#include "history.h"
+#include "glob.h"
+#include "arena.h"
+#include "lexer.h"
+#include "pathtrie.h"
+#include "builtins.h"
+
+#define LINEEDIT_READ_SIZE 4096
+#define LINEEDIT_SEQ_MAX 16         // longest escape sequence kept
+#define LINEEDIT_NEEDLE_MAX 256
+
+
+/**
+ * A growable byte string.
+ */
+struct strbuf
+{
+    char *s;
+    size_t len;
+    size_t cap;
+};
+
+static int usable = -1;                 // -1 until the terminal has been checked
+static int active = 0;                  // raw mode is on
+static struct termios cooked;
+static int term_cols = 80;
+
+static const char *prompt;
+static size_t prompt_cols;
+
+static struct strbuf line;              // the line being edited
+static size_t cursor;                   // byte offset of the cursor in line
+static size_t scroll;                   // first byte of line on screen
+static struct strbuf saved;             // the new line, while browsing history
+static long hist_pos, hist_count;
+static int last_was_tab;
+
+static int searching;                   // Ctrl-R is active
+static int search_failed;
+static char needle[LINEEDIT_NEEDLE_MAX];
+static size_t needle_len;
+static long match;                      // the entry found, or -1
+
+static struct strbuf shown;             // what the screen line holds now
+static size_t shown_col;                // where the terminal's cursor is on it
+static struct strbuf frame;             // what it should hold
+static struct strbuf out;               // bytes for the next write()
+
+static char seq[LINEEDIT_SEQ_MAX];      // an escape sequence still arriving
+static size_t seq_len;
+static char pending[LINEEDIT_READ_SIZE];    // input read past the last Enter
+static size_t pending_len;
+static int done;                        // this line has been handed over
+
+static struct arena completion_arena;
+
+/**
+ * @brief Makes room in a string.
+ *
+ * @param b    The string.
+ * @param more Bytes about to be added.
+ * @return none
+ */
+static void sb_reserve(struct strbuf *b, size_t more)
+{
+    if (b->len + more + 1 > b->cap)
+    {
+        size_t cap = b->cap ? b->cap : 256;
+        while (b->len + more + 1 > cap)
+        {
+            cap *= 2;
+        }
+        b->s = realloc(b->s, cap);
+        if (!b->s)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        b->cap = cap;
+    }
+}
+
+/**
+ * @brief Appends bytes to a string.
+ *
+ * @param b The string.
+ * @param s The bytes.
+ * @param n How many.
+ * @return none
+ */
+static void sb_add(struct strbuf *b, const char *s, size_t n)
+{
+    sb_reserve(b, n);
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+}
+
+/**
+ * @brief Appends a string, or a terminal escape with one number in it.
+ *
+ * @param b   The string.
+ * @param fmt Text with at most one "%zu".
+ * @param n   The number.
+ * @return none
+ */
+static void sb_addf(struct strbuf *b, const char *fmt, size_t n)
+{
+    char tmp[32];
+    sb_add(b, tmp, snprintf(tmp, sizeof(tmp), fmt, n));
+}
+
+/**
+ * @brief Counts the columns of some UTF-8 text (one per character).
+ *
+ * @param s The text.
+ * @param n Its length in bytes.
+ * @return The number of characters.
+ */
+static size_t columns(const char *s, size_t n)
+{
+    size_t cols = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        cols += ((unsigned char)s[i] & 0xc0) != 0x80;
+    }
+    return cols;
+}
+
+/**
+ * @brief Steps one character left or right in the line.
+ *
+ * @param at  A byte offset on a character boundary.
+ * @param dir -1 or 1.
+ * @return The neighbouring boundary (at itself at either end).
+ */
+static size_t step(size_t at, int dir)
+{
+    if (dir < 0)
+    {
+        if (at == 0)
+        {
+            return 0;
+        }
+        do
+        {
+            at--;
+        } while (at > 0 && ((unsigned char)line.s[at] & 0xc0) == 0x80);
+        return at;
+    }
+    if (at >= line.len)
+    {
+        return line.len;
+    }
+    do
+    {
+        at++;
+    } while (at < line.len && ((unsigned char)line.s[at] & 0xc0) == 0x80);
+    return at;
+}
+
+/**
+ * @brief Finds the start or end of a word next to a position.
+ *
+ * @param at  A byte offset.
+ * @param dir -1 for the start of the word before, 1 for the end of the
+ *            word after.
+ * @return The offset.
+ */
+static size_t word_edge(size_t at, int dir)
+{
+    if (dir < 0)
+    {
+        while (at > 0 && line.s[at - 1] == ' ')
+        {
+            at--;
+        }
+        while (at > 0 && line.s[at - 1] != ' ')
+        {
+            at--;
+        }
+        return at;
+    }
+    while (at < line.len && line.s[at] == ' ')
+    {
+        at++;
+    }
+    while (at < line.len && line.s[at] != ' ')
+    {
+        at++;
+    }
+    return at;
+}
+
+/**
+ * @brief Replaces a range of the line.
+ *
+ * @param from  The first byte replaced.
+ * @param to    The byte after the last one.
+ * @param text  The replacement.
+ * @param n     Its length.
+ * @return none
+ */
+static void splice_line(size_t from, size_t to, const char *text, size_t n)
+{
+    sb_reserve(&line, n);
+    memmove(line.s + from + n, line.s + to, line.len - to);
+    memcpy(line.s + from, text, n);
+    line.len = line.len - (to - from) + n;
+    line.s[line.len] = '\0';
+}
+
+/**
+ * @brief Replaces the whole line and puts the cursor at its end.
+ *
+ * @param text The new line.
+ * @param n    Its length.
+ * @return none
+ */
+static void set_line(const char *text, size_t n)
+{
+    line.len = 0;
+    sb_add(&line, text, n);
+    cursor = line.len;
+}
+
+/**
+ * @brief Moves the terminal's cursor along the screen line.
+ *
+ * @param from The column it is at.
+ * @param to   The column wanted.
+ * @return none
+ */
+static void move_cursor(size_t from, size_t to)
+{
+    if (to < from)
+    {
+        sb_addf(&out, "\033[%zuD", from - to);
+    }
+    else if (to > from)
+    {
+        sb_addf(&out, "\033[%zuC", to - from);
+    }
+}
+
+/**
+ * @brief Sends what has been queued for the terminal.
+ *
+ * @return none
+ */
+static void flush_out(void)
+{
+    fflush(stdout);
+    for (size_t off = 0; off < out.len;)
+    {
+        ssize_t n = write(STDOUT_FILENO, out.s + off, out.len - off);
+        if (n == -1 && errno != EINTR)
+        {
+            break;
+        }
+        off += n > 0 ? n : 0;
+    }
+    out.len = 0;
+}
+
+/**
+ * @brief Builds the screen line and queues the changes from what is shown.
+ *
+ * @return none
+ */
+static void refresh(void)
+{
+    size_t want;
+    size_t width = term_cols > 1 ? term_cols - 1 : 1;
+
+    frame.len = 0;
+    if (searching)
+    {
+        size_t n = 0;
+        const char *text = match >= 0 ? history_entry(match, &n) : "";
+        sb_add(&frame, search_failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`",
+               search_failed ? 26 : 19);
+        sb_add(&frame, needle, needle_len);
+        sb_add(&frame, "': ", 3);
+        want = columns(frame.s, frame.len);
+
+        const char *hit = needle_len > 0 ? memmem(text, n, needle, needle_len) : NULL;
+        if (hit != NULL)
+        {
+            want += columns(text, hit - text);
+        }
+        size_t i = 0;
+        for (size_t cols = columns(frame.s, frame.len); i < n && cols < width; i++)
+        {
+            cols += ((unsigned char)text[i] & 0xc0) != 0x80;
+        }
+        while (i < n && ((unsigned char)text[i] & 0xc0) == 0x80)
+        {
+            i++;
+        }
+        sb_add(&frame, text, i);
+        if (want > width)
+        {
+            want = width;
+        }
+    }
+    else
+    {
+        // Scroll sideways to keep the cursor on screen
+        size_t avail = width > prompt_cols + 1 ? width - prompt_cols : 1;
+        if (cursor < scroll)
+        {
+            scroll = cursor;
+        }
+        while (columns(line.s + scroll, cursor - scroll) > avail)
+        {
+            scroll = step(scroll, 1);
+        }
+        if (columns(line.s, line.len) <= avail)
+        {
+            scroll = 0;
+        }
+
+        sb_add(&frame, prompt, strlen(prompt));
+        size_t end = scroll;
+        for (size_t cols = 0; end < line.len && (cols < avail || ((unsigned char)line.s[end] & 0xc0) == 0x80); end++)
+        {
+            cols += ((unsigned char)line.s[end] & 0xc0) != 0x80;
+        }
+        sb_add(&frame, line.s + scroll, end - scroll);
+        want = prompt_cols + columns(line.s + scroll, cursor - scroll);
+    }
+
+    // Only what follows the first difference is rewritten
+    size_t same = 0;
+    while (same < shown.len && same < frame.len && shown.s[same] == frame.s[same])
+    {
+        same++;
+    }
+    while (same > 0 && same < frame.len && ((unsigned char)frame.s[same] & 0xc0) == 0x80)
+    {
+        same--;
+    }
+    size_t same_cols = columns(frame.s, same);
+    size_t frame_cols = columns(frame.s, frame.len);
+
+    if (same < frame.len || same < shown.len)
+    {
+        move_cursor(shown_col, same_cols);
+        sb_add(&out, frame.s + same, frame.len - same);
+        if (columns(shown.s, shown.len) > frame_cols)
+        {
+            sb_add(&out, "\033[K", 3);
+        }
+        shown_col = frame_cols;
+    }
+    move_cursor(shown_col, want);
+    shown_col = want;
+
+    shown.len = 0;
+    sb_add(&shown, frame.s, frame.len);
+}
+
+/**
+ * @brief Leaves the screen line as it was last drawn and moves below it.
+ *
+ * @return none
+ */
+static void newline(void)
+{
+    move_cursor(shown_col, columns(shown.s, shown.len));
+    sb_add(&out, "\r\n", 2);
+    shown.len = 0;
+    shown_col = 0;
+}
+
+/**
+ * @brief Hands the finished line to input.c.
+ *
+ * @return none
+ */
+static void submit(void)
+{
+    refresh();
+    newline();
+    input_push_line(line.s, line.len);
+    done = 1;
+}
+
+/**
+ * @brief Searches the history for the needle.
+ *
+ * @param before Only entries older than this are considered.
+ * @param skip_same Skip entries identical to the current match, so that
+ *                  repeating Ctrl-R never shows the same line twice.
+ * @return none
+ */
+static void search(long before, int skip_same)
+{
+    needle[needle_len] = '\0';
+    size_t cur_len = 0;
+    const char *cur = match >= 0 ? history_entry(match, &cur_len) : NULL;
+
+    for (long hit = history_search(needle, before); hit >= 0; hit = history_search(needle, hit))
+    {
+        size_t n;
+        const char *text = history_entry(hit, &n);
+        if (!skip_same || cur == NULL || n != cur_len || memcmp(text, cur, n) != 0)
+        {
+            match = hit;
+            search_failed = 0;
+            return;
+        }
+    }
+    search_failed = 1;
+}
+
+/**
+ * @brief Leaves Ctrl-R search, keeping the match as the line.
+ *
+ * @return none
+ */
+static void accept_search(void)
+{
+    if (match >= 0)
+    {
+        size_t n;
+        const char *text = history_entry(match, &n);
+        set_line(text, n);
+    }
+    searching = 0;
+}
+
+/**
+ * @brief Adds text to the line with the shell's special characters
+ *        escaped.
+ *
+ * @param text The text.
+ * @param n    Its length.
+ * @return none
+ */
+static void insert_escaped(const char *text, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (strchr(" \t\\'\"|&;<>()$`*?[#~", text[i]) != NULL)
+        {
+            splice_line(cursor, cursor, "\\", 1);
+            cursor++;
+        }
+        splice_line(cursor, cursor, text + i, 1);
+        cursor++;
+    }
+}
+
+/**
+ * @brief Lists completion candidates below the line, in columns.
+ *
+ * @param names The candidates.
+ * @param n     How many.
+ * @param skip  Leading bytes of each (the directory part) not shown.
+ * @return none
+ */
+static void list_candidates(char **names, int n, size_t skip)
+{
+    size_t longest = 0;
+    for (int i = 0; i < n; i++)
+    {
+        size_t cols = columns(names[i] + skip, strlen(names[i] + skip));
+        longest = cols > longest ? cols : longest;
+    }
+    int per_row = term_cols / (longest + 2);
+    per_row = per_row > 0 ? per_row : 1;
+    int rows = (n + per_row - 1) / per_row;
+
+    refresh();
+    newline();
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < per_row && c * rows + r < n; c++)
+        {
+            const char *name = names[c * rows + r] + skip;
+            size_t len = strlen(name);
+            sb_add(&out, name, len);
+            for (size_t pad = columns(name, len); pad < longest + 2; pad++)
+            {
+                sb_add(&out, " ", 1);
+            }
+        }
+        sb_add(&out, "\r\n", 2);
+    }
+}
+
+/**
+ * @brief Tells whether a word is where a command name goes.
+ *
+ * @param start Where the word starts in the line.
+ * @return 1 at the start of the line or after "|", "&", ";" or "(".
+ */
+static int command_position(size_t start)
+{
+    while (start > 0 && (line.s[start - 1] == ' ' || line.s[start - 1] == '\t'))
+    {
+        start--;
+    }
+    return start == 0 || strchr("|&;(", line.s[start - 1]) != NULL;
+}
+
+/**
+ * @brief Lists the builtins and $PATH commands starting with a prefix.
+ *
+ * @param prefix The prefix.
+ * @param count  Receives the number of names.
+ * @return The names, sorted and without repeats.
+ */
+static char **command_candidates(const char *prefix, int *count)
+{
+    int nfound;
+    char **found = pathtrie_complete(&completion_arena, prefix, &nfound);
+    size_t len = strlen(prefix);
+    int nbuiltins = 0;
+    while (builtin_name(nbuiltins) != NULL)
+    {
+        nbuiltins++;
+    }
+
+    // Both lists are sorted, so merging them keeps the order
+    char **names = arena_alloc(&completion_arena, (nfound + nbuiltins + 1) * sizeof(char *));
+    int n = 0, i = 0;
+    for (int b = 0; b <= nbuiltins; b++)
+    {
+        const char *name = builtin_name(b);
+        if (name != NULL && strncmp(name, prefix, len) != 0)
+        {
+            continue;
+        }
+        while (i < nfound && (name == NULL || strcmp(found[i], name) < 0))
+        {
+            names[n++] = found[i++];
+        }
+        if (name != NULL)
+        {
+            names[n++] = (char *)name;
+            i += i < nfound && strcmp(found[i], name) == 0;
+        }
+    }
+    *count = n;
+    return names;
+}
+
+/**
+ * @brief Completes the word before the cursor.
+ *
+ * A word where a command goes, with no '/', is completed from the
+ * builtins and the $PATH trie. Anything else is matched as a glob (the
+ * word with a '*' after it), so file name completion shares the
+ * directory listings the glob cache holds. A single match is completed
+ * with a '/' or a space after it; several are completed as far as they
+ * agree, and a second Tab lists them.
+ *
+ * @return none
+ */
+static void complete(void)
+{
+    size_t start = cursor;
+    while (start > 0 && (strchr(" \t|&;<>()", line.s[start - 1]) == NULL ||
+                         (start > 1 && line.s[start - 2] == '\\')))
+    {
+        start--;
+    }
+
+    // The word with escapes removed, room left for a marked '*'
+    arena_reset(&completion_arena);
+    char *pattern = arena_alloc(&completion_arena, cursor - start + 3);
+    size_t plen = 0;
+    for (size_t i = start; i < cursor; i++)
+    {
+        if (line.s[i] == '\\' && i + 1 < cursor)
+        {
+            i++;
+        }
+        pattern[plen++] = line.s[i];
+    }
+    size_t typed = plen;
+    pattern[plen] = '\0';
+
+    int n;
+    char **names;
+    int command = memchr(pattern, '/', typed) == NULL && command_position(start);
+    if (command)
+    {
+        names = command_candidates(pattern, &n);
+    }
+    else
+    {
+        pattern[plen++] = LEX_GLOB;
+        pattern[plen++] = '*';
+        pattern[plen] = '\0';
+        names = glob_expand(&completion_arena, pattern, &n);
+    }
+    if (n == 0)
+    {
+        sb_add(&out, "\a", 1);
+        return;
+    }
+
+    size_t common = strlen(names[0]);
+    for (int i = 1; i < n; i++)
+    {
+        size_t k = 0;
+        while (k < common && names[i][k] == names[0][k])
+        {
+            k++;
+        }
+        common = k;
+    }
+
+    if (common > typed)
+    {
+        insert_escaped(names[0] + typed, common - typed);
+    }
+    if (n == 1)
+    {
+        struct stat sb;
+        int dir = !command && stat(names[0], &sb) == 0 && S_ISDIR(sb.st_mode);
+        splice_line(cursor, cursor, dir ? "/" : " ", 1);
+        cursor++;
+    }
+    else if (common == typed)
+    {
+        if (last_was_tab)
+        {
+            const char *slash = strrchr(pattern, '/');
+            list_candidates(names, n, slash ? (size_t)(slash - pattern + 1) : 0);
+        }
+        else
+        {
+            sb_add(&out, "\a", 1);
+        }
+    }
+}
+
+/**
+ * @brief Applies one key to the line while Ctrl-R search is active.
+ *
+ * @param key The key: a byte, or an escape sequence's final byte plus 256.
+ * @return 1 if the key was consumed, 0 if it ended the search and should
+ *         be applied to the line as usual.
+ */
+static int search_key(int key)
+{
+    if (key == CTRL('R'))
+    {
+        search(match >= 0 ? match : hist_count, 1);
+    }
+    else if (key == CTRL('G') || key == CTRL('C'))
+    {
+        searching = 0;
+        set_line(saved.s, saved.len);
+    }
+    else if (key == 127 || key == CTRL('H'))
+    {
+        // A shorter needle may match something newer: start again
+        if (needle_len > 0)
+        {
+            needle_len--;
+        }
+        match = -1;
+        search(hist_count, 0);
+    }
+    else if (key >= 0x20 && key < 256)
+    {
+        if (needle_len + 1 < sizeof(needle))
+        {
+            needle[needle_len++] = key;
+        }
+        search(match >= 0 ? match + 1 : hist_count, 0);
+    }
+    else
+    {
+        accept_search();
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Applies one key to the line.
+ *
+ * @param key The key: a byte, or 256 plus the final byte of an escape
+ *            sequence (with '~' sequences mapped to their number).
+ * @return none
+ */
+static void handle_key(int key)
+{
+    int tab = key == '\t';
+
+    if (searching && search_key(key))
+    {
+        return;
+    }
+    switch (key)
+    {
+    case '\r':
+    case '\n':
+        submit();
+        break;
+    case CTRL('C'):
+        refresh();
+        move_cursor(shown_col, columns(shown.s, shown.len));
+        sb_add(&out, "^C", 2);
+        sb_add(&shown, "^C", 2);
+        shown_col = columns(shown.s, shown.len);
+        newline();
+        line.len = 0;
+        cursor = 0;
+        hist_pos = hist_count;
+        break;
+    case CTRL('D'):
+        if (line.len == 0)
+        {
+            refresh();
+            newline();
+            input_push_eof();
+            done = 1;
+            break;
+        }
+        /* fall through */
+    case 256 + '3':     // Delete
+        if (cursor < line.len)
+        {
+            splice_line(cursor, step(cursor, 1), "", 0);
+        }
+        break;
+    case 127:
+    case CTRL('H'):
+        if (cursor > 0)
+        {
+            size_t prev = step(cursor, -1);
+            splice_line(prev, cursor, "", 0);
+            cursor = prev;
+        }
+        break;
+    case CTRL('A'):
+    case 256 + 'H':
+    case 256 + '1':
+    case 256 + '7':
+        cursor = 0;
+        break;
+    case CTRL('E'):
+    case 256 + 'F':
+    case 256 + '4':
+    case 256 + '8':
+        cursor = line.len;
+        break;
+    case CTRL('B'):
+    case 256 + 'D':
+        cursor = step(cursor, -1);
+        break;
+    case CTRL('F'):
+    case 256 + 'C':
+        cursor = step(cursor, 1);
+        break;
+    case 256 + 'b':     // Alt-b, Ctrl-Left
+        cursor = word_edge(cursor, -1);
+        break;
+    case 256 + 'f':     // Alt-f, Ctrl-Right
+        cursor = word_edge(cursor, 1);
+        break;
+    case CTRL('W'):
+    {
+        size_t from = word_edge(cursor, -1);
+        splice_line(from, cursor, "", 0);
+        cursor = from;
+        break;
+    }
+    case CTRL('U'):
+        splice_line(0, cursor, "", 0);
+        cursor = 0;
+        break;
+    case CTRL('K'):
+        splice_line(cursor, line.len, "", 0);
+        break;
+    case CTRL('L'):
+        sb_add(&out, "\033[H\033[2J", 7);
+        shown.len = 0;
+        shown_col = 0;
+        break;
+    case CTRL('P'):
+    case 256 + 'A':
+    case CTRL('N'):
+    case 256 + 'B':
+    {
+        long to = hist_pos + (key == CTRL('P') || key == 256 + 'A' ? -1 : 1);
+        if (to < 0 || to > hist_count)
+        {
+            sb_add(&out, "\a", 1);
+            break;
+        }
+        if (hist_pos == hist_count)
+        {
+            saved.len = 0;
+            sb_add(&saved, line.s, line.len);
+        }
+        hist_pos = to;
+        if (to == hist_count)
+        {
+            set_line(saved.s, saved.len);
+        }
+        else
+        {
+            size_t n;
+            const char *text = history_entry(to, &n);
+            set_line(text, n);
+        }
+        break;
+    }
+    case CTRL('R'):
+        saved.len = 0;
+        sb_add(&saved, line.s, line.len);
+        searching = 1;
+        search_failed = 0;
+        needle_len = 0;
+        match = -1;
+        break;
+    case '\t':
+        complete();
+        break;
+    default:
+        if (key >= 0x20 && key < 256)
+        {
+            char c = key;
+            splice_line(cursor, cursor, &c, 1);
+            cursor++;
+        }
+        break;
+    }
+    last_was_tab = tab;
+}
+
+/**
+ * @brief Applies input bytes to the line, decoding escape sequences.
+ *
+ * A sequence cut off by the end of the bytes is finished by the next
+ * call. Bytes after an Enter are kept for the next line.
+ *
+ * @param bytes The input.
+ * @param n     How many bytes.
+ * @return none
+ */
+static void feed(const char *bytes, size_t n)
+{
+    size_t i = 0;
+    for (; i < n && !done; i++)
+    {
+        unsigned char c = bytes[i];
+        if (seq_len == 0 && c != 033)
+        {
+            handle_key(c);
+            continue;
+        }
+
+        if (seq_len == sizeof(seq))
+        {
+            seq_len = 0;    // not a sequence this editor knows
+            continue;
+        }
+        seq[seq_len++] = c;
+        if (seq_len == 1)
+        {
+            continue;
+        }
+        if (seq[1] != '[' && seq[1] != 'O')
+        {
+            handle_key(256 + seq[1]);   // Alt-key
+            seq_len = 0;
+            continue;
+        }
+        if (seq_len == 2 || c < 0x40 || c > 0x7e)
+        {
+            continue;   // CSI parameters still to come
+        }
+
+        int key = 256 + c;
+        if (c == '~')
+        {
+            key = 256 + seq[2];
+        }
+        else if (seq_len > 3 && seq[seq_len - 2] == '5' && (c == 'C' || c == 'D'))
+        {
+            key = 256 + (c == 'C' ? 'f' : 'b');     // Ctrl-Right, Ctrl-Left
+        }
+        seq_len = 0;
+        handle_key(key);
+    }
+
+    if (done && i < n)
+    {
+        memmove(pending, bytes + i, n - i);
+        pending_len = n - i;
+    }
+    if (!done)
+    {
+        refresh();
+    }
+    flush_out();
+}
+
+/**
+ * @brief Asks the terminal how wide it is.
+ *
+ * @return none
+ */
+static void read_width(void)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+    {
+        term_cols = ws.ws_col;
+    }
+}
+
+/**
+ * @brief Switches the terminal to raw mode and shows the prompt.
+ *
+ * The editor is only used when both stdin and stdout are a terminal
+ * whose modes can be changed; otherwise the caller reads the line in
+ * canonical mode. Input typed ahead of the prompt is applied at once,
+ * so it may already have finished a line.
+ *
+ * @param p The prompt.
+ * @return 0 if the editor is in use, -1 if not.
+ */
+int lineedit_begin(const char *p)
+{
+    if (usable == -1)
+    {
+        const char *term = getenv("TERM");
+        usable = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+                 tcgetattr(STDIN_FILENO, &cooked) == 0 &&
+                 (term == NULL || strcmp(term, "dumb") != 0);
+    }
+    if (!usable || tcgetattr(STDIN_FILENO, &cooked) == -1)
+    {
+        return -1;
+    }
+
+    struct termios raw = cooked;
+    raw.c_iflag &= ~(ICRNL | INLCR | IXON | ISTRIP);
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1)
+    {
+        return -1;
+    }
+    active = 1;
+    read_width();
+
+    prompt = p;
+    prompt_cols = columns(p, strlen(p));
+    line.len = 0;
+    cursor = 0;
+    scroll = 0;
+    searching = 0;
+    last_was_tab = 0;
+    done = 0;
+    hist_count = history_count();
+    hist_pos = hist_count;
+    shown.len = 0;
+    shown_col = 0;
+    sb_reserve(&line, 0);
+    sb_reserve(&saved, 0);
+    sb_reserve(&shown, 0);
+
+    char ahead[LINEEDIT_READ_SIZE];
+    size_t n = pending_len;
+    memcpy(ahead, pending, n);
+    pending_len = 0;
+    feed(ahead, n);
+    return 0;
+}
+
+/**
+ * @brief Reads whatever the terminal has and applies it.
+ *
+ * Meant to be called when the terminal is readable. At end of input the
+ * end is passed on to input.c.
+ *
+ * @param none
+ * @return none
+ */
+void lineedit_read(void)
+{
+    char bytes[LINEEDIT_READ_SIZE];
+    ssize_t n = read(STDIN_FILENO, bytes, sizeof(bytes));
+    if (n == -1 && (errno == EINTR || errno == EAGAIN))
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        input_push_eof();
+        done = 1;
+        return;
+    }
+    feed(bytes, n);
+}
+
+/**
+ * @brief Clears the prompt line so other output can be printed.
+ *
+ * @param none
+ * @return none
+ */
+void lineedit_hide(void)
+{
+    move_cursor(shown_col, 0);
+    sb_add(&out, "\033[K", 3);
+    flush_out();
+    shown.len = 0;
+    shown_col = 0;
+}
+
+/**
+ * @brief Redraws the prompt and line after lineedit_hide().
+ *
+ * @param none
+ * @return none
+ */
+void lineedit_show(void)
+{
+    refresh();
+    flush_out();
+}
+
+/**
+ * @brief Reacts to a SIGINT that reached the prompt as a signal (from
+ *        kill, since Ctrl-C is an ordinary key in raw mode).
+ *
+ * @param none
+ * @return none
+ */
+void lineedit_interrupt(void)
+{
+    handle_key(CTRL('C'));
+    refresh();
+    flush_out();
+}
+
+/**
+ * @brief Picks up the terminal's width after a SIGWINCH.
+ *
+ * @param none
+ * @return none
+ */
+void lineedit_resize(void)
+{
+    read_width();
+    if (active && !done)
+    {
+        lineedit_hide();
+        lineedit_show();
+    }
+}
+
+/**
+ * @brief Puts the terminal back in canonical mode.
+ *
+ * @param none
+ * @return none
+ */
+void lineedit_end(void)
+{
+    if (active)
+    {
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+        active = 0;
+    }
+}
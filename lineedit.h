@@ -0,0 +1,23 @@
+/****************************************************************************
+
+  @file         lineedit.h
+
+  @author       Ahnaful Hoque
+
+  @brief        The raw-mode line editor behind the interactive prompt:
+                cursor movement, history, Ctrl-R search and completion.
+
+*******************************************************************************/
+
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+int lineedit_begin(const char *prompt);
+void lineedit_read(void);
+void lineedit_hide(void);
+void lineedit_show(void);
+void lineedit_interrupt(void);
+void lineedit_resize(void);
+void lineedit_end(void);
+
+#endif
@@ -8,6 +8,8 @@
 
 *******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <sys/wait.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -16,100 +18,44 @@
 #include <sys/resource.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <time.h>
+
+#include "arena.h"
+#include "pipeline.h"
+#include "pathcache.h"
+#include "input.h"
+#include "jobs.h"
+#include "usage.h"
+#include "trace.h"
+#include "parallel.h"
+#include "fastio.h"
+#include "redirect.h"
+#include "parser.h"
+#include "builtins.h"
+#include "vars.h"
+#include "expand.h"
+#include "events.h"
+#include "history.h"
+#include "confine.h"
+#include "procsub.h"
+#include "server.h"
+#include "func.h"
+#include "cmdsub.h"
+#include "shell.h"
 
 #define LINE_LENGTH 100
 #define MAX_ARGS 5
 #define MAX_LENGTH 20
-#define MAX_BG_PROC 1
-#define LSH_TOK_BUFSIZE 64
-#define LSH_TOK_DELIM " \t\r\n\a"
-
-pid_t bg_processes[MAX_BG_PROC] = {-1}; // Array to keep track of background processes
-int bg_count = 0;
-long total_user_time = 0;
-long total_sys_time = 0;
-
-/**
- * @brief Reads a line of input from standard input (stdin).
- *
- * If getline() encounters EOF, the function exits successfully (EXIT_SUCCESS). 
- * On read error, it prints an error message with perror and exits with 
- * failure status (EXIT_FAILURE).
- *
- * @param void
- * @return A pointer to the dynamically allocated buffer containing the 
- *         input line, or NULL if an error occurred.
- */
-
-char *read_line(void)
-{
-    char *line = NULL;
-    size_t bufsize = 0;
-
-    if (getline(&line, &bufsize, stdin) == -1)
-    {
-        if (feof(stdin))
-        {
-            exit(EXIT_SUCCESS);
-        }
-        else
-        {
-            perror("Error in getline()");
-            exit(EXIT_FAILURE);
-        }
-    }
-    return line;
-}
-
-
-/**
- * @brief Splits a line into tokens based on predefined delimiters.
- *
- * Dynamically allocates memory for the tokens and handles reallocation 
- * as needed. Uses strtok() to split the line and returns a NULL-terminated 
- * array of strings (tokens).
- *
- * @param line A pointer to the string to be tokenized.
- *
- * @return tokens: A pointer to an array of strings extracted from the 
- *         input line.
- *         NULL: if memory allocation fails.
- */
-
-char **split_line(char *line)
-{
-    int bufsize = LSH_TOK_BUFSIZE, position = 0;
-    char **tokens = malloc(bufsize * sizeof(char *));
-    char *token;
-
-    if (!tokens)
-    {
-        fprintf(stderr, "lsh: allocation error\n");
-        exit(EXIT_FAILURE);
-    }
 
-    token = strtok(line, LSH_TOK_DELIM);
-    while (token != NULL)
-    {
-        tokens[position] = token;
-        position++;
-
-        if (position >= bufsize)
-        {
-            bufsize += LSH_TOK_BUFSIZE;
-            tokens = realloc(tokens, bufsize * sizeof(char *));
-            if (!tokens)
-            {
-                fprintf(stderr, "lsh: allocation error\n");
-                exit(EXIT_FAILURE);
-            }
-        }
 
-        token = strtok(NULL, LSH_TOK_DELIM);
-    }
-    tokens[position] = NULL;
-    return tokens;
-}
+static struct arena line_arena;  // the current line, when it is not cached
+int in_subshell = 0;              // this process is a forked "( list )" or stage
+int last_status = 0;              // status of the last pipeline, for $? and exit
+int *pipe_status = NULL;          // each stage's status in the last pipeline, for $PIPESTATUS
+int pipe_nstatus = 0;
+static int pipe_status_cap = 0;
 
 /**
  * @brief Changes the current working directory.
@@ -120,19 +66,33 @@ char **split_line(char *line)
  *
  * @param path The directory path to change to. If NULL, an 
  *             error is displayed.
- * @return none
+ * @return 0 on success, 1 on failure.
  */
 
-void cd(char *path)
+int cd(char *path)
 {
     if (path == NULL)
     {
         printf("dragonshell: Expected argument to \"cd\"\n");
+        return 1;
     }
     else if (chdir(path) != 0)
     {
         perror("dragonshell");
+        return 1;
     }
+    return 0;
+}
+
+/**
+ * @brief The "cd" builtin.
+ *
+ * @param args The argument vector, args[0] being "cd".
+ * @return 0 on success, 1 on failure.
+ */
+int cd_builtin(char **args)
+{
+    return cd(args[1]);
 }
 
 
@@ -144,66 +104,108 @@ void cd(char *path)
  * perror().
  * 
  * @param none
- * @return none
+ * @return 0 on success, 1 on failure.
  */
 
-void pwd(void)
+int pwd(void)
 {
     char cwd[1024];
     if (getcwd(cwd, sizeof(cwd)) != NULL)
     {
         printf("%s\n", cwd);
+        return 0;
     }
-    else
-    {
-        perror("dragonshell");
-    }
+    perror("dragonshell");
+    return 1;
+}
+
+/**
+ * @brief The "pwd" builtin.
+ *
+ * @param args Ignored.
+ * @return 0 on success, 1 on failure.
+ */
+int pwd_builtin(char **args)
+{
+    (void)args;
+    return pwd();
 }
 
 /**
  * @brief Gracefully terminates the shell and its background processes.
  *
  * Retrieves and prints the total user and system execution time 
- * for all child processes spawned since the shell started. Sends 
+ * for all child processes spawned since the shell started, and the
+ * latency histograms if timing is traced. Sends 
  * a SIGTERM signal to any running background processes before 
- * terminating the shell.
+ * terminating the shell. A subshell just exits.
  * 
- * @param none
+ * @param status The shell's exit status.
  * @return none
  */
 
-void exit_shell(void)
+void exit_shell(int status)
 {
-    struct rusage usage;
-    // Get resource usage of child processes
-    getrusage(RUSAGE_CHILDREN, &usage);
+    if (in_subshell)
+    {
+        exit(status);
+    }
+
 
-    total_user_time += usage.ru_utime.tv_sec;
-    total_sys_time += usage.ru_stime.tv_sec;
+    struct rusage usage;
+    // Get resource usage of child processes, as collected by wait4()
+    jobs_children_usage(&usage);
 
-    printf("User time: %ld seconds\n",total_user_time);
-    printf("Sys time: %ld seconds\n", total_sys_time);
+    printf("User time: %ld.%06ld seconds\n",
+           (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec);
+    printf("Sys time: %ld.%06ld seconds\n",
+           (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec);
     
+    if (trace_timing)
+    {
+        trace_dump();
+    }
+
     // Terminate any background processes
-    
-    for (int i = 0; i < MAX_BG_PROC; i++)
+    jobs_terminate_all();
+    jobs_control_end();
+    exit(status);
+}
+
+/**
+ * @brief The "exit" builtin: exit [n]
+ *
+ * Without n the shell exits with the status of the last pipeline.
+ *
+ * @param args The argument vector, args[0] being "exit".
+ * @return Does not return.
+ */
+int exit_builtin(char **args)
+{
+    char *end;
+    long status = args[1] != NULL ? strtol(args[1], &end, 10) : last_status;
+    if (args[1] != NULL && (*end != '\0' || end == args[1]))
     {
-        if (bg_processes[i] != -1)
-        {
-            kill(bg_processes[i], SIGTERM);
-        }
+        fprintf(stderr, "dragonshell: exit: %s: numeric argument required\n", args[1]);
+        status = 2;
     }
-    exit(0);
+    exit_shell((int)status & 0xff);
+    return 0;
 }
 
-pid_t shell_pid, child_pid = -1;
+pid_t shell_pid;
 
 /**
- * @brief Handles SIGINT signal (Ctrl+C).
+ * @brief Handles SIGINT signal (Ctrl+C) while a command runs.
  *
- * If a child process is running, sends SIGINT to the entire process group
- * of the child. If no child process is active, prints a new prompt
- * to the shell.
+ * Under job control the foreground job's group has the terminal, so the
+ * signal reaches it and not the shell. Otherwise a foreground command in
+ * the shell's own process group gets the signal from the terminal
+ * directly; a job brought back with fg has a group of its own, so the
+ * signal is passed on to it. At the prompt SIGINT is
+ * blocked and handled by the event loop instead, so nothing here needs
+ * to print (printf() is not async-signal-safe). Either way the rest of
+ * the command line is skipped, which is what stops a loop of builtins.
  *
  * @param sig The signal number received (typically SIGINT)
  * @return none
@@ -211,309 +213,858 @@ pid_t shell_pid, child_pid = -1;
  */
 void sigint_handler(int sig)
 {
-    if (child_pid != -1)
-    {
-        kill(-child_pid, SIGINT);
-    }
-    else
+    interrupted = 1;
+    if (foreground_pgid > 0)
     {
-        printf("\ndragonshell > ");
-        fflush(stdout);
+        kill(-foreground_pgid, SIGINT);
     }
 }
 
 /**
- * @brief Handles SIGTSTP signal (Ctrl+Z).
+ * @brief Handles SIGTSTP signal (Ctrl+Z) while a command runs.
  *
- * If a child process is running, sends SIGTSTP to the entire process
- * group of the child. If no child process is active, prints a new
- * prompt to the shell.
+ * Passed on to a job brought back with fg, as for SIGINT.
  *
  * @param sig The signal number received (typically SIGTSTP).
- * @return 0
+ * @return none
  */
 void sigtstp_handler(int sig)
 {
-    if (child_pid != -1)
+    if (foreground_pgid > 0)
     {
-        kill(-child_pid, SIGTSTP);
+        kill(-foreground_pgid, SIGTSTP);
     }
-    else
-    {
-        printf("\ndragonshell > ");
-        fflush(stdout);
+}
+
+/**
+ * @brief Installs a signal handler with SA_RESTART, so a signal that
+ *        arrives while the shell waits in read() or write() does not
+ *        make the call fail with EINTR.
+ *
+ * @param sig     The signal.
+ * @param handler The handler.
+ * @return none
+ */
+static void set_handler(int sig, void (*handler)(int))
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(sig, &sa, NULL);
+}
+
+/**
+ * @brief Starts a confined command in a forked child, which applies the
+ *        CPU affinity and nice value itself before it execs.
+ *
+ * @param pl   The single-stage pipeline, its redirections prepared.
+ * @param path The command's resolved path.
+ * @return The command's exit status (0 once a background job is started).
+ */
+static int fork_command(struct pipeline *pl, const char *path) {
+    struct stage *st = &pl->stages[0];
+    char **args = st->argv;
+
+    // The child reports a failed exec through this close-on-exec pipe
+    int errpipe[2];
+    if (pipe2(errpipe, O_CLOEXEC) == -1) {
+        perror("dragonshell: pipe failed");
+        redirect_release(st->redirs, st->nredirs);
+        return 1;
+    }
+
+    // SIGCHLD stays blocked until the child is in the job table
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    struct job *job = job_create(pl->text, pl->background);
+    job->grouped |= job_control;
+
+    fflush(stdout);     // don't let the child inherit buffered output
+    uint64_t fork_start = trace_clock();
+    pid_t pid = confine_fork(pl->confine);
+    if (pid == 0) {
+        // Child process
+        close(errpipe[0]);
+        job_set_group(job, 0);  // keep terminal signals away from other jobs
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        if (confine_apply(pl->confine) == -1) {
+            exit(EXIT_FAILURE);
+        }
+
+        // Apply the redirections in order
+        if (redirect_apply(st->redirs, st->nredirs) == -1) {
+            exit(EXIT_FAILURE);
+        }
+
+        // Execute the command
+        path_exec(path, args, st->envp != NULL ? st->envp : vars_environ());
+        int err = errno;
+        write(errpipe[1], &err, sizeof(err));
+        perror("dragonshell");
+        exit(EXIT_FAILURE);
+    } else if (pid > 0) {
+        // Parent process
+        uint64_t forked = trace_clock();
+        redirect_release(st->redirs, st->nredirs);
+        job_set_group(job, pid);    // also set here, whichever runs first
+        job_add_process(job, pid);
+        jobs_unblock(&old_mask);
+
+        int err = 0;
+        close(errpipe[1]);
+        if (read(errpipe[0], &err, sizeof(err)) == sizeof(err) && err == ENOENT) {
+            path_forget(args[0]);   // remembered path is gone, search $PATH next time
+        }
+        close(errpipe[0]);
+        uint64_t execed = trace_clock();
+        trace_record(pl->trace_key, TRACE_FORK, fork_start, forked);
+        trace_record(pl->trace_key, TRACE_EXEC, forked, execed);
+
+        if (!pl->background) {
+            // Wait for the child process to finish, collecting its resource usage
+            int status = job_wait(job, &pl->usage, NULL);
+            pl->has_usage = 1;
+            trace_record(pl->trace_key, TRACE_WAIT, execed, trace_clock());
+            return status;
+        } else {
+            job_launched(job);
+        }
+    } else {
+        job_launched(job);      // frees the job, which has no processes
+        jobs_unblock(&old_mask);
+        redirect_release(st->redirs, st->nredirs);
+        close(errpipe[0]);
+        close(errpipe[1]);
+        perror("dragonshell");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Executes a command with optional background processing.
+ *
+ * Everything the child needs is prepared in the parent: the path comes
+ * from the hash table, the environment is the one kept up to date in
+ * vars.c, and the redirection targets are opened here and become
+ * posix_spawn() file actions, so the child only dup2()s and execs.
+ * glibc starts it with clone(CLONE_VM | CLONE_VFORK): the child runs in
+ * the shell's memory until it execs, so a command starts as quickly
+ * with a heap grown by history, caches and variables as with a small
+ * one, where fork() has to copy page tables in proportion to the
+ * shell's resident size. Only a confined command is forked, since it
+ * must apply its limits itself. If the command is executed in the
+ * foreground, the parent process waits for it to complete and records
+ * its resource usage in pl. If executed in the background, it prints
+ * the child process ID and returns immediately.
+ *
+ * @param pl A single-stage pipeline: the command's argument vector (the first
+ *           element is the command itself), its redirections, if any, and
+ *           whether it runs in the background.
+ *
+ * @return The command's exit status (0 once a background job is started).
+ */
+int execute_command(struct pipeline *pl) {
+    struct stage *st = &pl->stages[0];
+    char **args = st->argv;
+
+    // Open redirection targets in the parent; the child only dup2()s them
+    if (redirect_prepare(st->redirs, st->nredirs) == -1) {
+        return 1;
+    }
+
+    // Resolve the command once in the parent through the hash table
+    const char *path = path_lookup(args[0]);
+    if (path == NULL) {
+        fprintf(stderr, "dragonshell: %s: command not found\n", args[0]);
+        redirect_release(st->redirs, st->nredirs);
+        return 127;
+    }
+    if (pl->confine != NULL) {
+        return fork_command(pl, path);
+    }
+
+    // SIGCHLD stays blocked until the child is in the job table
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    struct job *job = job_create(pl->text, pl->background);
+    job->grouped |= job_control;
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &old_mask);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    if (job->grouped) {
+        flags |= POSIX_SPAWN_SETPGROUP;     // the child leads a group of its own
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (job_control && !pl->background) {
+        // The child's group takes the terminal before fd 0 is replaced
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+    }
+    redirect_add_actions(&actions, st->redirs, st->nredirs);
+
+    fflush(stdout);     // keep builtin output ahead of the command's
+    uint64_t spawn_start = trace_clock();
+    pid_t pid;
+    int err = path_spawn(&pid, path, &actions, &attr, args,
+                         st->envp != NULL ? st->envp : vars_environ());
+    uint64_t spawned = trace_clock();
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    redirect_release(st->redirs, st->nredirs);
+
+    if (err != 0) {
+        job_launched(job);      // frees the job, which has no processes
+        jobs_unblock(&old_mask);
+        fprintf(stderr, "dragonshell: %s: %s\n", args[0], strerror(err));
+        if (err == ENOENT) {
+            path_forget(args[0]);   // remembered path is gone, search $PATH next time
+            return 127;
+        }
+        return 126;     // there, but not executable
+    }
+    job_add_process(job, pid);
+    trace_record(pl->trace_key, TRACE_SPAWN, spawn_start, spawned);
+
+    if (pl->background) {
+        job_launched(job);
+        jobs_unblock(&old_mask);
+        return 0;
     }
+    jobs_unblock(&old_mask);
+
+    // Wait for the child process to finish, collecting its resource usage
+    int status = job_wait(job, &pl->usage, NULL);
+    pl->has_usage = 1;
+    trace_record(pl->trace_key, TRACE_WAIT, spawned, trace_clock());
+    return status;
 }
 
 /**
- * @brief Checks for a pipe in the input string and splits commands.
+ * Options that "set -o name" / "set +o name" turn on and off.
+ */
+static const struct
+{
+    const char *name;
+    int *flag;
+} shell_options[] = {
+    {"pipefail", &pipefail},
+    {"trace-timing", &trace_timing},
+};
+
+/**
+ * @brief The "set" builtin, limited to named options.
  *
- * Searches for a pipe ('|') in the input string. If found, it splits
- * the string into two commands: one before the pipe and one after.
+ * "set -o" lists the options, "set -o name" enables one and
+ * "set +o name" disables it.
  *
- * @param input The input command string to check for a pipe.
- * @param cmd1 Pointer to store the command before the pipe.
- * @param cmd2 Pointer to store the command after the pipe.
- * @return 1 if a pipe is detected, 0 otherwise.
+ * @param args The argument vector, args[0] being "set".
+ * @return 0 on success, 1 for an unknown option.
  */
-int is_pipe(char *input, char **cmd1, char **cmd2)
+int set_builtin(char **args)
 {
-    char *pipe_pos = strstr(input, "|");
-    if (pipe_pos != NULL)
+    int count = sizeof(shell_options) / sizeof(shell_options[0]);
+
+    if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL))
+    {
+        for (int i = 0; i < count; i++)
+        {
+            printf("%-16s%s\n", shell_options[i].name, *shell_options[i].flag ? "on" : "off");
+        }
+        return 0;
+    }
+    if ((strcmp(args[1], "-o") != 0 && strcmp(args[1], "+o") != 0) || args[2] == NULL)
+    {
+        fprintf(stderr, "dragonshell: set: usage: set [-o|+o] option\n");
+        return 2;
+    }
+    for (int i = 0; i < count; i++)
     {
-        *pipe_pos = '\0';          // Split the input at the pipe
-        *cmd1 = input;             // Command before the pipe
-        *cmd2 = pipe_pos + 1;      // Command after the pipe
-        return 1;                  // Pipe is detected
+        if (strcmp(args[2], shell_options[i].name) == 0)
+        {
+            *shell_options[i].flag = args[1][0] == '-';
+            return 0;
+        }
     }
-    return 0;                      // No pipe detected
+    fprintf(stderr, "dragonshell: set: %s: invalid option name\n", args[2]);
+    return 1;
 }
 
-
 /**
- * @brief Executes two commands connected by a pipe.
+ * @brief Runs a command that is only assignments (and redirections), or
+ *        whose words all expanded to nothing.
  *
- * This function creates a pipe, forks two child processes to execute
- * the specified commands. The output of the first command is connected
- * to the input of the second command through the pipe.
+ * The assignments set shell variables; the redirections are still
+ * performed, so "x=1 >file" creates the file.
  *
- * @param cmd1 The command to be executed first.
- * @param cmd2 The command to be executed second.
- * 
- * @return none
+ * @param st The expanded stage.
+ * @return The status of the last command substitution in its words (0
+ *         if there was none), or 1 if a redirection failed.
  */
-void execute_pipe(char *cmd1, char *cmd2)
+int assign_only(struct stage *st)
 {
-    int pipefd[2];
-    pid_t p1, p2;
+    for (int i = 0; st->assigns != NULL && st->assigns[i] != NULL; i++)
+    {
+        var_assign(st->assigns[i], 0);
+    }
+    if (redirect_prepare(st->redirs, st->nredirs) == -1)
+    {
+        return 1;
+    }
+    redirect_release(st->redirs, st->nredirs);
+    return cmdsub_status;
+}
+
+/**
+ * @brief Runs an if, a loop or a "{ list; }" in the shell itself, with
+ *        the stage's redirections applied around it, as for a builtin.
+ *
+ * @param st The compound stage.
+ * @return The status of the last command it ran, or 1 if a redirection
+ *         failed.
+ */
+static int run_compound(struct stage *st)
+{
+    int saved[st->nredirs > 0 ? st->nredirs : 1];
 
-    if (pipe(pipefd) == -1)
+    if (redirect_prepare(st->redirs, st->nredirs) == -1)
     {
-        perror("dragonshell: pipe failed");
-        return;
+        return 1;
     }
+    if (redirect_save(st->redirs, st->nredirs, saved) == -1)
+    {
+        redirect_release(st->redirs, st->nredirs);
+        return 1;
+    }
+    int status = run_node(st->group);
+    redirect_restore(st->redirs, st->nredirs, saved);
+    redirect_release(st->redirs, st->nredirs);
+    return status;
+}
 
-    p1 = fork();
-    if (p1 == 0)
+/**
+ * @brief Runs a parsed pipeline: a compound command, a function or a
+ *        builtin in the shell itself, a single external command, or a
+ *        multi-stage pipeline.
+ *
+ * @param pl The pipeline.
+ * @return The exit status.
+ */
+static int run_pipeline(struct pipeline *pl)
+{
+    struct stage *st = &pl->stages[0];
+    char **args = st->argv;
+
+    if (pl->nstages == 1 && args[0] == NULL)
     {
-        // First child process (cmd1)
-        close(pipefd[0]);            // Close read end of pipe
-        dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to write end of pipe
-        close(pipefd[1]);
+        return assign_only(st);
+    }
+    if (pl->nstages == 1 && st->compound && !pl->background)
+    {
+        return run_compound(st);
+    }
 
-        char **args1 = split_line(cmd1);
-        if (execvp(args1[0], args1) == -1)
+    struct function *fn = st->group == NULL && args[0] != NULL ? function_lookup(args[0]) : NULL;
+    const struct builtin *b = st->group == NULL && args[0] != NULL ? builtin_lookup(args[0]) : NULL;
+
+    // A function or builtin in the background needs a process of its own
+    if (pl->nstages > 1 || st->group != NULL || ((b != NULL || fn != NULL) && pl->background))
+    {
+        return execute_pipeline(pl);
+    }
+    else if (fn != NULL)
+    {
+        return function_call(fn, st);   // functions come before builtins, as in sh
+    }
+    else if (b != NULL)
+    {
+        return builtin_run(b, st);
+    }
+    else if (!pl->background && !job_control && fastio_stage(&pl->stages[0]))
+    {
+        // Under job control it is spawned, so that Ctrl-Z can stop it
+        struct stage *st = &pl->stages[0];
+        if (redirect_prepare(st->redirs, st->nredirs) == -1)
         {
-            perror("dragonshell");
+            return 1;
         }
-        free(args1);
-        exit(EXIT_FAILURE);
+        int status = fastio_run(st, STDIN_FILENO, STDOUT_FILENO);
+        redirect_release(st->redirs, st->nredirs);
+        return status;
     }
-    else if (p1 < 0)
+    else
     {
-        perror("dragonshell: fork failed");
-        return;
+        return execute_command(pl);
     }
+}
 
-    p2 = fork();
-    if (p2 == 0)
+/**
+ * @brief Makes room in pipe_status for a pipeline's stages.
+ *
+ * @param n The number of stages.
+ * @return none
+ */
+static void pipe_status_reserve(int n)
+{
+    if (n <= pipe_status_cap)
     {
-        // Second child process (cmd2)
-        close(pipefd[1]);            // Close write end of pipe
-        dup2(pipefd[0], STDIN_FILENO); // Redirect stdin to read end of pipe
-        close(pipefd[0]);
+        return;
+    }
+    int *bigger = realloc(pipe_status, n * sizeof(*bigger));
+    if (!bigger)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    pipe_status = bigger;
+    pipe_status_cap = n;
+}
 
-        char **args2 = split_line(cmd2);
-        if (execvp(args2[0], args2) == -1)
+/**
+ * @brief Expands and runs one pipeline of a line, reporting its usage
+ *        when it was prefixed with "time".
+ *
+ * Afterwards pipe_status holds the status of each stage of a foreground
+ * pipeline, or just the pipeline's status for anything else. The
+ * expanded copy is given back to the line's arena, so a loop that runs
+ * the pipeline over and over stays in the same memory.
+ *
+ * @param parsed The pipeline as parsed.
+ * @return The exit status, negated for "! pipeline".
+ */
+static int run_timed(struct pipeline *parsed)
+{
+    uint64_t start_ns = trace_clock();
+    struct arena_mark mark = arena_save(&line_arena);
+    int procsubs = procsub_mark();
+    cmdsub_status = 0;
+    struct pipeline *pl = expand_pipeline(&line_arena, parsed);
+    uint64_t stage_ns[pl->nstages];
+    int status;
+
+    pipe_status_reserve(pl->nstages);
+    pl->statuses = pipe_status;
+    pl->stage_ns = stage_ns;
+    pl->nstatuses = 0;
+    pl->has_usage = 0;
+    if (interrupted)
+    {
+        status = 128 + SIGINT;  // Ctrl-C stopped a "$(command)": the rest is not run
+    }
+    else if (pl->timed && !pl->background)
+    {
+        struct timespec start;
+        struct rusage self_start, children;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        getrusage(RUSAGE_SELF, &self_start);
+        jobs_children_usage(&children);
+        status = run_pipeline(pl);
+        if (!pl->has_usage)
         {
-            perror("dragonshell");
+            // A builtin such as parallel or fg: count what it reaped
+            struct rusage children_start = children;
+            jobs_children_usage(&children);
+            usage_sub(&children, &children_start);
+            pl->usage = children;
+        }
+        usage_print_time(&start, &self_start, &pl->usage);
+        for (int i = 0; pl->nstatuses > 1 && i < pl->nstatuses; i++)
+        {
+            // Which stage of a pipeline held it up
+            const char *name = pl->stages[i].argv[0];
+            usage_print_stage(i + 1, name != NULL ? name : "-", stage_ns[i]);
         }
-        free(args2);
-        exit(EXIT_FAILURE);
     }
-    else if (p2 < 0)
+    else
     {
-        perror("dragonshell: fork failed");
-        return;
+        status = run_pipeline(pl);
+    }
+    if (pl->nstatuses == 0)
+    {
+        pipe_status[0] = status;
+        pl->nstatuses = 1;
+    }
+    pipe_nstatus = pl->nstatuses;
+    pl->statuses = NULL;    // a cached pipeline must not keep pointers to this frame
+    pl->stage_ns = NULL;
+    procsub_release(procsubs);
+    trace_record(pl->trace_key, TRACE_TOTAL, start_ns, trace_clock());
+    if (pl->negate)
+    {
+        status = status == 0;
     }
+    arena_rewind(&line_arena, mark);
+    return status;
+}
 
-    // Parent process
-    close(pipefd[0]);
-    close(pipefd[1]);
-    waitpid(p1, NULL, 0);            // Wait for both child processes
-    waitpid(p2, NULL, 0);
+/**
+ * @brief Tells whether the rest of a list must be skipped: a break,
+ *        continue or return is on its way out, or Ctrl-C was pressed.
+ *
+ * @param none
+ * @return 1 if so, 0 otherwise.
+ */
+static int unwinding(void)
+{
+    return jump_pending != JUMP_NONE || interrupted;
 }
 
 /**
- * @brief Executes a command with optional background processing.
+ * @brief Settles a break or continue at the loop that is running, after
+ *        a pass of its body or condition.
  *
- * This function forks a child process to execute a specified command.
- * If the command is executed in the foreground, the parent process
- * waits for it to complete and retrieves its resource usage. If executed
- * in the background, it prints the child process ID and returns immediately.
+ * @param none
+ * @return 1 if the loop must end (a break for it, a jump for an outer
+ *         loop or a return, or Ctrl-C), 0 to go on with the next pass.
+ */
+static int loop_done(void)
+{
+    if (interrupted || jump_pending == JUMP_RETURN)
+    {
+        return 1;
+    }
+    if (jump_pending == JUMP_NONE)
+    {
+        return 0;
+    }
+    if (--jump_levels > 0)
+    {
+        return 1;   // "break 2": an enclosing loop settles the rest
+    }
+    int next = jump_pending == JUMP_CONTINUE;
+    jump_pending = JUMP_NONE;
+    return !next;
+}
+
+/**
+ * @brief Runs a while or until loop.
  *
- * @param args An array of arguments for the command, where the first element is the command itself.
- * @param background A flag indicating whether to run the command in the background (1) or foreground (0).
- * 
- * @return none
+ * @param n The NODE_WHILE or NODE_UNTIL node.
+ * @return The status of the body's last pass, or 0 if it never ran.
  */
-void execute_command(char **args, int background) {
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
+static int run_loop(struct node *n)
+{
+    int status = 0;
 
-        // Check for output redirection
-        int output_fd = -1;
-        for (int i = 0; args[i] != NULL; i++) {
-            if (strcmp(args[i], ">") == 0) {
-                output_fd = open(args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (output_fd == -1) {
-                    perror("dragonshell");
-                    exit(EXIT_FAILURE);
-                }
-                args[i] = NULL; // Remove '>' from args
+    loop_depth++;
+    for (;;)
+    {
+        int test = run_node(n->left);
+        if (unwinding())
+        {
+            if (loop_done())
+            {
                 break;
             }
+            continue;
         }
-
-        // Redirect stdout if needed
-        if (output_fd != -1) {
-            dup2(output_fd, STDOUT_FILENO);
-            close(output_fd);
+        if ((test == 0) != (n->type == NODE_WHILE))
+        {
+            break;
         }
-
-        // Check for input redirection
-        int input_fd = -1;
-        for (int i = 0; args[i] != NULL; i++) {
-            if (strcmp(args[i], "<") == 0) {
-                input_fd = open(args[i + 1], O_RDONLY);
-                if (input_fd == -1) {
-                    perror("dragonshell");
-                    exit(EXIT_FAILURE);
-                }
-                args[i] = NULL; // Remove '<' from args
-                break;
-            }
+        status = run_node(n->right);
+        if (loop_done())
+        {
+            break;
         }
+    }
+    loop_depth--;
+    return status;
+}
 
-        // Redirect stdin if needed
-        if (input_fd != -1) {
-            dup2(input_fd, STDIN_FILENO);
-            close(input_fd);
-        }
+/**
+ * @brief Runs a for loop: the words are expanded once, then the body
+ *        runs with the variable set to each of them in turn.
+ *
+ * @param n The NODE_FOR node.
+ * @return The status of the body's last pass, or 0 if it never ran.
+ */
+static int run_for(struct node *n)
+{
+    struct arena_mark mark = arena_save(&line_arena);
+    struct pipeline *words = expand_pipeline(&line_arena, n->pipeline);
+    int status = 0;
 
-        // Execute the command
-        if (execvp(args[0], args) == -1) {
-            perror("dragonshell");
-        }
-        exit(EXIT_FAILURE);
-    } else if (pid > 0) {
-        // Parent process
-        if (!background) {
-            // Wait for the child process to finish
-            waitpid(pid, NULL, 0);
-            
-            // Get the resource usage of the child process
-            struct rusage usage;
-            getrusage(RUSAGE_CHILDREN, &usage);
-            total_user_time += usage.ru_utime.tv_sec;
-            total_sys_time += usage.ru_stime.tv_sec;
-        } else {
-            printf("PID %d is sent to background\n", pid);
+    loop_depth++;
+    for (char **w = words->stages[0].argv; *w != NULL; w++)
+    {
+        var_set(n->name, *w, 0);
+        status = run_node(n->left);
+        if (loop_done())
+        {
+            break;
         }
-    } else {
-        perror("dragonshell");
     }
+    loop_depth--;
+    arena_rewind(&line_arena, mark);
+    return status;
 }
 
 /**
- * @brief Checks if a command should be run in the background.
+ * @brief Executes a syntax tree, in the shell process.
  *
- * This function scans the command-line arguments for the presence of
- * the background operator "&". If found, it modifies the arguments 
- * array to terminate the command at that point and returns 1, indicating
- * that the command should be executed in the background. If not found, 
- * it returns 0.
+ * This is the interpreter: lists, ifs, loops and function calls are
+ * walked here, and only the pipelines at the leaves that run external
+ * commands start processes. "&&" runs its right side only if the left
+ * succeeded, "||" only if it failed; either way the status is that of
+ * the last pipeline run, which is also left in last_status. A pending
+ * break, continue or return, or Ctrl-C, skips the rest of each list on
+ * the way out.
  *
- * @param args An array of command-line arguments, ending with a NULL pointer.
- * @return 1 if the command should run in the background, 0 otherwise.
+ * @param n The tree.
+ * @return The exit status of the last pipeline run.
  */
-int is_background_process(char **args)
+int run_node(struct node *n)
 {
-    for (int i = 0; args[i] != NULL; i++)
+    switch (n->type)
     {
-        if (strcmp(args[i], "&") == 0)
+    case NODE_PIPELINE:
+        last_status = run_timed(n->pipeline);
+        break;
+    case NODE_SEQUENCE:
+        run_node(n->left);
+        if (!unwinding())
         {
-            args[i] = NULL;
-            return 1;
+            run_node(n->right);
+        }
+        break;
+    case NODE_AND:
+        if (run_node(n->left) == 0 && !unwinding())
+        {
+            run_node(n->right);
         }
+        break;
+    case NODE_OR:
+        if (run_node(n->left) != 0 && !unwinding())
+        {
+            run_node(n->right);
+        }
+        break;
+    case NODE_IF:
+    {
+        int test = run_node(n->left);
+        if (unwinding())
+        {
+            break;
+        }
+        if (test == 0)
+        {
+            run_node(n->right);
+        }
+        else if (n->other != NULL)
+        {
+            run_node(n->other);
+        }
+        else
+        {
+            last_status = 0;
+        }
+        break;
     }
-    return 0;
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        last_status = run_loop(n);
+        break;
+    case NODE_FOR:
+        last_status = run_for(n);
+        break;
+    case NODE_FUNCTION:
+        function_define(n->name, n->left);
+        last_status = 0;
+        break;
+    }
+    return last_status;
 }
 
 /**
- *  @brief main entry point
- * 
- * @param none
- * @return 0
+ * @brief Runs a "( list )" group, a compound command, a function, a
+ *        builtin or a bare assignment in a child the pipeline engine
+ *        forked.
+ *
+ * The child is a copy of the shell that forgets its parent's jobs, lets
+ * Ctrl-C and Ctrl-Z act on it directly, and exits with the stage's status.
+ *
+ * @param st The stage, its redirections applied.
+ * @return Does not return.
  */
-int main(void)
+void run_subshell(struct stage *st)
 {
-    char *input;
-    char **tokens;
-    shell_pid = getpid();
+    in_subshell = 1;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    jobs_forget();
+    if (st->group != NULL)
+    {
+        exit(run_node(st->group));
+    }
+    if (st->argv[0] == NULL)
+    {
+        exit(assign_only(st));
+    }
+    struct function *fn = function_lookup(st->argv[0]);
+    if (fn != NULL)
+    {
+        exit(function_call(fn, st));
+    }
+    exit(builtin_run(builtin_lookup(st->argv[0]), st));
+}
 
-    signal(SIGINT, sigint_handler);    // Set signal handlers
-    signal(SIGTSTP, sigtstp_handler);  // for SIGINT and SIGTSTP
+/**
+ * @brief Finds the leftmost pipeline of a tree, whose name a line's
+ *        parse time is traced under.
+ *
+ * @param n The tree.
+ * @return The pipeline.
+ */
+static struct pipeline *first_pipeline(struct node *n)
+{
+    while (n->type != NODE_PIPELINE)
+    {
+        n = n->left;
+    }
+    return n->pipeline;
+}
 
-    printf("Welcome to Dragon Shell!\n");
+/**
+ * @brief Reads, parses and runs lines until the input ends.
+ *
+ * @param interactive Read through the line editor, with a prompt and
+ *                    history, rather than from the input as it is.
+ * @return none
+ */
+void shell_loop(int interactive)
+{
+    char *input;
 
     while (1)
     {
-        printf("dragonshell > ");
-        input = read_line();
-
-        char *cmd1 = NULL;
-        char *cmd2 = NULL;
-
-        if (is_pipe(input, &cmd1, &cmd2))
+        if (interactive)
         {
-            execute_pipe(cmd1, cmd2);
+            input = events_read_line("dragonshell > ");
         }
         else
         {
-            tokens = split_line(input);
-
-            if (tokens[0] == NULL)
+            jobs_notify(0);
+            input = read_line();
+        }
+        if (input == NULL)
+        {
+            break;
+        }
+        if (interactive)
+        {
+            history_add(input);
+        }
+        uint64_t line_start = trace_clock();
+        arena_reset(&line_arena);
+        struct node *root = parse_line(&line_arena, input);
+        if (root == NULL)
+        {
+            continue;
+        }
+        interrupted = 0;
+        trace_record(first_pipeline(root)->trace_key, TRACE_PARSE, line_start, trace_clock());
+        run_node(root);
+        if (interrupted && last_status != 128 + SIGINT)
+        {
+            // Ctrl-C stopped a loop of builtins, not a job that said so
+            if (interactive)
             {
-                free(input);
-                free(tokens);
-                continue;
+                fputc('\n', stderr);
             }
+            last_status = 128 + SIGINT;
+        }
+    }
+}
 
-            if (strcmp(tokens[0], "cd") == 0)
-            {
-                cd(tokens[1]);
-            }
-            else if (strcmp(tokens[0], "pwd") == 0)
-            {
-                pwd();
-            }
-            else if (strcmp(tokens[0], "exit") == 0)
-            {
-                exit_shell();
-            }
-            else
-            {
-                int background = is_background_process(tokens);
-                execute_command(tokens, background);
-            }
+/**
+ *  @brief main entry point
+ *
+ * With no arguments the shell reads commands from stdin, showing the
+ * prompt only when stdin is a terminal. "dragonshell script.dsh args..."
+ * runs a script file with the arguments as $1, $2, ..., and
+ * "dragonshell -c 'commands' [name args...]" runs the given string;
+ * "dragonshell --server path" serves requests on a Unix socket.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return The status of the last command run, or an error status if the
+ *         script could not be opened.
+ */
+int main(int argc, char **argv)
+{
+    const char *server_path = NULL;
+    shell_pid = getpid();
+    vars_init(environ);
 
-            free(tokens);
+    if (argc > 1 && strcmp(argv[1], "--server") == 0)
+    {
+        if (argc < 3)
+        {
+            fprintf(stderr, "dragonshell: --server: option requires a socket path\n");
+            return 2;
+        }
+        server_path = argv[2];
+        input_open_string("");
+    }
+    else if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        if (argc < 3)
+        {
+            fprintf(stderr, "dragonshell: -c: option requires an argument\n");
+            return 2;
+        }
+        input_open_string(argv[2]);
+        if (argc > 3)
+        {
+            positional_init(argv[3], argv + 4);     // "-c cmd name args...", as in sh
+        }
+    }
+    else if (argc > 1)
+    {
+        if (input_open_file(argv[1]) == -1)
+        {
+            fprintf(stderr, "dragonshell: %s: %s\n", argv[1], strerror(errno));
+            return 127;
         }
+        positional_init(argv[1], argv + 2);
+    }
+    else
+    {
+        input_open_stdin();
+    }
 
-        free(input);
+    int interactive = input_is_interactive();
+
+    set_handler(SIGINT, sigint_handler);    // Set signal handlers
+    set_handler(SIGTSTP, sigtstp_handler);  // for SIGINT and SIGTSTP
+    jobs_init();
+    trace_init();
+
+    if (server_path != NULL)
+    {
+        return server_run(server_path);
     }
+    if (interactive)
+    {
+        jobs_control_init();
+        events_init();
+        printf("Welcome to Dragon Shell!\n");
+    }
+    shell_loop(interactive);
+    jobs_control_end();
 
-    return 0;
+    if (trace_timing)
+    {
+        trace_dump();
+    }
+    return last_status;
 }
@@ -0,0 +1,256 @@
+/****************************************************************************
+
+  @file         parallel.c
+
+  @author       Ahnaful Hoque
+
+  @brief        The parallel builtin.
+
+                  parallel [-j N] command [args...] ::: input...
+
+                runs the command once per input, with the input appended
+                to its arguments or substituted for every "{}" in them,
+                keeping up to N children (default: one per online CPU) in
+                flight. Children are started with posix_spawn() and
+                collected by a single wait4(-1) loop, so a finished child
+                is replaced as soon as it exits whichever one it is.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <spawn.h>
+#include <signal.h>
+
+#include "arena.h"
+#include "jobs.h"
+#include "pathcache.h"
+#include "vars.h"
+#include "parallel.h"
+
+
+/**
+ * @brief Replaces every "{}" in a word with the input.
+ *
+ * @param a     The arena for the result.
+ * @param word  The template word.
+ * @param input The input to substitute.
+ * @param used  Set to 1 when a substitution was made.
+ * @return The word itself if it has no "{}", otherwise the new string.
+ */
+static char *substitute(struct arena *a, char *word, const char *input, int *used)
+{
+    char *hole = strstr(word, "{}");
+    if (hole == NULL)
+    {
+        return word;
+    }
+
+    size_t holes = 0;
+    for (char *p = hole; p != NULL; p = strstr(p + 2, "{}"))
+    {
+        holes++;
+    }
+
+    size_t input_len = strlen(input);
+    char *out = arena_alloc(a, strlen(word) + holes * input_len + 1);
+    char *q = out;
+    for (char *p = word; *p != '\0';)
+    {
+        if (p[0] == '{' && p[1] == '}')
+        {
+            memcpy(q, input, input_len);
+            q += input_len;
+            p += 2;
+        }
+        else
+        {
+            *q++ = *p++;
+        }
+    }
+    *q = '\0';
+    *used = 1;
+    return out;
+}
+
+/**
+ * @brief Starts the command for one input as a job of its own.
+ *
+ * @param path     The resolved command.
+ * @param tmpl     The command's argument template (NULL terminated).
+ * @param ntmpl    Number of words in tmpl.
+ * @param input    The input for this run.
+ * @param old_mask Signal mask for the child, from before jobs_block().
+ * @return The job, or NULL if the spawn failed.
+ */
+static struct job *spawn_one(const char *path, char **tmpl, int ntmpl,
+                             const char *input, const sigset_t *old_mask)
+{
+    struct arena a = {0};
+    char **argv = arena_alloc(&a, (ntmpl + 2) * sizeof(char *));
+    int used = 0;
+
+    for (int i = 0; i < ntmpl; i++)
+    {
+        argv[i] = substitute(&a, tmpl[i], input, &used);
+    }
+    argv[ntmpl] = used ? NULL : (char *)input;
+    argv[ntmpl + 1] = NULL;
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, old_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    struct job *job = job_create(tmpl[0], 0);
+    pid_t pid;
+    int err = path_spawn(&pid, path, NULL, &attr, argv, vars_environ());
+    posix_spawnattr_destroy(&attr);
+    arena_release(&a);
+
+    if (err != 0)
+    {
+        fprintf(stderr, "dragonshell: parallel: %s: %s\n", tmpl[0], strerror(err));
+        job_finish(job);
+        return NULL;
+    }
+    job_add_process(job, pid);
+    return job;
+}
+
+/**
+ * @brief The "parallel" builtin.
+ *
+ * Stops starting new runs once one is killed by SIGINT, but still
+ * collects the ones in flight.
+ *
+ * @param args The argument vector, args[0] being "parallel".
+ * @return The number of runs that failed (at most 101), 127 if the
+ *         command is not found, or 2 for a usage error.
+ */
+int parallel_builtin(char **args)
+{
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+
+    if (args[i] != NULL && strncmp(args[i], "-j", 2) == 0)
+    {
+        const char *n = args[i][2] != '\0' ? args[i] + 2 : args[++i];
+        char *end;
+        max_jobs = n != NULL ? strtol(n, &end, 10) : -1;
+        if (n == NULL || *end != '\0' || max_jobs < 0)
+        {
+            fprintf(stderr, "dragonshell: parallel: -j: expected a number\n");
+            return 2;
+        }
+        i++;
+    }
+
+    int cmd = i;
+    while (args[i] != NULL && strcmp(args[i], ":::") != 0)
+    {
+        i++;
+    }
+    if (args[i] == NULL || i == cmd)
+    {
+        fprintf(stderr, "dragonshell: parallel: usage: parallel [-j N] command [args...] ::: input...\n");
+        return 2;
+    }
+
+    int ntmpl = i - cmd;
+    char **inputs = &args[i + 1];
+    int ninputs = 0;
+    while (inputs[ninputs] != NULL)
+    {
+        ninputs++;
+    }
+    if (max_jobs == 0 || max_jobs > ninputs)
+    {
+        max_jobs = ninputs;   // -j 0: everything at once
+    }
+    if (ninputs == 0)
+    {
+        return 0;
+    }
+
+    const char *path = path_lookup(args[cmd]);
+    if (path == NULL)
+    {
+        fprintf(stderr, "dragonshell: parallel: %s: command not found\n", args[cmd]);
+        return 127;
+    }
+
+    struct job **running = calloc(max_jobs, sizeof(struct job *));
+    if (!running)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Terminate the template at ":::" without losing the inputs after it
+    char *sep = args[i];
+    args[i] = NULL;
+    fflush(stdout);
+
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+
+    int next = 0, active = 0, failures = 0, interrupted = 0;
+    for (;;)
+    {
+        for (int slot = 0; slot < max_jobs && next < ninputs && !interrupted; slot++)
+        {
+            if (running[slot] != NULL)
+            {
+                continue;
+            }
+            running[slot] = spawn_one(path, &args[cmd], ntmpl, inputs[next++], &old_mask);
+            if (running[slot] == NULL)
+            {
+                failures++;
+            }
+            else
+            {
+                active++;
+            }
+        }
+        if (active == 0)
+        {
+            break;
+        }
+
+        if (jobs_reap_any() == -1)
+        {
+            break;
+        }
+        for (int slot = 0; slot < max_jobs; slot++)
+        {
+            struct job *j = running[slot];
+            if (j == NULL || j->state != JOB_DONE)
+            {
+                continue;
+            }
+            int status = job_finish(j);
+            if (status != 0)
+            {
+                failures++;
+            }
+            if (status == 128 + SIGINT)
+            {
+                interrupted = 1;
+            }
+            running[slot] = NULL;
+            active--;
+        }
+    }
+
+    jobs_unblock(&old_mask);
+    args[i] = sep;
+    free(running);
+    return failures > 101 ? 101 : failures;
+}
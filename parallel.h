@@ -0,0 +1,17 @@
+/****************************************************************************
+
+  @file         parallel.h
+
+  @author       Ahnaful Hoque
+
+  @brief        The parallel builtin: run a command once per argument with
+                a cap on how many run at once.
+
+*******************************************************************************/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+int parallel_builtin(char **args);
+
+#endif
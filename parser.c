@@ -0,0 +1,1124 @@
+/****************************************************************************
+
+  @file         parser.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Parses a command line into a syntax tree.
+
+                A line is lexed once and turned into a tree whose leaves
+                are pipelines (stages, redirections, background flag)
+                joined by ";", "&&" and "||" nodes; "( list )" is a
+                pipeline stage holding a subtree. The trees of the last
+                PARSE_CACHE_SIZE distinct lines are kept, each in an arena
+                of its own, in a hash table with least-recently-used
+                eviction, so a script that runs the same lines over and
+                over lexes and parses each of them once. An evicted entry's
+                arena is reset and reused, so a warm cache allocates
+                nothing. Lines with here-documents are never cached, as
+                their bodies come from the input that follows them.
+
+                The reserved words if, then, elif, else, fi, while,
+                until, for, in, do, done, '{', '}' and '!' are ordinary
+                words to the lexer; the parser recognizes them where a
+                command could start. An if or a loop becomes the group of
+                a pipeline stage, marked as one the shell runs itself
+                rather than in a forked "( list )". A command left
+                unfinished at the end of a line makes the parser read the
+                following lines and parse them all as one text, with
+                newlines as separators.
+
+*******************************************************************************/
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parser.h"
+#include "lexer.h"
+#include "redirect.h"
+#include "input.h"
+#include "events.h"
+#include "vars.h"
+
+#define PARSE_CACHE_SIZE 64
+#define PARSE_CACHE_BUCKETS 128
+
+struct cache_entry
+{
+    unsigned hash;
+    char *line;                     // NULL while the entry holds nothing
+    struct node *root;
+    struct arena arena;             // the line, its tokens and its tree
+    struct cache_entry *chain;      // next entry in the same hash bucket
+    struct cache_entry *newer, *older;
+};
+
+static struct cache_entry cache[PARSE_CACHE_SIZE];
+static struct cache_entry *buckets[PARSE_CACHE_BUCKETS];
+static struct cache_entry *newest, *oldest;
+static int cache_used = 0;
+
+/**
+ * A here-document body read while an unfinished command was going on
+ * over more lines.
+ */
+struct queued_body
+{
+    char *body;
+    struct queued_body *next;
+};
+
+static struct queued_body *queued, **queue_tail = &queued;
+static const struct token *parse_tokens;    // the text being parsed, for parse_unfinished()
+static int open_constructs;     // groups, compound commands and functions not yet closed
+static int parse_incomplete;    // the text ended inside one of them
+
+/**
+ * @brief FNV-1a hash of a line.
+ *
+ * @param line The line.
+ * @return The hash value.
+ */
+static unsigned hash_line(const char *line)
+{
+    unsigned h = 2166136261u;
+    for (const char *p = line; *p; p++)
+    {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Takes an entry out of the recency list.
+ *
+ * @param e The entry.
+ * @return none
+ */
+static void lru_unlink(struct cache_entry *e)
+{
+    if (e->newer)
+    {
+        e->newer->older = e->older;
+    }
+    else
+    {
+        newest = e->older;
+    }
+    if (e->older)
+    {
+        e->older->newer = e->newer;
+    }
+    else
+    {
+        oldest = e->newer;
+    }
+    e->newer = e->older = NULL;
+}
+
+/**
+ * @brief Puts an entry at the newest end of the recency list, or, for an
+ *        empty entry, at the oldest end so it is reused first.
+ *
+ * @param e The entry, not currently in the list.
+ * @return none
+ */
+static void lru_insert(struct cache_entry *e)
+{
+    if (e->line != NULL)
+    {
+        e->older = newest;
+        if (newest)
+        {
+            newest->newer = e;
+        }
+        newest = e;
+        if (!oldest)
+        {
+            oldest = e;
+        }
+    }
+    else
+    {
+        e->newer = oldest;
+        if (oldest)
+        {
+            oldest->older = e;
+        }
+        oldest = e;
+        if (!newest)
+        {
+            newest = e;
+        }
+    }
+}
+
+/**
+ * @brief Removes an entry from its hash bucket.
+ *
+ * @param e The entry, which holds a line.
+ * @return none
+ */
+static void bucket_remove(struct cache_entry *e)
+{
+    struct cache_entry **p = &buckets[e->hash % PARSE_CACHE_BUCKETS];
+    while (*p != e)
+    {
+        p = &(*p)->chain;
+    }
+    *p = e->chain;
+    e->chain = NULL;
+}
+
+/**
+ * @brief Makes a leaf or list node.
+ *
+ * @param a     The arena.
+ * @param type  The node type.
+ * @param pl    The pipeline, for NODE_PIPELINE.
+ * @param left  The first child, for list nodes.
+ * @param right The second child, for list nodes.
+ * @return The node.
+ */
+static struct node *make_node(struct arena *a, enum node_type type, struct pipeline *pl,
+                              struct node *left, struct node *right)
+{
+    struct node *n = arena_alloc(a, sizeof(struct node));
+    *n = (struct node){type, pl, left, right, NULL, NULL};
+    return n;
+}
+
+/**
+ * @brief Tells whether a token is a given reserved word. Reserved words
+ *        are only recognized unquoted and where a command could start.
+ *
+ * @param t    The token.
+ * @param word The reserved word.
+ * @return 1 if it is, 0 otherwise.
+ */
+static int is_keyword(const struct token *t, const char *word)
+{
+    return t->type == TOK_WORD && !t->quoted && !t->expand && strcmp(t->text, word) == 0;
+}
+
+/**
+ * @brief Tells whether a token is a reserved word that ends a list:
+ *        then, elif, else, fi, do, done or '}'.
+ *
+ * @param t The token, where a command could start.
+ * @return 1 if it is, 0 otherwise.
+ */
+int closes_list(const struct token *t)
+{
+    static const char *closers[] = {"then", "elif", "else", "fi", "do", "done", "}"};
+
+    for (size_t i = 0; i < sizeof(closers) / sizeof(closers[0]); i++)
+    {
+        if (is_keyword(t, closers[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Tells whether a token starts a compound command the shell runs
+ *        itself: if, while, until, for or '{'.
+ *
+ * @param t The token, where a command could start.
+ * @return The reserved word, or NULL if it is not one.
+ */
+const char *compound_keyword(const struct token *t)
+{
+    static const char *openers[] = {"if", "while", "until", "for", "{"};
+
+    for (size_t i = 0; i < sizeof(openers) / sizeof(openers[0]); i++)
+    {
+        if (is_keyword(t, openers[i]))
+        {
+            return openers[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Skips the newlines of a command that runs over several lines.
+ *
+ * @param t The current token.
+ * @return The first token that is not a newline.
+ */
+struct token *skip_newlines(struct token *t)
+{
+    while (t->type == TOK_NEWLINE)
+    {
+        t++;
+    }
+    return t;
+}
+
+/**
+ * @brief Tells whether the parse reached the end of the text inside an
+ *        unfinished construct, so that more lines should be read rather
+ *        than reporting an error.
+ *
+ * That is the case inside an if, a loop, a "{ }" or "( )" group or a
+ * function, and after a trailing '|', "&&" or "||". It is remembered for
+ * parse_line().
+ *
+ * @param tok The token the parser did not expect.
+ * @return 1 if the text is unfinished, 0 for a real syntax error.
+ */
+int parse_unfinished(const struct token *tok)
+{
+    if (tok->type != TOK_END || parse_tokens == NULL)
+    {
+        return 0;
+    }
+    while (tok > parse_tokens && tok[-1].type == TOK_NEWLINE)
+    {
+        tok--;
+    }
+    enum token_type last = tok > parse_tokens ? tok[-1].type : TOK_END;
+    if (open_constructs > 0 || last == TOK_PIPE || last == TOK_AND_IF || last == TOK_OR_IF)
+    {
+        parse_incomplete = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Wraps a tree in a one-stage pipeline that runs it as a group.
+ *
+ * This is how "a && b &" puts the whole of "a && b" in the background.
+ *
+ * @param a     The arena.
+ * @param line  The line.
+ * @param first The tree's first token.
+ * @param end   The token after the tree.
+ * @param n     The tree.
+ * @return The pipeline.
+ */
+static struct pipeline *group_pipeline(struct arena *a, const char *line, struct token *first,
+                                       struct token *end, struct node *n)
+{
+    struct pipeline *pl = arena_alloc(a, sizeof(struct pipeline));
+    struct stage *st = arena_alloc(a, sizeof(struct stage));
+    char **argv = arena_alloc(a, 2 * sizeof(char *));
+    int len = end[-1].end - first->start;
+    char *text = arena_alloc(a, len + 1);
+
+    memcpy(text, line + first->start, len);
+    text[len] = '\0';
+    argv[0] = "(...)";
+    argv[1] = NULL;
+    *st = (struct stage){argv, NULL, 0, n};
+    memset(pl, 0, sizeof(*pl));
+    pl->stages = st;
+    pl->nstages = 1;
+    pl->text = text;
+    pl->trace_key = pipeline_name(a, pl);
+    return pl;
+}
+
+/**
+ * @brief Tells whether a function definition starts here: "name()" or
+ *        "function name".
+ *
+ * @param t The current token.
+ * @return 1 if one does, 0 otherwise.
+ */
+static int function_start(const struct token *t)
+{
+    if (is_keyword(t, "function") && t[1].type == TOK_WORD)
+    {
+        return 1;
+    }
+    return t->type == TOK_WORD && !t->quoted && !t->expand && !t->assign &&
+           strchr(t->text, '/') == NULL && t[1].type == TOK_LPAREN && t[2].type == TOK_RPAREN;
+}
+
+/**
+ * @brief Parses "name() body" or "function name [()] body", where the
+ *        body is a compound command or a "( list )" group, possibly
+ *        with redirections.
+ *
+ * @param a    The arena for the tree.
+ * @param line The line.
+ * @param t    The definition's first token.
+ * @param n    Receives the NODE_FUNCTION node.
+ * @return The token after the body, or NULL after printing a syntax
+ *         error.
+ */
+static struct token *parse_function(struct arena *a, const char *line, struct token *t,
+                                    struct node **n)
+{
+    t += is_keyword(t, "function");
+    const char *name = t->text;
+    t++;
+    if (t->type == TOK_LPAREN && t[1].type == TOK_RPAREN)
+    {
+        t += 2;
+    }
+
+    open_constructs++;
+    t = skip_newlines(t);
+    if (compound_keyword(t) == NULL && t->type != TOK_LPAREN)
+    {
+        syntax_error(t);
+        return NULL;
+    }
+    struct pipeline *pl = arena_alloc(a, sizeof(struct pipeline));
+    t = parse_pipeline(a, line, t, pl);
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    if (pl->nstages > 1 || pl->negate)
+    {
+        syntax_error(&(struct token){TOK_PIPE, pl->negate ? "!" : "|", 0, 0, 0, 0, 0});
+        return NULL;
+    }
+    open_constructs--;
+
+    *n = make_node(a, NODE_FUNCTION, NULL, make_node(a, NODE_PIPELINE, pl, NULL, NULL), NULL);
+    (*n)->name = name;
+    return t;
+}
+
+/**
+ * @brief Parses pipelines joined by "&&" and "||", which group left to
+ *        right with equal precedence, as in sh.
+ *
+ * A function definition takes the place of a pipeline.
+ *
+ * @param a    The arena for the tree.
+ * @param line The line.
+ * @param tp   The current token; advanced past the list.
+ * @return The tree, or NULL after printing a syntax error.
+ */
+static struct node *parse_and_or(struct arena *a, const char *line, struct token **tp)
+{
+    struct node *left = NULL;
+    enum node_type op = NODE_AND;
+    struct token *t = *tp;
+
+    for (;;)
+    {
+        struct node *leaf;
+        if (function_start(t))
+        {
+            t = parse_function(a, line, t, &leaf);
+            if (t == NULL)
+            {
+                return NULL;
+            }
+        }
+        else
+        {
+            struct pipeline *pl = arena_alloc(a, sizeof(struct pipeline));
+            t = parse_pipeline(a, line, t, pl);
+            if (t == NULL)
+            {
+                return NULL;
+            }
+            leaf = make_node(a, NODE_PIPELINE, pl, NULL, NULL);
+        }
+
+        left = left == NULL ? leaf : make_node(a, op, NULL, left, leaf);
+        if (t->type != TOK_AND_IF && t->type != TOK_OR_IF)
+        {
+            break;
+        }
+        op = t->type == TOK_AND_IF ? NODE_AND : NODE_OR;
+        t = skip_newlines(t + 1);
+    }
+    *tp = t;
+    return left;
+}
+
+/**
+ * @brief Tells whether a list ends at a token.
+ *
+ * @param t        The token, where a command could start.
+ * @param in_group Whether the list is inside "( )" or a compound
+ *                 command, and ends at ')' or a reserved word such as
+ *                 "then" or "done".
+ * @return 1 if it ends there, 0 otherwise.
+ */
+static int list_end(const struct token *t, int in_group)
+{
+    return t->type == TOK_END || (in_group && (t->type == TOK_RPAREN || closes_list(t)));
+}
+
+/**
+ * @brief Parses a list: and-or lists separated by ';', '&' or newlines.
+ *
+ * A list followed by '&' runs in the background; a ';' or '&' at the end
+ * of the list is allowed.
+ *
+ * @param a        The arena for the tree.
+ * @param line     The line, for each pipeline's source text.
+ * @param tp       The current token; advanced past the list.
+ * @param in_group Whether the list is inside "( )" or a compound command.
+ * @return The tree, or NULL after printing a syntax error.
+ */
+static struct node *parse_list(struct arena *a, const char *line, struct token **tp, int in_group)
+{
+    struct node *root = NULL;
+    struct token *t = skip_newlines(*tp);
+
+    while (!list_end(t, in_group))
+    {
+        struct token *first = t;
+        struct node *n = parse_and_or(a, line, &t);
+        if (n == NULL)
+        {
+            return NULL;
+        }
+
+        if (t->type == TOK_AMP)
+        {
+            if (n->type != NODE_PIPELINE)
+            {
+                n = make_node(a, NODE_PIPELINE, group_pipeline(a, line, first, t, n), NULL, NULL);
+            }
+            n->pipeline->background = 1;
+            t++;
+        }
+        else if (t->type == TOK_SEMI || t->type == TOK_NEWLINE)
+        {
+            t++;
+        }
+        else if (!list_end(t, in_group))
+        {
+            syntax_error(t);
+            return NULL;
+        }
+        root = root == NULL ? n : make_node(a, NODE_SEQUENCE, NULL, root, n);
+        t = skip_newlines(t);
+    }
+    *tp = t;
+    if (root == NULL)
+    {
+        syntax_error(t);
+    }
+    return root;
+}
+
+/**
+ * @brief Parses a "( list )" group.
+ *
+ * @param a     The arena for the tree.
+ * @param line  The line.
+ * @param t     The '(' token.
+ * @param group Receives the list inside the parentheses.
+ * @return The token after ')', or NULL after printing a syntax error.
+ */
+struct token *parse_group(struct arena *a, const char *line, struct token *t, struct node **group)
+{
+    t++;
+    open_constructs++;
+    *group = parse_list(a, line, &t, 1);
+    if (*group == NULL)
+    {
+        return NULL;
+    }
+    if (t->type != TOK_RPAREN)
+    {
+        syntax_error(t);
+        return NULL;
+    }
+    open_constructs--;
+    return t + 1;
+}
+
+/**
+ * @brief Checks for the reserved word that must come next.
+ *
+ * @param t    The current token.
+ * @param word The reserved word.
+ * @return The token after it, or NULL after printing a syntax error.
+ */
+static struct token *expect(struct token *t, const char *word)
+{
+    if (!is_keyword(t, word))
+    {
+        syntax_error(t);
+        return NULL;
+    }
+    return t + 1;
+}
+
+/**
+ * @brief Parses the rest of "if list; then list; [elif ...] [else list;] fi".
+ *
+ * An elif is an if nested in the other part, which shares the fi.
+ *
+ * @param a    The arena for the tree.
+ * @param line The line.
+ * @param t    The token after "if" or "elif".
+ * @param n    Receives the NODE_IF node.
+ * @return The token after "fi", or NULL after printing a syntax error.
+ */
+static struct token *parse_if(struct arena *a, const char *line, struct token *t, struct node **n)
+{
+    *n = make_node(a, NODE_IF, NULL, NULL, NULL);
+    if (((*n)->left = parse_list(a, line, &t, 1)) == NULL || (t = expect(t, "then")) == NULL ||
+        ((*n)->right = parse_list(a, line, &t, 1)) == NULL)
+    {
+        return NULL;
+    }
+    if (is_keyword(t, "elif"))
+    {
+        return parse_if(a, line, t + 1, &(*n)->other);
+    }
+    if (is_keyword(t, "else"))
+    {
+        t++;
+        if (((*n)->other = parse_list(a, line, &t, 1)) == NULL)
+        {
+            return NULL;
+        }
+    }
+    return expect(t, "fi");
+}
+
+/**
+ * @brief Parses the rest of "for name [in word...]; do list; done".
+ *
+ * The words are kept as the argv of a one-stage pipeline, so expand.c
+ * expands and globs them like a command's on every run. Without "in"
+ * the loop runs over "$@".
+ *
+ * @param a    The arena for the tree.
+ * @param line The line.
+ * @param t    The token after "for".
+ * @param n    Receives the NODE_FOR node.
+ * @return The token after "done", or NULL after printing a syntax error.
+ */
+static struct token *parse_for(struct arena *a, const char *line, struct token *t, struct node **n)
+{
+    (void)line;
+    if (t->type != TOK_WORD || t->quoted || t->expand || !var_valid_name(t->text, strlen(t->text)))
+    {
+        syntax_error(t);
+        return NULL;
+    }
+    *n = make_node(a, NODE_FOR, arena_alloc(a, sizeof(struct pipeline)), NULL, NULL);
+    (*n)->name = t->text;
+    t = skip_newlines(t + 1);
+
+    struct pipeline *pl = (*n)->pipeline;
+    struct stage *st = arena_alloc(a, sizeof(struct stage));
+    memset(pl, 0, sizeof(*pl));
+    memset(st, 0, sizeof(*st));
+    pl->stages = st;
+    pl->nstages = 1;
+    pl->text = "for";
+
+    if (is_keyword(t, "in"))
+    {
+        struct token *first = ++t;
+        while (t->type == TOK_WORD)
+        {
+            t++;
+        }
+        st->argv = arena_alloc(a, (t - first + 1) * sizeof(char *));
+        for (struct token *w = first; w < t; w++)
+        {
+            st->argv[w - first] = w->text;
+            st->expand |= w->expand;
+        }
+        st->argv[t - first] = NULL;
+        if (t->type != TOK_SEMI && t->type != TOK_NEWLINE)
+        {
+            syntax_error(t);
+            return NULL;
+        }
+    }
+    else
+    {
+        static char all[] = {LEX_QPARAM, '@', LEX_PARAM_END, '\0'};     // "$@"
+        st->argv = arena_alloc(a, 2 * sizeof(char *));
+        st->argv[0] = all;
+        st->argv[1] = NULL;
+        st->expand = 1;
+    }
+    pl->expand = st->expand;
+    if (t->type == TOK_SEMI)
+    {
+        t++;
+    }
+    t = skip_newlines(t);
+
+    if ((t = expect(t, "do")) == NULL || ((*n)->left = parse_list(a, line, &t, 1)) == NULL)
+    {
+        return NULL;
+    }
+    return expect(t, "done");
+}
+
+/**
+ * @brief Parses a compound command: an if, a while, until or for loop,
+ *        or a "{ list; }" group.
+ *
+ * @param a    The arena for the tree.
+ * @param line The line.
+ * @param t    The reserved word starting it (see compound_keyword()).
+ * @param body Receives the command's tree; for "{ list; }" that is just
+ *             the list.
+ * @return The token after its closing reserved word, or NULL after
+ *         printing a syntax error.
+ */
+struct token *parse_compound(struct arena *a, const char *line, struct token *t, struct node **body)
+{
+    const char *keyword = t->text;
+
+    open_constructs++;
+    t++;
+    if (strcmp(keyword, "{") == 0)
+    {
+        if ((*body = parse_list(a, line, &t, 1)) == NULL || (t = expect(t, "}")) == NULL)
+        {
+            return NULL;
+        }
+    }
+    else if (strcmp(keyword, "if") == 0)
+    {
+        if ((t = parse_if(a, line, t, body)) == NULL)
+        {
+            return NULL;
+        }
+    }
+    else if (strcmp(keyword, "for") == 0)
+    {
+        if ((t = parse_for(a, line, t, body)) == NULL)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        struct node *n = make_node(a, keyword[0] == 'w' ? NODE_WHILE : NODE_UNTIL, NULL, NULL, NULL);
+        if ((n->left = parse_list(a, line, &t, 1)) == NULL || (t = expect(t, "do")) == NULL ||
+            (n->right = parse_list(a, line, &t, 1)) == NULL || (t = expect(t, "done")) == NULL)
+        {
+            return NULL;
+        }
+        *body = n;
+    }
+    open_constructs--;
+    return t;
+}
+
+/**
+ * @brief Reads the body of every here-document in a tree, in the order
+ *        they appear in the text.
+ *
+ * Bodies that parse_line() already read, while the command went on over
+ * more lines, are taken from its queue first. A body whose delimiter was
+ * not quoted has its references marked, and its stage is expanded when
+ * it runs.
+ *
+ * @param a The arena the bodies are stored in.
+ * @param n The tree, or NULL.
+ * @return none
+ */
+static void read_heredocs(struct arena *a, struct node *n)
+{
+    if (n == NULL)
+    {
+        return;
+    }
+    if (n->type != NODE_PIPELINE)
+    {
+        read_heredocs(a, n->left);
+        read_heredocs(a, n->right);
+        read_heredocs(a, n->other);
+        return;
+    }
+    for (int i = 0; i < n->pipeline->nstages; i++)
+    {
+        struct stage *st = &n->pipeline->stages[i];
+        read_heredocs(a, st->group);
+        for (int k = 0; k < st->nredirs; k++)
+        {
+            if (st->redirs[k].type != REDIR_HEREDOC)
+            {
+                continue;
+            }
+            if (queued != NULL)
+            {
+                st->redirs[k].body = queued->body;
+                queued = queued->next;
+            }
+            else
+            {
+                read_heredoc(a, &st->redirs[k]);
+            }
+            if (st->redirs[k].expand_body)
+            {
+                st->redirs[k].body = lex_heredoc(a, st->redirs[k].body);
+                if (strchr(st->redirs[k].body, LEX_QPARAM) != NULL)
+                {
+                    st->expand = 1;
+                    n->pipeline->expand = 1;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Copies a stage for node_copy().
+ *
+ * @param a    The arena.
+ * @param to   The copy.
+ * @param from The stage.
+ * @return none
+ */
+static void stage_copy(struct arena *a, struct stage *to, const struct stage *from)
+{
+    int argc = 0;
+    while (from->argv[argc] != NULL)
+    {
+        argc++;
+    }
+
+    *to = *from;
+    to->argv = arena_alloc(a, (argc + 1) * sizeof(char *));
+    for (int i = 0; i <= argc; i++)
+    {
+        to->argv[i] = from->argv[i] != NULL ? arena_strdup(a, from->argv[i]) : NULL;
+    }
+    if (from->nredirs > 0)
+    {
+        to->redirs = arena_alloc(a, from->nredirs * sizeof(struct redir));
+        for (int i = 0; i < from->nredirs; i++)
+        {
+            to->redirs[i] = from->redirs[i];
+            to->redirs[i].word = from->redirs[i].word ? arena_strdup(a, from->redirs[i].word) : NULL;
+            to->redirs[i].body = from->redirs[i].body ? arena_strdup(a, from->redirs[i].body) : NULL;
+        }
+    }
+    if (from->nprocsubs > 0)
+    {
+        to->procsubs = arena_alloc(a, from->nprocsubs * sizeof(struct procsub));
+        for (int i = 0; i < from->nprocsubs; i++)
+        {
+            to->procsubs[i].list = node_copy(a, from->procsubs[i].list);
+            to->procsubs[i].output = from->procsubs[i].output;
+        }
+    }
+    to->group = node_copy(a, from->group);
+}
+
+/**
+ * @brief Copies a parsed tree, with all its pipelines and words, into
+ *        another arena, so that it outlives the line it came from.
+ *
+ * @param a The arena for the copy.
+ * @param n The tree, or NULL.
+ * @return The copy, or NULL.
+ */
+struct node *node_copy(struct arena *a, const struct node *n)
+{
+    if (n == NULL)
+    {
+        return NULL;
+    }
+
+    struct node *copy = arena_alloc(a, sizeof(struct node));
+    *copy = *n;
+    copy->left = node_copy(a, n->left);
+    copy->right = node_copy(a, n->right);
+    copy->other = node_copy(a, n->other);
+    copy->name = n->name != NULL ? arena_strdup(a, n->name) : NULL;
+    if (n->pipeline != NULL)
+    {
+        const struct pipeline *pl = n->pipeline;
+        struct pipeline *p = arena_alloc(a, sizeof(struct pipeline));
+        *p = *pl;
+        p->text = arena_strdup(a, pl->text);
+        p->trace_key = pl->trace_key != NULL ? arena_strdup(a, pl->trace_key) : NULL;
+        p->stages = arena_alloc(a, pl->nstages * sizeof(struct stage));
+        for (int i = 0; i < pl->nstages; i++)
+        {
+            stage_copy(a, &p->stages[i], &pl->stages[i]);
+        }
+        copy->pipeline = p;
+    }
+    return copy;
+}
+
+/**
+ * @brief Lexes and parses a line into an arena.
+ *
+ * @param a    The arena.
+ * @param line The line, or several joined by newlines.
+ * @return The tree, or NULL for a blank line or after printing an error;
+ *         parse_incomplete is set instead of printing one if the text
+ *         ends inside a command.
+ */
+static struct node *parse_into(struct arena *a, const char *line)
+{
+    struct token *tokens = lex_line(a, line);
+    parse_incomplete = lex_unfinished;
+    open_constructs = 0;
+    if (tokens == NULL || skip_newlines(tokens)->type == TOK_END)
+    {
+        return NULL;
+    }
+
+    struct token *t = tokens;
+    parse_tokens = tokens;
+    struct node *root = parse_list(a, line, &t, 0);
+    parse_tokens = NULL;
+    if (root != NULL && t->type != TOK_END)
+    {
+        syntax_error(t);    // a ')' with no '(', or a "fi" with no "if"
+        return NULL;
+    }
+    return root;
+}
+
+/**
+ * @brief Reads the here-documents of a line of an unfinished command,
+ *        whose bodies follow that line rather than the whole command.
+ *
+ * @param a    The arena the bodies are stored in.
+ * @param line The line.
+ * @return none
+ */
+static void queue_heredocs(struct arena *a, const char *line)
+{
+    struct token *t = lex_line(a, line);
+
+    for (; t != NULL && t->type != TOK_END; t++)
+    {
+        if ((t->type == TOK_DLESS || t->type == TOK_DLESSDASH) && t[1].type == TOK_WORD)
+        {
+            struct redir r = {REDIR_HEREDOC, STDIN_FILENO, -1, t[1].text, NULL,
+                              t->type == TOK_DLESSDASH};
+            struct queued_body *q = arena_alloc(a, sizeof(struct queued_body));
+            read_heredoc(a, &r);
+            q->body = r.body;
+            q->next = NULL;
+            *queue_tail = q;
+            queue_tail = &q->next;
+        }
+    }
+}
+
+/**
+ * @brief Reads lines until an unfinished command is complete, and
+ *        parses them as one text.
+ *
+ * Each further line is read with a "> " prompt at a terminal, joined on
+ * with a newline, and the whole text parsed again into the caller's
+ * arena; the failed attempts are rewound, so a long function body read
+ * line by line does not pile up copies of itself.
+ *
+ * @param a     The caller's per-line arena.
+ * @param first The command's first line.
+ * @return The tree, or NULL after printing an error, which includes the
+ *         input ending first.
+ */
+static struct node *parse_continued(struct arena *a, const char *first)
+{
+    static char *text = NULL;
+    static size_t text_cap = 0;
+    const char *line = first;
+    size_t len = 0, line_start = 0;
+
+    for (;;)
+    {
+        size_t n = strlen(line);
+        if (len + n + 2 > text_cap)
+        {
+            text_cap = (len + n + 2) * 2;
+            text = realloc(text, text_cap);
+            if (!text)
+            {
+                fprintf(stderr, "dragonshell: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (len > 0)
+        {
+            text[len++] = '\n';
+        }
+        line_start = len;
+        memcpy(text + len, line, n + 1);
+        len += n;
+
+        if (len > n)
+        {
+            struct arena_mark mark = arena_save(a);
+            struct node *root = parse_into(a, text);
+            if (!parse_incomplete)
+            {
+                if (root != NULL)
+                {
+                    read_heredocs(a, root);
+                }
+                return root;
+            }
+            arena_rewind(a, mark);
+        }
+
+        queue_heredocs(a, text + line_start);
+        line = input_is_interactive() ? events_read_line("> ") : read_line();
+        if (line == NULL)
+        {
+            fprintf(stderr, "dragonshell: syntax error: unexpected end of file\n");
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Turns a command line into its syntax tree.
+ *
+ * A line seen recently comes straight from the cache. Otherwise it is
+ * parsed into the least recently used entry, or into the caller's arena
+ * if it has here-documents, whose bodies are then read from the input.
+ * A line that leaves a command unfinished, such as "while true; do", is
+ * not cached either: the lines that complete it are read and the whole
+ * command is parsed into the caller's arena.
+ * The tree must not be modified; it stays valid until the next call.
+ *
+ * @param a    The caller's per-line arena, for lines that are not cached.
+ * @param line The command line.
+ * @return The tree, or NULL for a blank line or after printing an error.
+ */
+struct node *parse_line(struct arena *a, const char *line)
+{
+    queued = NULL;
+    queue_tail = &queued;
+    if (strstr(line, "<<") != NULL)
+    {
+        struct arena_mark mark = arena_save(a);
+        struct node *root = parse_into(a, line);
+        if (parse_incomplete)
+        {
+            arena_rewind(a, mark);
+            return parse_continued(a, line);
+        }
+        if (root != NULL)
+        {
+            read_heredocs(a, root);
+        }
+        return root;
+    }
+
+    unsigned h = hash_line(line);
+    for (struct cache_entry *e = buckets[h % PARSE_CACHE_BUCKETS]; e; e = e->chain)
+    {
+        if (e->hash == h && strcmp(e->line, line) == 0)
+        {
+            lru_unlink(e);
+            lru_insert(e);
+            return e->root;
+        }
+    }
+
+    struct cache_entry *e;
+    if (cache_used < PARSE_CACHE_SIZE)
+    {
+        e = &cache[cache_used++];
+    }
+    else
+    {
+        e = oldest;
+        lru_unlink(e);
+        if (e->line != NULL)
+        {
+            bucket_remove(e);
+        }
+        arena_reset(&e->arena);
+    }
+
+    e->root = parse_into(&e->arena, line);
+    e->line = NULL;
+    if (e->root != NULL)
+    {
+        e->hash = h;
+        e->line = arena_strdup(&e->arena, line);
+        e->chain = buckets[h % PARSE_CACHE_BUCKETS];
+        buckets[h % PARSE_CACHE_BUCKETS] = e;
+    }
+    lru_insert(e);
+    if (parse_incomplete)
+    {
+        return parse_continued(a, line);
+    }
+    return e->root;
+}
+
+/**
+ * @brief Tells whether a tree has a here-document in it.
+ *
+ * @param n The tree, or NULL.
+ * @return 1 if it does, 0 otherwise.
+ */
+static int has_heredoc(const struct node *n)
+{
+    if (n == NULL)
+    {
+        return 0;
+    }
+    if (n->type != NODE_PIPELINE)
+    {
+        return has_heredoc(n->left) || has_heredoc(n->right) || has_heredoc(n->other);
+    }
+    for (int i = 0; i < n->pipeline->nstages; i++)
+    {
+        const struct stage *st = &n->pipeline->stages[i];
+        if (has_heredoc(st->group))
+        {
+            return 1;
+        }
+        for (int k = 0; k < st->nredirs; k++)
+        {
+            if (st->redirs[k].type == REDIR_HEREDOC)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses a text that must be a whole command in itself, such as
+ *        that of a "$(command)".
+ *
+ * Nothing more is read from the input: a text that ends inside a
+ * command is an error, and so is a here-document, whose body would have
+ * to come from the input.
+ *
+ * @param a    The arena the tree is allocated from.
+ * @param text The text.
+ * @return The tree, or NULL for a blank text or after printing an error.
+ */
+struct node *parse_text(struct arena *a, const char *text)
+{
+    struct node *root = parse_into(a, text);
+    if (parse_incomplete)
+    {
+        fprintf(stderr, "dragonshell: syntax error: unexpected end of file\n");
+        return NULL;
+    }
+    if (has_heredoc(root))
+    {
+        fprintf(stderr, "dragonshell: here-documents are not supported in command substitutions\n");
+        return NULL;
+    }
+    return root;
+}
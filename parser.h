@@ -0,0 +1,56 @@
+/****************************************************************************
+
+  @file         parser.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Parses a command line into a syntax tree, keeping recently
+                parsed lines in an LRU cache.
+
+*******************************************************************************/
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "arena.h"
+#include "pipeline.h"
+
+enum node_type
+{
+    NODE_PIPELINE,      // one pipeline; its background flag covers '&'
+    NODE_SEQUENCE,      // left, then right (";" or "&" between them)
+    NODE_AND,           // left && right
+    NODE_OR,            // left || right
+    NODE_IF,            // if left; then right; else other; fi
+    NODE_WHILE,         // while left; do right; done
+    NODE_UNTIL,         // until left; do right; done
+    NODE_FOR,           // for name in pipeline's words; do left; done
+    NODE_FUNCTION       // name() left
+};
+
+/**
+ * A node of the syntax tree. Leaves are pipelines; inner nodes say how
+ * their children are combined. An if or a loop is the group of a
+ * pipeline stage, so it can be piped and redirected like a command.
+ */
+struct node
+{
+    enum node_type type;
+    struct pipeline *pipeline;      // NODE_PIPELINE; NODE_FOR: its words, as a stage's argv
+    struct node *left, *right;      // lists: both sides; if and loops: the condition and the
+                                    // body; for and functions: left is the body
+    struct node *other;             // NODE_IF: the elif or else part, or NULL
+    const char *name;               // NODE_FOR: the variable; NODE_FUNCTION: the function
+};
+
+struct node *parse_line(struct arena *a, const char *line);
+struct node *parse_text(struct arena *a, const char *text);
+struct token *parse_group(struct arena *a, const char *line, struct token *t, struct node **group);
+const char *compound_keyword(const struct token *t);
+struct token *parse_compound(struct arena *a, const char *line, struct token *t, struct node **body);
+int closes_list(const struct token *t);
+struct token *skip_newlines(struct token *t);
+int parse_unfinished(const struct token *tok);
+struct node *node_copy(struct arena *a, const struct node *n);
+
+#endif
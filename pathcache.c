@@ -0,0 +1,442 @@
+/****************************************************************************
+
+  @file         pathcache.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Remembers where each command was found on $PATH so that the
+                shell can execv() it directly instead of letting execvp()
+                try (and fail) every $PATH directory on every command.
+
+*******************************************************************************/
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pathcache.h"
+#include "vars.h"
+#include "pathtrie.h"
+
+#define PATH_CACHE_BUCKETS 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define SCRIPT_SHELL "/bin/sh"      // runs files without a "#!" line
+
+struct path_entry
+{
+    char *name;
+    char *path;
+    unsigned hits;
+    struct path_entry *next;
+};
+
+static struct path_entry **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t nentries = 0;
+static char *cached_path_var = NULL;  // $PATH the entries were resolved against
+
+/**
+ * @brief FNV-1a hash of a command name.
+ *
+ * @param s The string to hash.
+ * @return The 32-bit hash value.
+ */
+static unsigned hash_name(const char *s)
+{
+    unsigned h = 2166136261u;
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Doubles the bucket array and rehashes every entry into it.
+ *
+ * @param none
+ * @return none
+ */
+static void grow_table(void)
+{
+    size_t new_size = nbuckets ? nbuckets * 2 : PATH_CACHE_BUCKETS;
+    struct path_entry **new_buckets = calloc(new_size, sizeof(*new_buckets));
+    if (!new_buckets && nbuckets == 0)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!new_buckets)
+    {
+        return;  // keep using the old, more crowded table
+    }
+
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        struct path_entry *e = buckets[i];
+        while (e)
+        {
+            struct path_entry *next = e->next;
+            size_t b = hash_name(e->name) & (new_size - 1);
+            e->next = new_buckets[b];
+            new_buckets[b] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    nbuckets = new_size;
+}
+
+/**
+ * @brief Drops every entry if $PATH changed since they were resolved.
+ *
+ * @param none
+ * @return none
+ */
+static void check_path_var(void)
+{
+    const char *path = var_get("PATH");
+    if (path == NULL)
+    {
+        path = DEFAULT_PATH;
+    }
+    if (cached_path_var != NULL && strcmp(cached_path_var, path) == 0)
+    {
+        return;
+    }
+    path_flush();
+    cached_path_var = strdup(path);
+}
+
+/**
+ * @brief Searches each $PATH directory for an executable regular file.
+ *
+ * An empty $PATH element means the current directory, as for execvp().
+ * At an interactive prompt the $PATH trie has usually seen the name
+ * already, and only the directory it names is checked.
+ *
+ * @param name The command name (contains no '/').
+ * @return A malloc'd absolute path, or NULL if it was not found.
+ */
+static char *search_path(const char *name)
+{
+    const char *dir = cached_path_var;
+    size_t name_len = strlen(name);
+    struct stat st;
+
+    // The completion trie usually knows the directory already
+    const char *known = pathtrie_lookup(name);
+    if (known != NULL)
+    {
+        char *candidate = malloc(strlen(known) + name_len + 2);
+        if (!candidate)
+        {
+            return NULL;
+        }
+        sprintf(candidate, "%s/%s", known, name);
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+        {
+            return candidate;
+        }
+        free(candidate);
+    }
+
+    while (dir != NULL)
+    {
+        const char *colon = strchr(dir, ':');
+        size_t dir_len = colon ? (size_t)(colon - dir) : strlen(dir);
+        char *candidate = malloc(dir_len + name_len + 3);
+
+        if (!candidate)
+        {
+            return NULL;
+        }
+        if (dir_len == 0)
+        {
+            sprintf(candidate, "./%s", name);
+        }
+        else
+        {
+            sprintf(candidate, "%.*s/%s", (int)dir_len, dir, name);
+        }
+
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(candidate, X_OK) == 0)
+        {
+            return candidate;
+        }
+        free(candidate);
+        dir = colon ? colon + 1 : NULL;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Resolves a command name to the path it should be executed from.
+ *
+ * Names containing a '/' are returned unchanged. Otherwise the table is
+ * consulted first and $PATH is only searched on a miss; the result is
+ * remembered until $PATH changes, the entry is forgotten or the table
+ * is flushed.
+ *
+ * @param name The command name (argv[0]).
+ * @return The path to execv(), or NULL with errno set to ENOENT.
+ */
+const char *path_lookup(const char *name)
+{
+    if (strchr(name, '/') != NULL)
+    {
+        return name;
+    }
+
+    check_path_var();
+
+    unsigned h = hash_name(name);
+    if (nbuckets)
+    {
+        for (struct path_entry *e = buckets[h & (nbuckets - 1)]; e; e = e->next)
+        {
+            if (strcmp(e->name, name) == 0)
+            {
+                e->hits++;
+                return e->path;
+            }
+        }
+    }
+
+    char *path = search_path(name);
+    if (path == NULL)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    struct path_entry *e = malloc(sizeof(*e));
+    if (!e || !(e->name = strdup(name)))
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (nentries >= nbuckets)
+    {
+        grow_table();
+    }
+    e->path = path;
+    e->hits = 1;
+    size_t b = h & (nbuckets - 1);
+    e->next = buckets[b];
+    buckets[b] = e;
+    nentries++;
+    return e->path;
+}
+
+/**
+ * @brief Removes one command from the table.
+ *
+ * Called when executing a remembered path fails with ENOENT, so the next
+ * use of the command searches $PATH again.
+ *
+ * @param name The command name.
+ * @return none
+ */
+void path_forget(const char *name)
+{
+    if (!nbuckets)
+    {
+        return;
+    }
+    struct path_entry **link = &buckets[hash_name(name) & (nbuckets - 1)];
+    while (*link)
+    {
+        struct path_entry *e = *link;
+        if (strcmp(e->name, name) == 0)
+        {
+            *link = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            nentries--;
+            return;
+        }
+        link = &e->next;
+    }
+}
+
+/**
+ * @brief Empties the table.
+ *
+ * @param none
+ * @return none
+ */
+void path_flush(void)
+{
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        struct path_entry *e = buckets[i];
+        while (e)
+        {
+            struct path_entry *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+    nentries = 0;
+    free(cached_path_var);
+    cached_path_var = NULL;
+}
+
+/**
+ * @brief Builds the argument vector that runs a file as a script of
+ *        SCRIPT_SHELL: the shell, the file, then the file's arguments.
+ *
+ * @param path The file.
+ * @param argv Its argument vector.
+ * @param args Receives the vector; it needs one more entry than argv.
+ * @return none
+ */
+static void script_args(const char *path, char **argv, char **args)
+{
+    args[0] = SCRIPT_SHELL;
+    args[1] = (char *)path;
+    int i = 1;
+    for (; argv[i] != NULL; i++)
+    {
+        args[i + 1] = argv[i];
+    }
+    args[i + 1] = NULL;
+}
+
+/**
+ * @brief Counts an argument vector.
+ *
+ * @param argv The vector.
+ * @return How many entries precede its NULL.
+ */
+static int count_args(char **argv)
+{
+    int n = 0;
+    while (argv[n] != NULL)
+    {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief posix_spawn()s a path from path_lookup().
+ *
+ * A file the kernel will not run (ENOEXEC: a script without a "#!"
+ * line) is run by SCRIPT_SHELL instead, as execvp() would.
+ *
+ * @param pid     Receives the child's pid.
+ * @param path    The program.
+ * @param actions File actions, or NULL.
+ * @param attr    Attributes, or NULL.
+ * @param argv    Its argument vector.
+ * @param envp    Its environment.
+ * @return 0, or an errno value as from posix_spawn().
+ */
+int path_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *actions,
+               const posix_spawnattr_t *attr, char **argv, char **envp)
+{
+    int err = posix_spawn(pid, path, actions, attr, argv, envp);
+    if (err != ENOEXEC)
+    {
+        return err;
+    }
+    char *args[count_args(argv) + 2];
+    script_args(path, argv, args);
+    return posix_spawn(pid, SCRIPT_SHELL, actions, attr, args, envp);
+}
+
+/**
+ * @brief execve()s a path from path_lookup(), in a forked child, with
+ *        the same fallback to SCRIPT_SHELL as path_spawn().
+ *
+ * @param path The program.
+ * @param argv Its argument vector.
+ * @param envp Its environment.
+ * @return Only on failure, with errno set.
+ */
+void path_exec(const char *path, char **argv, char **envp)
+{
+    execve(path, argv, envp);
+    if (errno == ENOEXEC)
+    {
+        char *args[count_args(argv) + 2];
+        script_args(path, argv, args);
+        execve(SCRIPT_SHELL, args, envp);
+    }
+}
+
+/**
+ * @brief The "hash" builtin.
+ *
+ *   hash            list remembered commands with their hit counts
+ *   hash -r         forget every remembered command
+ *   hash -d name... forget the named commands
+ *   hash -t name... print the path each name resolves to
+ *   hash name...    look the names up and remember them
+ *
+ * @param args The argument vector, args[0] being "hash".
+ * @return 0 on success, 1 if a name could not be found.
+ */
+int hash_builtin(char **args)
+{
+    int status = 0;
+
+    if (args[1] == NULL)
+    {
+        check_path_var();
+        if (nentries == 0)
+        {
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < nbuckets; i++)
+        {
+            for (struct path_entry *e = buckets[i]; e; e = e->next)
+            {
+                printf("%4u\t%s\n", e->hits, e->path);
+            }
+        }
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0)
+    {
+        path_flush();
+        return 0;
+    }
+
+    int forget = strcmp(args[1], "-d") == 0;
+    int print = strcmp(args[1], "-t") == 0;
+    for (int i = (forget || print) ? 2 : 1; args[i] != NULL; i++)
+    {
+        if (forget)
+        {
+            path_forget(args[i]);
+            continue;
+        }
+        const char *path = path_lookup(args[i]);
+        if (path == NULL)
+        {
+            fprintf(stderr, "dragonshell: hash: %s: not found\n", args[i]);
+            status = 1;
+        }
+        else if (print)
+        {
+            printf("%s\n", path);
+        }
+    }
+    return status;
+}
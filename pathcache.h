@@ -0,0 +1,26 @@
+/****************************************************************************
+
+  @file         pathcache.h
+
+  @author       Ahnaful Hoque
+
+  @brief        bash-style hash table mapping command names to the absolute
+                paths found on $PATH.
+
+*******************************************************************************/
+
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <sys/types.h>
+#include <spawn.h>
+
+const char *path_lookup(const char *name);
+void path_forget(const char *name);
+void path_flush(void);
+int path_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *actions,
+               const posix_spawnattr_t *attr, char **argv, char **envp);
+void path_exec(const char *path, char **argv, char **envp);
+int hash_builtin(char **args);
+
+#endif
@@ -0,0 +1,471 @@
+/****************************************************************************
+
+  @file         pathtrie.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Indexes the executables in $PATH by prefix.
+
+                Completing a command name must not mean listing every
+                $PATH directory on every Tab, so the names are kept in a
+                trie. Each node is one character; its children are a
+                sorted sibling list, so walking a prefix and then the
+                subtree below it yields the completions already in order.
+                A name's node records, as a bit per directory, which
+                $PATH directories hold an executable of that name, so the
+                same name in two directories is counted once and the
+                first one in $PATH order is known at a glance.
+
+                Building it never delays the prompt: the event loop scans
+                one directory each time it is idle, and only a Tab
+                pressed before it is done finishes the scan on the spot.
+                Each directory gets an inotify watch before it is read,
+                and the watch's events set or clear that directory's bit
+                for a name, so a new install is completable at once and
+                nothing is rescanned. The trie starts over when $PATH
+                itself changes. path_lookup() asks it first, which saves
+                a stat() per $PATH directory on a command's first run.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+
+#include "arena.h"
+#include "pathtrie.h"
+#include "events.h"
+#include "vars.h"
+
+#define PATHTRIE_MAX_DIRS 64        // one bit each in a node's dirs
+#define PATHTRIE_EVENTS 4096
+#define DEFAULT_PATH "/bin:/usr/bin"
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                    IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * One character of one or more names.
+ */
+struct trie_node
+{
+    int child;          // first child (smallest character), or 0
+    int sibling;        // next larger character under the same parent, or 0
+    uint64_t dirs;      // the $PATH directories with an executable of this name
+    unsigned char c;
+};
+
+static struct trie_node *nodes = NULL;  // nodes[0] is the root
+static int nnodes = 0;
+static int nodes_cap = 0;
+
+static int started = 0;                 // pathtrie_init() was called
+static int epoll_fd = -1;
+static int inotify_fd = -1;
+static char *trie_path = NULL;          // the $PATH the trie describes
+static char *dirs[PATHTRIE_MAX_DIRS];
+static int watches[PATHTRIE_MAX_DIRS];  // each directory's inotify descriptor
+static int ndirs = 0;
+static int scanned = 0;                 // directories read so far
+static int has_relative = 0;            // $PATH has an entry resolved against the current directory
+
+/**
+ * @brief Finds a node's child for a character, adding it if asked.
+ *
+ * @param parent The node.
+ * @param c      The character.
+ * @param create Add the child when it is missing.
+ * @return The child's index, or 0 if it is missing.
+ */
+static int child_of(int parent, unsigned char c, int create)
+{
+    int *link = &nodes[parent].child;
+    while (*link != 0 && nodes[*link].c < c)
+    {
+        link = &nodes[*link].sibling;
+    }
+    if (*link != 0 && nodes[*link].c == c)
+    {
+        return *link;
+    }
+    if (!create)
+    {
+        return 0;
+    }
+
+    if (nnodes == nodes_cap)
+    {
+        nodes_cap *= 2;
+        nodes = check_alloc(realloc(nodes, nodes_cap * sizeof(struct trie_node)));
+        link = NULL;    // nodes moved: find the link again below
+    }
+    int n = nnodes++;
+    nodes[n] = (struct trie_node){0, 0, 0, c};
+
+    if (link == NULL)
+    {
+        link = &nodes[parent].child;
+        while (*link != 0 && nodes[*link].c < c)
+        {
+            link = &nodes[*link].sibling;
+        }
+    }
+    nodes[n].sibling = *link;
+    *link = n;
+    return n;
+}
+
+/**
+ * @brief Finds the node of a name or prefix.
+ *
+ * @param name   The name.
+ * @param create Add the missing nodes.
+ * @return The node, or 0 if it is missing (or name is "", the root).
+ */
+static int find_node(const char *name, int create)
+{
+    int n = 0;
+    for (const char *p = name; *p != '\0'; p++)
+    {
+        n = child_of(n, *p, create);
+        if (n == 0)
+        {
+            return 0;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Tells whether a directory entry is something $PATH would run.
+ *
+ * @param dir  The directory.
+ * @param name The entry.
+ * @return 1 for an executable regular file (or a link to one), 0 otherwise.
+ */
+static int is_executable(const char *dir, const char *name)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+    {
+        return 0;
+    }
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/**
+ * @brief Records whether a directory has an executable of some name.
+ *
+ * @param name The name.
+ * @param dir  The directory's index.
+ * @param on   1 if it does, 0 if it no longer does.
+ * @return none
+ */
+static void mark(const char *name, int dir, int on)
+{
+    int n = find_node(name, on);
+    if (n == 0)
+    {
+        return;
+    }
+    if (on)
+    {
+        nodes[n].dirs |= (uint64_t)1 << dir;
+    }
+    else
+    {
+        nodes[n].dirs &= ~((uint64_t)1 << dir);
+    }
+}
+
+/**
+ * @brief Makes the trie describe the current $PATH, emptying it when
+ *        $PATH has changed.
+ *
+ * @param none
+ * @return none
+ */
+static void check_path(void)
+{
+    const char *path = var_get("PATH");
+    if (path == NULL)
+    {
+        path = DEFAULT_PATH;
+    }
+    if (trie_path != NULL && strcmp(trie_path, path) == 0)
+    {
+        return;
+    }
+
+    // Closing the inotify descriptor drops every watch with it
+    if (inotify_fd != -1)
+    {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    for (int i = 0; i < ndirs; i++)
+    {
+        free(dirs[i]);
+    }
+    free(trie_path);
+    trie_path = check_alloc(strdup(path));
+    ndirs = 0;
+    scanned = 0;
+    has_relative = 0;
+    if (nodes_cap == 0)
+    {
+        nodes_cap = 4096;
+        nodes = check_alloc(malloc(nodes_cap * sizeof(struct trie_node)));
+    }
+    nodes[0] = (struct trie_node){0, 0, 0, 0};  // the root
+    nnodes = 1;
+
+    for (const char *dir = trie_path; dir != NULL;)
+    {
+        const char *colon = strchr(dir, ':');
+        size_t len = colon ? (size_t)(colon - dir) : strlen(dir);
+        if (len == 0 || dir[0] != '/')
+        {
+            has_relative = 1;   // "", "." or "bin" mean something else after a cd
+        }
+        else if (ndirs < PATHTRIE_MAX_DIRS)
+        {
+            dirs[ndirs++] = check_alloc(strndup(dir, len));
+        }
+        dir = colon ? colon + 1 : NULL;
+    }
+}
+
+/**
+ * @brief Starts indexing $PATH in the background of the prompt.
+ *
+ * Nothing is read yet; the event loop calls pathtrie_step() whenever it
+ * is idle, and inotify events arrive in its epoll set.
+ *
+ * @param fd The event loop's epoll descriptor.
+ * @return none
+ */
+void pathtrie_init(int fd)
+{
+    epoll_fd = fd;
+    started = 1;
+}
+
+/**
+ * @brief Tells whether there are directories still to be read.
+ *
+ * @param none
+ * @return 1 if pathtrie_step() has work to do, 0 otherwise.
+ */
+int pathtrie_pending(void)
+{
+    if (!started)
+    {
+        return 0;
+    }
+    check_path();
+    return scanned < ndirs;
+}
+
+/**
+ * @brief Reads the next $PATH directory into the trie.
+ *
+ * @param none
+ * @return none
+ */
+void pathtrie_step(void)
+{
+    check_path();
+    if (scanned >= ndirs)
+    {
+        return;
+    }
+    if (inotify_fd == -1)
+    {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd != -1 && epoll_fd != -1)
+        {
+            struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EVENT_DATA(EVENT_PATH, 0)};
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &ev);
+        }
+    }
+
+    // Watch first, so nothing added during the read is missed
+    int i = scanned++;
+    const char *dir = dirs[i];
+    watches[i] = inotify_fd == -1 ? -1 : inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+    {
+        return;
+    }
+    for (struct dirent *e; (e = readdir(d)) != NULL;)
+    {
+        if (e->d_name[0] != '.' && (e->d_type == DT_REG || e->d_type == DT_LNK || e->d_type == DT_UNKNOWN) &&
+            is_executable(dir, e->d_name))
+        {
+            mark(e->d_name, i, 1);
+        }
+    }
+    closedir(d);
+}
+
+/**
+ * @brief Applies the inotify events that have arrived.
+ *
+ * @param none
+ * @return none
+ */
+void pathtrie_notify(void)
+{
+    char buf[PATHTRIE_EVENTS] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while (inotify_fd != -1 && (n = read(inotify_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + n;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // Events were lost: read everything again
+                free(trie_path);
+                trie_path = NULL;
+                check_path();
+                return;
+            }
+            int i = 0;
+            while (i < scanned && watches[i] != ev->wd)
+            {
+                i++;
+            }
+            if (i == scanned || ev->len == 0 || ev->name[0] == '.')
+            {
+                continue;
+            }
+            mark(ev->name, i, !(ev->mask & (IN_DELETE | IN_MOVED_FROM)) && is_executable(dirs[i], ev->name));
+        }
+    }
+}
+
+/**
+ * @brief Reads every directory not read yet, for a Tab that cannot wait.
+ *
+ * @return none
+ */
+static void finish(void)
+{
+    check_path();
+    while (scanned < ndirs)
+    {
+        pathtrie_step();
+    }
+}
+
+/**
+ * The completions being collected by collect().
+ */
+struct collection
+{
+    struct arena *arena;
+    char **v;
+    int n;
+    int cap;
+    char name[NAME_MAX + 1];
+};
+
+/**
+ * @brief Adds every name in a subtree, in order.
+ *
+ * @param c     The collection; c->name holds the name down to here.
+ * @param node  The subtree's root.
+ * @param depth The length of that name.
+ * @return none
+ */
+static void collect(struct collection *c, int node, size_t depth)
+{
+    if (nodes[node].dirs != 0)
+    {
+        if (c->n == c->cap)
+        {
+            int cap = c->cap ? c->cap * 2 : 64;
+            char **v = arena_alloc(c->arena, cap * sizeof(char *));
+            if (c->n > 0)
+            {
+                memcpy(v, c->v, c->n * sizeof(char *));
+            }
+            c->v = v;
+            c->cap = cap;
+        }
+        c->name[depth] = '\0';
+        c->v[c->n++] = arena_strdup(c->arena, c->name);
+    }
+    if (depth >= NAME_MAX)
+    {
+        return;
+    }
+    for (int child = nodes[node].child; child != 0; child = nodes[child].sibling)
+    {
+        c->name[depth] = nodes[child].c;
+        collect(c, child, depth + 1);
+    }
+}
+
+/**
+ * @brief Lists the commands on $PATH that start with a prefix.
+ *
+ * @param a      The arena the names are allocated from.
+ * @param prefix The prefix (no '/').
+ * @param count  Receives the number of names.
+ * @return The names, sorted, or NULL when there are none.
+ */
+char **pathtrie_complete(struct arena *a, const char *prefix, int *count)
+{
+    struct collection c = {a, NULL, 0, 0, ""};
+    size_t len = strlen(prefix);
+
+    finish();
+    int node = find_node(prefix, 0);
+    if ((node != 0 || len == 0) && len <= NAME_MAX)
+    {
+        memcpy(c.name, prefix, len);
+        collect(&c, node, len);
+    }
+    *count = c.n;
+    return c.v;
+}
+
+/**
+ * @brief Finds the first $PATH directory holding a command, when the
+ *        trie is complete and can answer for the current $PATH.
+ *
+ * @param name The command name (no '/').
+ * @return The directory, or NULL if the trie cannot say (the caller
+ *         then searches $PATH itself).
+ */
+const char *pathtrie_lookup(const char *name)
+{
+    if (!started || has_relative || pathtrie_pending())
+    {
+        return NULL;
+    }
+    int n = find_node(name, 0);
+    if (n == 0 || nodes[n].dirs == 0)
+    {
+        return NULL;
+    }
+    return dirs[__builtin_ctzll(nodes[n].dirs)];
+}
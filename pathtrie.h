@@ -0,0 +1,24 @@
+/****************************************************************************
+
+  @file         pathtrie.h
+
+  @author       Ahnaful Hoque
+
+  @brief        A prefix trie of the executables in $PATH, kept current
+                with inotify, for command completion and the path cache.
+
+*******************************************************************************/
+
+#ifndef PATHTRIE_H
+#define PATHTRIE_H
+
+#include "arena.h"
+
+void pathtrie_init(int epoll_fd);
+int pathtrie_pending(void);
+void pathtrie_step(void);
+void pathtrie_notify(void);
+char **pathtrie_complete(struct arena *a, const char *prefix, int *count);
+const char *pathtrie_lookup(const char *name);
+
+#endif
@@ -0,0 +1,816 @@
+/****************************************************************************
+
+  @file         pipeline.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Builds an N-stage pipeline from a single parse and launches
+                every stage at once with posix_spawn().
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <errno.h>
+
+#include "pipeline.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "trace.h"
+#include "fastio.h"
+#include "parser.h"
+#include "builtins.h"
+#include "func.h"
+#include "vars.h"
+#include "shell.h"
+
+/**
+ * @brief Reports a token the parser did not expect.
+ *
+ * @param tok The offending token.
+ * @return -1, for the caller to return.
+ */
+int syntax_error(const struct token *tok)
+{
+    if (parse_unfinished(tok))
+    {
+        return -1;      // not an error yet: the parser reads another line
+    }
+    fprintf(stderr, "dragonshell: syntax error near unexpected token `%s'\n",
+            tok->type == TOK_END || tok->type == TOK_NEWLINE ? "newline" : tok->text);
+    return -1;
+}
+
+/**
+ * @brief Tells whether a token ends a pipeline.
+ *
+ * @param type The token type.
+ * @return 1 for ';', '&', '&&', '||', ')', a newline and the end of the
+ *         line, 0 otherwise.
+ */
+static int pipeline_end(enum token_type type)
+{
+    return type == TOK_END || type == TOK_SEMI || type == TOK_AMP || type == TOK_AND_IF ||
+           type == TOK_OR_IF || type == TOK_RPAREN || type == TOK_NEWLINE;
+}
+
+/**
+ * @brief Tells whether a token ends a stage.
+ *
+ * @param st The stage; after a compound command a reserved word such as
+ *           "fi" or "done" closes the enclosing one, as in "fi fi".
+ * @param t  The token.
+ * @return 1 if it does, 0 otherwise.
+ */
+static int stage_end(const struct stage *st, const struct token *t)
+{
+    return pipeline_end(t->type) || t->type == TOK_PIPE || (st->compound && closes_list(t));
+}
+
+/**
+ * @brief Tells whether a token is a redirection operator.
+ *
+ * @param type The token type.
+ * @return 1 for <, >, >>, <<, <<-, <<<, <&, >&, &> and &>>, 0 otherwise.
+ */
+static int is_redirection(enum token_type type)
+{
+    switch (type)
+    {
+    case TOK_LESS:
+    case TOK_GREAT:
+    case TOK_DGREAT:
+    case TOK_DLESS:
+    case TOK_DLESSDASH:
+    case TOK_TLESS:
+    case TOK_LESSAND:
+    case TOK_GREATAND:
+    case TOK_ANDGREAT:
+    case TOK_ANDDGREAT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Tells whether a token opens a parenthesized list.
+ *
+ * @param type The token type.
+ * @return 1 for '(', "<(" and ">(", 0 otherwise.
+ */
+static int opens_list(enum token_type type)
+{
+    return type == TOK_LPAREN || type == TOK_PROCSUB_IN || type == TOK_PROCSUB_OUT;
+}
+
+/**
+ * @brief Skips a parenthesized list without parsing it.
+ *
+ * @param t The token opening the list.
+ * @return The token after its ')', or the TOK_END of an unclosed list.
+ */
+static struct token *skip_list(struct token *t)
+{
+    int depth = 0;
+    do
+    {
+        if (opens_list(t->type))
+        {
+            depth++;
+        }
+        else if (t->type == TOK_RPAREN)
+        {
+            depth--;
+        }
+        t++;
+    } while (depth > 0 && t->type != TOK_END);
+    return t;
+}
+
+/**
+ * @brief Parses a "<( list )" or ">( list )" into the stage's list of
+ *        process substitutions.
+ *
+ * @param a    The arena.
+ * @param line The line.
+ * @param tp   The "<(" or ">(" token; advanced past the ')'.
+ * @param st   The stage.
+ * @return The LEX_PROCSUB word standing for it, or NULL after printing a
+ *         syntax error.
+ */
+static char *parse_procsub(struct arena *a, const char *line, struct token **tp, struct stage *st)
+{
+    struct procsub *ps = &st->procsubs[st->nprocsubs];
+    ps->output = (*tp)->type == TOK_PROCSUB_OUT;
+    struct token *t = parse_group(a, line, *tp, &ps->list);
+    if (t == NULL)
+    {
+        return NULL;
+    }
+
+    char *word = arena_alloc(a, 16);
+    snprintf(word, 16, "%c%d", LEX_PROCSUB, st->nprocsubs++);
+    st->expand = 1;
+    *tp = t;
+    return word;
+}
+
+/**
+ * @brief Parses one redirection into the stage's list.
+ *
+ * "&>f" and "&>>f" (and ">&f" with a file name) become two entries,
+ * stdout to the file and then stderr to stdout.
+ *
+ * The word may be a process substitution, as in "> >(tee log)", and a
+ * descriptor after "<&" or ">&" may be a reference such as "$fd", which
+ * is only known once it is expanded.
+ *
+ * @param a    The arena, for a process substitution.
+ * @param line The line.
+ * @param t    The optional TOK_IO_NUMBER, followed by the operator and
+ *             its word.
+ * @param st   The stage; the entries are appended to st->redirs.
+ * @return The number of tokens used, or -1 after printing an error.
+ */
+static int parse_redirection(struct arena *a, const char *line, struct token *t, struct stage *st)
+{
+    int used = 0;
+    int fd = -1;
+
+    if (t->type == TOK_IO_NUMBER)
+    {
+        fd = atoi(t->text);
+        t++;
+        used++;
+    }
+
+    char *word;
+    struct token *after = &t[2];
+    if (t[1].type == TOK_PROCSUB_IN || t[1].type == TOK_PROCSUB_OUT)
+    {
+        if (t->type != TOK_LESS && t->type != TOK_GREAT && t->type != TOK_DGREAT)
+        {
+            return syntax_error(&t[1]);
+        }
+        after = &t[1];
+        word = parse_procsub(a, line, &after, st);
+        if (word == NULL)
+        {
+            return -1;
+        }
+    }
+    else if (t[1].type == TOK_WORD)
+    {
+        word = t[1].text;
+    }
+    else
+    {
+        return syntax_error(&t[1]);
+    }
+
+    struct redir *r = &st->redirs[st->nredirs];
+    *r = (struct redir){REDIR_IN, fd, -1, word, NULL, 0};
+
+    switch (t->type)
+    {
+    case TOK_LESS:
+        r->type = REDIR_IN;
+        break;
+    case TOK_GREAT:
+        r->type = REDIR_OUT;
+        break;
+    case TOK_DGREAT:
+        r->type = REDIR_APPEND;
+        break;
+    case TOK_TLESS:
+        r->type = REDIR_HERESTRING;
+        break;
+    case TOK_DLESS:
+    case TOK_DLESSDASH:
+        r->type = REDIR_HEREDOC;
+        r->strip_tabs = t->type == TOK_DLESSDASH;
+        r->expand_body = !t[1].quoted;
+        break;
+    case TOK_LESSAND:
+    case TOK_GREATAND:
+        if (strcmp(word, "-") == 0)
+        {
+            r->type = REDIR_CLOSE;
+        }
+        else if (word[0] != '\0' && strspn(word, "0123456789") == strlen(word))
+        {
+            r->type = REDIR_DUP;
+            r->source = atoi(word);
+        }
+        else if (t[1].expand && strchr(word, LEX_GLOB) == NULL)
+        {
+            r->type = REDIR_DUP;    // expand.c sets the source, or makes it REDIR_CLOSE
+        }
+        else if (t->type == TOK_GREATAND && fd == -1)
+        {
+            r->type = REDIR_OUT;    // ">&file" is "&>file"
+            r[1] = (struct redir){REDIR_DUP, STDERR_FILENO, STDOUT_FILENO, NULL, NULL, 0};
+            st->nredirs++;
+        }
+        else
+        {
+            fprintf(stderr, "dragonshell: %s: ambiguous redirect\n", word);
+            return -1;
+        }
+        break;
+    case TOK_ANDGREAT:
+    case TOK_ANDDGREAT:
+        r->type = t->type == TOK_ANDGREAT ? REDIR_OUT : REDIR_APPEND;
+        r[1] = (struct redir){REDIR_DUP, STDERR_FILENO, STDOUT_FILENO, NULL, NULL, 0};
+        st->nredirs++;
+        break;
+    default:
+        return syntax_error(t);
+    }
+
+    if (r->fd == -1)
+    {
+        int reads = t->type == TOK_LESS || t->type == TOK_DLESS || t->type == TOK_DLESSDASH ||
+                    t->type == TOK_TLESS || t->type == TOK_LESSAND;
+        r->fd = reads ? STDIN_FILENO : STDOUT_FILENO;
+    }
+    st->expand |= t[1].expand;
+    st->nredirs++;
+    return used + (after - t);
+}
+
+/**
+ * @brief Builds a pipeline from a line's tokens.
+ *
+ * Each '|' starts a new stage; a stage's words become its argv and its
+ * redirections are kept in order in its redirection list, and a stage
+ * may instead be a "( list )" group or a compound command. A leading
+ * "time" keyword asks for the pipeline's resource usage to be reported,
+ * and a '!' for its status to be negated. Parsing stops at the
+ * list operator or end of line that follows the pipeline, which the
+ * caller deals with. All memory comes from the arena, so nothing needs
+ * to be freed.
+ *
+ * @param a      The arena for the stage array and argv vectors.
+ * @param line   The line, for the pipeline's source text.
+ * @param tokens The pipeline's first token.
+ * @param pl     Receives the parsed stages.
+ * @return The token after the pipeline, or NULL after printing a syntax
+ *         error.
+ */
+struct token *parse_pipeline(struct arena *a, const char *line, struct token *tokens,
+                             struct pipeline *pl)
+{
+    int cap = 2;
+    pl->stages = arena_alloc(a, cap * sizeof(struct stage));
+    pl->nstages = 0;
+    pl->background = 0;
+    pl->timed = 0;
+    pl->negate = 0;
+    memset(&pl->usage, 0, sizeof(pl->usage));
+    pl->has_usage = 0;
+    pl->statuses = NULL;
+    pl->stage_ns = NULL;
+    pl->nstatuses = 0;
+    pl->expand = 0;
+    pl->confine = NULL;
+
+    struct token *t = tokens;
+    if (t->type == TOK_WORD && strcmp(t->text, "time") == 0 && !pipeline_end(t[1].type))
+    {
+        pl->timed = 1;
+        t++;
+    }
+    if (t->type == TOK_WORD && !t->quoted && strcmp(t->text, "!") == 0 && !pipeline_end(t[1].type))
+    {
+        pl->negate = 1;
+        t++;
+    }
+    for (;;)
+    {
+        if (pl->nstages == cap)
+        {
+            struct stage *bigger = arena_alloc(a, 2 * cap * sizeof(struct stage));
+            memcpy(bigger, pl->stages, cap * sizeof(struct stage));
+            pl->stages = bigger;
+            cap *= 2;
+        }
+        struct stage *st = &pl->stages[pl->nstages++];
+        int nwords = 0, nredirs = 0;
+        const char *keyword = compound_keyword(t);
+
+        st->group = NULL;
+        st->nassigns = 0;
+        st->compound = keyword != NULL;
+        st->expand = 0;
+        st->assigns = NULL;
+        st->envp = NULL;
+        st->nprocsubs = 0;
+        if (t->type == TOK_LPAREN)
+        {
+            t = parse_group(a, line, t, &st->group);
+        }
+        else if (keyword != NULL)
+        {
+            t = parse_compound(a, line, t, &st->group);
+        }
+        else if (closes_list(t))
+        {
+            syntax_error(t);    // a "done" with no "do"
+            return NULL;
+        }
+        if (t == NULL)
+        {
+            return NULL;
+        }
+
+        int nprocsubs = 0;
+        for (struct token *u = t; !stage_end(st, u);)
+        {
+            nwords++;
+            if (u->type == TOK_PROCSUB_IN || u->type == TOK_PROCSUB_OUT)
+            {
+                nprocsubs++;
+                u = skip_list(u);
+                continue;
+            }
+            nredirs += is_redirection(u->type) ? 2 : 0;     // &> needs two
+            u++;
+        }
+        st->argv = arena_alloc(a, (nwords + 2) * sizeof(char *));
+        st->redirs = nredirs > 0 ? arena_alloc(a, nredirs * sizeof(struct redir)) : NULL;
+        st->nredirs = 0;
+        st->procsubs = nprocsubs > 0 ? arena_alloc(a, nprocsubs * sizeof(struct procsub)) : NULL;
+
+        int argc = 0;
+        if (st->group != NULL)
+        {
+            // The stage's name in listings and traces
+            st->argv[argc++] = keyword != NULL ? (char *)keyword : "(...)";
+        }
+        while (!stage_end(st, t))
+        {
+            if (t->type == TOK_WORD && st->group == NULL)
+            {
+                if (t->assign && argc == st->nassigns)
+                {
+                    st->nassigns++;
+                }
+                st->expand |= t->expand;
+                st->argv[argc++] = t->text;
+                t++;
+            }
+            else if ((t->type == TOK_PROCSUB_IN || t->type == TOK_PROCSUB_OUT) && st->group == NULL)
+            {
+                st->argv[argc] = parse_procsub(a, line, &t, st);
+                if (st->argv[argc++] == NULL)
+                {
+                    return NULL;
+                }
+            }
+            else if (t->type == TOK_IO_NUMBER || is_redirection(t->type))
+            {
+                int used = parse_redirection(a, line, t, st);
+                if (used == -1)
+                {
+                    return NULL;
+                }
+                t += used;
+            }
+            else
+            {
+                syntax_error(t);
+                return NULL;
+            }
+        }
+        st->argv[argc] = NULL;
+        pl->expand |= st->expand || st->nassigns > 0;
+
+        if (argc == 0)
+        {
+            syntax_error(t);
+            return NULL;
+        }
+        if (t->type != TOK_PIPE)
+        {
+            break;
+        }
+        t = skip_newlines(t + 1);
+    }
+
+    int len = t[-1].end - tokens->start;
+    char *text = arena_alloc(a, len + 1);
+    memcpy(text, line + tokens->start, len);
+    text[len] = '\0';
+    pl->text = text;
+    pl->trace_key = pipeline_name(a, pl);
+    return t;
+}
+
+/**
+ * @brief Forks a copy of the shell to run a "( list )", compound,
+ *        function or builtin stage.
+ *
+ * posix_spawn() cannot run code of the shell's own, so these stages are
+ * the one place a pipeline still fork()s.
+ *
+ * @param st       The stage, its redirections prepared.
+ * @param in_fd    The pipe end for its stdin, or -1.
+ * @param out_fd   The pipe end for its stdout, or -1.
+ * @param pipes    All of the pipeline's pipes, which the child closes.
+ * @param npipes   How many there are.
+ * @param job      The pipeline's job, whose process group the child joins.
+ * @param old_mask Signal mask for the child, from before jobs_block().
+ * @return The child's pid, or -1 after reporting a failed fork().
+ */
+static pid_t fork_stage(struct stage *st, int in_fd, int out_fd, int (*pipes)[2], int npipes,
+                       const struct job *job, const sigset_t *old_mask)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("dragonshell: fork failed");
+        return -1;
+    }
+    if (pid > 0)
+    {
+        job_set_group(job, pid);    // also set in the child, whichever runs first
+        return pid;
+    }
+
+    job_set_group(job, 0);
+    sigprocmask(SIG_SETMASK, old_mask, NULL);
+    if (in_fd != -1)
+    {
+        dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd != -1)
+    {
+        dup2(out_fd, STDOUT_FILENO);
+    }
+    for (int i = 0; i < npipes; i++)
+    {
+        close(pipes[i][0]);     // nothing is exec'd, so O_CLOEXEC won't close them
+        close(pipes[i][1]);
+    }
+    if (redirect_apply(st->redirs, st->nredirs) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+    run_subshell(st);
+}
+
+/**
+ * @brief Works out each stage's status and run time once a foreground
+ *        pipeline has finished, and the pipeline's status from them.
+ *
+ * The statuses go to pl->statuses for $PIPESTATUS and the times to
+ * pl->stage_ns for the time keyword, when the caller asked for them,
+ * and the times of spawned stages to the latency histograms, keyed by
+ * each stage's command name.
+ *
+ * @param pl         The pipeline.
+ * @param procs      The job's processes, as job_wait() left them.
+ * @param stage_proc Each stage's index in procs, or -1 if it has none.
+ * @param status     Each stage's status, for those without a process.
+ * @param ns         Each stage's run time, likewise.
+ * @param waited     The status job_wait() returned.
+ * @return The last stage's status or, with pipefail, the last nonzero
+ *         one; a stopped job keeps the status job_wait() gave.
+ */
+static int collect_stages(struct pipeline *pl, const struct process *procs,
+                          const int *stage_proc, int *status, uint64_t *ns, int waited)
+{
+    int result = 0, stopped = 0;
+
+    for (int i = 0; i < pl->nstages; i++)
+    {
+        if (stage_proc[i] != -1)
+        {
+            const struct process *p = &procs[stage_proc[i]];
+            status[i] = process_status(p);
+            ns[i] = p->done ? p->end_ns - p->start_ns : 0;
+            stopped |= p->stopped;
+            if (p->done && pl->trace_key != NULL && pl->stages[i].argv[0] != NULL)
+            {
+                trace_record(pl->stages[i].argv[0], TRACE_STAGE, p->start_ns, p->end_ns);
+            }
+        }
+        if (pipefail ? status[i] != 0 : i == pl->nstages - 1)
+        {
+            result = status[i];
+        }
+    }
+
+    if (pl->statuses != NULL)
+    {
+        memcpy(pl->statuses, status, pl->nstages * sizeof(*status));
+        memcpy(pl->stage_ns, ns, pl->nstages * sizeof(*ns));
+        pl->nstatuses = pl->nstages;
+    }
+    return stopped ? waited : result;
+}
+
+/**
+ * @brief Runs every stage of a pipeline concurrently.
+ *
+ * All nstages - 1 pipes are created up front with O_CLOEXEC, so a stage
+ * only keeps the two ends it dup2()s onto stdin/stdout and never has to
+ * close the others itself. Each command is resolved through the hash
+ * table and started with posix_spawn(), which glibc implements with
+ * vfork semantics, so the shell's page tables are not copied once per
+ * stage; a "( list )", compound, function or builtin stage is forked
+ * instead. The stages form one job;
+ * a background job gets its own process group, and under job control so
+ * does a foreground one, which is given the terminal. The shell then
+ * waits for the job unless it runs in the background.
+ *
+ * In a foreground pipeline the first plain cat or tee stage is not
+ * spawned at all: once the other stages are running, the shell moves its
+ * data itself with fastio_run(). Only one such stage runs in the shell,
+ * since two of them would have to take turns and could deadlock on a
+ * full pipe between them. Under job control every stage is spawned, as
+ * Ctrl-Z could not stop a stage the shell runs itself along with the
+ * rest of the job.
+ *
+ * The SIGCHLD handler reaps the stages in whatever order they exit,
+ * stamping each one's end, so every stage's status and run time are
+ * known once the last has gone.
+ *
+ * @param pl The pipeline to execute.
+ * @return The exit status of the last stage, or with pipefail of the
+ *         last that failed (0 for a background job).
+ */
+int execute_pipeline(struct pipeline *pl)
+{
+    int n = pl->nstages;
+    int pipes[n][2];
+
+    fflush(stdout);     // keep builtin output ahead of the stages' output
+
+    int npipes = 0;
+    for (; npipes < n - 1; npipes++)
+    {
+        if (pipe2(pipes[npipes], O_CLOEXEC) == -1)
+        {
+            perror("dragonshell: pipe failed");
+            for (int i = 0; i < npipes; i++)
+            {
+                close(pipes[i][0]);
+                close(pipes[i][1]);
+            }
+            return 1;
+        }
+        pipe_grow(pipes[npipes][0]);
+    }
+
+    int inproc = -1;
+    for (int i = 0; i < n && !pl->background && !job_control; i++)
+    {
+        // A function named cat or tee is run as the function, as it would be alone
+        if (fastio_stage(&pl->stages[i]) && function_lookup(pl->stages[i].argv[0]) == NULL)
+        {
+            inproc = i;
+            break;
+        }
+    }
+
+    int stage_proc[n];          // each stage's index among the job's processes
+    int stage_status[n];        // the status of a stage that has no process
+    uint64_t stage_ns[n];
+
+    // SIGCHLD stays blocked until every stage is in the job table
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    struct job *job = job_create(pl->text, pl->background);
+    job->grouped |= job_control;
+
+    uint64_t spawn_start = trace_clock();
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &old_mask);
+
+    for (int i = 0; i < n; i++)
+    {
+        struct stage *st = &pl->stages[i];
+        posix_spawn_file_actions_t actions;
+        short flags = POSIX_SPAWN_SETSIGMASK;
+
+        stage_proc[i] = -1;
+        stage_status[i] = 1;
+        stage_ns[i] = 0;
+        if (i == inproc)
+        {
+            continue;
+        }
+
+        if (job->grouped)
+        {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attr, job->pgid);
+        }
+        posix_spawnattr_setflags(&attr, flags);
+
+        if (redirect_prepare(st->redirs, st->nredirs) == -1)
+        {
+            continue;
+        }
+        if (st->group != NULL || st->argv[0] == NULL || function_lookup(st->argv[0]) != NULL ||
+            builtin_lookup(st->argv[0]) != NULL)
+        {
+            pid_t pid = fork_stage(st, i > 0 ? pipes[i - 1][0] : -1, i < n - 1 ? pipes[i][1] : -1,
+                                   pipes, npipes, job, &old_mask);
+            if (pid > 0)
+            {
+                stage_proc[i] = job->nprocs;
+                job_add_process(job, pid);
+            }
+            redirect_release(st->redirs, st->nredirs);
+            continue;
+        }
+        posix_spawn_file_actions_init(&actions);
+        if (job_control && !pl->background)
+        {
+            // The stage's group takes the terminal before fd 0 is replaced
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+        if (i > 0)
+        {
+            posix_spawn_file_actions_adddup2(&actions, pipes[i - 1][0], STDIN_FILENO);
+        }
+        if (i < n - 1)
+        {
+            posix_spawn_file_actions_adddup2(&actions, pipes[i][1], STDOUT_FILENO);
+        }
+        redirect_add_actions(&actions, st->redirs, st->nredirs);
+
+        const char *path = path_lookup(st->argv[0]);
+        pid_t pid;
+        int err = ENOENT;
+        if (path != NULL)
+        {
+            err = path_spawn(&pid, path, &actions, &attr, st->argv,
+                             st->envp != NULL ? st->envp : vars_environ());
+        }
+        if (err == 0)
+        {
+            stage_proc[i] = job->nprocs;
+            job_add_process(job, pid);
+        }
+        else if (path == NULL)
+        {
+            fprintf(stderr, "dragonshell: %s: command not found\n", st->argv[0]);
+            stage_status[i] = 127;
+        }
+        else
+        {
+            fprintf(stderr, "dragonshell: %s: %s\n", st->argv[0], strerror(err));
+            stage_status[i] = err == ENOENT ? 127 : 126;
+            if (err == ENOENT)
+            {
+                path_forget(st->argv[0]);
+            }
+        }
+        posix_spawn_file_actions_destroy(&actions);
+        redirect_release(st->redirs, st->nredirs);
+    }
+    posix_spawnattr_destroy(&attr);
+    uint64_t spawned = trace_clock();
+    trace_record(pl->trace_key, TRACE_SPAWN, spawn_start, spawned);
+
+    // Parent process: keep only the ends an in-shell stage uses, so its
+    // neighbours still see EOF once the other writers exit
+    int in_fd = inproc > 0 ? pipes[inproc - 1][0] : STDIN_FILENO;
+    int out_fd = inproc >= 0 && inproc < n - 1 ? pipes[inproc][1] : STDOUT_FILENO;
+    for (int i = 0; i < npipes; i++)
+    {
+        if (pipes[i][0] != in_fd)
+        {
+            close(pipes[i][0]);
+        }
+        if (pipes[i][1] != out_fd)
+        {
+            close(pipes[i][1]);
+        }
+    }
+
+    if (pl->background)
+    {
+        job_launched(job);
+        jobs_unblock(&old_mask);
+        return 0;
+    }
+    jobs_unblock(&old_mask);
+
+    if (inproc >= 0)
+    {
+        struct stage *st = &pl->stages[inproc];
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (redirect_prepare(st->redirs, st->nredirs) == 0)
+        {
+            stage_status[inproc] = fastio_run(st, in_fd, out_fd);
+            redirect_release(st->redirs, st->nredirs);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        stage_ns[inproc] = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+        if (in_fd != STDIN_FILENO)
+        {
+            close(in_fd);
+        }
+        if (out_fd != STDOUT_FILENO)
+        {
+            close(out_fd);
+        }
+    }
+
+    struct process procs[n];
+    int status = job_wait(job, &pl->usage, procs);
+    status = collect_stages(pl, procs, stage_proc, stage_status, stage_ns, status);
+    pl->has_usage = 1;
+    trace_record(pl->trace_key, TRACE_WAIT, spawned, trace_clock());
+    return status;
+}
+
+/**
+ * @brief Names a pipeline by its commands, e.g. "grep|sort|uniq".
+ *
+ * Used as the latency tracing key, so runs of the same commands share a
+ * histogram whatever their arguments.
+ *
+ * @param a  The arena the name is allocated from.
+ * @param pl The pipeline.
+ * @return The name.
+ */
+const char *pipeline_name(struct arena *a, const struct pipeline *pl)
+{
+    size_t len = 0;
+    for (int i = 0; i < pl->nstages; i++)
+    {
+        len += strlen(pl->stages[i].argv[0]) + 1;
+    }
+
+    char *name = arena_alloc(a, len);
+    char *p = name;
+    for (int i = 0; i < pl->nstages; i++)
+    {
+        if (i > 0)
+        {
+            *p++ = '|';
+        }
+        size_t n = strlen(pl->stages[i].argv[0]);
+        memcpy(p, pl->stages[i].argv[0], n);
+        p += n;
+    }
+    *p = '\0';
+    return name;
+}
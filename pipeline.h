@@ -0,0 +1,85 @@
+/****************************************************************************
+
+  @file         pipeline.h
+
+  @author       Ahnaful Hoque
+
+  @brief        N-stage pipeline parsing and execution.
+
+*******************************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <sys/resource.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "lexer.h"
+#include "redirect.h"
+
+struct node;
+struct confine;
+
+/**
+ * A "<(list)" or ">(list)" in a stage's words or redirections. Each run
+ * of the stage starts the list with its stdout (or stdin) on a pipe and
+ * passes the command the other end as a /dev/fd path.
+ */
+struct procsub
+{
+    struct node *list;
+    int output;             // >(list): the command writes, the list reads
+};
+
+/**
+ * One command of a pipeline: its argument vector and its redirections,
+ * in the order they appeared. A "( list )" stage has a group instead,
+ * run by a forked copy of the shell; so does an if, a loop or a
+ * "{ list; }", which the shell runs itself unless it is piped or in the
+ * background.
+ */
+struct stage
+{
+    char **argv;
+    struct redir *redirs;
+    int nredirs;
+    struct node *group;
+    int nassigns;           // leading "NAME=value" words of argv
+    int compound;           // the group is a compound command: argv[0] is its keyword
+    int expand;             // argv or a redirection holds "$" references
+    char **assigns;         // after expansion: the assignments, NULL-terminated
+    char **envp;            // after expansion: the environment, with assigns
+    struct procsub *procsubs;   // referred to by LEX_PROCSUB words
+    int nprocsubs;
+};
+
+/**
+ * A parsed pipeline: nstages commands connected stdout-to-stdin,
+ * optionally run in the background.
+ */
+struct pipeline
+{
+    struct stage *stages;
+    int nstages;
+    int background;
+    int timed;              // prefixed with the time keyword
+    int negate;             // prefixed with '!': 0 and nonzero statuses swap
+    const char *text;       // the pipeline's source text, for job listings
+    const char *trace_key;  // name for latency tracing, NULL when off
+    struct rusage usage;    // filled in when a foreground job finishes
+    int has_usage;          // usage was filled in
+    int *statuses;          // if not NULL, receives each stage's exit status
+    uint64_t *stage_ns;     // with statuses, each stage's run time
+    int nstatuses;          // how many statuses were filled in
+    int expand;             // some stage has references or assignments
+    const struct confine *confine;  // set by the confine builtin, else NULL
+};
+
+int syntax_error(const struct token *tok);
+struct token *parse_pipeline(struct arena *a, const char *line, struct token *tokens,
+                             struct pipeline *pl);
+int execute_pipeline(struct pipeline *pl);
+const char *pipeline_name(struct arena *a, const struct pipeline *pl);
+
+#endif
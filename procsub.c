@@ -0,0 +1,370 @@
+/****************************************************************************
+
+  @file         procsub.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Process substitution and coprocesses.
+
+                "<(list)" runs the list with its stdout on a pipe and
+                hands the command "/dev/fd/N" for the read end; ">(list)"
+                is the same the other way round. So "diff <(sort a)
+                <(sort b)" compares two streams without a temporary file.
+                The shell keeps its end close-on-exec, above
+                PROCSUB_FD_BASE, and the stage gets an "N>&N" redirection
+                in front of its own, so only the command that names the
+                path inherits it and a ">(list)" sees end-of-file as soon
+                as that command is done. The shell closes its ends once
+                the pipeline has been started (or, in the foreground, has
+                finished); the lists are not waited for, as in bash.
+
+                  coproc [-n NAME] command [args...]
+
+                starts a long-lived helper in the background with both its
+                stdin and stdout on pipes, and sets NAME_WRITE and
+                NAME_READ (NAME is COPROC by default) to the shell's ends,
+                for "echo 2^10 >&$COPROC_WRITE; head -n1 <&$COPROC_READ",
+                and NAME_PID. "coproc -e [NAME]" closes the write end, so
+                the helper sees end-of-file and its last output can still
+                be read, and "coproc -c [NAME]" closes both.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+
+#include "procsub.h"
+#include "pipeline.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "vars.h"
+#include "shell.h"
+
+#define PROCSUB_FD_BASE 63      // the shell's ends stay clear of the user's descriptors
+#define COPROC_FD_BASE 60
+#define COPROC_MAX 8
+
+/**
+ * A running coprocess and the shell's ends of its pipes.
+ */
+struct coproc
+{
+    char name[64];          // "" while the slot is free
+    int read_fd;            // the helper's stdout
+    int write_fd;           // the helper's stdin
+};
+
+static int *open_fds;       // the shell's ends of running substitutions
+static int nopen, open_cap;
+static struct coproc coprocs[COPROC_MAX];
+
+/**
+ * @brief Moves a descriptor to the lowest free number at or above base.
+ *
+ * @param fd   The descriptor, which is closed.
+ * @param base The lowest number wanted.
+ * @return The new close-on-exec descriptor, or -1 on error.
+ */
+static int move_high(int fd, int base)
+{
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, base);
+    close(fd);
+    return high;
+}
+
+/**
+ * @brief Starts a process substitution.
+ *
+ * The list runs in a forked copy of the shell, which closes the other
+ * substitutions' ends before it starts.
+ *
+ * @param list   The parsed list.
+ * @param output 1 for ">(list)", which reads what the command writes.
+ * @return The shell's end of the pipe, for a "/dev/fd/N" path, or -1
+ *         after reporting an error.
+ */
+int procsub_start(struct node *list, int output)
+{
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1)
+    {
+        perror("dragonshell: pipe failed");
+        return -1;
+    }
+    int mine = output ? p[1] : p[0];
+    int theirs = output ? p[0] : p[1];
+
+    fflush(stdout);     // don't let the child inherit buffered output
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("dragonshell: fork failed");
+        close(p[0]);
+        close(p[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(theirs, output ? STDIN_FILENO : STDOUT_FILENO);
+        close(p[0]);
+        close(p[1]);
+        for (int i = 0; i < nopen; i++)
+        {
+            close(open_fds[i]);
+        }
+        struct stage st;
+        memset(&st, 0, sizeof(st));
+        st.group = list;
+        run_subshell(&st);
+    }
+
+    close(theirs);
+    mine = move_high(mine, PROCSUB_FD_BASE);
+    if (mine == -1)
+    {
+        perror("dragonshell: process substitution");
+        return -1;
+    }
+    if (nopen == open_cap)
+    {
+        open_cap = open_cap ? open_cap * 2 : 8;
+        open_fds = realloc(open_fds, open_cap * sizeof(int));
+        if (!open_fds)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    open_fds[nopen++] = mine;
+    return mine;
+}
+
+/**
+ * @brief Notes how many substitutions are open, before a pipeline is
+ *        expanded.
+ *
+ * @param none
+ * @return A mark for procsub_release().
+ */
+int procsub_mark(void)
+{
+    return nopen;
+}
+
+/**
+ * @brief Closes the shell's ends of the substitutions started since a
+ *        mark, once their pipeline has run.
+ *
+ * @param mark The value procsub_mark() returned.
+ * @return none
+ */
+void procsub_release(int mark)
+{
+    while (nopen > mark)
+    {
+        close(open_fds[--nopen]);
+    }
+}
+
+/**
+ * @brief Sets a variable to a number.
+ *
+ * @param prefix The coprocess's name.
+ * @param suffix "_READ", "_WRITE" or "_PID".
+ * @param value  The number.
+ * @return none
+ */
+static void set_number(const char *prefix, const char *suffix, long value)
+{
+    char name[80], buf[24];
+    snprintf(name, sizeof(name), "%s%s", prefix, suffix);
+    snprintf(buf, sizeof(buf), "%ld", value);
+    var_set(name, buf, 0);
+}
+
+/**
+ * @brief Unsets one of a coprocess's variables.
+ *
+ * @param prefix The coprocess's name.
+ * @param suffix "_READ", "_WRITE" or "_PID".
+ * @return none
+ */
+static void unset_number(const char *prefix, const char *suffix)
+{
+    char name[80];
+    snprintf(name, sizeof(name), "%s%s", prefix, suffix);
+    var_unset(name);
+}
+
+/**
+ * @brief Closes a coprocess's pipes and unsets its variables.
+ *
+ * @param c          The coprocess.
+ * @param input_only Close only the end the helper reads from.
+ * @return none
+ */
+static void close_coproc(struct coproc *c, int input_only)
+{
+    if (c->write_fd != -1)
+    {
+        close(c->write_fd);
+        c->write_fd = -1;
+        unset_number(c->name, "_WRITE");
+    }
+    if (input_only)
+    {
+        return;
+    }
+    close(c->read_fd);
+    unset_number(c->name, "_READ");
+    unset_number(c->name, "_PID");
+    c->name[0] = '\0';
+}
+
+/**
+ * @brief Finds a coprocess by name.
+ *
+ * @param name The name.
+ * @return Its slot, or NULL.
+ */
+static struct coproc *find_coproc(const char *name)
+{
+    for (int i = 0; i < COPROC_MAX; i++)
+    {
+        if (strcmp(coprocs[i].name, name) == 0)
+        {
+            return &coprocs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief The "coproc" builtin.
+ *
+ * @param args The argument vector, args[0] being "coproc".
+ * @return 0 once the helper is started or its pipes closed, 127 if the command is
+ *         not found, 1 on other errors, 2 for a usage error.
+ */
+int coproc_builtin(char **args)
+{
+    const char *name = "COPROC";
+    int i = 1, closing = 0, input_only = 0;
+
+    if (args[i] != NULL && (strcmp(args[i], "-c") == 0 || strcmp(args[i], "-e") == 0))
+    {
+        closing = 1;
+        input_only = args[i][1] == 'e';
+        i++;
+    }
+    else if (args[i] != NULL && strcmp(args[i], "-n") == 0 && args[i + 1] != NULL)
+    {
+        name = args[i + 1];
+        i += 2;
+    }
+    if (closing && args[i] != NULL)
+    {
+        name = args[i++];
+    }
+    if ((closing ? args[i] != NULL : args[i] == NULL) || strlen(name) > 48 ||
+        !var_valid_name(name, strlen(name)))
+    {
+        fprintf(stderr, "dragonshell: coproc: usage: coproc [-n NAME] command [args...]\n"
+                        "       coproc -c|-e [NAME]\n");
+        return 2;
+    }
+
+    struct coproc *c = find_coproc(name);
+    if (closing)
+    {
+        if (c == NULL)
+        {
+            fprintf(stderr, "dragonshell: coproc: %s: no such coprocess\n", name);
+            return 1;
+        }
+        close_coproc(c, input_only);
+        return 0;
+    }
+    if (c != NULL)
+    {
+        close_coproc(c, 0);     // as in bash, the old one loses its pipes
+    }
+    c = find_coproc("");
+    if (c == NULL)
+    {
+        fprintf(stderr, "dragonshell: coproc: too many coprocesses\n");
+        return 1;
+    }
+
+    const char *path = path_lookup(args[i]);
+    if (path == NULL)
+    {
+        fprintf(stderr, "dragonshell: %s: command not found\n", args[i]);
+        return 127;
+    }
+
+    int to[2], from[2];
+    if (pipe2(to, O_CLOEXEC) == -1)
+    {
+        perror("dragonshell: pipe failed");
+        return 1;
+    }
+    if (pipe2(from, O_CLOEXEC) == -1)
+    {
+        perror("dragonshell: pipe failed");
+        close(to[0]);
+        close(to[1]);
+        return 1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from[1], STDOUT_FILENO);
+
+    // A background job: its own process group, away from Ctrl-C
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &old_mask);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+
+    struct job *job = job_create(args[i], 1);
+    pid_t pid;
+    fflush(stdout);
+    int err = path_spawn(&pid, path, &actions, &attr, &args[i], vars_environ());
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(to[0]);
+    close(from[1]);
+
+    if (err != 0)
+    {
+        job_launched(job);      // frees the job, which has no processes
+        jobs_unblock(&old_mask);
+        close(to[1]);
+        close(from[0]);
+        fprintf(stderr, "dragonshell: coproc: %s: %s\n", args[i], strerror(err));
+        return 1;
+    }
+    job_add_process(job, pid);
+    job_launched(job);
+    jobs_unblock(&old_mask);
+
+    c->read_fd = move_high(from[0], COPROC_FD_BASE);
+    c->write_fd = move_high(to[1], COPROC_FD_BASE);
+    strcpy(c->name, name);
+    set_number(name, "_READ", c->read_fd);
+    set_number(name, "_WRITE", c->write_fd);
+    set_number(name, "_PID", pid);
+    return 0;
+}
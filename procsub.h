@@ -0,0 +1,23 @@
+/****************************************************************************
+
+  @file         procsub.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Process substitution ("<(list)", ">(list)") and the coproc
+                builtin: commands connected to the shell by pipes rather
+                than temporary files.
+
+*******************************************************************************/
+
+#ifndef PROCSUB_H
+#define PROCSUB_H
+
+struct node;
+
+int procsub_start(struct node *list, int output);
+int procsub_mark(void);
+void procsub_release(int mark);
+int coproc_builtin(char **args);
+
+#endif
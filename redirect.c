@@ -0,0 +1,355 @@
+/****************************************************************************
+
+  @file         redirect.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Opens and applies a stage's redirections.
+
+                The parser turns "<", ">", ">>", "2>", "2>&1", "&>", "<<<"
+                and here-documents into an ordered list. The shell opens
+                every file (and fills every here-document) before starting
+                the stage, so a missing file is reported by name and the
+                command is never started; the child then only has to
+                dup2() each descriptor into place, in order, so "2>&1 >f"
+                and ">f 2>&1" mean what they do in sh. Here-documents and
+                here-strings live in a memfd_create() file, or a pipe where
+                that is unavailable, and never touch the disk. A builtin
+                run by the shell itself has the list applied to the shell's
+                own descriptors and undone afterwards.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "redirect.h"
+#include "input.h"
+#include "events.h"
+
+#define REDIR_FD_BASE 10    // prepared descriptors stay clear of n in "n>file"
+
+/**
+ * @brief Reads a here-document's lines up to its delimiter.
+ *
+ * The lines come from the shell's own input, after the line holding the
+ * "<<" operator, so this must run before the next command line is read.
+ *
+ * @param a The arena the document is stored in.
+ * @param r The REDIR_HEREDOC redirection; its body is filled in.
+ * @return 0, or -1 if the input ended before the delimiter (the lines
+ *         read so far are kept, as in sh).
+ */
+int read_heredoc(struct arena *a, struct redir *r)
+{
+    size_t len = 0, cap = 256;
+    char *body = arena_alloc(a, cap);
+    const char *line;
+
+    for (;;)
+    {
+        // At a terminal the line editor reads it, with a "> " prompt
+        line = input_is_interactive() ? events_read_line("> ") : read_line();
+        if (line == NULL)
+        {
+            fprintf(stderr, "dragonshell: warning: here-document delimited by end-of-file (wanted `%s')\n",
+                    r->word);
+            break;
+        }
+        if (r->strip_tabs)
+        {
+            line += strspn(line, "\t");
+        }
+        if (strcmp(line, r->word) == 0)
+        {
+            break;
+        }
+
+        size_t n = strlen(line);
+        if (len + n + 2 > cap)
+        {
+            while (len + n + 2 > cap)
+            {
+                cap *= 2;
+            }
+            char *bigger = arena_alloc(a, cap);
+            memcpy(bigger, body, len);
+            body = bigger;
+        }
+        memcpy(body + len, line, n);
+        len += n;
+        body[len++] = '\n';
+    }
+    body[len] = '\0';
+    r->body = body;
+    return line == NULL ? -1 : 0;
+}
+
+/**
+ * @brief Moves a descriptor the shell opened above REDIR_FD_BASE.
+ *
+ * Otherwise a redirection to, say, fd 3 could overwrite a descriptor
+ * that a later redirection in the same list still has to read from.
+ *
+ * @param fd The descriptor (close-on-exec).
+ * @return The new descriptor (close-on-exec), or -1 on error.
+ */
+static int high_fd(int fd)
+{
+    if (fd == -1 || fd >= REDIR_FD_BASE)
+    {
+        return fd;
+    }
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_FD_BASE);
+    close(fd);
+    return high;
+}
+
+/**
+ * @brief Makes a readable descriptor holding some text.
+ *
+ * @param text The here-document or here-string contents.
+ * @param len  Their length.
+ * @return The descriptor, positioned at the start, or -1 on error.
+ */
+static int text_fd(const char *text, size_t len)
+{
+    int fd = memfd_create("dragonshell-heredoc", MFD_CLOEXEC);
+    if (fd != -1)
+    {
+        if (write(fd, text, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // No memfd: a pipe works as long as the text fits in its buffer
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    if ((size_t)fcntl(p[1], F_SETPIPE_SZ, len) < len ||
+        write(p[1], text, len) != (ssize_t)len)
+    {
+        close(p[0]);
+        close(p[1]);
+        errno = EFBIG;
+        return -1;
+    }
+    close(p[1]);
+    return p[0];
+}
+
+/**
+ * @brief Opens everything a redirection list refers to.
+ *
+ * Each file, here-document and here-string gets a close-on-exec
+ * descriptor in redirs[i].source for redirect_apply() or
+ * redirect_add_actions() to put in place.
+ *
+ * @param redirs The redirections.
+ * @param n      How many there are.
+ * @return 0 on success, or -1 after reporting the failing file (nothing
+ *         is left open).
+ */
+int redirect_prepare(struct redir *redirs, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        struct redir *r = &redirs[i];
+        int fd;
+
+        switch (r->type)
+        {
+        case REDIR_IN:
+            fd = open(r->word, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIR_OUT:
+            fd = open(r->word, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            break;
+        case REDIR_APPEND:
+            fd = open(r->word, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            break;
+        case REDIR_HERESTRING:
+        {
+            // A here-string gets the newline a terminal line would have
+            size_t len = strlen(r->word);
+            r->word[len] = '\n';
+            fd = text_fd(r->word, len + 1);
+            r->word[len] = '\0';
+            break;
+        }
+        case REDIR_HEREDOC:
+            fd = text_fd(r->body, strlen(r->body));
+            break;
+        case REDIR_DUP:
+            if (r->source == -1)
+            {
+                // ">&$fd" where $fd was not a descriptor number
+                fprintf(stderr, "dragonshell: %s: ambiguous redirect\n", r->word);
+                redirect_release(redirs, i);
+                return -1;
+            }
+            continue;
+        default:
+            continue;   // REDIR_CLOSE needs nothing opened
+        }
+
+        r->source = high_fd(fd);
+        if (r->source == -1)
+        {
+            fprintf(stderr, "dragonshell: %s: %s\n",
+                    r->type == REDIR_HEREDOC ? "here-document" : r->word, strerror(errno));
+            redirect_release(redirs, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the descriptors redirect_prepare() opened.
+ *
+ * @param redirs The redirections.
+ * @param n      How many there are.
+ * @return none
+ */
+void redirect_release(struct redir *redirs, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        struct redir *r = &redirs[i];
+        if (r->type != REDIR_DUP && r->type != REDIR_CLOSE && r->source != -1)
+        {
+            close(r->source);
+            r->source = -1;
+        }
+    }
+}
+
+/**
+ * @brief Puts a prepared redirection list in place, in order.
+ *
+ * Meant for a forked child just before it execs.
+ *
+ * @param redirs The prepared redirections.
+ * @param n      How many there are.
+ * @return 0 on success, -1 after reporting a bad descriptor.
+ */
+int redirect_apply(const struct redir *redirs, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const struct redir *r = &redirs[i];
+
+        if (r->type == REDIR_CLOSE)
+        {
+            close(r->fd);
+        }
+        else if (r->source == r->fd)
+        {
+            // dup2() onto itself would keep close-on-exec set
+            fcntl(r->fd, F_SETFD, 0);
+        }
+        else if (dup2(r->source, r->fd) == -1)
+        {
+            fprintf(stderr, "dragonshell: %d: %s\n", r->source, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies a prepared redirection list to the shell itself, for a
+ *        builtin, remembering what each descriptor was.
+ *
+ * @param redirs The prepared redirections.
+ * @param n      How many there are.
+ * @param saved  Receives n saved descriptors for redirect_restore().
+ * @return 0 on success, -1 after reporting a bad descriptor (whatever
+ *         was applied has been undone).
+ */
+int redirect_save(const struct redir *redirs, int n, int *saved)
+{
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < n; i++)
+    {
+        const struct redir *r = &redirs[i];
+
+        saved[i] = fcntl(r->fd, F_DUPFD_CLOEXEC, REDIR_FD_BASE);   // -1: it was closed
+        if (r->type == REDIR_CLOSE)
+        {
+            close(r->fd);
+        }
+        else if (dup2(r->source, r->fd) == -1)
+        {
+            fprintf(stderr, "dragonshell: %d: %s\n", r->source, strerror(errno));
+            redirect_restore(redirs, i + 1, saved);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Puts back the descriptors redirect_save() changed, last first.
+ *
+ * @param redirs The redirections.
+ * @param n      How many there are.
+ * @param saved  The descriptors redirect_save() kept.
+ * @return none
+ */
+void redirect_restore(const struct redir *redirs, int n, const int *saved)
+{
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = n - 1; i >= 0; i--)
+    {
+        if (saved[i] == -1)
+        {
+            close(redirs[i].fd);
+        }
+        else
+        {
+            dup2(saved[i], redirs[i].fd);
+            close(saved[i]);
+        }
+    }
+}
+
+/**
+ * @brief Adds a prepared redirection list to posix_spawn() file actions.
+ *
+ * @param actions The file actions of the stage being spawned.
+ * @param redirs  The prepared redirections.
+ * @param n       How many there are.
+ * @return none
+ */
+void redirect_add_actions(posix_spawn_file_actions_t *actions, const struct redir *redirs, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const struct redir *r = &redirs[i];
+
+        if (r->type == REDIR_CLOSE)
+        {
+            posix_spawn_file_actions_addclose(actions, r->fd);
+        }
+        else
+        {
+            posix_spawn_file_actions_adddup2(actions, r->source, r->fd);
+        }
+    }
+}
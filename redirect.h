@@ -0,0 +1,49 @@
+/****************************************************************************
+
+  @file         redirect.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Redirection lists: parsed once per stage, opened by the
+                shell, and applied in the child with dup2().
+
+*******************************************************************************/
+
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include <spawn.h>
+
+#include "arena.h"
+
+enum redir_type
+{
+    REDIR_IN,           // n<file
+    REDIR_OUT,          // n>file
+    REDIR_APPEND,       // n>>file
+    REDIR_DUP,          // n>&m, n<&m
+    REDIR_CLOSE,        // n>&-, n<&-
+    REDIR_HERESTRING,   // n<<<word
+    REDIR_HEREDOC       // n<<delim, n<<-delim
+};
+
+struct redir
+{
+    enum redir_type type;
+    int fd;             // the descriptor being redirected
+    int source;         // REDIR_DUP: the fd copied; otherwise set by redirect_prepare()
+    char *word;         // file name, here-string or here-document delimiter
+    char *body;         // REDIR_HEREDOC: the document, filled by read_heredoc()
+    int strip_tabs;     // <<-: leading tabs are removed from the document
+    int expand_body;    // REDIR_HEREDOC: the delimiter was not quoted, so the document is expanded
+};
+
+int read_heredoc(struct arena *a, struct redir *r);
+int redirect_prepare(struct redir *redirs, int n);
+void redirect_release(struct redir *redirs, int n);
+int redirect_apply(const struct redir *redirs, int n);
+int redirect_save(const struct redir *redirs, int n, int *saved);
+void redirect_restore(const struct redir *redirs, int n, const int *saved);
+void redirect_add_actions(posix_spawn_file_actions_t *actions, const struct redir *redirs, int n);
+
+#endif
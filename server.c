@@ -0,0 +1,763 @@
+/****************************************************************************
+
+  @file         server.c
+
+  @author       Ahnaful Hoque
+
+  @brief        "dragonshell --server path": runs command requests sent
+                over a Unix domain socket.
+
+                Every message, in both directions, is a frame: a type
+                byte, a 4-byte big-endian payload length, and the payload.
+                A client sends 'C' frames holding command text (one or
+                more lines, as for -c); for each one it gets back 'O'
+                frames with the commands' standard output and 'E' frames
+                with their standard error, as they are produced, then an
+                'X' frame whose payload is the 4-byte big-endian exit
+                status. Requests on one connection run one after another;
+                connections are served concurrently.
+
+                The server is a shell that stays up: each request runs in
+                a fork of it, so it starts with the command hash table,
+                variables and parse cache already warm and never pays for
+                exec() and startup, yet cannot change the server's state
+                for the next request (as a "( list )" cannot). The forks
+                are jobs in the job table, each with a process group of
+                its own, watched through a pidfd. One epoll set covers the
+                listening socket, the clients, the forks' output pipes and
+                their pidfds, and a signalfd for SIGINT and SIGTERM, which
+                remove the socket and stop the server. A client that does
+                not read its replies only stalls its own request: beyond
+                SERVER_BACKLOG unsent bytes, the server stops reading that
+                fork's pipes until the client catches up. A client that
+                hangs up has its running request sent SIGHUP.
+
+*******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "server.h"
+#include "input.h"
+#include "jobs.h"
+#include "shell.h"
+
+#define SERVER_BATCH 64
+#define SERVER_CHUNK 65536          // most output read into one frame
+#define SERVER_BACKLOG (256 << 10)  // unsent bytes that pause a request's output
+#define SERVER_MAX_REQUEST (16 << 20)
+#define FRAME_HEADER 5
+
+#define TAG(kind, slot) (((uint64_t)(kind) << 32) | (uint32_t)(slot))
+
+enum server_source
+{
+    SERVER_LISTEN,      // a client is connecting
+    SERVER_SIGNAL,      // SIGINT or SIGTERM
+    SERVER_CLIENT,      // a client sent data, or can take more
+    SERVER_STDOUT,      // a request's standard output
+    SERVER_STDERR,      // a request's standard error
+    SERVER_CHILD        // a request's fork exited
+};
+
+/**
+ * A client connection, and the request it has running, if any.
+ */
+struct conn
+{
+    int fd;                 // the client, -1 once it has hung up
+    char *in;               // received bytes not yet run as requests
+    size_t in_len, in_cap;
+    char *out;              // frames not yet sent
+    size_t out_off, out_len, out_cap;
+    pid_t pid;              // the request's fork, 0 when idle
+    struct job *job;
+    int pidfd;
+    int pipes[2];           // read ends of its stdout and stderr, -1 at EOF
+    int exited;             // the fork has been reaped
+    int status;
+    int paused;             // the pipes are out of the epoll set
+    int writing;            // the client is watched for EPOLLOUT
+};
+
+static int epoll_fd = -1;
+static int listen_fd = -1;
+static int signal_fd = -1;
+static const char *socket_path;
+static struct conn **conns;
+static int nconns;
+static sigset_t base_mask;          // the signal mask a fork runs with
+
+/**
+ * @brief Grows a buffer to hold at least need bytes.
+ *
+ * @param buf  The buffer.
+ * @param cap  Its capacity; updated.
+ * @param need The size required.
+ * @return none
+ */
+static void reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+    {
+        return;
+    }
+    size_t n = *cap ? *cap : 4096;
+    while (n < need)
+    {
+        n *= 2;
+    }
+    *buf = realloc(*buf, n);
+    if (!*buf)
+    {
+        fprintf(stderr, "dragonshell: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    *cap = n;
+}
+
+/**
+ * @brief Writes a frame header.
+ *
+ * @param p    Where it goes (FRAME_HEADER bytes).
+ * @param type The frame type.
+ * @param len  The payload length.
+ * @return none
+ */
+static void put_header(char *p, char type, uint32_t len)
+{
+    p[0] = type;
+    p[1] = len >> 24;
+    p[2] = len >> 16;
+    p[3] = len >> 8;
+    p[4] = len;
+}
+
+/**
+ * @brief Reads a big-endian 32-bit number.
+ *
+ * @param p The bytes.
+ * @return The number.
+ */
+static uint32_t get_u32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | u[3];
+}
+
+/**
+ * @brief Adds, changes or removes a descriptor in the epoll set.
+ *
+ * @param op     EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL.
+ * @param fd     The descriptor.
+ * @param events The events to wait for.
+ * @param tag    TAG(kind, slot).
+ * @return none
+ */
+static void watch(int op, int fd, uint32_t events, uint64_t tag)
+{
+    struct epoll_event ev = {.events = events, .data.u64 = tag};
+    epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+/**
+ * @brief Watches a client for output room only while frames are waiting,
+ *        and a request's pipes only while the backlog is small.
+ *
+ * @param c    The connection.
+ * @param slot Its slot.
+ * @return none
+ */
+static void update_interest(struct conn *c, int slot)
+{
+    size_t pending = c->out_len - c->out_off;
+
+    if (c->fd != -1 && c->writing != (pending > 0))
+    {
+        c->writing = pending > 0;
+        watch(EPOLL_CTL_MOD, c->fd, EPOLLIN | (c->writing ? EPOLLOUT : 0), TAG(SERVER_CLIENT, slot));
+    }
+    int pause = pending > SERVER_BACKLOG;
+    if (c->paused != pause)
+    {
+        c->paused = pause;
+        for (int i = 0; i < 2; i++)
+        {
+            if (c->pipes[i] != -1)
+            {
+                watch(EPOLL_CTL_MOD, c->pipes[i], pause ? 0 : EPOLLIN,
+                      TAG(i == 0 ? SERVER_STDOUT : SERVER_STDERR, slot));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Sends as many waiting frames as the client takes without
+ *        blocking.
+ *
+ * @param c The connection.
+ * @return 0, or -1 if the client is gone.
+ */
+static int flush_out(struct conn *c)
+{
+    while (c->fd != -1 && c->out_off < c->out_len)
+    {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN)
+        {
+            return 0;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        c->out_off += n;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+/**
+ * @brief Frees a connection's slot.
+ *
+ * @param slot The slot; its request must have finished.
+ * @return none
+ */
+static void free_conn(int slot)
+{
+    struct conn *c = conns[slot];
+    if (c->fd != -1)
+    {
+        close(c->fd);
+    }
+    free(c->in);
+    free(c->out);
+    free(c);
+    conns[slot] = NULL;
+}
+
+/**
+ * @brief Deals with a client that hung up: its request, if one is
+ *        running, gets SIGHUP and the slot is freed once it is done.
+ *
+ * @param slot The connection's slot.
+ * @return none
+ */
+static void hang_up(int slot)
+{
+    struct conn *c = conns[slot];
+    close(c->fd);
+    c->fd = -1;
+    c->out_off = c->out_len = 0;
+    if (c->pid == 0)
+    {
+        free_conn(slot);
+        return;
+    }
+    kill(-c->pid, SIGHUP);
+    kill(-c->pid, SIGCONT);
+    update_interest(c, slot);   // nobody to stall for any more
+}
+
+/**
+ * @brief Sends what a client can take and adjusts what is watched; a
+ *        client that is gone is hung up on.
+ *
+ * @param slot The connection's slot.
+ * @return none
+ */
+static void sync_client(int slot)
+{
+    struct conn *c = conns[slot];
+    if (flush_out(c) == -1)
+    {
+        hang_up(slot);
+        return;
+    }
+    update_interest(c, slot);
+}
+
+/**
+ * @brief Starts a request in a fork of the shell.
+ *
+ * @param c    The connection.
+ * @param slot Its slot.
+ * @param text The commands.
+ * @return 0, or -1 if nothing could be started.
+ */
+static int start_request(struct conn *c, int slot, const char *text)
+{
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    if (pipe2(err, O_CLOEXEC) == -1)
+    {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+
+    sigset_t old_mask;
+    jobs_block(&old_mask);
+    struct job *job = job_create(text, 0);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        sigprocmask(SIG_SETMASK, &base_mask, NULL);
+        setpgid(0, 0);
+        int null = open("/dev/null", O_RDONLY);
+        dup2(null, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(null);
+        for (int i = 0; i < nconns; i++)
+        {
+            if (conns[i] != NULL && conns[i]->fd != -1)
+            {
+                close(conns[i]->fd);    // nothing but the pipes may keep a client open
+            }
+        }
+        close(epoll_fd);
+        close(listen_fd);
+        close(signal_fd);
+
+        // The request runs as a subshell: "exit" just exits
+        in_subshell = 1;
+        jobs_forget();
+        input_open_string(text);
+        shell_loop(0);
+        exit(last_status);
+    }
+    close(out[1]);
+    close(err[1]);
+    if (pid == -1)
+    {
+        job_finish(job);
+        jobs_unblock(&old_mask);
+        close(out[0]);
+        close(err[0]);
+        return -1;
+    }
+    setpgid(pid, pid);      // also set in the child, whichever runs first
+    job_add_process(job, pid);
+    jobs_unblock(&old_mask);
+
+    c->pid = pid;
+    c->job = job;
+    c->exited = 0;
+    c->paused = 0;
+    c->pipes[0] = out[0];
+    c->pipes[1] = err[0];
+    watch(EPOLL_CTL_ADD, out[0], EPOLLIN, TAG(SERVER_STDOUT, slot));
+    watch(EPOLL_CTL_ADD, err[0], EPOLLIN, TAG(SERVER_STDERR, slot));
+    c->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (c->pidfd != -1)
+    {
+        watch(EPOLL_CTL_ADD, c->pidfd, EPOLLIN, TAG(SERVER_CHILD, slot));
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a whole frame to a connection's output.
+ *
+ * @param c    The connection.
+ * @param type The frame type.
+ * @param data The payload.
+ * @param len  Its length.
+ * @return none
+ */
+static void add_frame(struct conn *c, char type, const void *data, size_t len)
+{
+    reserve(&c->out, &c->out_cap, c->out_len + FRAME_HEADER + len);
+    put_header(c->out + c->out_len, type, len);
+    memcpy(c->out + c->out_len + FRAME_HEADER, data, len);
+    c->out_len += FRAME_HEADER + len;
+}
+
+/**
+ * @brief Appends the 'X' frame that ends a reply.
+ *
+ * @param c      The connection.
+ * @param status The exit status.
+ * @return none
+ */
+static void add_status(struct conn *c, int status)
+{
+    char payload[4] = {status >> 24, status >> 16, status >> 8, status};
+    add_frame(c, 'X', payload, 4);
+}
+
+/**
+ * @brief Starts the next complete request a client has sent, if it has
+ *        nothing running (or reports why it could not, and moves on).
+ *
+ * @param slot The connection's slot.
+ * @return 0, or -1 if the client sent something that is not a request
+ *         and was hung up on.
+ */
+static int next_request(int slot)
+{
+    struct conn *c = conns[slot];
+    while (c->pid == 0 && c->fd != -1 && c->in_len >= FRAME_HEADER)
+    {
+        uint32_t len = get_u32(c->in + 1);
+        if (c->in[0] != 'C' || len > SERVER_MAX_REQUEST)
+        {
+            hang_up(slot);
+            return -1;
+        }
+        if (c->in_len < FRAME_HEADER + len)
+        {
+            return 0;
+        }
+
+        char *text = malloc(len + 1);
+        if (!text)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(text, c->in + FRAME_HEADER, len);
+        text[len] = '\0';
+        c->in_len -= FRAME_HEADER + len;
+        memmove(c->in, c->in + FRAME_HEADER + len, c->in_len);
+
+        if (start_request(c, slot, text) == -1)
+        {
+            char msg[128];
+            int n = snprintf(msg, sizeof(msg), "dragonshell: --server: %s\n", strerror(errno));
+            add_frame(c, 'E', msg, n);
+            add_status(c, 1);
+        }
+        free(text);
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends the exit status once a request's fork has exited and both
+ *        of its pipes are drained, then starts the client's next request.
+ *
+ * @param slot The connection's slot.
+ * @return none
+ */
+static void finish_request(int slot)
+{
+    struct conn *c = conns[slot];
+    if (c->pid == 0 || !c->exited || c->pipes[0] != -1 || c->pipes[1] != -1)
+    {
+        return;
+    }
+    c->pid = 0;
+    if (c->fd == -1)
+    {
+        free_conn(slot);
+        return;
+    }
+
+    add_status(c, c->status);
+    if (next_request(slot) == 0)
+    {
+        sync_client(slot);
+    }
+}
+
+/**
+ * @brief Reads what a request has written to its stdout or stderr into
+ *        an 'O' or 'E' frame.
+ *
+ * @param slot  The connection's slot.
+ * @param which 0 for stdout, 1 for stderr.
+ * @return none
+ */
+static void read_output(int slot, int which)
+{
+    struct conn *c = conns[slot];
+    int fd = c->pipes[which];
+
+    reserve(&c->out, &c->out_cap, c->out_len + FRAME_HEADER + SERVER_CHUNK);
+    ssize_t n = read(fd, c->out + c->out_len + FRAME_HEADER, SERVER_CHUNK);
+    if (n == -1 && errno == EINTR)
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        c->pipes[which] = -1;
+        finish_request(slot);
+        return;
+    }
+    if (c->fd != -1)
+    {
+        put_header(c->out + c->out_len, which == 0 ? 'O' : 'E', n);
+        c->out_len += FRAME_HEADER + n;
+    }
+    sync_client(slot);
+}
+
+/**
+ * @brief Collects a request's fork once its pidfd says it has exited.
+ *
+ * @param slot The connection's slot.
+ * @return none
+ */
+static void reap_request(int slot)
+{
+    struct conn *c = conns[slot];
+
+    jobs_reap_pid(c->pid);
+    if (c->job->state != JOB_DONE)
+    {
+        return;     // stopped, not gone
+    }
+    c->status = job_finish(c->job);
+    c->job = NULL;
+    c->exited = 1;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->pidfd, NULL);
+    close(c->pidfd);
+    c->pidfd = -1;
+    finish_request(slot);
+}
+
+/**
+ * @brief Reads what a client sent and starts its next request.
+ *
+ * @param slot The connection's slot.
+ * @return none
+ */
+static void read_client(int slot)
+{
+    struct conn *c = conns[slot];
+
+    for (;;)
+    {
+        reserve(&c->in, &c->in_cap, c->in_len + SERVER_CHUNK);
+        ssize_t n = read(c->fd, c->in + c->in_len, SERVER_CHUNK);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN)
+        {
+            break;
+        }
+        if (n <= 0)
+        {
+            hang_up(slot);
+            return;
+        }
+        c->in_len += n;
+    }
+    if (next_request(slot) == 0)
+    {
+        sync_client(slot);
+    }
+}
+
+/**
+ * @brief Accepts every waiting client.
+ *
+ * @param none
+ * @return none
+ */
+static void accept_clients(void)
+{
+    for (;;)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        int slot = 0;
+        while (slot < nconns && conns[slot] != NULL)
+        {
+            slot++;
+        }
+        if (slot == nconns)
+        {
+            conns = realloc(conns, ++nconns * sizeof(struct conn *));
+            if (!conns)
+            {
+                fprintf(stderr, "dragonshell: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        struct conn *c = calloc(1, sizeof(struct conn));
+        if (!c)
+        {
+            fprintf(stderr, "dragonshell: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        c->fd = fd;
+        c->pidfd = -1;
+        c->pipes[0] = c->pipes[1] = -1;
+        conns[slot] = c;
+        watch(EPOLL_CTL_ADD, fd, EPOLLIN, TAG(SERVER_CLIENT, slot));
+    }
+}
+
+/**
+ * @brief Opens the listening socket, replacing a stale one left by a
+ *        server that is no longer running.
+ *
+ * @param path The socket's path.
+ * @return The socket, or -1 after reporting an error.
+ */
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "dragonshell: --server: %s: path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        perror("dragonshell: --server: socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno == EADDRINUSE)
+    {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        close(probe);
+        if (!live)
+        {
+            unlink(path);
+            errno = 0;
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        }
+        else
+        {
+            errno = EADDRINUSE;
+        }
+    }
+    if (errno != 0 || listen(fd, SOMAXCONN) == -1)
+    {
+        fprintf(stderr, "dragonshell: --server: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Runs the server until SIGINT or SIGTERM.
+ *
+ * @param path The socket's path.
+ * @return The shell's exit status: 0 after a signal, 1 if the socket
+ *         could not be set up.
+ */
+int server_run(const char *path)
+{
+    listen_fd = open_socket(path);
+    if (listen_fd == -1)
+    {
+        return 1;
+    }
+    socket_path = path;
+
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop, &base_mask);
+    signal_fd = signalfd(-1, &stop, SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    watch(EPOLL_CTL_ADD, listen_fd, EPOLLIN, TAG(SERVER_LISTEN, 0));
+    watch(EPOLL_CTL_ADD, signal_fd, EPOLLIN, TAG(SERVER_SIGNAL, 0));
+
+    struct epoll_event events[SERVER_BATCH];
+    for (;;)
+    {
+        int n = epoll_wait(epoll_fd, events, SERVER_BATCH, -1);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;   // SIGCHLD; the pidfds say which request it was
+        }
+        for (int i = 0; i < n; i++)
+        {
+            int kind = events[i].data.u64 >> 32;
+            int slot = (uint32_t)events[i].data.u64;
+
+            if (kind == SERVER_LISTEN)
+            {
+                accept_clients();
+                continue;
+            }
+            if (kind == SERVER_SIGNAL)
+            {
+                unlink(socket_path);
+                for (int k = 0; k < nconns; k++)
+                {
+                    if (conns[k] != NULL && conns[k]->pid != 0)
+                    {
+                        kill(-conns[k]->pid, SIGHUP);
+                    }
+                }
+                return 0;
+            }
+
+            // An earlier event in this batch may have freed the slot
+            struct conn *c = conns[slot];
+            if (c == NULL)
+            {
+                continue;
+            }
+            if (kind == SERVER_CLIENT && c->fd != -1)
+            {
+                if (events[i].events & EPOLLOUT)
+                {
+                    sync_client(slot);
+                }
+                if (conns[slot] != NULL && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                {
+                    read_client(slot);
+                }
+            }
+            else if ((kind == SERVER_STDOUT || kind == SERVER_STDERR) && c->pipes[kind - SERVER_STDOUT] != -1)
+            {
+                read_output(slot, kind - SERVER_STDOUT);
+            }
+            else if (kind == SERVER_CHILD && c->pidfd != -1)
+            {
+                reap_request(slot);
+            }
+        }
+    }
+}
@@ -0,0 +1,17 @@
+/****************************************************************************
+
+  @file         server.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Server mode: one warm shell running framed requests from
+                clients on a Unix domain socket.
+
+*******************************************************************************/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+int server_run(const char *path);
+
+#endif
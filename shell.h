@@ -0,0 +1,38 @@
+/****************************************************************************
+
+  @file         shell.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Declarations shared between main.c and the shell subsystems.
+
+*******************************************************************************/
+
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <sys/types.h>
+
+#define LSH_TOK_DELIM " \t\r\n\a"
+
+struct node;
+struct stage;
+struct pipeline;
+
+extern int last_status;
+extern int *pipe_status;
+extern int pipe_nstatus;
+extern int in_subshell;
+extern pid_t shell_pid;
+
+int run_node(struct node *n);
+void shell_loop(int interactive);
+int execute_command(struct pipeline *pl);
+void run_subshell(struct stage *st) __attribute__((noreturn));
+int cd_builtin(char **args);
+int pwd_builtin(char **args);
+int exit_builtin(char **args);
+int set_builtin(char **args);
+int assign_only(struct stage *st);
+
+#endif
@@ -0,0 +1,321 @@
+/****************************************************************************
+
+  @file         trace.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Opt-in per-command latency tracing.
+
+                When enabled (DRAGONSHELL_TRACE_TIMING=1 in the environment
+                or "set -o trace-timing"), each phase of running a command
+                is timed with CLOCK_MONOTONIC and recorded in a histogram
+                kept per command name and phase. The histograms are
+                log-linear like HdrHistogram: every power of two is split
+                into 16 linear sub-buckets, so any recorded value is known
+                to within 1/16 (about 6%) using under 1000 counters. When
+                tracing is off the only cost is testing trace_timing.
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)                   // sub-buckets per power of two
+#define NBUCKETS (2 * SUB_COUNT + (63 - SUB_BITS) * SUB_COUNT)
+#define TRACE_BUCKETS 64                            // hash buckets for command names
+
+struct histogram
+{
+    uint64_t count;
+    uint64_t max;
+    uint32_t buckets[NBUCKETS];
+};
+
+struct trace_entry
+{
+    char *key;
+    struct histogram *phases[TRACE_NPHASES];        // allocated on first use
+    struct trace_entry *next;
+};
+
+static const char *phase_names[TRACE_NPHASES] = {
+    "parse", "fork", "exec", "spawn", "wait", "stage", "total"
+};
+
+int trace_timing = 0;
+static struct trace_entry *entries[TRACE_BUCKETS];
+
+/**
+ * @brief Enables tracing if DRAGONSHELL_TRACE_TIMING is set to anything
+ *        but "" or "0".
+ *
+ * @param none
+ * @return none
+ */
+void trace_init(void)
+{
+    const char *env = getenv("DRAGONSHELL_TRACE_TIMING");
+    trace_timing = env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
+/**
+ * @brief Reads CLOCK_MONOTONIC when tracing is enabled.
+ *
+ * @param none
+ * @return Nanoseconds, or 0 when tracing is off.
+ */
+uint64_t trace_clock(void)
+{
+    struct timespec ts;
+
+    if (!trace_timing)
+    {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief Maps a value to its histogram bucket.
+ *
+ * Values below 2 * SUB_COUNT have a bucket each; above that, a value
+ * whose highest set bit is b falls into one of the SUB_COUNT buckets
+ * for [2^b, 2^(b+1)).
+ *
+ * @param v The value in nanoseconds.
+ * @return The bucket index.
+ */
+static int bucket_index(uint64_t v)
+{
+    if (v < 2 * SUB_COUNT)
+    {
+        return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    return 2 * SUB_COUNT + (shift - 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+}
+
+/**
+ * @brief The largest value that maps to a bucket.
+ *
+ * @param i The bucket index.
+ * @return The upper bound in nanoseconds.
+ */
+static uint64_t bucket_limit(int i)
+{
+    if (i < 2 * SUB_COUNT)
+    {
+        return (uint64_t)i;
+    }
+    int shift = (i - 2 * SUB_COUNT) / SUB_COUNT + 1;
+    uint64_t sub = (uint64_t)((i - 2 * SUB_COUNT) % SUB_COUNT + SUB_COUNT);
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Finds or creates the entry for a command name.
+ *
+ * @param key The command name.
+ * @return The entry, or NULL if memory ran out.
+ */
+static struct trace_entry *find_entry(const char *key)
+{
+    unsigned h = 2166136261u;
+    for (const char *p = key; *p; p++)
+    {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+
+    struct trace_entry **slot = &entries[h % TRACE_BUCKETS];
+    for (struct trace_entry *e = *slot; e; e = e->next)
+    {
+        if (strcmp(e->key, key) == 0)
+        {
+            return e;
+        }
+    }
+
+    struct trace_entry *e = calloc(1, sizeof(*e));
+    if (!e || !(e->key = strdup(key)))
+    {
+        free(e);
+        return NULL;
+    }
+    e->next = *slot;
+    *slot = e;
+    return e;
+}
+
+/**
+ * @brief Records how long a phase of a command took.
+ *
+ * @param key   The command name the sample belongs to.
+ * @param phase The phase.
+ * @param start trace_clock() when the phase began.
+ * @param end   trace_clock() when it ended.
+ * @return none
+ */
+void trace_record(const char *key, enum trace_phase phase, uint64_t start, uint64_t end)
+{
+    if (!trace_timing || key == NULL || start == 0 || end < start)
+    {
+        return;
+    }
+
+    struct trace_entry *e = find_entry(key);
+    if (e == NULL)
+    {
+        return;
+    }
+    if (e->phases[phase] == NULL && !(e->phases[phase] = calloc(1, sizeof(struct histogram))))
+    {
+        return;
+    }
+
+    struct histogram *h = e->phases[phase];
+    uint64_t v = end - start;
+    h->buckets[bucket_index(v)]++;
+    h->count++;
+    if (v > h->max)
+    {
+        h->max = v;
+    }
+}
+
+/**
+ * @brief Finds the value below which a fraction of the samples fall.
+ *
+ * @param h The histogram.
+ * @param q The quantile, e.g. 0.99.
+ * @return The bucket bound in nanoseconds.
+ */
+static uint64_t quantile(const struct histogram *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * h->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    for (int i = 0; i < NBUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t limit = bucket_limit(i);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * @brief Prints a nanosecond duration with a readable unit.
+ *
+ * @param ns The duration.
+ * @return none
+ */
+static void print_ns(uint64_t ns)
+{
+    if (ns < 10000)
+    {
+        fprintf(stderr, " %9luns", (unsigned long)ns);
+    }
+    else if (ns < 10000000)
+    {
+        fprintf(stderr, " %9.1fus", ns / 1e3);
+    }
+    else
+    {
+        fprintf(stderr, " %9.1fms", ns / 1e6);
+    }
+}
+
+/**
+ * @brief Prints p50/p99/max of every recorded phase to stderr.
+ *
+ * @param none
+ * @return none
+ */
+void trace_dump(void)
+{
+    fprintf(stderr, "%-20s %-6s %8s %11s %11s %11s\n",
+            "command", "phase", "count", "p50", "p99", "max");
+    for (int b = 0; b < TRACE_BUCKETS; b++)
+    {
+        for (struct trace_entry *e = entries[b]; e; e = e->next)
+        {
+            for (int p = 0; p < TRACE_NPHASES; p++)
+            {
+                struct histogram *h = e->phases[p];
+                if (h == NULL || h->count == 0)
+                {
+                    continue;
+                }
+                fprintf(stderr, "%-20s %-6s %8lu", e->key, phase_names[p],
+                        (unsigned long)h->count);
+                print_ns(quantile(h, 0.50));
+                print_ns(quantile(h, 0.99));
+                print_ns(h->max);
+                fprintf(stderr, "\n");
+            }
+        }
+    }
+}
+
+/**
+ * @brief Forgets every recorded sample.
+ *
+ * @param none
+ * @return none
+ */
+static void trace_reset(void)
+{
+    for (int b = 0; b < TRACE_BUCKETS; b++)
+    {
+        struct trace_entry *e = entries[b];
+        while (e)
+        {
+            struct trace_entry *next = e->next;
+            for (int p = 0; p < TRACE_NPHASES; p++)
+            {
+                free(e->phases[p]);
+            }
+            free(e->key);
+            free(e);
+            e = next;
+        }
+        entries[b] = NULL;
+    }
+}
+
+/**
+ * @brief The "trace" builtin: prints the latency histograms, or with -r
+ *        discards them.
+ *
+ * @param args The argument vector, args[0] being "trace".
+ * @return 0
+ */
+int trace_builtin(char **args)
+{
+    fflush(stdout);
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0)
+    {
+        trace_reset();
+        return 0;
+    }
+    if (!trace_timing)
+    {
+        fprintf(stderr, "dragonshell: trace: timing is off (set -o trace-timing)\n");
+    }
+    trace_dump();
+    return 0;
+}
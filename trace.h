@@ -0,0 +1,36 @@
+/****************************************************************************
+
+  @file         trace.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Opt-in per-command latency tracing with HDR-style histograms.
+
+*******************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+enum trace_phase
+{
+    TRACE_PARSE,    // lexing and parsing the line
+    TRACE_FORK,     // fork() of a confined command
+    TRACE_EXEC,     // fork() returning until the child's execv() succeeded
+    TRACE_SPAWN,    // posix_spawn() of a command, or of every stage of a pipeline
+    TRACE_WAIT,     // waiting for the foreground job
+    TRACE_STAGE,    // one pipeline stage, spawned until reaped; keyed by its command
+    TRACE_TOTAL,    // line read until the command finished
+    TRACE_NPHASES
+};
+
+extern int trace_timing;
+
+void trace_init(void);
+uint64_t trace_clock(void);
+void trace_record(const char *key, enum trace_phase phase, uint64_t start, uint64_t end);
+void trace_dump(void);
+int trace_builtin(char **args);
+
+#endif
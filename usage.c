@@ -0,0 +1,213 @@
+/****************************************************************************
+
+  @file         usage.c
+
+  @author       Ahnaful Hoque
+
+  @brief        Resource usage accounting for the time keyword and the
+                times builtin.
+
+                Children's usage is collected per process with wait4() by
+                the job table, so every figure here keeps microseconds and
+                covers exactly the processes it describes.
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "usage.h"
+#include "jobs.h"
+
+/**
+ * @brief Adds b to a, carrying microseconds into seconds.
+ *
+ * @param a The accumulator.
+ * @param b The time to add.
+ * @return none
+ */
+static void timeval_add(struct timeval *a, const struct timeval *b)
+{
+    a->tv_sec += b->tv_sec;
+    a->tv_usec += b->tv_usec;
+    if (a->tv_usec >= 1000000)
+    {
+        a->tv_sec++;
+        a->tv_usec -= 1000000;
+    }
+}
+
+/**
+ * @brief Subtracts b from a, borrowing from seconds when needed.
+ *
+ * @param a The accumulator.
+ * @param b The time to subtract.
+ * @return none
+ */
+static void timeval_sub(struct timeval *a, const struct timeval *b)
+{
+    a->tv_sec -= b->tv_sec;
+    a->tv_usec -= b->tv_usec;
+    if (a->tv_usec < 0)
+    {
+        a->tv_sec--;
+        a->tv_usec += 1000000;
+    }
+}
+
+/**
+ * @brief Accumulates one process's usage into a total.
+ *
+ * Times and counters are summed; the peak resident set size is the
+ * largest of the two. Only arithmetic, so it is safe in a signal handler.
+ *
+ * @param acc The total.
+ * @param ru  The usage to add.
+ * @return none
+ */
+void usage_add(struct rusage *acc, const struct rusage *ru)
+{
+    timeval_add(&acc->ru_utime, &ru->ru_utime);
+    timeval_add(&acc->ru_stime, &ru->ru_stime);
+    if (ru->ru_maxrss > acc->ru_maxrss)
+    {
+        acc->ru_maxrss = ru->ru_maxrss;
+    }
+    acc->ru_minflt += ru->ru_minflt;
+    acc->ru_majflt += ru->ru_majflt;
+    acc->ru_inblock += ru->ru_inblock;
+    acc->ru_oublock += ru->ru_oublock;
+    acc->ru_nvcsw += ru->ru_nvcsw;
+    acc->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/**
+ * @brief Turns a later snapshot into the difference from an earlier one.
+ *
+ * The peak resident set size is left alone, since it is not a counter.
+ *
+ * @param acc The later snapshot; receives the difference.
+ * @param ru  The earlier snapshot.
+ * @return none
+ */
+void usage_sub(struct rusage *acc, const struct rusage *ru)
+{
+    timeval_sub(&acc->ru_utime, &ru->ru_utime);
+    timeval_sub(&acc->ru_stime, &ru->ru_stime);
+    acc->ru_minflt -= ru->ru_minflt;
+    acc->ru_majflt -= ru->ru_majflt;
+    acc->ru_inblock -= ru->ru_inblock;
+    acc->ru_oublock -= ru->ru_oublock;
+    acc->ru_nvcsw -= ru->ru_nvcsw;
+    acc->ru_nivcsw -= ru->ru_nivcsw;
+}
+
+/**
+ * @brief Prints a duration as minutes and seconds with microseconds.
+ *
+ * @param out  The stream.
+ * @param sec  Whole seconds.
+ * @param usec Microseconds.
+ * @return none
+ */
+static void print_duration(FILE *out, long sec, long usec)
+{
+    fprintf(out, "%ldm%ld.%06lds", sec / 60, sec % 60, usec);
+}
+
+/**
+ * @brief Prints the report of the time keyword to stderr.
+ *
+ * User and system time are the children's plus whatever the shell itself
+ * spent since self_start; the peak RSS, page faults and context switches
+ * are the children's.
+ *
+ * @param start      CLOCK_MONOTONIC when the pipeline started.
+ * @param self_start The shell's own usage when the pipeline started.
+ * @param children   Usage of the processes the pipeline ran.
+ * @return none
+ */
+void usage_print_time(const struct timespec *start, const struct rusage *self_start,
+                      const struct rusage *children)
+{
+    struct timespec now;
+    struct rusage self, total = *children;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &self);
+    usage_sub(&self, self_start);
+    timeval_add(&total.ru_utime, &self.ru_utime);
+    timeval_add(&total.ru_stime, &self.ru_stime);
+
+    long sec = now.tv_sec - start->tv_sec;
+    long nsec = now.tv_nsec - start->tv_nsec;
+    if (nsec < 0)
+    {
+        sec--;
+        nsec += 1000000000;
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "\nreal\t");
+    print_duration(stderr, sec, nsec / 1000);
+    fprintf(stderr, "\nuser\t");
+    print_duration(stderr, total.ru_utime.tv_sec, total.ru_utime.tv_usec);
+    fprintf(stderr, "\nsys\t");
+    print_duration(stderr, total.ru_stime.tv_sec, total.ru_stime.tv_usec);
+    fprintf(stderr, "\nmaxrss\t%ld KB\n", total.ru_maxrss);
+    fprintf(stderr, "faults\t%ld minor, %ld major\n", total.ru_minflt, total.ru_majflt);
+    fprintf(stderr, "ctxsw\t%ld voluntary, %ld involuntary\n",
+            total.ru_nvcsw, total.ru_nivcsw);
+}
+
+/**
+ * @brief Prints one stage's line of the time keyword's report for a
+ *        pipeline, e.g. "stage 2\t0m1.002311s\tgrep", to stderr.
+ *
+ * @param index The stage's position, from 1.
+ * @param name  Its command name.
+ * @param ns    How long it ran, from its start until it was reaped.
+ * @return none
+ */
+void usage_print_stage(int index, const char *name, uint64_t ns)
+{
+    fprintf(stderr, "stage %d\t", index);
+    print_duration(stderr, ns / 1000000000, ns % 1000000000 / 1000);
+    fprintf(stderr, "\t%s\n", name);
+}
+
+/**
+ * @brief The "times" builtin.
+ *
+ * Prints the shell's own user and system time, then the accumulated
+ * user and system time of every child it has reaped. With -v, the
+ * children's peak RSS, page faults and context switches follow.
+ *
+ * @param args The argument vector, args[0] being "times".
+ * @return 0
+ */
+int times_builtin(char **args)
+{
+    struct rusage self, children;
+
+    getrusage(RUSAGE_SELF, &self);
+    jobs_children_usage(&children);
+
+    print_duration(stdout, self.ru_utime.tv_sec, self.ru_utime.tv_usec);
+    printf(" ");
+    print_duration(stdout, self.ru_stime.tv_sec, self.ru_stime.tv_usec);
+    printf("\n");
+    print_duration(stdout, children.ru_utime.tv_sec, children.ru_utime.tv_usec);
+    printf(" ");
+    print_duration(stdout, children.ru_stime.tv_sec, children.ru_stime.tv_usec);
+    printf("\n");
+
+    if (args[1] != NULL && strcmp(args[1], "-v") == 0)
+    {
+        printf("maxrss %ld KB, faults %ld minor %ld major, "
+               "ctxsw %ld voluntary %ld involuntary\n",
+               children.ru_maxrss, children.ru_minflt, children.ru_majflt,
+               children.ru_nvcsw, children.ru_nivcsw);
+    }
+    return 0;
+}
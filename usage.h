@@ -0,0 +1,26 @@
+/****************************************************************************
+
+  @file         usage.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Resource usage accounting for the time keyword and the
+                times builtin.
+
+*******************************************************************************/
+
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <sys/resource.h>
+#include <stdint.h>
+#include <time.h>
+
+void usage_add(struct rusage *acc, const struct rusage *ru);
+void usage_sub(struct rusage *acc, const struct rusage *ru);
+void usage_print_time(const struct timespec *start, const struct rusage *self_start,
+                      const struct rusage *children);
+void usage_print_stage(int index, const char *name, uint64_t ns);
+int times_builtin(char **args);
+
+#endif
@@ -0,0 +1,480 @@
+/****************************************************************************
+
+  @file         vars.c
+
+  @author       Ahnaful Hoque
+
+  @brief        The shell's variable store.
+
+                Variables live in a chained hash table, so looking one up
+                during expansion is a hash and a compare however many are
+                set. Each variable is kept as a single "NAME=value" string,
+                which is exactly what an environment entry looks like, so
+                the envp handed to commands is just an array of pointers
+                to the exported ones. That array is rebuilt only after an
+                exported variable changes, not once per command. Until a
+                variable is first changed the table is not even built, and
+                the environment the shell was given is used as it is.
+
+*******************************************************************************/
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "arena.h"
+#include "vars.h"
+
+#define VAR_BUCKETS 64
+
+struct var
+{
+    struct var *next;       // next variable in the same bucket
+    unsigned hash;
+    size_t name_len;
+    int flags;
+    int has_value;          // "export NAME" can mark a variable that is not set
+    char *str;              // "NAME=value", or just "NAME" without a value
+};
+
+static struct var **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t count = 0;
+
+static char **initial_env = NULL;   // the environment, until it has to be imported
+static char **env = NULL;       // the exported variables, NULL-terminated
+static size_t env_cap = 0;
+static int env_dirty = 1;
+
+/**
+ * @brief FNV-1a hash of a variable name.
+ *
+ * @param name The name.
+ * @param len  Its length.
+ * @return The hash value.
+ */
+static unsigned hash_name(const char *name, size_t len)
+{
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Doubles the bucket array once the table is three-quarters full.
+ *
+ * @param none
+ * @return none
+ */
+static void grow(void)
+{
+    if (nbuckets != 0 && count * 4 < nbuckets * 3)
+    {
+        return;
+    }
+
+    size_t new_size = nbuckets ? nbuckets * 2 : VAR_BUCKETS;
+    struct var **new_buckets = check_alloc(calloc(new_size, sizeof(struct var *)));
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        struct var *v = buckets[i];
+        while (v != NULL)
+        {
+            struct var *next = v->next;
+            v->next = new_buckets[v->hash & (new_size - 1)];
+            new_buckets[v->hash & (new_size - 1)] = v;
+            v = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    nbuckets = new_size;
+}
+
+/**
+ * @brief Finds a variable's slot in its bucket chain.
+ *
+ * @param name The name.
+ * @param len  Its length.
+ * @param hash Its hash.
+ * @return The link pointing at the variable, or at the chain's NULL end.
+ */
+static struct var **find(const char *name, size_t len, unsigned hash)
+{
+    struct var **p = &buckets[hash & (nbuckets - 1)];
+    while (*p != NULL &&
+           ((*p)->hash != hash || (*p)->name_len != len || memcmp((*p)->str, name, len) != 0))
+    {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+/**
+ * @brief Finds a variable, creating it (unset) if it does not exist.
+ *
+ * @param name The name.
+ * @param len  Its length.
+ * @return The variable.
+ */
+static struct var *intern(const char *name, size_t len)
+{
+    grow();
+    unsigned h = hash_name(name, len);
+    struct var **p = find(name, len, h);
+    if (*p == NULL)
+    {
+        struct var *v = check_alloc(malloc(sizeof(struct var)));
+        v->next = NULL;
+        v->hash = h;
+        v->name_len = len;
+        v->flags = 0;
+        v->has_value = 0;
+        v->str = check_alloc(malloc(len + 1));
+        memcpy(v->str, name, len);
+        v->str[len] = '\0';
+        *p = v;
+        count++;
+    }
+    return *p;
+}
+
+/**
+ * @brief Takes note of the environment the shell was started with.
+ *
+ * Nothing is copied yet. Most runs of "dragonshell -c" only read a
+ * variable or two and pass the environment on unchanged, so lookups
+ * search envp directly and it is handed to commands as it is; the table
+ * is only built when something changes a variable.
+ *
+ * @param envp The environment, every entry of which becomes an exported
+ *             variable.
+ * @return none
+ */
+void vars_init(char **envp)
+{
+    initial_env = envp;
+}
+
+/**
+ * @brief Copies the environment into the table, before its first change.
+ *
+ * @param none
+ * @return none
+ */
+static void import_env(void)
+{
+    char **envp = initial_env;
+    if (envp == NULL)
+    {
+        return;
+    }
+    initial_env = NULL;
+    for (char **e = envp; *e != NULL; e++)
+    {
+        var_assign(*e, VAR_EXPORT);
+    }
+}
+
+/**
+ * @brief Looks up a variable by a name that need not be terminated.
+ *
+ * @param name The name.
+ * @param len  Its length.
+ * @return The value, or NULL if the variable is not set.
+ */
+const char *var_lookup(const char *name, size_t len)
+{
+    if (initial_env != NULL)
+    {
+        // Not imported: the last definition wins, as it would in the table
+        const char *value = NULL;
+        for (char **e = initial_env; *e != NULL; e++)
+        {
+            if (strncmp(*e, name, len) == 0 && (*e)[len] == '=')
+            {
+                value = *e + len + 1;
+            }
+        }
+        return value;
+    }
+    if (nbuckets == 0)
+    {
+        return NULL;
+    }
+    struct var *v = *find(name, len, hash_name(name, len));
+    return v != NULL && v->has_value ? v->str + len + 1 : NULL;
+}
+
+/**
+ * @brief Looks up a variable.
+ *
+ * @param name The name.
+ * @return The value, or NULL if the variable is not set.
+ */
+const char *var_get(const char *name)
+{
+    return var_lookup(name, strlen(name));
+}
+
+/**
+ * @brief Sets a variable.
+ *
+ * @param name  The name.
+ * @param value The new value.
+ * @param flags VAR_EXPORT to export it as well; an exported variable
+ *              stays exported either way.
+ * @return none
+ */
+void var_set(const char *name, const char *value, int flags)
+{
+    import_env();
+    size_t len = strlen(name);
+    struct var *v = intern(name, len);
+    size_t vlen = strlen(value);
+
+    v->str = check_alloc(realloc(v->str, len + vlen + 2));
+    v->str[len] = '=';
+    memcpy(v->str + len + 1, value, vlen + 1);
+    v->has_value = 1;
+    v->flags |= flags;
+    if (v->flags & VAR_EXPORT)
+    {
+        env_dirty = 1;
+    }
+}
+
+/**
+ * @brief Sets a variable from a "NAME=value" word.
+ *
+ * @param assignment The word; the name is everything before the first '='.
+ * @param flags      As for var_set().
+ * @return none
+ */
+void var_assign(const char *assignment, int flags)
+{
+    const char *eq = strchr(assignment, '=');
+    if (eq == NULL)
+    {
+        return;
+    }
+
+    size_t len = eq - assignment;
+    char name[len + 1];
+    memcpy(name, assignment, len);
+    name[len] = '\0';
+    var_set(name, eq + 1, flags);
+}
+
+/**
+ * @brief Marks a variable for export, creating it unset if need be.
+ *
+ * @param name The name.
+ * @return none
+ */
+void var_export(const char *name)
+{
+    import_env();
+    struct var *v = intern(name, strlen(name));
+    if (!(v->flags & VAR_EXPORT))
+    {
+        v->flags |= VAR_EXPORT;
+        env_dirty = 1;
+    }
+}
+
+/**
+ * @brief Removes a variable.
+ *
+ * @param name The name.
+ * @return none
+ */
+void var_unset(const char *name)
+{
+    import_env();
+    size_t len = strlen(name);
+    if (nbuckets == 0)
+    {
+        return;
+    }
+
+    struct var **p = find(name, len, hash_name(name, len));
+    struct var *v = *p;
+    if (v == NULL)
+    {
+        return;
+    }
+    if (v->flags & VAR_EXPORT)
+    {
+        env_dirty = 1;
+    }
+    *p = v->next;
+    free(v->str);
+    free(v);
+    count--;
+}
+
+/**
+ * @brief Tells whether a word is a valid variable name.
+ *
+ * @param name The word.
+ * @param len  How much of it is the name.
+ * @return 1 if it is, 0 otherwise.
+ */
+int var_valid_name(const char *name, size_t len)
+{
+    if (len == 0 || isdigit((unsigned char)name[0]))
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief The environment for commands: every exported variable that is
+ *        set.
+ *
+ * @param none
+ * @return A NULL-terminated array, valid until a variable changes.
+ */
+char **vars_environ(void)
+{
+    if (initial_env != NULL)
+    {
+        return initial_env;
+    }
+    if (!env_dirty)
+    {
+        return env;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        for (struct var *v = buckets[i]; v != NULL; v = v->next)
+        {
+            n += (v->flags & VAR_EXPORT) && v->has_value;
+        }
+    }
+    if (n + 1 > env_cap)
+    {
+        env_cap = n + 1;
+        env = check_alloc(realloc(env, env_cap * sizeof(char *)));
+    }
+
+    n = 0;
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        for (struct var *v = buckets[i]; v != NULL; v = v->next)
+        {
+            if ((v->flags & VAR_EXPORT) && v->has_value)
+            {
+                env[n++] = v->str;
+            }
+        }
+    }
+    env[n] = NULL;
+    env_dirty = 0;
+    return env;
+}
+
+/**
+ * @brief The environment for one command with "NAME=value" prefixes.
+ *
+ * @param a       The arena the array is allocated from.
+ * @param assigns The command's assignments, NULL-terminated; each
+ *                replaces an exported variable of the same name or is
+ *                added.
+ * @return A NULL-terminated array.
+ */
+char **vars_environ_with(struct arena *a, char **assigns)
+{
+    char **base = vars_environ();
+    size_t n = 0, m = 0;
+    while (base[n] != NULL)
+    {
+        n++;
+    }
+    while (assigns[m] != NULL)
+    {
+        m++;
+    }
+
+    char **envp = arena_alloc(a, (n + m + 1) * sizeof(char *));
+    memcpy(envp, base, n * sizeof(char *));
+    for (size_t k = 0; k < m; k++)
+    {
+        size_t len = strcspn(assigns[k], "=") + 1;
+        size_t i = 0;
+        while (i < n && strncmp(envp[i], assigns[k], len) != 0)
+        {
+            i++;
+        }
+        envp[i] = assigns[k];
+        n += i == n;
+    }
+    envp[n] = NULL;
+    return envp;
+}
+
+/**
+ * @brief qsort() comparison of two variables by name.
+ *
+ * @param a A pointer to the first variable.
+ * @param b A pointer to the second.
+ * @return As strcmp().
+ */
+static int compare_vars(const void *a, const void *b)
+{
+    return strcmp((*(struct var *const *)a)->str, (*(struct var *const *)b)->str);
+}
+
+/**
+ * @brief Lists the exported variables, sorted, as "export" commands.
+ *
+ * @param none
+ * @return none
+ */
+void vars_print_exported(void)
+{
+    import_env();
+    struct var **list = check_alloc(malloc((count + 1) * sizeof(struct var *)));
+    size_t n = 0;
+
+    for (size_t i = 0; i < nbuckets; i++)
+    {
+        for (struct var *v = buckets[i]; v != NULL; v = v->next)
+        {
+            if (v->flags & VAR_EXPORT)
+            {
+                list[n++] = v;
+            }
+        }
+    }
+    qsort(list, n, sizeof(struct var *), compare_vars);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (list[i]->has_value)
+        {
+            printf("export %.*s=\"%s\"\n", (int)list[i]->name_len, list[i]->str,
+                   list[i]->str + list[i]->name_len + 1);
+        }
+        else
+        {
+            printf("export %s\n", list[i]->str);
+        }
+    }
+    free(list);
+}
@@ -0,0 +1,33 @@
+/****************************************************************************
+
+  @file         vars.h
+
+  @author       Ahnaful Hoque
+
+  @brief        Shell variables: a hash table of name=value pairs, some of
+                them exported to the environment of commands.
+
+*******************************************************************************/
+
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+#define VAR_EXPORT 1        // passed to the environment of commands
+
+void vars_init(char **envp);
+const char *var_lookup(const char *name, size_t len);
+const char *var_get(const char *name);
+void var_set(const char *name, const char *value, int flags);
+void var_assign(const char *assignment, int flags);
+void var_export(const char *name);
+void var_unset(const char *name);
+int var_valid_name(const char *name, size_t len);
+char **vars_environ(void);
+char **vars_environ_with(struct arena *a, char **assigns);
+void vars_print_exported(void);
+
+#endif